@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Range arithmetic for a singly linked chain of buffers, see Mdl(MDL *SourceMdl, ...).
+ * It does not depend on WDK and can be used in user mode as is.
+ */
+namespace usbip
+{
+
+/*
+ * Calls f(node, offset, length) for each node that overlaps [offset, offset + length) of the chain,
+ * offset of f is relative to the node. Nodes of zero size are skipped.
+ *
+ * @param next returns the next node, null if it is the last one
+ * @param size returns the number of bytes of the node
+ * @return false if the chain is shorter than offset + length or f returned false
+ */
+template<typename Node, typename Next, typename Size, typename F>
+constexpr bool for_each_range(
+        Node node, unsigned long long offset, unsigned long long length, Next &&next, Size &&size, F &&f)
+{
+        for ( ; node && length; node = next(node)) {
+
+                unsigned long long sz = size(node);
+
+                if (offset >= sz) {
+                        offset -= sz;
+                        continue;
+                }
+
+                auto len = sz - offset;
+                if (len > length) {
+                        len = length;
+                }
+
+                if (!f(node, offset, len)) {
+                        return false;
+                }
+
+                offset = 0;
+                length -= len;
+        }
+
+        return !length;
+}
+
+} // namespace usbip
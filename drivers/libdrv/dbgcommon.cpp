@@ -250,6 +250,10 @@ const char *device_control_name(ULONG ioctl_code)
 	case vhci::ioctl::GET_IMPORTED_DEVICES: return "vhci_get_imported_devices";
 	case vhci::ioctl::GET_PERSISTENT: return "vhci_get_persistent";
 	case vhci::ioctl::SET_PERSISTENT: return "vhci_set_persistent";
+	case vhci::ioctl::SET_EVENT_FILTER: return "vhci_set_event_filter";
+	case vhci::ioctl::GET_CHANGED_DEVICES: return "vhci_get_changed_devices";
+	case vhci::ioctl::SET_DEVICE_RATE: return "vhci_set_device_rate";
+	case vhci::ioctl::PLUGIN_HARDWARE_BATCH: return "vhci_plugin_hardware_batch";
 
 	case IOCTL_USB_DIAG_IGNORE_HUBS_ON: return "USB_DIAG_IGNORE_HUBS_ON";
 	case IOCTL_USB_DIAG_IGNORE_HUBS_OFF: return "USB_DIAG_IGNORE_HUBS_OFF";
@@ -3,6 +3,7 @@
  */
 
 #include "mdl_cpp.h"
+#include "chain_range.h"
 
 /*
 * @see reactos\ntoskrnl\io\iomgr\iomdl.c
@@ -13,25 +14,50 @@ usbip::Mdl::Mdl(_In_opt_ __drv_aliasesMem void *VirtualAddress, _In_ ULONG Lengt
 }
 
 /*
- * Impossible to build partial MDL for a chain, only for THIS SourceMdl.
+ * IoBuildPartialMdl does not walk a chain, a partial MDL is built for each MDL of SourceMdl chain 
+ * that overlaps the range. The system-space mapping of the source is not required.
+ * The result is empty if the memory can't be allocated or the chain is shorter than Offset + Length.
  */
-usbip::Mdl::Mdl(_In_ MDL *SourceMdl, _In_ ULONG Offset, _In_ ULONG Length) :
-        Mdl((char*)MmGetMdlVirtualAddress(SourceMdl) + Offset, Length)
+usbip::Mdl::Mdl(_In_ MDL *SourceMdl, _In_ ULONG Offset, _In_ ULONG Length)
 {
-        NT_ASSERT(!SourceMdl->Next);
-        NT_ASSERT(Offset + Length <= MmGetMdlByteCount(SourceMdl)); // usbip::size(SourceMdl)
+        auto ok = for_each_range(SourceMdl, Offset, Length, 
+                [] (auto mdl) { return mdl->Next; },
+                [] (auto mdl) { return MmGetMdlByteCount(mdl); },
+                [this] (auto mdl, auto off, auto len) { return append_partial(mdl, ULONG(off), ULONG(len)); });
+
+        if (!ok) {
+                reset();
+        }
+}
+
+bool usbip::Mdl::append_partial(_In_ MDL *SourceMdl, _In_ ULONG Offset, _In_ ULONG Length)
+{
+        auto va = static_cast<char*>(MmGetMdlVirtualAddress(SourceMdl)) + Offset;
+
+        auto mdl = IoAllocateMdl(va, Length, false, false, nullptr);
+        if (!mdl) {
+                return false;
+        }
+
+        IoBuildPartialMdl(SourceMdl, mdl, va, Length);
+        NT_ASSERT(mdl->MdlFlags & MDL_PARTIAL);
 
         if (m_mdl) {
-                NT_ASSERT(!partial());
-                IoBuildPartialMdl(SourceMdl, m_mdl, vaddr(), Length);
-                NT_ASSERT(partial());
+                last()->Next = mdl;
+                m_last = mdl;
+        } else {
+                m_mdl = mdl;
         }
+
+        return true;
 }
 
 auto usbip::Mdl::operator =(Mdl&& m) -> Mdl&
 {
         if (m_mdl != m.m_mdl) {
+                auto last = m.m_last;
                 reset(m.release());
+                m_last = last;
         }
 
         return *this;
@@ -41,6 +67,7 @@ MDL* usbip::Mdl::release()
 {
         auto m = m_mdl;
         m_mdl = nullptr;
+        m_last = nullptr;
         return m;
 }
 
@@ -49,10 +76,16 @@ void usbip::Mdl::reset(_In_opt_ MDL *mdl)
         if (m_mdl) {
                 NT_ASSERT(m_mdl != mdl);
                 unprepare();
-                IoFreeMdl(m_mdl); // calls MmPrepareMdlForReuse
+
+                for (auto m = m_mdl, end = next(); m != end; ) { // MDLs after the owned chain are not freed
+                        auto n = m->Next;
+                        IoFreeMdl(m); // calls MmPrepareMdlForReuse
+                        m = n;
+                }
         }
 
         m_mdl = mdl;
+        m_last = nullptr;
 }
 
 NTSTATUS usbip::Mdl::lock(_In_ LOCK_OPERATION Operation)
@@ -71,7 +104,7 @@ NTSTATUS usbip::Mdl::lock(_In_ LOCK_OPERATION Operation)
 void usbip::Mdl::next(_In_opt_ MDL *m)
 { 
         if (m_mdl) {
-                m_mdl->Next = m; 
+                last()->Next = m; 
         }
 }
 
@@ -14,6 +14,9 @@ enum class memory { nonpaged, paged, stack = paged };
 MDL *tail(_In_opt_ MDL *mdl);
 size_t size(_In_opt_ const MDL *mdl);
 
+/*
+ * Owns a single MDL or a chain of partial MDLs.
+ */
 class Mdl
 {
 public:
@@ -25,7 +28,7 @@ public:
         Mdl(const Mdl&) = delete;
         Mdl& operator =(const Mdl&) = delete;
 
-        Mdl(Mdl&& m) : m_mdl(m.release()) {}
+        Mdl(Mdl&& m) : m_last(m.m_last), m_mdl(m.release()) {}
         Mdl& operator =(Mdl&& m);
 
         explicit operator bool() const { return m_mdl; }
@@ -33,6 +36,7 @@ public:
 
         auto get() const { return m_mdl; }
 
+        // of the first MDL, use usbip::size() for a chain
         auto vaddr() const { return m_mdl ? MmGetMdlVirtualAddress(m_mdl) : nullptr; }
         auto size() const { return m_mdl ? MmGetMdlByteCount(m_mdl) : 0; }
 
@@ -43,13 +47,17 @@ public:
 
         void reset() { reset(nullptr); }
 
-        auto next() const { return m_mdl ? m_mdl->Next : nullptr; }
+        auto next() const { return m_mdl ? last()->Next : nullptr; } // after the owned chain
         void next(_In_opt_ MDL *m);
         auto& next(_Inout_ Mdl &m) { next(m.get()); return m; }
 
 private:
+        MDL *m_last{}; // of the owned chain, nullptr if it has one MDL
         MDL *m_mdl{};
 
+        auto last() const { return m_last ? m_last : m_mdl; }
+        bool append_partial(_In_ MDL *SourceMdl, _In_ ULONG Offset, _In_ ULONG Length);
+
         bool locked() const { return m_mdl->MdlFlags & MDL_PAGES_LOCKED; }
         bool nonpaged() const { return m_mdl->MdlFlags & MDL_SOURCE_IS_NONPAGED_POOL; }
         bool partial() const { return m_mdl->MdlFlags & MDL_PARTIAL; }
@@ -4,7 +4,10 @@
 
 #include "strconv.h"
 
+#include <usbip\ascii.h>
+
 /*
+ * ASCII prefix is converted in a single pass, the rest (if any) by RtlUnicodeToUTF8N.
  * @see RtlUnicodeStringToUTF8String
  */
 _IRQL_requires_same_
@@ -13,10 +16,19 @@ PAGED NTSTATUS libdrv::unicode_to_utf8(_Out_ UTF8_STRING &dst, _In_ const UNICOD
 {
         PAGED_CODE();
 
+        auto len = src.Length/sizeof(*src.Buffer);
+        auto pos = usbip::ascii::narrow(dst.Buffer, src.Buffer, min(len, size_t(dst.MaximumLength)));
+
+        if (pos == len) {
+                dst.Length = static_cast<USHORT>(pos);
+                return STATUS_SUCCESS;
+        }
+
         ULONG actual{};
-        auto st = RtlUnicodeToUTF8N(dst.Buffer, dst.MaximumLength, &actual, src.Buffer, src.Length);
+        auto st = RtlUnicodeToUTF8N(dst.Buffer + pos, ULONG(dst.MaximumLength - pos), &actual, 
+                                    src.Buffer + pos, ULONG(src.Length - pos*sizeof(*src.Buffer)));
 
-        dst.Length = static_cast<USHORT>(actual);
+        dst.Length = static_cast<USHORT>(pos + actual);
         return st;
 }
 
@@ -41,6 +53,8 @@ PAGED NTSTATUS libdrv::unicode_to_utf8(_Out_ char *utf8, _In_ USHORT maxlen, _In
 }
 
 /*
+ * The buffer is allocated for the upper bound of the length, so the size is not calculated in advance.
+ * ASCII prefix is converted in a single pass, the rest (if any) by RtlUTF8ToUnicodeN.
  * @return libdrv::FreeUnicodeString must be used to release a memory
  */
 _IRQL_requires_same_
@@ -54,9 +68,12 @@ PAGED NTSTATUS libdrv::utf8_to_unicode(
                 return STATUS_ALREADY_INITIALIZED;
         }
 
-        ULONG dst_bytes{};
-        if (auto st = RtlUTF8ToUnicodeN(nullptr, 0, &dst_bytes, src.Buffer, src.Length); NT_ERROR(st)) {
-                return st;
+        ULONG dst_bytes = src.Length*sizeof(*dst.Buffer); // UTF-16 string has no more code units than UTF-8 has bytes
+
+        if (dst_bytes > MAXUSHORT) { // the exact size is required
+                if (auto st = RtlUTF8ToUnicodeN(nullptr, 0, &dst_bytes, src.Buffer, src.Length); NT_ERROR(st)) {
+                        return st;
+                }
         }
 
         dst.Buffer = (WCHAR*)ExAllocatePoolUninitialized(pooltype, dst_bytes, pooltag);
@@ -64,15 +81,21 @@ PAGED NTSTATUS libdrv::utf8_to_unicode(
                 return STATUS_INSUFFICIENT_RESOURCES;
         }
 
+        dst.MaximumLength = static_cast<USHORT>(dst_bytes);
+
+        auto pos = usbip::ascii::widen(dst.Buffer, src.Buffer, min(size_t(src.Length), dst_bytes/sizeof(*dst.Buffer)));
+        if (pos == src.Length) {
+                dst.Length = static_cast<USHORT>(pos*sizeof(*dst.Buffer));
+                return STATUS_SUCCESS;
+        }
+
         ULONG actual{};
-        auto st = RtlUTF8ToUnicodeN(dst.Buffer, dst_bytes, &actual, src.Buffer, src.Length);
+        auto st = RtlUTF8ToUnicodeN(dst.Buffer + pos, ULONG(dst_bytes - pos*sizeof(*dst.Buffer)), &actual, 
+                                    src.Buffer + pos, ULONG(src.Length - pos));
 
         NT_ASSERT(NT_SUCCESS(st));
-        NT_ASSERT(actual == dst_bytes);
         
-        dst.Length = static_cast<USHORT>(actual);
-        dst.MaximumLength = static_cast<USHORT>(dst_bytes);
-
+        dst.Length = static_cast<USHORT>(pos*sizeof(*dst.Buffer) + actual);
         return st;
 }
 
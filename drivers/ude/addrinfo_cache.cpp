@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "addrinfo_cache.h"
+#include "trace.h"
+#include "addrinfo_cache.tmh"
+
+#include "context.h"
+#include "driver.h"
+#include "dns_cache.h"
+
+#include <libdrv\strconv.h>
+#include <libdrv\wait_timeout.h>
+
+#include <ntstrsafe.h>
+
+struct usbip::addrinfo_cache : usbip::dns::cache<SOCKADDR_INET> {};
+
+namespace
+{
+
+using namespace usbip;
+
+static_assert(addrinfo_cache::HOST_SIZE == sizeof(vhci::imported_device_location::host));
+static_assert(addrinfo_cache::SERVICE_SIZE == sizeof(vhci::imported_device_location::service));
+
+/*
+ * WSK does not provide TTL of DNS records.
+ */
+constexpr dns::params cache_params {
+        .ttl = 5*wdm::minute,
+        .stale_ttl = 1*wdm::hour,
+        .negative_ttl = 10*wdm::second,
+};
+
+/*
+ * WskGetAddressInfo() can return STATUS_INTERNAL_ERROR after reboot if dnscache service is not ready yet.
+ * @see can_retry in persistent.cpp
+ */
+constexpr auto can_cache(_In_ NTSTATUS status)
+{
+        switch (status) {
+        case STATUS_INTERNAL_ERROR:
+        case STATUS_CANCELLED:
+        case STATUS_INSUFFICIENT_RESOURCES:
+                return false;
+        default:
+                return true;
+        }
+}
+
+struct revalidate_ctx
+{
+        WDFDEVICE vhci;
+
+        char host[addrinfo_cache::HOST_SIZE];
+        char service[addrinfo_cache::SERVICE_SIZE];
+
+        UNICODE_STRING node_name;
+        UNICODE_STRING service_name;
+
+        IRP *irp;
+        ADDRINFOEXW *addrinfo;
+
+        IO_REMOVE_LOCK *remove_lock; // of vhci, is held while IRP is in flight
+};
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(revalidate_ctx, get_revalidate_ctx)
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void cancel_refresh(_In_ WDFDEVICE vhci, _In_ const char *host, _In_ const char *service)
+{
+        PAGED_CODE();
+        auto &ctx = *get_vhci_ctx(vhci);
+
+        wdf::WaitLock lck(ctx.dns_cache_lock);
+        ctx.dns_cache->cancel_refresh(host, service);
+}
+
+_Function_class_(EVT_WDF_WORKITEM)
+_IRQL_requires_same_
+_IRQL_requires_max_(PASSIVE_LEVEL)
+PAGED void NTAPI revalidated(_In_ WDFWORKITEM wi)
+{
+        PAGED_CODE();
+        auto &ctx = *get_revalidate_ctx(wi);
+
+        auto st = ctx.irp->IoStatus.Status;
+        TraceDbg("%s:%s %!STATUS!", ctx.host, ctx.service, st);
+
+        update_addrinfo_cache(ctx.vhci, ctx.host, ctx.service, st, ctx.addrinfo);
+
+        auto lock = ctx.remove_lock;
+        WdfObjectDelete(wi); // frees IRP
+
+        IoReleaseRemoveLock(lock, wi);
+}
+
+_Function_class_(EVT_WDF_OBJECT_CONTEXT_CLEANUP)
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void revalidate_cleanup(_In_ WDFOBJECT obj)
+{
+        PAGED_CODE();
+        auto &ctx = *get_revalidate_ctx(obj);
+
+        wsk::free(ctx.addrinfo);
+        ctx.addrinfo = nullptr;
+
+        if (auto &irp = ctx.irp) {
+                IoFreeIrp(irp);
+                irp = nullptr;
+        }
+
+        libdrv::FreeUnicodeString(ctx.node_name, pooltag);
+        libdrv::FreeUnicodeString(ctx.service_name, pooltag);
+}
+
+_Function_class_(IO_COMPLETION_ROUTINE)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS revalidate_complete(
+        _In_ DEVICE_OBJECT*, _In_ IRP*, _In_reads_opt_(_Inexpressible_("varies")) void *context)
+{
+        WdfWorkItemEnqueue(static_cast<WDFWORKITEM>(context));
+        return StopCompletion; // IRP is owned by revalidate_ctx
+}
+
+/*
+ * The request that has got stale answer does not wait for it.
+ * IRP is owned by WSK until the completion, so the removal of vhci waits for it on the remove lock.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto revalidate(_In_ WDFDEVICE vhci, _In_ const char *host, _In_ const char *service)
+{
+        PAGED_CODE();
+
+        WDF_WORKITEM_CONFIG cfg;
+        WDF_WORKITEM_CONFIG_INIT(&cfg, revalidated);
+        cfg.AutomaticSerialization = false;
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attr, revalidate_ctx);
+        attr.EvtCleanupCallback = revalidate_cleanup;
+        attr.ParentObject = vhci;
+
+        WDFWORKITEM wi{};
+        if (auto err = WdfWorkItemCreate(&cfg, &attr, &wi)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfWorkItemCreate %!STATUS!", err);
+                return err;
+        }
+
+        auto &ctx = *get_revalidate_ctx(wi);
+        ctx.vhci = vhci;
+
+        NT_VERIFY(NT_SUCCESS(RtlStringCbCopyA(ctx.host, sizeof(ctx.host), host)));
+        NT_VERIFY(NT_SUCCESS(RtlStringCbCopyA(ctx.service, sizeof(ctx.service), service)));
+
+        struct {
+                UNICODE_STRING &dst;
+                const char *src;
+                USHORT maxlen;
+        } const v[] = {
+                { ctx.node_name, ctx.host, sizeof(ctx.host) },
+                { ctx.service_name, ctx.service, sizeof(ctx.service) },
+        };
+
+        for (auto &[dst, src, maxlen]: v) {
+                if (auto err = libdrv::utf8_to_unicode(dst, src, maxlen, PagedPool, pooltag)) {
+                        Trace(TRACE_LEVEL_ERROR, "utf8_to_unicode('%s') %!STATUS!", src, err);
+                        WdfObjectDelete(wi);
+                        return err;
+                }
+        }
+
+        ctx.irp = IoAllocateIrp(1, false);
+        if (!ctx.irp) {
+                Trace(TRACE_LEVEL_ERROR, "IoAllocateIrp error");
+                WdfObjectDelete(wi);
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        ctx.remove_lock = WdfDeviceWdmGetRemoveLock(vhci);
+
+        if (auto err = IoAcquireRemoveLock(ctx.remove_lock, wi)) { // vhci is being removed
+                Trace(TRACE_LEVEL_ERROR, "IoAcquireRemoveLock %!STATUS!", err);
+                WdfObjectDelete(wi);
+                return err;
+        }
+
+        IoSetCompletionRoutine(ctx.irp, revalidate_complete, wi, true, true, true);
+
+        ADDRINFOEXW hints {
+                .ai_flags = AI_NUMERICSERV,
+                .ai_family = AF_UNSPEC,
+                .ai_socktype = SOCK_STREAM,
+                .ai_protocol = IPPROTO_TCP // zero isn't work
+        };
+
+        auto st = wsk::getaddrinfo(ctx.addrinfo, &ctx.node_name, &ctx.service_name, &hints, ctx.irp);
+        TraceDbg("%s:%s %!STATUS!", host, service, st); // completion handler will be called anyway
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto make_addrinfo(_Out_ ADDRINFOEXW* &result, _In_ const addrinfo_cache::answer &ans)
+{
+        PAGED_CODE();
+        NT_ASSERT(ans.cnt);
+
+        struct item
+        {
+                ADDRINFOEXW ai;
+                SOCKADDR_INET addr;
+        };
+
+        auto v = (item*)ExAllocatePoolZero(PagedPool, ans.cnt*sizeof(item), pooltag);
+        if (!v) {
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate %lu ADDRINFOEXW", ans.cnt);
+                result = nullptr;
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        result = &v->ai;
+
+        for (ULONG i = 0; i < ans.cnt; ++i) {
+                auto &[ai, addr] = v[i];
+                addr = ans.addrs[i];
+
+                ai.ai_family = addr.si_family;
+                ai.ai_socktype = SOCK_STREAM;
+                ai.ai_protocol = IPPROTO_TCP;
+                ai.ai_addrlen = addr.si_family == AF_INET ? sizeof(addr.Ipv4) : sizeof(addr.Ipv6);
+                ai.ai_addr = reinterpret_cast<SOCKADDR*>(&addr);
+                ai.ai_next = i + 1 < ans.cnt ? &v[i + 1].ai : nullptr;
+        }
+
+        return STATUS_SUCCESS;
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::init_addrinfo_cache(_In_ WDFDEVICE vhci)
+{
+        PAGED_CODE();
+        auto &ctx = *get_vhci_ctx(vhci);
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = vhci;
+
+        if (auto err = WdfWaitLockCreate(&attr, &ctx.dns_cache_lock)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfWaitLockCreate %!STATUS!", err);
+                return err;
+        }
+
+        WDFMEMORY mem;
+        auto &buf = reinterpret_cast<PVOID&>(ctx.dns_cache);
+
+        if (auto err = WdfMemoryCreate(&attr, PagedPool, pooltag, sizeof(*ctx.dns_cache), &mem, &buf)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfMemoryCreate %!STATUS!", err);
+                return err;
+        }
+
+        RtlZeroMemory(buf, sizeof(*ctx.dns_cache)); // empty cache
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::lookup_addrinfo(
+        _In_ WDFDEVICE vhci, _In_ const char *host, _In_ const char *service, _Out_ ADDRINFOEXW* &ai)
+{
+        PAGED_CODE();
+
+        auto &ctx = *get_vhci_ctx(vhci);
+        ai = nullptr;
+
+        addrinfo_cache::answer ans;
+        bool refresh{};
+        dns::result res;
+        {
+                wdf::WaitLock lck(ctx.dns_cache_lock);
+                res = ctx.dns_cache->lookup(host, service, KeQueryInterruptTime(), ans, refresh);
+        }
+
+        switch (res) {
+        case dns::result::miss:
+                return STATUS_SUCCESS;
+        case dns::result::negative:
+                TraceDbg("%s:%s, cached %!STATUS!", host, service, ans.status);
+                return ans.status;
+        case dns::result::stale:
+                if (refresh && revalidate(vhci, host, service)) {
+                        cancel_refresh(vhci, host, service);
+                }
+                break;
+        case dns::result::fresh:
+                break;
+        }
+
+        TraceDbg("%s:%s, %lu cached address(es), stale %d", host, service, ans.cnt, res == dns::result::stale);
+
+        make_addrinfo(ai, ans); // resolve the name if failed
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::free_addrinfo(_In_opt_ ADDRINFOEXW *ai)
+{
+        PAGED_CODE();
+
+        if (ai) {
+                ExFreePoolWithTag(ai, pooltag);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::update_addrinfo_cache(
+        _In_ WDFDEVICE vhci, _In_ const char *host, _In_ const char *service,
+        _In_ NTSTATUS status, _In_opt_ const ADDRINFOEXW *ai)
+{
+        PAGED_CODE();
+
+        auto &ctx = *get_vhci_ctx(vhci);
+        auto now = KeQueryInterruptTime();
+
+        if (!NT_SUCCESS(status)) {
+                wdf::WaitLock lck(ctx.dns_cache_lock);
+                if (can_cache(status)) {
+                        ctx.dns_cache->insert_negative(cache_params, host, service, now, status);
+                } else {
+                        ctx.dns_cache->cancel_refresh(host, service);
+                }
+                return;
+        }
+
+        SOCKADDR_INET addrs[addrinfo_cache::MAX_ADDRESSES];
+        ULONG cnt = 0;
+
+        for (auto r = ai; r && cnt < ARRAYSIZE(addrs); r = r->ai_next) {
+                if (auto &a = addrs[cnt]; r->ai_addrlen <= sizeof(a)) {
+                        RtlZeroMemory(&a, sizeof(a));
+                        RtlCopyMemory(&a, r->ai_addr, r->ai_addrlen);
+                        ++cnt;
+                }
+        }
+
+        wdf::WaitLock lck(ctx.dns_cache_lock);
+
+        if (cnt) {
+                ctx.dns_cache->insert(cache_params, host, service, now, addrs, cnt);
+        } else {
+                ctx.dns_cache->cancel_refresh(host, service);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::remove_addrinfo(_In_ WDFDEVICE vhci, _In_ const char *host, _In_ const char *service)
+{
+        PAGED_CODE();
+        auto &ctx = *get_vhci_ctx(vhci);
+
+        TraceDbg("%s:%s", host, service);
+
+        wdf::WaitLock lck(ctx.dns_cache_lock);
+        ctx.dns_cache->remove(host, service);
+}
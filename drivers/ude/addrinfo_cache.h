@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <libdrv\codeseg.h>
+#include <libdrv\wdf_cpp.h>
+#include <libdrv\wsk_cpp.h>
+
+namespace usbip
+{
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS init_addrinfo_cache(_In_ WDFDEVICE vhci);
+
+/*
+ * Stale answer is returned immediately and is revalidated in the background.
+ * 
+ * @param ai list of cached addresses that must be released by free_addrinfo, NULL if not cached
+ * @return error of failed name resolution if it is cached
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS lookup_addrinfo(
+        _In_ WDFDEVICE vhci, _In_ const char *host, _In_ const char *service, _Out_ ADDRINFOEXW* &ai);
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void free_addrinfo(_In_opt_ ADDRINFOEXW *ai);
+
+/*
+ * @param status result of wsk::getaddrinfo
+ * @param ai result of wsk::getaddrinfo if status is success
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void update_addrinfo_cache(
+        _In_ WDFDEVICE vhci, _In_ const char *host, _In_ const char *service, 
+        _In_ NTSTATUS status, _In_opt_ const ADDRINFOEXW *ai);
+
+/*
+ * Cached addresses are not valid anymore, f.e. connect failed for each of them.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void remove_addrinfo(_In_ WDFDEVICE vhci, _In_ const char *host, _In_ const char *service);
+
+} // namespace usbip
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Scheduling policy for attaching of persistent devices, see persistent.cpp.
+ * It does not depend on WDK and can be used in user mode as is.
+ * Units of time are defined by the caller, they must be the same for all arguments.
+ */
+namespace usbip::attach_policy
+{
+
+using time_type = unsigned long long;
+
+struct params
+{
+        unsigned int max_inflight; // the number of simultaneous attach attempts for all hosts
+        time_type base_delay; // the delay after the first failure
+        time_type max_delay;
+};
+
+/*
+ * All devices of the same host share it.
+ */
+struct host_state
+{
+        unsigned int failures; // in a row
+        unsigned int inflight; // attempts for this host
+        time_type not_before; // the next attempt is not allowed earlier
+};
+
+/*
+ * Exponential backoff with "equal jitter": half of the delay is fixed, another half is random.
+ * @param failures in a row, must be greater than zero
+ * @param random any value of a random number generator
+ */
+constexpr auto get_delay(const params &p, unsigned int failures, unsigned int random)
+{
+        auto delay = p.base_delay;
+
+        for (auto i = 1U; i < failures && delay < p.max_delay; ++i) {
+                delay <<= 1;
+        }
+
+        if (delay > p.max_delay) {
+                delay = p.max_delay;
+        }
+
+        auto half = delay/2;
+        return delay - half + (half ? random % (half + 1) : 0);
+}
+
+/*
+ * A host that failed is probed by a single device till the first success, other devices wait.
+ */
+constexpr auto can_start(const params &p, const host_state &h, unsigned int inflight, time_type now)
+{
+        return inflight < p.max_inflight && now >= h.not_before && !(h.failures && h.inflight);
+}
+
+constexpr void on_start(host_state &h)
+{
+        ++h.inflight;
+}
+
+/*
+ * The host has responded, even if the device was not attached.
+ */
+constexpr void on_success(host_state &h)
+{
+        --h.inflight;
+        h.failures = 0;
+        h.not_before = 0;
+}
+
+/*
+ * Simultaneous failures of the same host are counted once.
+ */
+constexpr void on_failure(const params &p, host_state &h, time_type now, unsigned int random)
+{
+        --h.inflight;
+
+        if (now >= h.not_before) {
+                ++h.failures;
+                h.not_before = now + get_delay(p, h.failures, random);
+        }
+}
+
+} // namespace usbip::attach_policy
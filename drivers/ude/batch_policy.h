@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Scheduling of PLUGIN_HARDWARE_BATCH, see plugin_batch.cpp.
+ * It does not depend on WDK and can be used in user mode as is.
+ *
+ * Entries of the same host and service make a group, its first entry is the leader.
+ * Leaders are started first, so different hosts are resolved and connected in parallel.
+ * Other entries of a group wait for its leader and reuse its result of name resolution (see addrinfo_cache).
+ */
+namespace usbip::batch_policy
+{
+
+enum class state : unsigned char { waiting, inflight, done };
+
+struct entry
+{
+        unsigned int leader; // index of the first entry of the group, its own index for the leader
+        batch_policy::state state;
+};
+
+constexpr auto is_leader(const entry *v, unsigned int idx)
+{
+        return v[idx].leader == idx;
+}
+
+/*
+ * @param same(i, j) returns true if entries i and j have the same host and service
+ * @return the number of groups
+ */
+template<typename F>
+constexpr auto make_groups(entry *v, unsigned int cnt, F &&same)
+{
+        unsigned int groups = 0;
+
+        for (unsigned int i = 0; i < cnt; ++i) {
+                auto &e = v[i];
+                e = { .leader = i, .state = state::waiting };
+
+                for (unsigned int j = 0; j < i; ++j) {
+                        if (is_leader(v, j) && same(j, i)) {
+                                e.leader = j;
+                                break;
+                        }
+                }
+
+                groups += is_leader(v, i);
+        }
+
+        return groups;
+}
+
+/*
+ * @return index of the entry to start, cnt if there is nothing to start
+ */
+constexpr auto next(const entry *v, unsigned int cnt, unsigned int inflight, unsigned int max_inflight)
+{
+        if (inflight >= max_inflight) {
+                return cnt;
+        }
+
+        auto follower = cnt;
+
+        for (unsigned int i = 0; i < cnt; ++i) {
+                if (auto &e = v[i]; e.state != state::waiting) {
+                        //
+                } else if (is_leader(v, i)) {
+                        return i;
+                } else if (follower == cnt && v[e.leader].state == state::done) {
+                        follower = i;
+                }
+        }
+
+        return follower;
+}
+
+/*
+ * The leader has failed to reach its host, the rest of the group will fail the same way.
+ * @param f(idx) is called for each entry of the group that is marked as done
+ * @return the number of such entries
+ */
+template<typename F>
+constexpr auto skip_group(entry *v, unsigned int cnt, unsigned int leader, F &&f)
+{
+        unsigned int skipped = 0;
+
+        for (auto i = leader + 1; i < cnt; ++i) {
+                if (auto &e = v[i]; e.leader == leader && e.state == state::waiting) {
+                        e.state = state::done;
+                        f(i);
+                        ++skipped;
+                }
+        }
+
+        return skipped;
+}
+
+} // namespace usbip::batch_policy
@@ -10,6 +10,15 @@
 
 #include <usbip\proto.h>
 
+#include "teardown.h"
+#include "port_bitmap.h"
+#include "event_ring.h"
+#include "event_filter.h"
+#include "endpoint_table.h"
+#include "recv_policy.h"
+#include "shaper.h"
+#include "send_queue.h"
+
 #include <wdfusb.h>
 #include <UdeCx.h>
 
@@ -30,26 +39,42 @@ namespace usbip
 {
 
 enum { 
-        USB2_PORTS = 30,
+        USB2_PORTS = 30, // default, @see vhci_ctx::usb2_ports
         USB3_PORTS = USB2_PORTS,
-        TOTAL_PORTS = USB2_PORTS + USB3_PORTS
+        MAX_PORTS = 127, // per speed, arbitrary
+        MAX_TOTAL_PORTS = 2*MAX_PORTS
 };
 
+/*
+ * The number of ports of VHCI can be less, see vhci_ctx::total_ports.
+ */
 constexpr auto is_valid_port(int port)
 {
-        return port > 0 && port <= TOTAL_PORTS;
+        return port > 0 && port <= MAX_TOTAL_PORTS;
 }
 
 /*
  * Context space for WDFDEVICE, Virtual Host Controller Interface.
  * The parent is WDFDRIVER.
  */
+struct addrinfo_cache; // @see lookup_addrinfo
+
 struct vhci_ctx
 {
         WDFQUEUE sequential_queue; // see also WdfDeviceGetDefaultQueue
 
-        UDECXUSBDEVICE devices[TOTAL_PORTS]; // do not access directly, functions must be used
-        WDFSPINLOCK devices_lock;
+        UDECXUSBDEVICE devices[MAX_TOTAL_PORTS]; // do not access directly, functions must be used
+        WDFSPINLOCK devices_lock; // for devices, generation, port_generation; claimed_ports does not need it
+        port_bitmap<MAX_TOTAL_PORTS> claimed_ports;
+
+        UINT64 epoch; // is unique for each instance, generations of different instances are not comparable
+        UINT64 generation; // is incremented on any change of a port
+        UINT64 port_generation[MAX_TOTAL_PORTS]; // of the last change of a port
+
+        int usb2_ports; // [1, usb2_ports]
+        int total_ports; // usb3.x ports are [usb2_ports + 1, total_ports]
+
+        KPRIORITY recv_priority[recv_policy::LEVELS]; // of receive threads, index is recv_policy::level
 
         LIST_ENTRY fileobjects; // @see fileobject_ctx::entry
         WDFQUEUE reads; // IRP_MJ_READ
@@ -58,6 +83,9 @@ struct vhci_ctx
 
         _KTHREAD *attach_thread;
         KEVENT attach_thread_stop;
+
+        addrinfo_cache *dns_cache; // WDFMEMORY buffer
+        WDFWAITLOCK dns_cache_lock;
 };
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(vhci_ctx, get_vhci_ctx)
 
@@ -110,16 +138,23 @@ struct device_ctx
 
         WDFDEVICE vhci; // parent, virtual (emulated) host controller interface
 
-        UDECXUSBENDPOINT ep0; // default control pipe
-        WDFSPINLOCK endpoint_list_lock; // for endpoint_ctx::entry
+        UDECXUSBENDPOINT ep0; // default control pipe, it is not in endpoints
+        endpoint_table<endpoint_ctx> endpoints; // readers are lock-free, see find_endpoint
+        WDFSPINLOCK endpoints_lock; // serializes writers of endpoints
 
-        WDFSPINLOCK send_lock; // for WskSend on sock()
+        WDFSPINLOCK send_lock; // for WskSend on sock(), shaper, pending
+        shaper::token_bucket shaper; // vhci::ioctl::SET_DEVICE_RATE
+        send_queue<shaper::PRIORITIES> pending; // wsk_context::queued, transfers that are waiting to be sent
+        volatile LONG inflight; // bytes that are being sent
+        WDFTIMER shaper_timer; // sends pending bulk transfers when the tokens are refilled
+        WDFDPC send_dpc; // sends pending transfers when there is room in the socket
 
         int port; // vhci_ctx.devices[port - 1]
         seqnum_t seqnum; // @see next_seqnum
 
         volatile bool unplugged; // initiated detach that may still be ongoing
         KEVENT detach_completed;
+        teardown::times teardown; // KeQueryInterruptTime
 
         WDFWAITLOCK delete_lock; // serialize UdecxUsbDevicePlugOutAndDelete and UDECX_USB_DEVICE_STATE_CHANGE_CALLBACKS
 
@@ -131,6 +166,8 @@ struct device_ctx
         UINT64 cancelable_requests; // marked as
 
         _KTHREAD *recv_thread;
+        recv_policy::interface_levels intf_levels; // of selected interfaces
+        volatile recv_policy::level recv_level; // the highest of intf_levels, applied by recv_thread
 };        
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(device_ctx, get_device_ctx)
 
@@ -155,8 +192,7 @@ struct endpoint_ctx
         // UCHAR interface_number; // interface to which it belongs
         // UCHAR alternate_setting;
 
-        USBD_PIPE_HANDLE PipeHandle;
-        LIST_ENTRY entry; // list head if default control pipe, protected by device_ctx::endpoint_list_lock
+        USBD_PIPE_HANDLE PipeHandle; // @see set_pipe_handle
 };        
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(endpoint_ctx, get_endpoint_ctx)
 
@@ -206,8 +242,12 @@ struct fileobject_ctx
 {
         LIST_ENTRY entry; // head is vhci_ctx::fileobjects
 
-        WDFCOLLECTION events; // WDFMEMORY(device_state) that are waiting for IRP_MJ_READ
-        enum { MAX_EVENTS = 2*TOTAL_PORTS }; // arbitrary
+        enum { // attach and detach of each port: connecting, connected, plugged; unplugging, unplugged, disconnected
+                EVENTS_PER_PORT = 3,
+                MAX_EVENTS = event_ring_capacity(EVENTS_PER_PORT*MAX_TOTAL_PORTS) // 1024
+        };
+        event_ring<WDFMEMORY, MAX_EVENTS> events; // referenced WDFMEMORY(device_state) that are waiting for IRP_MJ_READ
+        event_filter filter; // of events that are queued, vhci::ioctl::SET_EVENT_FILTER
 
         bool process_events; // if IRP_MJ_READ was issued, see vhci_ctx::events_subscribers
 };
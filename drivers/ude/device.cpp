@@ -78,6 +78,7 @@ PAGED void device_cleanup(_In_ WDFOBJECT Object)
 
         // all resources must be freed except for device_ctx_ext*
         NT_ASSERT(IsListEmpty(&dev.requests));
+        NT_ASSERT(dev.pending.empty());
         NT_ASSERT(dev.unplugged);
         NT_ASSERT(!dev.port);
         NT_ASSERT(!dev.recv_thread);
@@ -363,7 +364,6 @@ PAGED NTSTATUS endpoint_add(_In_ UDECXUSBDEVICE device, _In_ UDECX_USB_ENDPOINT_
         auto &endp = *get_endpoint_ctx(endpoint);
 
         endp.device = device;
-        InitializeListHead(&endp.entry);
 
         if (auto len = data->EndpointDescriptorBufferLength) {
                 NT_ASSERT(epd.bLength == len);
@@ -551,6 +551,51 @@ PAGED auto create_spin_lock(_Out_ WDFSPINLOCK *handle, _In_ WDFOBJECT parent)
         return STATUS_SUCCESS;
 }
 
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto create_shaper_timer(_Out_ WDFTIMER &timer, _In_ UDECXUSBDEVICE device)
+{
+        PAGED_CODE();
+
+        WDF_TIMER_CONFIG cfg;
+        WDF_TIMER_CONFIG_INIT(&cfg, device::send_pending_timer);
+        cfg.AutomaticSerialization = false;
+        cfg.UseHighResolutionTimer = WdfTrue; // delays are shorter than the system clock interval
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = device;
+
+        if (auto err = WdfTimerCreate(&cfg, &attr, &timer)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfTimerCreate %!STATUS!", err);
+                return err;
+        }
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto create_send_dpc(_Out_ WDFDPC &dpc, _In_ UDECXUSBDEVICE device)
+{
+        PAGED_CODE();
+
+        WDF_DPC_CONFIG cfg;
+        WDF_DPC_CONFIG_INIT(&cfg, device::send_pending_dpc);
+        cfg.AutomaticSerialization = false;
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = device;
+
+        if (auto err = WdfDpcCreate(&cfg, &attr, &dpc)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfDpcCreate %!STATUS!", err);
+                return err;
+        }
+
+        return STATUS_SUCCESS;
+}
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED auto init_device(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev)
@@ -559,7 +604,7 @@ PAGED auto init_device(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev)
 
         WDFSPINLOCK *v[] = {
                 &dev.send_lock,
-                &dev.endpoint_list_lock,
+                &dev.endpoints_lock,
                 &dev.requests_lock,
         };
 
@@ -573,16 +618,35 @@ PAGED auto init_device(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev)
                 return err;
         }
 
+        if (auto err = create_shaper_timer(dev.shaper_timer, device)) {
+                return err;
+        }
+
+        if (auto err = create_send_dpc(dev.send_dpc, device)) {
+                return err;
+        }
+
         InitializeListHead(&dev.requests);
         KeInitializeEvent(&dev.detach_completed, NotificationEvent, false);
 
         return STATUS_SUCCESS;
 }
 
+inline auto get_teardown_ms(_In_ const device_ctx &dev)
+{
+        return teardown::get_duration(dev.teardown, KeQueryInterruptTime()) / wdm::msec;
+}
+
 inline auto set_unplugged(_Inout_ device_ctx &dev)
 {
         static_assert(sizeof(dev.unplugged) == sizeof(CHAR));
-        return InterlockedExchange8(PCHAR(&dev.unplugged), true);
+        auto was_unplugged = InterlockedExchange8(PCHAR(&dev.unplugged), true);
+
+        if (!was_unplugged) {
+                NT_VERIFY(teardown::on_start(dev.teardown, KeQueryInterruptTime()));
+        }
+
+        return was_unplugged;
 }
 
 _IRQL_requires_same_
@@ -629,6 +693,7 @@ PAGED auto detach(_In_ UDECXUSBDEVICE device)
                 device_state_changed(dev, vhci::state::disconnected);
         }
 
+        device::flush_pending(device);
         auto thread = recv_thread_join(device, dev);
 
         auto port = vhci::reclaim_roothub_port(device);
@@ -643,6 +708,9 @@ PAGED auto detach(_In_ UDECXUSBDEVICE device)
                 device_state_changed(dev.vhci, *dev.ext, port, vhci::state::unplugged);
         }
 
+        teardown::on_finish(dev.teardown, KeQueryInterruptTime());
+        TraceDbg("dev %04x, detached in %I64u ms", ptr04x(device), get_teardown_ms(dev));
+
         NT_VERIFY(!KeSetEvent(&dev.detach_completed, IO_NO_INCREMENT, false)); // once
         return thread;
 }
@@ -704,9 +772,58 @@ PAGED auto wait_detach(_In_ UDECXUSBDEVICE device, _In_opt_ LARGE_INTEGER *timeo
         return st;
 }
 
+constexpr auto detach_timeout = 30*wdm::second;
+
 constexpr auto wait_detach_timeout()
 {
-        return make_timeout(30*wdm::second, wdm::period::relative);
+        return make_timeout(detach_timeout, wdm::period::relative);
+}
+
+/*
+ * Fallback if there is no memory for KWAIT_BLOCK-s, the devices share the deadline anyway.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto wait_detach_each(_In_reads_(cnt) const UDECXUSBDEVICE *devices, _In_ ULONG cnt, _In_ ULONGLONG deadline)
+{
+        PAGED_CODE();
+        auto result = STATUS_SUCCESS;
+
+        for (ULONG i = 0; i < cnt; ++i) {
+                if (!get_device_ctx(devices[i])->unplugged) { // async_detach_nowait has failed
+                        continue;
+                }
+
+                auto remaining = teardown::get_remaining(deadline, KeQueryInterruptTime());
+                auto timeout = make_timeout(static_cast<LONG64>(remaining), wdm::period::relative);
+
+                if (auto st = wait_detach(devices[i], &timeout); st != STATUS_SUCCESS && result == STATUS_SUCCESS) {
+                        result = st;
+                }
+        }
+
+        return result;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void trace_teardown(_In_reads_(cnt) const UDECXUSBDEVICE *devices, _In_ ULONG cnt)
+{
+        PAGED_CODE();
+
+        for (ULONG i = 0; i < cnt; ++i) {
+                auto &dev = *get_device_ctx(devices[i]);
+
+                auto state = teardown::get_state(dev.teardown);
+                if (state == teardown::state::attached) {
+                        continue;
+                }
+
+                auto done = state == teardown::state::detached;
+
+                Trace(TRACE_LEVEL_INFORMATION, "dev %04x, %s %I64u ms", ptr04x(devices[i]), // port is released
+                        done ? "detached in" : "still detaching after", get_teardown_ms(dev));
+        }
 }
 
 } // namespace
@@ -834,6 +951,77 @@ PAGED NTSTATUS usbip::device::async_detach_and_wait(_In_ UDECXUSBDEVICE device)
         return st;
 }
 
+/*
+ * Initiate the detach of all devices and wait for the whole set, the timeout is shared.
+ * KeWaitForMultipleObjects can wait for MAXIMUM_WAIT_OBJECTS at once, the devices are waited in chunks.
+ * The caller must hold references to the devices.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::device::async_detach_and_wait(_In_reads_(cnt) const UDECXUSBDEVICE *devices, _In_ ULONG cnt)
+{
+        PAGED_CODE();
+        auto result = STATUS_SUCCESS;
+
+        for (ULONG i = 0; i < cnt; ++i) {
+                if (auto err = async_detach_nowait(devices[i]); NT_ERROR(err)) { // STATUS_PENDING if already unplugged
+                        Trace(TRACE_LEVEL_ERROR, "dev %04x, async_detach_nowait %!STATUS!", ptr04x(devices[i]), err);
+                        if (result == STATUS_SUCCESS) {
+                                result = err;
+                        }
+                }
+        }
+
+        unique_ptr buf(NonPagedPoolNx, MAXIMUM_WAIT_OBJECTS*(sizeof(KWAIT_BLOCK) + sizeof(void*)));
+        if (!buf) {
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate memory for %d KWAIT_BLOCK-s", MAXIMUM_WAIT_OBJECTS);
+        }
+
+        auto wait_blocks = buf.get<KWAIT_BLOCK>();
+        auto objects = buf ? reinterpret_cast<void**>(wait_blocks + MAXIMUM_WAIT_OBJECTS) : nullptr;
+
+        auto deadline = KeQueryInterruptTime() + detach_timeout;
+        NTSTATUS st = STATUS_SUCCESS;
+
+        for (ULONG i = 0; buf && i < cnt && st == STATUS_SUCCESS; ) {
+
+                ULONG pending = 0;
+
+                for ( ; i < cnt && pending < MAXIMUM_WAIT_OBJECTS; ++i) {
+                        if (auto &dev = *get_device_ctx(devices[i]); dev.unplugged) { // async_detach_nowait has succeeded
+                                objects[pending++] = &dev.detach_completed;
+                        }
+                }
+
+                if (!pending) {
+                        break;
+                }
+
+                auto remaining = teardown::get_remaining(deadline, KeQueryInterruptTime());
+                auto timeout = make_timeout(static_cast<LONG64>(remaining), wdm::period::relative);
+
+                st = KeWaitForMultipleObjects(pending, objects, WaitAll, Executive, KernelMode, false, &timeout, wait_blocks);
+
+                switch (st) {
+                case STATUS_SUCCESS:
+                        break;
+                case STATUS_TIMEOUT: // a bug in the driver
+                        Trace(TRACE_LEVEL_ERROR, "%lu device(s), timeout (purged WDFREQUEST is not completed?)", pending);
+                        st = STATUS_OPERATION_IN_PROGRESS;
+                        break;
+                default:
+                        Trace(TRACE_LEVEL_ERROR, "KeWaitForMultipleObjects %!STATUS!", st);
+                }
+        }
+
+        if (!buf) {
+                st = wait_detach_each(devices, cnt, deadline);
+        }
+
+        trace_teardown(devices, cnt);
+        return result == STATUS_SUCCESS ? st : result;
+}
+
 /*
  * @see plugout_and_delete
  */
@@ -855,3 +1043,15 @@ PAGED NTSTATUS usbip::device::detach(_In_ UDECXUSBDEVICE device)
         auto timeout = wait_detach_timeout();
         return wait_detach(device, &timeout); // concurrent calls wait for the completion
 }
+
+/*
+ * The port of the device is released by the detach, r.port must be set by the caller.
+ * @return false if the detach of the device was not initiated
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool usbip::device::get_teardown(_Inout_ vhci::ioctl::plugout_hardware_time &r, _In_ UDECXUSBDEVICE device)
+{
+        auto &dev = *get_device_ctx(device);
+        return teardown::fill(r, dev.teardown, KeQueryInterruptTime(), wdm::msec);
+}
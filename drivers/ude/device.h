@@ -16,6 +16,11 @@ namespace usbip
         struct device_ctx_ext;
 } // namespace usbip
 
+namespace usbip::vhci::ioctl
+{
+        struct plugout_hardware_time;
+} // namespace usbip::vhci::ioctl
+
 
 namespace usbip::device
 {
@@ -36,8 +41,16 @@ _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED NTSTATUS async_detach_and_wait(_In_ UDECXUSBDEVICE device);
 
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS async_detach_and_wait(_In_reads_(cnt) const UDECXUSBDEVICE *devices, _In_ ULONG cnt);
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED NTSTATUS detach(_In_ UDECXUSBDEVICE device);
 
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool get_teardown(_Inout_ vhci::ioctl::plugout_hardware_time &r, _In_ UDECXUSBDEVICE device);
+
 } // namespace usbip::device
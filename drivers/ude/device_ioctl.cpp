@@ -14,6 +14,7 @@
 #include "proto.h"
 #include "network.h"
 #include "ioctl.h"
+#include "endpoint_list.h"
 
 #include "filter_request.h"
 #include <ude_filter\request.h>
@@ -27,12 +28,25 @@
 #include <libdrv\usb_util.h>
 #include <libdrv\dbgcommon.h>
 #include <libdrv\usbd_helper.h>
+#include <libdrv\wait_timeout.h>
 
 namespace
 {
 
 using namespace usbip;
 
+/*
+ * Limits the data in the socket that is ahead of a transfer of higher priority.
+ * It is large enough to keep the link busy.
+ */
+enum { MAX_INFLIGHT = 512*1024 }; // bytes
+static_assert(MAX_INFLIGHT > 0);
+
+/*
+ * A transfer of lower priority that waits for longer is sent ahead of transfers of higher priority.
+ */
+constexpr auto max_wait = 50*wdm::msec;
+
 /*
  * wsk_irp->Tail.Overlay.DriverContext[] are zeroed.
  *
@@ -49,6 +63,11 @@ NTSTATUS send_complete(_In_ DEVICE_OBJECT*, _In_ IRP *wsk_irp, _In_reads_opt_(_I
         auto request = ctx->request; // can be WDF_NO_HANDLE or already completed
         auto &dev = *ctx->dev;
 
+        if (LONG len = ctx->buf.Length, inflight = InterlockedExchangeAdd(&dev.inflight, -len);
+            inflight >= MAX_INFLIGHT && inflight - len < MAX_INFLIGHT && !dev.pending.empty()) {
+                WdfDpcEnqueue(dev.send_dpc); // send_pending has stopped due to MAX_INFLIGHT
+        }
+
         auto &wsk = wsk_irp->IoStatus;
         TraceWSK("req %04x -> wsk irp %04x, %!STATUS!, Information %Iu", 
                   ptr04x(request), ptr04x(wsk_irp), wsk.Status, wsk.Information);
@@ -106,6 +125,105 @@ auto prepare_wsk_buf(_Inout_ WSK_BUF &buf, _Inout_ wsk_context &ctx, _Inout_opt_
         return STATUS_SUCCESS;
 }
 
+/*
+ * CMD_UNLINK is sent without endpoint.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto get_priority(_In_opt_ UDECXUSBENDPOINT endpoint)
+{
+        auto type = endpoint ? usb_endpoint_type(get_endpoint_ctx(endpoint)->descriptor) : UsbdPipeTypeControl;
+        return shaper::get_priority(type);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void start_shaper_timer(_Inout_ device_ctx &dev, _In_ ULONGLONG now)
+{
+        static_assert(shaper::UNITS_PER_SECOND == wdm::second);
+
+        auto delay = shaper::get_delay(dev.shaper, now);
+        auto due = make_timeout(delay, wdm::period::relative);
+
+        WdfTimerStart(dev.shaper_timer, due.QuadPart);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(DISPATCH_LEVEL)
+void send_now(_Inout_ device_ctx &dev, _Inout_ wsk_context &ctx)
+{
+        auto request = ctx.request; // do not access ctx or wsk_irp after send
+        auto wsk_irp = ctx.wsk_irp;
+        auto buf = ctx.buf;
+
+        InterlockedExchangeAdd(&dev.inflight, static_cast<LONG>(buf.Length));
+        auto st = send(dev.sock(), &buf, WSK_FLAG_NODELAY, wsk_irp); // completion handler will be called anyway
+
+        TraceWSK("req %04x -> wsk irp %04x, %Iu bytes, %!STATUS!", 
+                  ptr04x(request), ptr04x(wsk_irp), buf.Length, st);
+}
+
+/*
+ * Sends the transfers of dev.pending in the order of priority while there is room in the socket.
+ * Bulk transfers also wait for the tokens of dev.shaper, the rest borrow them.
+ * Must be called under dev.send_lock.
+ *
+ * @param all send regardless of the tokens and MAX_INFLIGHT
+ */
+_IRQL_requires_same_
+_IRQL_requires_(DISPATCH_LEVEL)
+void send_pending(_Inout_ device_ctx &dev, _In_ bool all)
+{
+        unsigned int skip = 0; // priorities that wait for the tokens
+
+        for (auto now = KeQueryInterruptTime(); auto e = dev.pending.front(now, max_wait, skip); ) {
+
+                auto &ctx = *CONTAINING_RECORD(e, wsk_context, queued);
+                auto prio = static_cast<shaper::priority>(e->priority);
+
+                if (all) {
+                        // send at once
+                } else if (dev.inflight >= MAX_INFLIGHT) {
+                        break; // send_complete will resume
+                } else if (!shaper::consume(dev.shaper, ctx.buf.Length, prio, now)) {
+                        NT_ASSERT(prio == shaper::priority::bulk);
+                        skip |= 1U << e->priority;
+                        start_shaper_timer(dev, now);
+                        continue;
+                }
+
+                dev.pending.pop(*e);
+                send_now(dev, ctx);
+        }
+}
+
+/*
+ * CMD_SUBMIT that waits in dev.pending has not been sent yet. CMD_UNLINK has the priority of control transfers,
+ * it would overtake CMD_SUBMIT of lower priority and the server would get the URB that is never unlinked.
+ *
+ * @return true if CMD_SUBMIT was removed from dev.pending, CMD_UNLINK must not be sent
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto remove_pending(_Inout_ device_ctx &dev, _In_ seqnum_t seqnum)
+{
+        auto match = [seqnum] (auto &e)
+        {
+                auto &ctx = *CONTAINING_RECORD(&e, wsk_context, queued);
+                return ctx.request && RtlUlongByteSwap(ctx.hdr.base.seqnum) == seqnum; // the header is in network byte order
+        };
+
+        wdf::Lock lck(dev.send_lock);
+        auto e = dev.pending.remove(match);
+        lck.release();
+
+        if (e) {
+                free(CONTAINING_RECORD(e, wsk_context, queued), true); // mdl_buf is released before the request is completed
+        }
+
+        return static_cast<bool>(e);
+}
+
 /*
  * switch (wdf::Lock lck(...); auto st = send(...))
  * is not used due to unspecified evaluation order of init-statement and condition.
@@ -138,17 +256,23 @@ auto send(_In_opt_ UDECXUSBENDPOINT endpoint, _In_ wsk_context_ptr &ctx, _Inout_
 
         byteswap_header(ctx->hdr, swap_dir::host2net);
 
-        auto wsk_irp = ctx->wsk_irp; // do not access ctx or wsk_irp after send
-        IoSetCompletionRoutine(wsk_irp, send_complete, ctx.release(), true, true, true);
+        auto prio = static_cast<unsigned int>(get_priority(endpoint));
 
-        NTSTATUS st;
-        {
-                wdf::Lock lck(dev.send_lock); // EvtUsbEndpointPurge, EvtIoInternalDeviceControl on other queues
-                st = send(dev.sock(), &buf, WSK_FLAG_NODELAY, wsk_irp); // completion handler will be called anyway
+        auto &c = *ctx.release(); // do not access it after send
+        c.buf = buf;
+        IoSetCompletionRoutine(c.wsk_irp, send_complete, &c, true, true, true);
+
+        wdf::Lock lck(dev.send_lock); // EvtUsbEndpointPurge, EvtIoInternalDeviceControl on other queues
+
+        if (dev.unplugged) { // dev.pending was flushed
+                send_now(dev, c); // WskSend will fail if the socket is closed
+        } else {
+                dev.pending.push(c.queued, prio, KeQueryInterruptTime());
+                KeMemoryBarrier(); // the read of dev.inflight must not be reordered, see send_complete
+                send_pending(dev, false);
         }
-        TraceWSK("req %04x -> wsk irp %04x, %Iu bytes, %!STATUS!", 
-                  ptr04x(request), ptr04x(wsk_irp), buf.Length, st);
 
+        lck.release(); // explicit call to satisfy code analyzer and get rid of warning C28166
         return STATUS_PENDING;
 }
 
@@ -166,7 +290,7 @@ auto control_transfer(
         auto &r = urb.UrbControlTransferEx;
 
         if (r.PipeHandle && endp.PipeHandle != r.PipeHandle) { // r.PipeHandle is null if USBD_DEFAULT_PIPE_TRANSFER
-                endp.PipeHandle = r.PipeHandle;
+                set_pipe_handle(endp, r.PipeHandle);
         }
 
         if (!filter::is_request(r)) {
@@ -226,7 +350,7 @@ auto bulk_or_interrupt_transfer(
         auto &r = urb.UrbBulkOrInterruptTransfer;
 
         if (endp.PipeHandle != r.PipeHandle) {
-                endp.PipeHandle = r.PipeHandle;
+                set_pipe_handle(endp, r.PipeHandle);
         }
 
         {
@@ -293,7 +417,7 @@ auto isoch_transfer(
         auto &r = urb.UrbIsochronousTransfer;
 
         if (endp.PipeHandle != r.PipeHandle) {
-                endp.PipeHandle = r.PipeHandle;
+                set_pipe_handle(endp, r.PipeHandle);
         }
 
         {
@@ -455,6 +579,8 @@ void usbip::device::send_cmd_unlink_and_complete(_In_ UDECXUSBDEVICE device, _In
 
         if (dev.unplugged) {
                 TraceDbg("Unplugged, do not send unlink");
+        } else if (remove_pending(dev, req.seqnum)) {
+                TraceDbg("CMD_SUBMIT was not sent, do not send unlink");
         } else if (auto ctx = wsk_context_ptr(&dev, WDFREQUEST(WDF_NO_HANDLE))) {
                 set_cmd_unlink_usbip_header(ctx->hdr, dev, req.seqnum);
                 ::send(WDF_NO_HANDLE, ctx, dev, false); // ignore error
@@ -574,6 +700,66 @@ NTSTATUS usbip::device::reset_port(_In_ UDECXUSBDEVICE device, _In_opt_ WDFREQUE
         return send_ep0_out(device, request, r);
 }
 
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::device::set_rate(_In_ UDECXUSBDEVICE device, _In_ ULONG rate, _In_ ULONG burst)
+{
+        auto &dev = *get_device_ctx(device);
+        TraceDbg("dev %04x, rate %lu, burst %lu", ptr04x(device), rate, burst);
+
+        wdf::Lock lck(dev.send_lock);
+
+        shaper::set_rate(dev.shaper, rate, burst, KeQueryInterruptTime());
+        send_pending(dev, false); // the new rate can be higher
+
+        lck.release();
+}
+
+_Function_class_(EVT_WDF_TIMER)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void NTAPI usbip::device::send_pending_timer(_In_ WDFTIMER timer)
+{
+        auto device = static_cast<UDECXUSBDEVICE>(WdfTimerGetParentObject(timer));
+        auto &dev = *get_device_ctx(device);
+
+        wdf::Lock lck(dev.send_lock);
+        send_pending(dev, false);
+        lck.release();
+}
+
+_Function_class_(EVT_WDF_DPC)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void NTAPI usbip::device::send_pending_dpc(_In_ WDFDPC dpc)
+{
+        auto device = static_cast<UDECXUSBDEVICE>(WdfDpcGetParentObject(dpc));
+        auto &dev = *get_device_ctx(device);
+
+        wdf::Lock lck(dev.send_lock);
+        send_pending(dev, false);
+        lck.release();
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::device::flush_pending(_In_ UDECXUSBDEVICE device)
+{
+        PAGED_CODE();
+
+        auto &dev = *get_device_ctx(device);
+        NT_ASSERT(dev.unplugged);
+
+        {
+                wdf::Lock lck(dev.send_lock);
+                send_pending(dev, true);
+        }
+
+        // will not be started again since dev.pending is not used after unplugging
+        WdfTimerStop(dev.shaper_timer, true);
+        WdfDpcCancel(dev.send_dpc, true);
+}
+
 /*
  * IRP_MJ_INTERNAL_DEVICE_CONTROL 
  */
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <libdrv/wdf_cpp.h>
+#include <libdrv\codeseg.h>
 
 #include <usb.h>
 #include <wdfusb.h>
@@ -59,6 +60,38 @@ _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NTSTATUS reset_port(_In_ UDECXUSBDEVICE device, _In_opt_ WDFREQUEST request);
 
+/*
+ * Limits the rate of sending, see shaper.h.
+ * @param rate bytes per second, zero removes the limit
+ * @param burst bytes, zero selects the default
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void set_rate(_In_ UDECXUSBDEVICE device, _In_ ULONG rate, _In_ ULONG burst);
+
+/*
+ * Resumes sending of device_ctx::pending when the tokens are refilled.
+ */
+_Function_class_(EVT_WDF_TIMER)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void NTAPI send_pending_timer(_In_ WDFTIMER timer);
+
+/*
+ * Resumes sending of device_ctx::pending when there is room in the socket.
+ */
+_Function_class_(EVT_WDF_DPC)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void NTAPI send_pending_dpc(_In_ WDFDPC dpc);
+
+/*
+ * Sends all pending transfers at once, must be called after the socket is closed.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void flush_pending(_In_ UDECXUSBDEVICE device);
+
 _Function_class_(EVT_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL)
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
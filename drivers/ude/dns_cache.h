@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Cache of name resolution results keyed by (host, service), see addrinfo_cache.cpp.
+ * It does not depend on WDK and can be used in user mode as is. It is not thread-safe.
+ * Zero-initialized object is an empty cache.
+ * Units of time are defined by the caller, they must be the same for all arguments.
+ */
+namespace usbip::dns
+{
+
+using time_type = unsigned long long;
+
+struct params
+{
+        time_type ttl; // positive answer is fresh
+        time_type stale_ttl; // positive answer can be used after ttl while it is being revalidated
+        time_type negative_ttl; // failed resolution is not repeated
+};
+
+enum class result { miss, fresh, stale, negative };
+
+template<typename Address, unsigned int Capacity = 32, unsigned int MaxAddresses = 8>
+class cache
+{
+public:
+        enum { HOST_SIZE = 1025, SERVICE_SIZE = 32, MAX_ADDRESSES = MaxAddresses }; // NI_MAXHOST, NI_MAXSERV
+
+        struct answer
+        {
+                Address addrs[MaxAddresses];
+                unsigned int cnt;
+                long status; // of failed resolution
+        };
+
+        /*
+         * @param refresh is set if the caller must revalidate stale answer and call insert() or insert_negative(),
+         *        only one caller receives it till then
+         */
+        result lookup(const char *host, const char *service, time_type now, answer &ans, bool &refresh);
+
+        void insert(
+                const params &p, const char *host, const char *service, time_type now,
+                const Address *addrs, unsigned int cnt);
+
+        /*
+         * Stale positive answer is kept, failed revalidation will be repeated by the next lookup.
+         */
+        void insert_negative(const params &p, const char *host, const char *service, time_type now, long status);
+
+        /*
+         * Revalidation was not done, the next lookup of stale answer will request it again.
+         */
+        void cancel_refresh(const char *host, const char *service);
+
+        void remove(const char *host, const char *service);
+
+private:
+        struct entry
+        {
+                char host[HOST_SIZE];
+                char service[SERVICE_SIZE];
+
+                time_type expires; // fresh or negative till
+                time_type stale_until;
+                time_type last_used;
+
+                Address addrs[MaxAddresses];
+                unsigned int cnt;
+                long status; // zero for positive answer
+
+                bool used;
+                bool refreshing;
+        };
+
+        entry m_entries[Capacity];
+
+        static bool equal(const char *a, const char *b, unsigned int size, bool nocase);
+        static void copy(char *dst, const char *src, unsigned int size);
+
+        entry* find(const char *host, const char *service);
+        entry& get_slot(const char *host, const char *service);
+};
+
+template<typename Address, unsigned int Capacity, unsigned int MaxAddresses>
+bool cache<Address, Capacity, MaxAddresses>::equal(const char *a, const char *b, unsigned int size, bool nocase)
+{
+        auto lower = [nocase] (char c) { return nocase && c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c; };
+
+        for (unsigned int i = 0; i < size; ++i) {
+                if (lower(a[i]) != lower(b[i])) {
+                        return false;
+                } else if (!a[i]) {
+                        return true;
+                }
+        }
+
+        return true;
+}
+
+template<typename Address, unsigned int Capacity, unsigned int MaxAddresses>
+void cache<Address, Capacity, MaxAddresses>::copy(char *dst, const char *src, unsigned int size)
+{
+        unsigned int i = 0;
+
+        for ( ; i + 1 < size && src[i]; ++i) {
+                dst[i] = src[i];
+        }
+
+        dst[i] = '\0';
+}
+
+template<typename Address, unsigned int Capacity, unsigned int MaxAddresses>
+auto cache<Address, Capacity, MaxAddresses>::find(const char *host, const char *service) -> entry*
+{
+        for (auto &e: m_entries) {
+                if (e.used && equal(e.host, host, HOST_SIZE, true) && equal(e.service, service, SERVICE_SIZE, false)) {
+                        return &e;
+                }
+        }
+
+        return nullptr;
+}
+
+/*
+ * Least recently used entry is evicted if the cache is full.
+ * The caller must initialize other members.
+ */
+template<typename Address, unsigned int Capacity, unsigned int MaxAddresses>
+auto cache<Address, Capacity, MaxAddresses>::get_slot(const char *host, const char *service) -> entry&
+{
+        if (auto e = find(host, service)) {
+                return *e;
+        }
+
+        auto victim = m_entries;
+
+        for (auto &e: m_entries) {
+                if (!e.used) {
+                        victim = &e;
+                        break;
+                } else if (e.last_used < victim->last_used) {
+                        victim = &e;
+                }
+        }
+
+        victim->used = true;
+
+        copy(victim->host, host, HOST_SIZE);
+        copy(victim->service, service, SERVICE_SIZE);
+
+        return *victim;
+}
+
+template<typename Address, unsigned int Capacity, unsigned int MaxAddresses>
+result cache<Address, Capacity, MaxAddresses>::lookup(
+        const char *host, const char *service, time_type now, answer &ans, bool &refresh)
+{
+        refresh = false;
+        ans.cnt = 0;
+        ans.status = 0;
+
+        auto e = find(host, service);
+        if (!e) {
+                return result::miss;
+        }
+
+        if (e->status) {
+                if (now < e->expires) {
+                        ans.status = e->status;
+                        return result::negative;
+                }
+                e->used = false;
+                return result::miss;
+        }
+
+        if (now >= e->stale_until) {
+                e->used = false;
+                return result::miss;
+        }
+
+        e->last_used = now;
+
+        for (ans.cnt = 0; ans.cnt < e->cnt; ++ans.cnt) {
+                ans.addrs[ans.cnt] = e->addrs[ans.cnt];
+        }
+
+        if (now < e->expires) {
+                return result::fresh;
+        }
+
+        if (!e->refreshing) {
+                e->refreshing = true;
+                refresh = true;
+        }
+
+        return result::stale;
+}
+
+template<typename Address, unsigned int Capacity, unsigned int MaxAddresses>
+void cache<Address, Capacity, MaxAddresses>::insert(
+        const params &p, const char *host, const char *service, time_type now,
+        const Address *addrs, unsigned int cnt)
+{
+        if (!cnt) {
+                return;
+        }
+
+        auto &e = get_slot(host, service);
+
+        e.expires = now + p.ttl;
+        e.stale_until = e.expires + p.stale_ttl;
+        e.last_used = now;
+
+        e.status = 0;
+        e.refreshing = false;
+
+        for (e.cnt = 0; e.cnt < cnt && e.cnt < MaxAddresses; ++e.cnt) {
+                e.addrs[e.cnt] = addrs[e.cnt];
+        }
+}
+
+template<typename Address, unsigned int Capacity, unsigned int MaxAddresses>
+void cache<Address, Capacity, MaxAddresses>::insert_negative(
+        const params &p, const char *host, const char *service, time_type now, long status)
+{
+        if (auto e = find(host, service); e && !e->status && now < e->stale_until) {
+                e->refreshing = false;
+                return;
+        }
+
+        auto &e = get_slot(host, service);
+
+        e.expires = now + p.negative_ttl;
+        e.stale_until = e.expires;
+        e.last_used = now;
+
+        e.cnt = 0;
+        e.status = status;
+        e.refreshing = false;
+}
+
+template<typename Address, unsigned int Capacity, unsigned int MaxAddresses>
+void cache<Address, Capacity, MaxAddresses>::cancel_refresh(const char *host, const char *service)
+{
+        if (auto e = find(host, service)) {
+                e->refreshing = false;
+        }
+}
+
+template<typename Address, unsigned int Capacity, unsigned int MaxAddresses>
+void cache<Address, Capacity, MaxAddresses>::remove(const char *host, const char *service)
+{
+        if (auto e = find(host, service)) {
+                e->used = false;
+        }
+}
+
+} // namespace usbip::dns
@@ -6,77 +6,55 @@
 #include "trace.h"
 #include "endpoint_list.tmh"
 
-namespace
-{
-
-using namespace usbip;
-
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-auto matches(_In_ const endpoint_ctx &endp, _In_ const endpoint_search &crit)
+void usbip::insert_endpoint_list(_In_ endpoint_ctx &endp)
 {
-        switch (crit.what) {
-        case crit.HANDLE:
-                return crit.handle == endp.PipeHandle;
-        case crit.ADDRESS:
-                return crit.address == endp.descriptor.bEndpointAddress;
-        }
+        auto &dev = *get_device_ctx(endp.device);
+        auto addr = endp.descriptor.bEndpointAddress;
 
-        Trace(TRACE_LEVEL_ERROR, "Invalid union's member selector %d", crit.what);
-        return false;
-}
+        wdf::Lock lck(dev.endpoints_lock);
 
-_IRQL_requires_same_
-_IRQL_requires_max_(DISPATCH_LEVEL)
-auto get_endpoint_list_head(_In_ device_ctx &dev)
-{
-        auto ep0 = get_endpoint_ctx(dev.ep0);
-        return &ep0->entry;
+        if (!dev.endpoints.insert(addr, &endp, endp.PipeHandle)) { // outdated, but still not removed endpoint is replaced
+                Trace(TRACE_LEVEL_ERROR, "Invalid bEndpointAddress %#x", addr);
+        }
 }
 
-} // namespace
-
-
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-void usbip::insert_endpoint_list(_In_ endpoint_ctx &endp)
+void usbip::remove_endpoint_list(_In_ endpoint_ctx &endp)
 {
-        NT_ASSERT(IsListEmpty(&endp.entry));
-
-        if (auto &dev = *get_device_ctx(endp.device); auto head = get_endpoint_list_head(dev)) {
-                wdf::Lock lck(dev.endpoint_list_lock);
-                InsertHeadList(head, &endp.entry); // outdated, but still not removed endpoints will be at end
+        if (auto dev = get_device_ctx(endp.device)) {
+                wdf::Lock lck(dev->endpoints_lock);
+                dev->endpoints.remove(endp.descriptor.bEndpointAddress, &endp); // works if it was not inserted
         }
 }
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-void usbip::remove_endpoint_list(_In_ endpoint_ctx &endp)
+void usbip::set_pipe_handle(_Inout_ endpoint_ctx &endp, _In_ USBD_PIPE_HANDLE handle)
 {
-        auto e = &endp.entry;
-
-        if (auto dev = get_device_ctx(endp.device)) {
-                wdf::Lock lck(dev->endpoint_list_lock);
-                RemoveEntryList(e); // works if entry was just InitializeListHead-ed
-        }
+        auto &dev = *get_device_ctx(endp.device);
+        wdf::Lock lck(dev.endpoints_lock);
 
-        InitializeListHead(e);
+        endp.PipeHandle = handle;
+        dev.endpoints.set_handle(endp.descriptor.bEndpointAddress, &endp, handle);
 }
 
+/*
+ * Lock-free, see endpoint_table.
+ */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 auto usbip::find_endpoint(_In_ device_ctx &dev, _In_ const endpoint_search &crit) -> endpoint_ctx*
 {
-        auto head = get_endpoint_list_head(dev);
-
-        wdf::Lock lck(dev.endpoint_list_lock);
-
-        for (auto entry = head->Flink; entry != head; entry = entry->Flink) {
-                auto endp = CONTAINING_RECORD(entry, endpoint_ctx, entry);
-                if (matches(*endp, crit)) {
-                        return endp;
-                }
+        switch (crit.what) {
+        case crit.HANDLE:
+                return dev.endpoints.find(static_cast<const void*>(crit.handle));
+        case crit.ADDRESS:
+                return dev.endpoints.find(crit.address);
         }
 
+        Trace(TRACE_LEVEL_ERROR, "Invalid union's member selector %d", crit.what);
         return nullptr;
 }
@@ -37,6 +37,13 @@ _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 void remove_endpoint_list(_In_ endpoint_ctx &endp);
 
+/*
+ * Sets endpoint_ctx::PipeHandle, the endpoint can be found by it after that.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void set_pipe_handle(_Inout_ endpoint_ctx &endp, _In_ USBD_PIPE_HANDLE handle);
+
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 endpoint_ctx *find_endpoint(_In_ device_ctx &dev, _In_ const endpoint_search &crit);
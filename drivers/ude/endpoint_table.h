@@ -0,0 +1,395 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
+/*
+ * Endpoints of a device, see device_ctx::endpoints.
+ * It does not depend on WDK and can be used in user mode as is.
+ * Zero-initialized object is an empty table.
+ *
+ * Slot is indexed by endpoint address: number | direction, 32 slots.
+ * An element replaced in its slot is retired, it is still found by its handle until it is removed.
+ * Pipe handles are looked up through a small open addressing hash of slot indexes.
+ *
+ * Writers must be serialized by the caller, readers are lock-free (seqlock).
+ * A reader retries if a writer has modified the table during the lookup.
+ * The table does not own the elements, a caller is responsible for the lifetime of a found element.
+ */
+namespace usbip
+{
+
+namespace endpoint_table_detail
+{
+
+template<typename T>
+inline T load(const volatile T &v)
+{
+#ifdef _MSC_VER
+        return v;
+#else
+        return __atomic_load_n(&v, __ATOMIC_RELAXED);
+#endif
+}
+
+template<typename T>
+inline void store(volatile T &v, T val)
+{
+#ifdef _MSC_VER
+        v = val;
+#else
+        __atomic_store_n(&v, val, __ATOMIC_RELAXED);
+#endif
+}
+
+/*
+ * Loads are not reordered across it.
+ */
+inline void read_fence()
+{
+#if defined(_M_ARM64) || defined(_M_ARM64EC)
+        __dmb(_ARM64_BARRIER_ISHLD);
+#elif defined(_MSC_VER)
+        _ReadWriteBarrier(); // x86/x64 do not reorder loads with other loads
+#else
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+#endif
+}
+
+/*
+ * Makes the sequence odd before stores to the table.
+ */
+inline void write_begin(volatile long &seq)
+{
+#ifdef _MSC_VER
+        _InterlockedIncrement(&seq); // full barrier
+#else
+        __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+#endif
+}
+
+/*
+ * Makes the sequence even after stores to the table.
+ */
+inline void write_end(volatile long &seq)
+{
+#ifdef _MSC_VER
+        _InterlockedIncrement(&seq); // full barrier
+#else
+        __atomic_fetch_add(&seq, 1, __ATOMIC_RELEASE);
+#endif
+}
+
+} // namespace endpoint_table_detail
+
+
+template<typename T>
+class endpoint_table
+{
+public:
+        enum { SIZE = 32, RETIRED = SIZE, HASH_SIZE = 2*(SIZE + RETIRED) };
+
+        /*
+         * @return -1 if reserved bits of the address are set
+         */
+        static constexpr int index(unsigned char address)
+        {
+                return address & 0x70 ? -1 : (address & 0xF) | ((address & 0x80) >> 3);
+        }
+
+        /*
+         * Writer. Replaces an element with the same address, the replaced one is retired.
+         * It is not retired if there is no room for it, its handle is not found in such case.
+         * @return false if the address is invalid
+         */
+        bool insert(unsigned char address, T *val, const void *handle);
+
+        /*
+         * Writer. Removes the element from its slot or from the retired ones.
+         * @return false if the element was not found
+         */
+        bool remove(unsigned char address, const T *val);
+
+        /*
+         * Writer.
+         * @param handle can be null to remove the handle
+         * @return false if the element was not found
+         */
+        bool set_handle(unsigned char address, const T *val, const void *handle);
+
+        // readers
+
+        T* find(unsigned char address) const;
+        T* find(const void *handle) const;
+
+private:
+        T* volatile m_items[SIZE + RETIRED]; // slots, then retired elements
+        const void* volatile m_handles[SIZE + RETIRED]; // of m_items
+        volatile unsigned char m_hash[HASH_SIZE]; // index of m_items + 1, zero if empty
+        volatile long m_seq; // odd if a writer is active
+
+        long read_begin() const;
+        bool read_retry(long seq) const;
+
+        static unsigned int hash(const void *handle);
+        void rehash();
+
+        int position(unsigned char address, const T *val) const;
+        void retire(int slot);
+};
+
+template<typename T>
+inline long endpoint_table<T>::read_begin() const
+{
+        using namespace endpoint_table_detail;
+
+        for (;; ) {
+                if (auto seq = load(m_seq); !(seq & 1)) {
+                        read_fence();
+                        return seq;
+                }
+        }
+}
+
+template<typename T>
+inline bool endpoint_table<T>::read_retry(long seq) const
+{
+        using namespace endpoint_table_detail;
+
+        read_fence();
+        return load(m_seq) != seq;
+}
+
+template<typename T>
+inline unsigned int endpoint_table<T>::hash(const void *handle)
+{
+        auto v = static_cast<unsigned long long>(reinterpret_cast<decltype(sizeof(0))>(handle));
+        v ^= v >> 17;
+        v *= 0x9E3779B97F4A7C15ULL; // Fibonacci hashing
+        return static_cast<unsigned int>(v >> 57); // 128 == HASH_SIZE
+}
+
+/*
+ * Is called inside of the write section only.
+ */
+template<typename T>
+void endpoint_table<T>::rehash()
+{
+        using namespace endpoint_table_detail;
+        static_assert(HASH_SIZE == 128);
+
+        for (auto &i: m_hash) {
+                store(i, static_cast<unsigned char>(0));
+        }
+
+        for (int i = 0; i < SIZE + RETIRED; ++i) {
+                auto handle = load(m_handles[i]);
+                if (!handle) {
+                        continue;
+                }
+
+                for (auto h = hash(handle); ; h = (h + 1) % HASH_SIZE) { // HASH_SIZE > SIZE + RETIRED, always terminates
+                        if (!load(m_hash[h])) {
+                                store(m_hash[h], static_cast<unsigned char>(i + 1));
+                                break;
+                        }
+                }
+        }
+}
+
+/*
+ * Writer. @return index of m_items or -1
+ */
+template<typename T>
+int endpoint_table<T>::position(unsigned char address, const T *val) const
+{
+        using namespace endpoint_table_detail;
+
+        auto i = index(address);
+        if (i < 0 || !val) {
+                return -1;
+        }
+
+        if (load(m_items[i]) == val) {
+                return i;
+        }
+
+        for (int j = SIZE; j < SIZE + RETIRED; ++j) {
+                if (load(m_items[j]) == val) {
+                        return j;
+                }
+        }
+
+        return -1;
+}
+
+/*
+ * Is called inside of the write section only, the caller must rehash.
+ * Moves the element of the slot to a free retired entry, the slot becomes empty.
+ */
+template<typename T>
+void endpoint_table<T>::retire(int slot)
+{
+        using namespace endpoint_table_detail;
+
+        auto val = load(m_items[slot]);
+        auto handle = load(m_handles[slot]);
+
+        store(m_items[slot], static_cast<T*>(nullptr));
+        store(m_handles[slot], static_cast<const void*>(nullptr));
+
+        for (int j = SIZE; j < SIZE + RETIRED; ++j) {
+                if (!load(m_items[j])) {
+                        store(m_items[j], val);
+                        store(m_handles[j], handle);
+                        break;
+                }
+        }
+}
+
+template<typename T>
+bool endpoint_table<T>::insert(unsigned char address, T *val, const void *handle)
+{
+        using namespace endpoint_table_detail;
+
+        auto i = index(address);
+        if (i < 0) {
+                return false;
+        }
+
+        write_begin(m_seq);
+
+        bool rehash_needed = load(m_handles[i]) || handle;
+
+        if (auto j = position(address, val); j >= SIZE) { // retired one is inserted again
+                rehash_needed |= !!load(m_handles[j]);
+                store(m_items[j], static_cast<T*>(nullptr));
+                store(m_handles[j], static_cast<const void*>(nullptr));
+        }
+
+        if (auto cur = load(m_items[i]); cur && cur != val) {
+                retire(i);
+        }
+
+        store(m_items[i], val);
+        store(m_handles[i], handle);
+
+        if (rehash_needed) {
+                rehash();
+        }
+
+        write_end(m_seq);
+        return true;
+}
+
+template<typename T>
+bool endpoint_table<T>::remove(unsigned char address, const T *val)
+{
+        using namespace endpoint_table_detail;
+
+        auto i = position(address, val);
+        if (i < 0) {
+                return false;
+        }
+
+        write_begin(m_seq);
+
+        store(m_items[i], static_cast<T*>(nullptr));
+
+        if (load(m_handles[i])) {
+                store(m_handles[i], static_cast<const void*>(nullptr));
+                rehash();
+        }
+
+        write_end(m_seq);
+        return true;
+}
+
+template<typename T>
+bool endpoint_table<T>::set_handle(unsigned char address, const T *val, const void *handle)
+{
+        using namespace endpoint_table_detail;
+
+        auto i = position(address, val);
+        if (i < 0) {
+                return false;
+        }
+
+        if (load(m_handles[i]) == handle) {
+                return true;
+        }
+
+        write_begin(m_seq);
+        store(m_handles[i], handle);
+        rehash();
+        write_end(m_seq);
+
+        return true;
+}
+
+template<typename T>
+T* endpoint_table<T>::find(unsigned char address) const
+{
+        using namespace endpoint_table_detail;
+
+        auto i = index(address);
+        if (i < 0) {
+                return nullptr;
+        }
+
+        T *val{};
+
+        for (long seq{}; ; ) {
+                seq = read_begin();
+                val = load(m_items[i]);
+
+                if (!read_retry(seq)) {
+                        return val;
+                }
+        }
+}
+
+/*
+ * The hash can be inconsistent if a writer is active, this is detected by read_retry.
+ */
+template<typename T>
+T* endpoint_table<T>::find(const void *handle) const
+{
+        using namespace endpoint_table_detail;
+
+        if (!handle) {
+                return nullptr;
+        }
+
+        T *val{};
+        auto start = hash(handle);
+
+        for (long seq{}; ; ) {
+                seq = read_begin();
+                val = nullptr;
+
+                for (unsigned int k = 0, h = start; k < HASH_SIZE; ++k, h = (h + 1) % HASH_SIZE) {
+                        auto n = load(m_hash[h]);
+                        if (!n) {
+                                break;
+                        }
+
+                        if (auto i = (n - 1) % (SIZE + RETIRED); load(m_handles[i]) == handle) {
+                                val = load(m_items[i]);
+                                break;
+                        }
+                }
+
+                if (!read_retry(seq)) {
+                        return val;
+                }
+        }
+}
+
+} // namespace usbip
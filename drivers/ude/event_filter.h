@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Filter of device state events of a subscriber, see fileobject_ctx::filter.
+ * It does not depend on WDK and can be used in user mode as is.
+ * Zero-initialized object matches any event.
+ */
+namespace usbip
+{
+
+struct event_filter
+{
+        enum { MAX_PORT = 256, HOST_SIZE = 1025 }; // NI_MAXHOST
+
+        unsigned long long ports[MAX_PORT/64]; // bit (port - 1), empty set matches any port
+        unsigned int states; // bit (state), empty set matches any state
+        char host[HOST_SIZE]; // case-insensitive, empty string matches any host
+};
+
+namespace filter_detail
+{
+
+constexpr auto tolower(char c)
+{
+        return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+constexpr auto is_empty(const unsigned long long *bits, unsigned int cnt)
+{
+        for (unsigned int i = 0; i < cnt; ++i) {
+                if (bits[i]) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+} // namespace filter_detail
+
+/*
+ * @param port zero if the device has not been plugged in yet, such events are matched by state and host only
+ */
+constexpr bool matches(const event_filter &f, int port, int state, const char *host)
+{
+        using namespace filter_detail;
+
+        if (state < 0 || state >= int(8*sizeof(f.states))) {
+                return false;
+        } else if (f.states && !(f.states & (1U << state))) {
+                return false;
+        }
+
+        if (port < 0 || port > event_filter::MAX_PORT) {
+                return false;
+        } else if (auto idx = port - 1; port && !is_empty(f.ports, sizeof(f.ports)/sizeof(*f.ports)) &&
+                   !(f.ports[idx/64] & (1ULL << (idx % 64)))) {
+                return false;
+        }
+
+        if (!*f.host) {
+                return true;
+        } else if (!host) {
+                return false;
+        }
+
+        for (int i = 0; i < event_filter::HOST_SIZE; ++i) {
+                if (tolower(f.host[i]) != tolower(host[i])) {
+                        return false;
+                } else if (!host[i]) {
+                        break;
+                }
+        }
+
+        return true;
+}
+
+} // namespace usbip
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Per-subscriber queue of device state events, see fileobject_ctx::events.
+ * It does not depend on WDK and can be used in user mode as is. It is not thread-safe.
+ * Zero-initialized object is an empty ring.
+ *
+ * If the ring is full, the oldest element is overwritten.
+ * Each element gets a sequence number, the first one is 1.
+ * The number of overwritten elements is reported by the next pop(), the reader must resync in such case.
+ */
+namespace usbip
+{
+
+/*
+ * @return the least power of two that is not less than n
+ */
+constexpr unsigned int event_ring_capacity(unsigned int n)
+{
+        unsigned int cap = 1;
+        while (cap < n) {
+                cap <<= 1;
+        }
+        return cap;
+}
+
+template<typename T, unsigned int Capacity>
+class event_ring
+{
+public:
+        static_assert(Capacity && !(Capacity & (Capacity - 1)), "must be a power of two");
+        enum { CAPACITY = Capacity };
+
+        /*
+         * @param dropped receives the overwritten element
+         * @return true if an element was overwritten
+         */
+        bool push(const T &val, T &dropped);
+
+        /*
+         * @param lost the number of elements that were overwritten since the previous pop
+         */
+        bool pop(T &val, unsigned int &seqnum, unsigned int &lost);
+
+        auto size() const { return m_tail - m_head; }
+        auto empty() const { return m_tail == m_head; }
+
+private:
+        T m_items[Capacity];
+
+        unsigned int m_head; // the number of removed elements, the seqnum of the last one
+        unsigned int m_tail; // the number of pushed elements
+        unsigned int m_lost; // since the previous pop
+};
+
+template<typename T, unsigned int Capacity>
+bool event_ring<T, Capacity>::push(const T &val, T &dropped)
+{
+        auto full = size() == Capacity;
+
+        if (full) {
+                dropped = m_items[m_head++ % Capacity];
+                ++m_lost;
+        }
+
+        m_items[m_tail++ % Capacity] = val;
+        return full;
+}
+
+template<typename T, unsigned int Capacity>
+bool event_ring<T, Capacity>::pop(T &val, unsigned int &seqnum, unsigned int &lost)
+{
+        if (empty()) {
+                return false;
+        }
+
+        val = m_items[m_head % Capacity];
+        seqnum = ++m_head;
+
+        lost = m_lost;
+        m_lost = 0;
+
+        return true;
+}
+
+} // namespace usbip
@@ -97,10 +97,13 @@ void update_pipe_properties(_In_ device_ctx &dev, _In_ const USBD_INTERFACE_INFO
                         usb_endpoint_dir_out(endp->descriptor) ? "Out" : "In", usb_endpoint_num(endp->descriptor),
                         ptr04x(pipe.PipeHandle), ptr04x(endp->PipeHandle), endp->priority_boost);
 
-                endp->PipeHandle = pipe.PipeHandle;
+                set_pipe_handle(*endp, pipe.PipeHandle);
                 // endp->interface_number = intf.InterfaceNumber;
                 // endp->alternate_setting = intf.AlternateSetting;
         }
+
+        auto lvl = recv_policy::get_level(intf.Class, intf.SubClass, intf.Protocol);
+        dev.recv_level = dev.intf_levels.set(intf.InterfaceNumber, lvl); // the receive thread will apply it
 }
 
 _IRQL_requires_same_
@@ -133,6 +136,9 @@ auto select_configuration(
 
         UCHAR cfg{}; // FIXME: can't pass -1 if unconfigured
 
+        dev.intf_levels.clear();
+        dev.recv_level = recv_policy::level::normal; // if unconfigured
+
         if (auto cd = r.ConfigurationDescriptor) { // null if unconfigured
                 cfg = cd->bConfigurationValue;
 
@@ -16,17 +16,6 @@
 
 #include <libusbip/src/op_common.h>
 
-namespace {
-
-constexpr auto make_priority( _In_ LOCK_OPERATION operation)
-{
-        return NormalPagePriority | MdlMappingNoExecute | 
-                (operation == IoReadAccess ? MdlMappingNoWrite : 0UL);
-}
-
-} // namespace
-
-
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED NTSTATUS usbip::send(_Inout_ SOCKET *sock, _In_ memory pool, _In_ void *data, _In_ ULONG len)
 {
@@ -119,33 +108,25 @@ NTSTATUS usbip::make_transfer_buffer_mdl(
                 return STATUS_SUCCESS;
         }
 
-        void *buf{};
-        bool probe_and_lock;
-
         if (auto head = r.TransferBufferMDL) { // preferable case because it is locked-down, can be a chain
 
                 if (auto len = size(head); len < r.TransferBufferLength) { // must describe full buffer
                         return STATUS_BUFFER_TOO_SMALL;
-                } else if (!head->Next) { // source MDL is not a chain
-                        mdl = Mdl(head, 0, mdl_size);
-                        return mdl ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
-                } else if (buf = MmGetSystemAddressForMdlSafe(head, make_priority(operation)); !buf) {
-                        return STATUS_INSUFFICIENT_RESOURCES;        
-                } else { // IoBuildPartialMdl doesn't treat SourceMdl as a chain and can't be used
-                        probe_and_lock = false;
                 }
 
-        } else if (buf = r.TransferBuffer; buf) { // could be allocated from paged pool
-                probe_and_lock = true; // false -> DRIVER_VERIFIER_DETECTED_VIOLATION
-        } else {
+                mdl = Mdl(head, 0, mdl_size); // a chain of partial MDLs if the source is a chain
+                return mdl ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        auto buf = r.TransferBuffer; // could be allocated from paged pool
+        if (!buf) {
                 Trace(TRACE_LEVEL_ERROR, "TransferBuffer and TransferBufferMDL are NULL");
                 return STATUS_INVALID_PARAMETER;
         }
 
-        NT_ASSERT(buf);
         mdl = Mdl(buf, mdl_size);
 
-        auto st = probe_and_lock ? mdl.prepare_paged(operation) : mdl.prepare_nonpaged();
+        auto st = mdl.prepare_paged(operation); // prepare_nonpaged -> DRIVER_VERIFIER_DETECTED_VIOLATION
         if (st) {
                 mdl.reset();
         }
@@ -7,6 +7,8 @@
 #include "persistent.tmh"
 
 #include "context.h"
+#include "driver.h"
+#include "attach_policy.h"
 
 #include <libdrv\strconv.h>
 #include <libdrv\wait_timeout.h>
@@ -82,186 +84,404 @@ PAGED auto parse_string(_Out_ vhci::ioctl::plugin_hardware &r, _In_ const UNICOD
 }
 
 /*
- * Target is self. 
+ * WskGetAddressInfo() can return STATUS_INTERNAL_ERROR(0xC00000E5), but after some delay it will succeed.
+ * This can happen after reboot if dnscache(?) service is not ready yet.
  */
+constexpr auto can_retry(_In_ NTSTATUS status)
+{
+        switch (as_usbip_status(status)) {
+        case USBIP_ERROR_VERSION:
+        case USBIP_ERROR_PROTOCOL:
+        case USBIP_ERROR_ABI:
+        // @see op_status_t
+        case USBIP_ERROR_ST_NA: 
+        case USBIP_ERROR_ST_DEV_BUSY:
+        case USBIP_ERROR_ST_DEV_ERR:
+        case USBIP_ERROR_ST_NODEV:
+        case USBIP_ERROR_ST_ERROR:
+                return false;
+        default:
+                return true;
+        }
+}
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED auto make_target(_In_ WDFDEVICE vhci)
+PAGED auto contains(_In_ WDFCOLLECTION col, _In_ const UNICODE_STRING &str)
 {
         PAGED_CODE();
-        ObjectDelete target;
+        
+        for (ULONG i = 0, cnt = WdfCollectionGetCount(col); i < cnt; ++i) {
+                auto item = (WDFSTRING)WdfCollectionGetItem(col, i);
 
-        if (WDFIOTARGET t; auto err = WdfIoTargetCreate(vhci, WDF_NO_OBJECT_ATTRIBUTES, &t)) {
-                Trace(TRACE_LEVEL_ERROR, "WdfIoTargetCreate %!STATUS!", err);
-                return target;
-        } else {
-                target.reset(t);
+                UNICODE_STRING s{};
+                WdfStringGetUnicodeString(item, &s);
+                        
+                if (RtlEqualUnicodeString(&s, &str, true)) {
+                        return true;
+                }
         }
 
-        auto fdo = WdfDeviceWdmGetDeviceObject(vhci);
+        return false;
+}
 
-        WDF_IO_TARGET_OPEN_PARAMS params;
-        WDF_IO_TARGET_OPEN_PARAMS_INIT_EXISTING_DEVICE(&params, fdo);
+/*
+ * Persistent device.
+ */
+struct attach_item
+{
+        UNICODE_STRING line; // WDFSTRING is owned by the collection
+        vhci::ioctl::plugin_hardware req;
+        ULONG host; // index in attach_ctx::hosts
+
+        struct attach_ctx *ctx;
+        WDFREQUEST request; // is being attached if not NULL
+        NTSTATUS status;
+        LONG completed;
+        bool done; // attached or excluded
+};
+
+struct attach_ctx
+{
+        vhci_ctx &vhci;
+        WDFIOTARGET target;
 
-        if (auto err = WdfIoTargetOpen(target.get<WDFIOTARGET>(), &params)) {
-                Trace(TRACE_LEVEL_ERROR, "WdfIoTargetOpen %!STATUS!", err);
-                target.reset();
-        }
+        attach_item *items;
+        ULONG item_cnt;
 
-        return target;
-}
+        attach_policy::host_state *hosts;
+        ULONG host_cnt;
 
-constexpr auto get_delay(_In_ ULONG attempt, _In_ ULONG cnt)
+        ULONG inflight; // requests
+        ULONG seed; // for RtlRandomEx
+        KEVENT completed; // one of requests is completed
+};
+
+constexpr attach_policy::params policy {
+        .max_inflight = 4,
+        .base_delay = 5*wdm::second,
+        .max_delay = 30*wdm::minute,
+};
+
+constexpr auto outlen = offsetof(vhci::ioctl::plugin_hardware, port) + sizeof(vhci::ioctl::plugin_hardware::port);
+
+/*
+ * Hosts are compared by name, therefore devices of the same server 
+ * specified by a name and by an IP address have separate backoffs.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto get_host(_Inout_ attach_ctx &ctx, _In_ ULONG cnt)
 {
-        NT_ASSERT(cnt);
-        enum { UNIT = 10, MAX_DELAY = 30*60 }; // seconds
-        return attempt > 1 ? min(UNIT*attempt/cnt, MAX_DELAY) : 0; // first two attempts without a delay
+        PAGED_CODE();
+        auto &host = ctx.items[cnt].req.host;
+
+        for (ULONG i = 0; i < cnt; ++i) {
+                if (auto &r = ctx.items[i]; !r.done && !_stricmp(r.req.host, host)) {
+                        return r.host;
+                }
+        }
+
+        return ctx.host_cnt++;
 }
 
 _IRQL_requires_same_
-_IRQL_requires_max_(APC_LEVEL)
-PAGED auto sleep(_Inout_ vhci_ctx &ctx, _In_ ULONG seconds)
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void init_items(_Inout_ attach_ctx &ctx, _In_ WDFCOLLECTION col)
 {
         PAGED_CODE();
-        auto timeout = make_timeout(seconds*wdm::second, wdm::period::relative);
 
-        switch (auto st = KeWaitForSingleObject(&ctx.attach_thread_stop, Executive, KernelMode, false, &timeout)) {
-        case STATUS_SUCCESS:
-                TraceDbg("thread stop requested");
-                return false;
-        case STATUS_TIMEOUT:
-                break;
-        default:
-                Trace(TRACE_LEVEL_ERROR, "KeWaitForSingleObject %!STATUS!", st);
+        for (ULONG i = 0; i < ctx.item_cnt; ++i) {
+                auto &r = ctx.items[i];
+                r.ctx = &ctx;
+                r.req.size = sizeof(r.req);
+
+                if (auto s = (WDFSTRING)WdfCollectionGetItem(col, i)) {
+                        WdfStringGetUnicodeString(s, &r.line);
+                }
+
+                if (auto err = parse_string(r.req, r.line)) {
+                        Trace(TRACE_LEVEL_ERROR, "'%!USTR!' parse %!STATUS!", &r.line, err);
+                        r.done = true; // skip malformed string
+                } else {
+                        r.host = get_host(ctx, i);
+                }
         }
+}
 
-        return true;
+_Function_class_(EVT_WDF_REQUEST_COMPLETION_ROUTINE)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void on_plugin_complete(
+        _In_ WDFREQUEST, _In_ WDFIOTARGET, _In_ WDF_REQUEST_COMPLETION_PARAMS *params, _In_ WDFCONTEXT context)
+{
+        auto &r = *static_cast<attach_item*>(context);
+        auto &st = params->IoStatus;
+
+        r.status = st.Status;
+        NT_ASSERT(!NT_SUCCESS(st.Status) || st.Information == outlen);
+
+        InterlockedExchange(&r.completed, true);
+        KeSetEvent(&r.ctx->completed, IO_NO_INCREMENT, false);
 }
 
 /*
- * WskGetAddressInfo() can return STATUS_INTERNAL_ERROR(0xC00000E5), but after some delay it will succeed.
- * This can happen after reboot if dnscache(?) service is not ready yet.
+ * Send IOCTL to itself.
  */
-constexpr auto can_retry(_In_ NTSTATUS status)
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto send_plugin_hardware(_Inout_ attach_item &r)
 {
-        switch (as_usbip_status(status)) {
-        case USBIP_ERROR_VERSION:
-        case USBIP_ERROR_PROTOCOL:
-        case USBIP_ERROR_ABI:
-        // @see op_status_t
-        case USBIP_ERROR_ST_NA: 
-        case USBIP_ERROR_ST_DEV_BUSY:
-        case USBIP_ERROR_ST_DEV_ERR:
-        case USBIP_ERROR_ST_NODEV:
-        case USBIP_ERROR_ST_ERROR:
-                return false;
-        default:
-                return true;
+        PAGED_CODE();
+
+        auto &ctx = *r.ctx;
+        Trace(TRACE_LEVEL_INFORMATION, "%s:%s/%s", r.req.host, r.req.service, r.req.busid);
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = ctx.target;
+
+        ObjectDelete request;
+
+        if (WDFREQUEST h; auto err = WdfRequestCreate(&attr, ctx.target, &h)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfRequestCreate %!STATUS!", err);
+                return err;
+        } else {
+                request.reset(h);
+        }
+
+        attr.ParentObject = request.get();
+        r.req.port = 0;
+
+        WDFMEMORY mem;
+        if (auto err = WdfMemoryCreatePreallocated(&attr, &r.req, sizeof(r.req), &mem)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfMemoryCreatePreallocated %!STATUS!", err);
+                return err;
+        }
+
+        WDFMEMORY_OFFSET output{ .BufferLength = outlen };
+
+        if (auto err = WdfIoTargetFormatRequestForIoctl(ctx.target, request.get<WDFREQUEST>(), 
+                                                        vhci::ioctl::PLUGIN_HARDWARE, mem, nullptr, mem, &output)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfIoTargetFormatRequestForIoctl %!STATUS!", err);
+                return err;
+        }
+
+        WdfRequestSetCompletionRoutine(request.get<WDFREQUEST>(), on_plugin_complete, &r);
+        r.completed = false;
+
+        if (!WdfRequestSend(request.get<WDFREQUEST>(), ctx.target, WDF_NO_SEND_OPTIONS)) {
+                auto err = WdfRequestGetStatus(request.get<WDFREQUEST>());
+                Trace(TRACE_LEVEL_ERROR, "WdfRequestSend %!STATUS!", err);
+                return err;
+        }
+
+        r.request = static_cast<WDFREQUEST>(request.release());
+        ++ctx.inflight;
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void on_result(_Inout_ attach_item &r, _In_ NTSTATUS status)
+{
+        PAGED_CODE();
+
+        auto &ctx = *r.ctx;
+        auto &host = ctx.hosts[r.host];
+
+        if (!status || !can_retry(status)) {
+                TraceDbg("exclude %!USTR!, %!STATUS!", &r.line, status);
+                r.done = true;
+                attach_policy::on_success(host);
+        } else {
+                attach_policy::on_failure(policy, host, KeQueryInterruptTime(), RtlRandomEx(&ctx.seed));
+                TraceDbg("%!USTR!: %!STATUS!, host failures %lu", &r.line, status, host.failures);
         }
 }
 
 /*
- * @return true - do not try to connect to this device again
+ * @return true if a request is in progress
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED auto plugin_hardware(
-        _In_ const UNICODE_STRING &line, 
-        _In_ WDFIOTARGET target,
-        _Inout_ vhci::ioctl::plugin_hardware &req,
-        _Inout_ WDF_MEMORY_DESCRIPTOR &input,
-        _Inout_ WDF_MEMORY_DESCRIPTOR &output,
-        [[maybe_unused]] _In_ const ULONG outlen)
+PAGED auto process_completed(_Inout_ attach_ctx &ctx)
 {
         PAGED_CODE();
 
-        if (auto err = parse_string(req, line)) {
-                Trace(TRACE_LEVEL_ERROR, "'%!USTR!' parse %!STATUS!", &line, err);
-                return true; // remove malformed string
+        for (ULONG i = 0; i < ctx.item_cnt; ++i) {
+                if (auto &r = ctx.items[i]; r.request && InterlockedCompareExchange(&r.completed, false, false)) {
+                        WdfObjectDelete(r.request);
+                        r.request = WDF_NO_HANDLE;
+                        --ctx.inflight;
+                        on_result(r, r.status);
+                }
         }
 
-        Trace(TRACE_LEVEL_INFORMATION, "%s:%s/%s", req.host, req.service, req.busid);
-        req.port = 0;
+        return ctx.inflight;
+}
 
-        if (ULONG_PTR BytesReturned; // send IOCTL to itself
-            auto err = WdfIoTargetSendIoctlSynchronously(target, WDF_NO_HANDLE, vhci::ioctl::PLUGIN_HARDWARE, 
-                                                         &input, &output, nullptr, &BytesReturned)) {
-                Trace(TRACE_LEVEL_ERROR, "WdfIoTargetSendIoctlSynchronously %!STATUS!", err);
-                return !can_retry(err);
-        } else {
-                NT_ASSERT(BytesReturned == outlen);
-                return true;
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void start_ready(_Inout_ attach_ctx &ctx)
+{
+        PAGED_CODE();
+
+        for (ULONG i = 0; i < ctx.item_cnt; ++i) {
+
+                auto &r = ctx.items[i];
+                if (r.done || r.request) {
+                        continue;
+                }
+
+                auto &host = ctx.hosts[r.host];
+                if (!attach_policy::can_start(policy, host, ctx.inflight, KeQueryInterruptTime())) {
+                        continue;
+                }
+
+                attach_policy::on_start(host);
+
+                if (auto err = send_plugin_hardware(r)) {
+                        on_result(r, err);
+                }
         }
 }
 
+/*
+ * Devices that are ready but can't be started wait for completion of other requests.
+ * @return relative timeout till the earliest backoff expiration, zero if nothing is waiting for it
+ */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED auto contains(_In_ WDFCOLLECTION col, _In_ const UNICODE_STRING &str)
+PAGED LONGLONG get_timeout(_In_ const attach_ctx &ctx)
 {
         PAGED_CODE();
-        
-        for (ULONG i = 0, cnt = WdfCollectionGetCount(col); i < cnt; ++i) {
-                auto item = (WDFSTRING)WdfCollectionGetItem(col, i);
 
-                UNICODE_STRING s{};
-                WdfStringGetUnicodeString(item, &s);
-                        
-                if (RtlEqualUnicodeString(&s, &str, true)) {
-                        return true;
+        auto now = KeQueryInterruptTime();
+        auto when = ~0ULL;
+
+        for (ULONG i = 0; i < ctx.item_cnt; ++i) {
+                if (auto &r = ctx.items[i]; r.done || r.request) {
+                        //
+                } else if (auto t = ctx.hosts[r.host].not_before; t > now) {
+                        when = min(when, t);
                 }
         }
 
-        return false;
+        return when == ~0ULL ? 0 : LONGLONG(when - now);
 }
 
 /*
- * Remove from collection A items absent in collection B.
+ * Refreshing allows to remove devices that constantly fail to attach.
+ * @return false if there is nothing to attach
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED void intersection(_In_ WDFCOLLECTION a, _In_ WDFCOLLECTION b)
+PAGED auto refresh(_Inout_ attach_ctx &ctx, _In_ WDFKEY key)
 {
         PAGED_CODE();
 
-        for (ULONG i = 0, cnt = WdfCollectionGetCount(a); i < cnt; ) {
-                auto item = (WDFSTRING)WdfCollectionGetItem(a, i);
+        auto col = get_persistent_devices(key);
+        if (!col) {
+                return false;
+        }
 
-                UNICODE_STRING s{};
-                WdfStringGetUnicodeString(item, &s);
+        bool pending{};
 
-                if (contains(b, s)) {
-                        ++i;
+        for (ULONG i = 0; i < ctx.item_cnt; ++i) {
+                if (auto &r = ctx.items[i]; r.done || r.request) {
+                        pending |= !r.done;
+                } else if (contains(col.get<WDFCOLLECTION>(), r.line)) {
+                        pending = true;
                 } else {
-                        TraceDbg("exclude %!USTR!", &s);
-                        WdfCollectionRemoveItem(a, i);
-                        --cnt;
+                        TraceDbg("exclude %!USTR!", &r.line);
+                        r.done = true;
                 }
         }
+
+        return pending;
 }
 
 /*
- * Refreshing allows to remove devices that constantly fail to attach.
+ * PLUGIN_HARDWARE passes the IRP of the request to WSK, the pending connect or name resolution is cancelled,
+ * the request completes with STATUS_CANCELLED. Otherwise stop would wait until each connect times out.
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED ULONG get_count(_In_ WDFCOLLECTION col, _In_ WDFKEY key, _In_ bool refresh)
+PAGED void cancel_inflight(_In_ const attach_ctx &ctx)
 {
         PAGED_CODE();
 
-        if (!refresh) {
-                //
-        } else if (auto newcol = get_persistent_devices(key)) {
-                intersection(col, newcol.get<WDFCOLLECTION>());
-        } else {
-                return 0;
+        for (ULONG i = 0; i < ctx.item_cnt; ++i) {
+                if (auto &r = ctx.items[i]; r.request && !InterlockedCompareExchange(&r.completed, false, false)) {
+                        auto ok = WdfRequestCancelSentRequest(r.request);
+                        TraceDbg("cancel %!USTR!, %d", &r.line, ok);
+                }
         }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void wait_inflight(_Inout_ attach_ctx &ctx)
+{
+        PAGED_CODE();
 
-        return min(WdfCollectionGetCount(col), ARRAYSIZE(vhci_ctx::devices));
+        while (process_completed(ctx)) {
+                TraceDbg("waiting for %lu request(s)", ctx.inflight);
+                NT_VERIFY(NT_SUCCESS(KeWaitForSingleObject(&ctx.completed, Executive, KernelMode, false, nullptr)));
+        }
 }
 
+/*
+ * Devices are attached simultaneously, but no more than policy.max_inflight at once.
+ * Each host has its own backoff, healthy hosts are not delayed by hosts that are down.
+ */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED void plugin_persistent_devices(_In_ vhci_ctx &ctx)
+PAGED void run(_Inout_ attach_ctx &ctx, _In_ WDFKEY key)
+{
+        PAGED_CODE();
+
+        while (true) {
+                process_completed(ctx);
+                start_ready(ctx);
+
+                auto timeout = get_timeout(ctx);
+                if (!(timeout || ctx.inflight)) {
+                        break; // all done
+                }
+
+                auto when = make_timeout(timeout, wdm::period::relative);
+                void* objects[] { &ctx.vhci.attach_thread_stop, &ctx.completed };
+
+                switch (auto st = KeWaitForMultipleObjects(ARRAYSIZE(objects), objects, WaitAny, Executive, KernelMode, 
+                                                           false, timeout ? &when : nullptr, nullptr)) {
+                case STATUS_WAIT_0:
+                        TraceDbg("thread stop requested");
+                        cancel_inflight(ctx);
+                        wait_inflight(ctx);
+                        return;
+                case STATUS_WAIT_1:
+                        break;
+                case STATUS_TIMEOUT:
+                        if (!refresh(ctx, key)) {
+                                wait_inflight(ctx);
+                                return;
+                        }
+                        break;
+                default:
+                        Trace(TRACE_LEVEL_ERROR, "KeWaitForMultipleObjects %!STATUS!", st);
+                        cancel_inflight(ctx);
+                        wait_inflight(ctx);
+                        return;
+                }
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void plugin_persistent_devices(_In_ vhci_ctx &vhci)
 {
         PAGED_CODE();
 
@@ -271,56 +491,43 @@ PAGED void plugin_persistent_devices(_In_ vhci_ctx &ctx)
         }
 
         auto devices = get_persistent_devices(key.get());
-        if (!(devices && WdfCollectionGetCount(devices.get<WDFCOLLECTION>()))) {
+        if (!devices) {
                 return;
         }
 
-        auto vhci = get_handle(&ctx);
-
-        auto target = make_target(vhci);
-        if (!target) {
+        auto cnt = static_cast<ULONG>(min(WdfCollectionGetCount(devices.get<WDFCOLLECTION>()), ULONG(vhci.total_ports)));
+        if (!cnt) {
                 return;
         }
 
-        vhci::ioctl::plugin_hardware req{{ .size = sizeof(req) }};
-
-        WDF_MEMORY_DESCRIPTOR input;
-        WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(&input, &req, sizeof(req));
-
-        constexpr auto outlen = offsetof(vhci::ioctl::plugin_hardware, port) + sizeof(req.port);
+        ObjectDelete target;
+        if (auto err = make_self_target(target, get_handle(&vhci))) {
+                return;
+        }
 
-        WDF_MEMORY_DESCRIPTOR output;
-        WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(&output, &req, outlen);
+        unique_ptr buf(NonPagedPoolNx, cnt*(sizeof(attach_item) + sizeof(attach_policy::host_state)));
+        if (!buf) {
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate memory for %lu device(s)", cnt);
+                return;
+        }
 
-        for (ULONG attempt = 0; true; ++attempt) {
+        auto items = buf.get<attach_item>();
 
-                auto cnt = get_count(devices.get<WDFCOLLECTION>(), key.get(), attempt);
-                if (!cnt) {
-                        break;
-                }
+        attach_ctx ctx {
+                .vhci = vhci,
+                .target = target.get<WDFIOTARGET>(),
+                .items = items,
+                .item_cnt = cnt,
+                .hosts = reinterpret_cast<attach_policy::host_state*>(items + cnt),
+                .seed = static_cast<ULONG>(KeQueryInterruptTime()),
+        };
 
-                if (auto secs = get_delay(attempt, cnt)) {
-                        TraceDbg("attempt #%lu, %lu device(s), sleep %lu sec.", attempt, cnt, secs);
-                        if (!sleep(ctx, secs)) {
-                                break;
-                        }
-                }
+        KeInitializeEvent(&ctx.completed, SynchronizationEvent, false);
 
-                for (ULONG i = 0; i < cnt && sleep(ctx, 0); ) {
-                        UNICODE_STRING str{};
-                        if (auto s = (WDFSTRING)WdfCollectionGetItem(devices.get<WDFCOLLECTION>(), i)) {
-                                WdfStringGetUnicodeString(s, &str);
-                        }
+        init_items(ctx, devices.get<WDFCOLLECTION>());
+        TraceDbg("%lu device(s), %lu host(s)", ctx.item_cnt, ctx.host_cnt);
 
-                        if (plugin_hardware(str, target.get<WDFIOTARGET>(), req, input, output, outlen)) {
-                                TraceDbg("exclude %!USTR!", &str);
-                                WdfCollectionRemoveItem(devices.get<WDFCOLLECTION>(), i);
-                                --cnt;
-                        } else {
-                                ++i;
-                        }
-                }
-        }
+        run(ctx, key.get());
 }
 
 /*
@@ -418,3 +625,31 @@ PAGED NTSTATUS usbip::open_parameters_key(_Out_ Registry &key, _In_ ACCESS_MASK
         key.reset(k);
         return st;
 }
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::make_self_target(_Out_ ObjectDelete &target, _In_ WDFDEVICE vhci)
+{
+        PAGED_CODE();
+        target.reset();
+
+        if (WDFIOTARGET t; auto err = WdfIoTargetCreate(vhci, WDF_NO_OBJECT_ATTRIBUTES, &t)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfIoTargetCreate %!STATUS!", err);
+                return err;
+        } else {
+                target.reset(t);
+        }
+
+        auto fdo = WdfDeviceWdmGetDeviceObject(vhci);
+
+        WDF_IO_TARGET_OPEN_PARAMS params;
+        WDF_IO_TARGET_OPEN_PARAMS_INIT_EXISTING_DEVICE(&params, fdo);
+
+        if (auto err = WdfIoTargetOpen(target.get<WDFIOTARGET>(), &params)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfIoTargetOpen %!STATUS!", err);
+                target.reset();
+                return err;
+        }
+
+        return STATUS_SUCCESS;
+}
@@ -24,6 +24,13 @@ PAGED NTSTATUS copy(
         _Out_ char *service, _In_ USHORT service_sz, _In_ const UNICODE_STRING &uservice,
         _Out_ char *busid, _In_ USHORT busid_sz, _In_ const UNICODE_STRING &ubusid);
 
+/*
+ * Creates I/O target of vhci itself, IOCTLs sent to it are dispatched by its queues.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS make_self_target(_Out_ ObjectDelete &target, _In_ WDFDEVICE vhci);
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED void plugin_persistent_devices(_In_ vhci_ctx *vhci);
@@ -0,0 +1,394 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "plugin_batch.h"
+#include "trace.h"
+#include "plugin_batch.tmh"
+
+#include "context.h"
+#include "driver.h"
+#include "persistent.h"
+#include "batch_policy.h"
+
+#include <usbip\vhci.h>
+#include <resources/messages.h>
+
+namespace
+{
+
+using namespace usbip;
+
+constexpr ULONG default_max_inflight = 4; // as for persistent devices
+
+constexpr auto outlen = offsetof(vhci::ioctl::plugin_hardware, port) + sizeof(vhci::ioctl::plugin_hardware::port);
+
+/*
+ * Device of the batch, it is attached by PLUGIN_HARDWARE that is sent to itself.
+ */
+struct batch_item
+{
+        vhci::ioctl::plugin_hardware req;
+        WDFWORKITEM wi;
+
+        WDFREQUEST request; // is being attached if not NULL
+        NTSTATUS status;
+        LONG completed;
+};
+
+struct batch_ctx
+{
+        WDFREQUEST request; // PLUGIN_HARDWARE_BATCH
+        vhci::ioctl::plugin_hardware_batch *batch; // its buffer, the results are written to it
+
+        WDFIOTARGET target;
+        batch_item *items;
+        batch_policy::entry *entries;
+        ULONG count;
+
+        ULONG max_inflight;
+        ULONG inflight; // requests
+        ULONG done; // entries
+
+        LONG signals; // not processed yet, the workitem is queued or running if not zero
+        ULONG expected; // signals, one for the start and one for each request that was sent
+        ULONG received; // signals
+};
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(batch_ctx, get_batch_ctx)
+
+/*
+ * Other devices of the same host and service will fail the same way, there is no need to wait for them.
+ * Failed name resolution is not listed, it is cached, see lookup_addrinfo.
+ */
+constexpr auto is_host_error(_In_ NTSTATUS status)
+{
+        switch (status) {
+        case STATUS_CONNECTION_REFUSED:
+        case STATUS_HOST_UNREACHABLE:
+        case STATUS_NETWORK_UNREACHABLE:
+        case STATUS_PORT_UNREACHABLE:
+        case STATUS_IO_TIMEOUT:
+                return true;
+        default:
+                return false;
+        }
+}
+
+/*
+ * Item is owned by the workitem, the completion routine only sets the flag and signals.
+ */
+_Function_class_(EVT_WDF_REQUEST_COMPLETION_ROUTINE)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void on_plugin_complete(
+        _In_ WDFREQUEST, _In_ WDFIOTARGET, _In_ WDF_REQUEST_COMPLETION_PARAMS *params, _In_ WDFCONTEXT context)
+{
+        auto &r = *static_cast<batch_item*>(context);
+        auto &st = params->IoStatus;
+
+        r.status = st.Status;
+        NT_ASSERT(!NT_SUCCESS(st.Status) || st.Information == outlen);
+
+        InterlockedExchange(&r.completed, true);
+
+        if (auto wi = r.wi; InterlockedIncrement(&get_batch_ctx(wi)->signals) == 1) {
+                WdfWorkItemEnqueue(wi);
+        }
+}
+
+/*
+ * Send IOCTL to itself, it is dispatched by the parallel queue, see device_control_parallel.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto send_plugin_hardware(_Inout_ batch_ctx &ctx, _Inout_ batch_item &r)
+{
+        PAGED_CODE();
+        Trace(TRACE_LEVEL_INFORMATION, "%s:%s/%s", r.req.host, r.req.service, r.req.busid);
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = ctx.target;
+
+        ObjectDelete request;
+
+        if (WDFREQUEST h; auto err = WdfRequestCreate(&attr, ctx.target, &h)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfRequestCreate %!STATUS!", err);
+                return err;
+        } else {
+                request.reset(h);
+        }
+
+        attr.ParentObject = request.get();
+
+        WDFMEMORY mem;
+        if (auto err = WdfMemoryCreatePreallocated(&attr, &r.req, sizeof(r.req), &mem)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfMemoryCreatePreallocated %!STATUS!", err);
+                return err;
+        }
+
+        WDFMEMORY_OFFSET output{ .BufferLength = outlen };
+
+        if (auto err = WdfIoTargetFormatRequestForIoctl(ctx.target, request.get<WDFREQUEST>(),
+                                                        vhci::ioctl::PLUGIN_HARDWARE, mem, nullptr, mem, &output)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfIoTargetFormatRequestForIoctl %!STATUS!", err);
+                return err;
+        }
+
+        WdfRequestSetCompletionRoutine(request.get<WDFREQUEST>(), on_plugin_complete, &r);
+        r.completed = false;
+
+        if (!WdfRequestSend(request.get<WDFREQUEST>(), ctx.target, WDF_NO_SEND_OPTIONS)) {
+                auto err = WdfRequestGetStatus(request.get<WDFREQUEST>());
+                Trace(TRACE_LEVEL_ERROR, "WdfRequestSend %!STATUS!", err);
+                return err;
+        }
+
+        r.request = static_cast<WDFREQUEST>(request.release());
+        ++ctx.inflight;
+        ++ctx.expected;
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void on_result(_Inout_ batch_ctx &ctx, _In_ ULONG idx, _In_ NTSTATUS status)
+{
+        PAGED_CODE();
+
+        auto &e = ctx.batch->entries[idx];
+        e.status = status;
+        e.port = NT_SUCCESS(status) ? ctx.items[idx].req.port : 0;
+
+        TraceDbg("#%lu %s:%s/%s, port %d, %!STATUS!", idx, e.host, e.service, e.busid, e.port, status);
+
+        ctx.entries[idx].state = batch_policy::state::done;
+        ++ctx.done;
+
+        if (NT_SUCCESS(status) || !batch_policy::is_leader(ctx.entries, idx) || !is_host_error(status)) {
+                return;
+        }
+
+        ctx.done += batch_policy::skip_group(ctx.entries, ctx.count, idx, [&ctx, status] (auto i)
+        {
+                auto &r = ctx.batch->entries[i];
+                r.status = status;
+                r.port = 0;
+        });
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void process_completed(_Inout_ batch_ctx &ctx)
+{
+        PAGED_CODE();
+
+        for (ULONG i = 0; i < ctx.count; ++i) {
+                if (auto &r = ctx.items[i]; r.request && InterlockedCompareExchange(&r.completed, false, false)) {
+                        WdfObjectDelete(r.request);
+                        r.request = WDF_NO_HANDLE;
+                        --ctx.inflight;
+                        on_result(ctx, i, r.status);
+                }
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void start_ready(_Inout_ batch_ctx &ctx)
+{
+        PAGED_CODE();
+
+        for (ULONG i; (i = batch_policy::next(ctx.entries, ctx.count, ctx.inflight, ctx.max_inflight)) != ctx.count; ) {
+                ctx.entries[i].state = batch_policy::state::inflight;
+
+                if (auto err = send_plugin_hardware(ctx, ctx.items[i])) {
+                        on_result(ctx, i, err);
+                }
+        }
+}
+
+/*
+ * Only one instance runs at a time, it owns the batch while ctx.signals is not zero.
+ * The flag can be seen before the completion routine signals, so the batch is completed
+ * when all the signals are received, otherwise the workitem could be queued after its deletion.
+ */
+_Function_class_(EVT_WDF_WORKITEM)
+_IRQL_requires_same_
+_IRQL_requires_max_(PASSIVE_LEVEL)
+PAGED void NTAPI run(_In_ WDFWORKITEM wi)
+{
+        PAGED_CODE();
+        auto &ctx = *get_batch_ctx(wi);
+
+        bool done{}; // must be evaluated by the owner, the next instance can be already running after the loop
+
+        for (auto n = InterlockedCompareExchange(&ctx.signals, 0, 0); n; n = InterlockedAdd(&ctx.signals, -n)) {
+                ctx.received += n;
+
+                process_completed(ctx);
+                start_ready(ctx);
+
+                done = ctx.done == ctx.count && ctx.received == ctx.expected;
+        }
+
+        if (done) {
+                NT_ASSERT(!ctx.inflight);
+                TraceDbg("req %04x, %lu device(s) done", ptr04x(ctx.request), ctx.count);
+
+                WdfRequestComplete(ctx.request, STATUS_SUCCESS);
+                WdfObjectDelete(wi); // do not use ctx more, see batch_cleanup
+        }
+}
+
+_Function_class_(EVT_WDF_OBJECT_CONTEXT_CLEANUP)
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void batch_cleanup(_In_ WDFOBJECT obj)
+{
+        PAGED_CODE();
+        auto &ctx = *get_batch_ctx(obj);
+
+        if (auto &t = ctx.target) {
+                WdfObjectDelete(t); // requests are its children
+                t = WDF_NO_HANDLE;
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto create_workitem(_Out_ WDFWORKITEM &wi, _In_ WDFOBJECT parent)
+{
+        PAGED_CODE();
+
+        WDF_WORKITEM_CONFIG cfg;
+        WDF_WORKITEM_CONFIG_INIT(&cfg, run);
+        cfg.AutomaticSerialization = false;
+
+        WDF_OBJECT_ATTRIBUTES attr; // WdfSynchronizationScopeNone is inherited from the driver object
+        WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attr, batch_ctx);
+
+        attr.EvtCleanupCallback = batch_cleanup;
+        attr.ParentObject = parent;
+
+        return WdfWorkItemCreate(&cfg, &attr, &wi);
+}
+
+/*
+ * The memory is released with the workitem.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto init_items(_Inout_ batch_ctx &ctx, _In_ WDFWORKITEM wi)
+{
+        PAGED_CODE();
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = wi;
+
+        auto size = ctx.count*(sizeof(*ctx.items) + sizeof(*ctx.entries)); // items are aligned stricter
+
+        WDFMEMORY mem;
+        PVOID buf{};
+
+        if (auto err = WdfMemoryCreate(&attr, NonPagedPoolNx, pooltag, size, &mem, &buf)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfMemoryCreate(%Iu) %!STATUS!", size, err);
+                return err;
+        }
+        RtlZeroMemory(buf, size);
+
+        ctx.items = static_cast<batch_item*>(buf);
+        ctx.entries = reinterpret_cast<batch_policy::entry*>(ctx.items + ctx.count);
+
+        for (ULONG i = 0; i < ctx.count; ++i) {
+                auto &e = ctx.batch->entries[i];
+                e.port = 0;
+                e.status = STATUS_PENDING;
+
+                auto &r = ctx.items[i];
+                r.wi = wi;
+
+                static_cast<vhci::imported_device_location&>(r.req) = e;
+                r.req.size = sizeof(r.req);
+        }
+
+        auto groups = batch_policy::make_groups(ctx.entries, ctx.count, [&ctx] (auto i, auto j)
+        {
+                auto &a = ctx.batch->entries[i];
+                auto &b = ctx.batch->entries[j];
+
+                return !_strnicmp(a.host, b.host, sizeof(a.host)) && !strncmp(a.service, b.service, sizeof(a.service));
+        });
+
+        TraceDbg("%lu device(s), %lu host(s), max_inflight %lu", ctx.count, groups, ctx.max_inflight);
+        return STATUS_SUCCESS;
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::plugin_hardware_batch(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        WdfRequestSetInformation(request, 0);
+
+        vhci::ioctl::plugin_hardware_batch *r{};
+        size_t length{};
+
+        if (auto err = WdfRequestRetrieveInputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &length)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "plugin_hardware_batch.size %lu != sizeof(plugin_hardware_batch) %Iu",
+                                          r->size, sizeof(*r));
+
+                return USBIP_ERROR_ABI;
+        } else if (!r->count || length != vhci::ioctl::plugin_hardware_batch_size(r->count)) {
+                return STATUS_INVALID_BUFFER_SIZE;
+        } else if (PVOID out; auto err = WdfRequestRetrieveOutputBuffer(request, length, &out, nullptr)) {
+                return err; // METHOD_BUFFERED, the same buffer
+        }
+
+        auto vhci = get_vhci(request);
+
+        if (auto total_ports = ULONG(get_vhci_ctx(vhci)->total_ports); r->count > total_ports) {
+                Trace(TRACE_LEVEL_ERROR, "%lu device(s), total ports %lu", r->count, total_ports);
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        WDFWORKITEM wi{};
+        if (auto err = create_workitem(wi, vhci)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfWorkItemCreate %!STATUS!", err);
+                return err;
+        }
+
+        auto &ctx = *get_batch_ctx(wi);
+
+        ctx.request = request;
+        ctx.batch = r;
+        ctx.count = r->count;
+        ctx.max_inflight = min(r->max_inflight ? r->max_inflight : default_max_inflight, ctx.count);
+
+        if (auto err = init_items(ctx, wi)) {
+                WdfObjectDelete(wi);
+                return err;
+        }
+
+        if (ObjectDelete target; auto err = make_self_target(target, vhci)) {
+                WdfObjectDelete(wi);
+                return err;
+        } else {
+                ctx.target = static_cast<WDFIOTARGET>(target.release());
+        }
+
+        WdfRequestSetInformation(request, length);
+
+        ctx.signals = 1; // the workitem starts the first requests
+        ctx.expected = 1;
+        WdfWorkItemEnqueue(wi);
+
+        return STATUS_PENDING;
+}
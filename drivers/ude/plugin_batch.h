@@ -0,0 +1,21 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <libdrv\codeseg.h>
+#include <libdrv\wdf_cpp.h>
+
+namespace usbip
+{
+
+/*
+ * PLUGIN_HARDWARE_BATCH, see vhci::ioctl::plugin_hardware_batch.
+ * @return STATUS_PENDING if the request will be completed later
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS plugin_hardware_batch(_In_ WDFREQUEST request);
+
+} // namespace usbip
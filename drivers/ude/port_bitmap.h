@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
+/*
+ * Lock-free allocator of roothub ports, see vhci::claim_roothub_port.
+ * It does not depend on WDK and can be used in user mode as is.
+ * Zero-initialized object has all bits free.
+ */
+namespace usbip
+{
+
+template<unsigned int Bits>
+class port_bitmap
+{
+public:
+        enum { BITS = Bits };
+
+        /*
+         * Find the first zero bit in [begin, end) and set it.
+         * @return index of the bit or -1 if all bits in the range are set
+         */
+        int claim(int begin, int end);
+
+        /*
+         * @return false if the bit was not set
+         */
+        bool release(int idx);
+
+        bool test(int idx) const;
+
+private:
+        using word_type = unsigned long long;
+        enum { WORD_BITS = 8*sizeof(word_type), WORDS = (Bits + WORD_BITS - 1)/WORD_BITS };
+
+        volatile word_type m_words[WORDS];
+
+        static word_type load(const volatile word_type &w);
+        static bool cas(volatile word_type &w, word_type expected, word_type desired);
+        static word_type fetch_and(volatile word_type &w, word_type mask);
+        static int find_first_set(word_type w); // w must not be zero
+
+        static auto bit(int idx) { return word_type(1) << (idx % WORD_BITS); }
+};
+
+template<unsigned int Bits>
+inline auto port_bitmap<Bits>::load(const volatile word_type &w) -> word_type
+{
+#ifdef _MSC_VER
+        return w;
+#else
+        return __atomic_load_n(&w, __ATOMIC_RELAXED);
+#endif
+}
+
+template<unsigned int Bits>
+inline bool port_bitmap<Bits>::cas(volatile word_type &w, word_type expected, word_type desired)
+{
+#ifdef _MSC_VER
+        auto p = reinterpret_cast<volatile __int64*>(&w);
+        return _InterlockedCompareExchange64(p, __int64(desired), __int64(expected)) == __int64(expected);
+#else
+        return __atomic_compare_exchange_n(&w, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+#endif
+}
+
+template<unsigned int Bits>
+inline auto port_bitmap<Bits>::fetch_and(volatile word_type &w, word_type mask) -> word_type
+{
+#ifdef _MSC_VER
+        return word_type(_InterlockedAnd64(reinterpret_cast<volatile __int64*>(&w), __int64(mask)));
+#else
+        return __atomic_fetch_and(&w, mask, __ATOMIC_ACQ_REL);
+#endif
+}
+
+template<unsigned int Bits>
+inline int port_bitmap<Bits>::find_first_set(word_type w)
+{
+#ifdef _MSC_VER
+        unsigned long idx;
+        _BitScanForward64(&idx, w);
+        return int(idx);
+#else
+        return __builtin_ctzll(w);
+#endif
+}
+
+/*
+ * A stale word causes CAS to fail, the word is reread in such case.
+ */
+template<unsigned int Bits>
+int port_bitmap<Bits>::claim(int begin, int end)
+{
+        if (begin < 0) {
+                begin = 0;
+        }
+
+        if (end > int(Bits)) {
+                end = Bits;
+        }
+
+        for (auto i = begin; i < end; ) {
+                auto widx = i/WORD_BITS;
+                auto base = widx*WORD_BITS;
+
+                auto mask = ~word_type() << (i - base); // bits >= i
+                if (auto hi = end - base; hi < WORD_BITS) {
+                        mask &= bit(hi) - 1; // bits < end
+                }
+
+                auto &w = m_words[widx];
+                auto val = load(w);
+
+                if (auto free = ~val & mask) {
+                        auto idx = find_first_set(free);
+                        if (cas(w, val, val | bit(idx))) {
+                                return base + idx;
+                        }
+                } else {
+                        i = base + WORD_BITS;
+                }
+        }
+
+        return -1;
+}
+
+template<unsigned int Bits>
+bool port_bitmap<Bits>::release(int idx)
+{
+        if (idx < 0 || idx >= int(Bits)) {
+                return false;
+        }
+
+        auto b = bit(idx);
+        return fetch_and(m_words[idx/WORD_BITS], ~b) & b;
+}
+
+template<unsigned int Bits>
+bool port_bitmap<Bits>::test(int idx) const
+{
+        return idx >= 0 && idx < int(Bits) && (load(m_words[idx/WORD_BITS]) & bit(idx));
+}
+
+} // namespace usbip
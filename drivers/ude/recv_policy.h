@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Scheduling policy of receive threads, see recv_thread_function.
+ * It does not depend on WDK and can be used in user mode as is.
+ */
+namespace usbip::recv_policy
+{
+
+/*
+ * Zero-initialized value is normal.
+ */
+enum class level : unsigned char { normal, above_normal, high };
+enum { LEVELS = 3 };
+
+/*
+ * Thread priorities, LOW_REALTIME_PRIORITY is 16.
+ * The default priority of a system thread is 8.
+ */
+enum { MIN_PRIORITY = 1, MAX_PRIORITY = 31 };
+constexpr int default_priority[LEVELS] { 8, 12, 16 };
+
+/*
+ * @return priority or def if val is out of range
+ */
+constexpr int get_priority(unsigned long val, int def)
+{
+        return val >= MIN_PRIORITY && val <= MAX_PRIORITY ? static_cast<int>(val) : def;
+}
+
+/*
+ * Latency-sensitive classes get higher level, bulk classes (f.e. mass storage) are normal.
+ * @param cls bInterfaceClass
+ */
+constexpr level get_level(int cls, int subclass, [[maybe_unused]] int proto)
+{
+        switch (cls) {
+        case 0x01: // audio
+        case 0x03: // HID
+        case 0x0E: // video
+        case 0x10: // audio/video
+                return level::high;
+        case 0x02: // communications
+        case 0x0A: // CDC-data
+        case 0xE0: // wireless controller
+                return level::above_normal;
+        case 0xEF: // miscellaneous
+                return subclass == 4 ? level::above_normal : level::normal; // RNDIS over XXX
+        }
+
+        return level::normal;
+}
+
+constexpr auto max(level a, level b) { return a < b ? b : a; }
+
+/*
+ * Levels of the selected interfaces of a device, zero-initialized value is normal for each of them.
+ * The level of a device is recomputed on every selection, so it goes down
+ * if a latency-sensitive interface is no longer selected.
+ */
+class interface_levels
+{
+public:
+        /*
+         * A configuration is selected, the interfaces of the previous one are not.
+         */
+        constexpr void clear()
+        {
+                for (auto &l: m_levels) {
+                        l = level::normal;
+                }
+        }
+
+        /*
+         * An interface or its alternate setting is selected.
+         * @param num bInterfaceNumber
+         * @return the highest level of the selected interfaces
+         */
+        constexpr level set(unsigned char num, level lvl)
+        {
+                m_levels[num] = lvl;
+                return get();
+        }
+
+        constexpr level get() const
+        {
+                auto ret = level::normal;
+                for (auto l: m_levels) {
+                        ret = max(ret, l);
+                }
+                return ret;
+        }
+
+private:
+        level m_levels[256]{}; // by bInterfaceNumber
+};
+
+struct cpu
+{
+        unsigned int node; // NUMA
+        unsigned int index; // of the processor within the node
+};
+
+/*
+ * Spreads receive threads across NUMA nodes first and then across the processors of a node,
+ * so adjacent threads do not share a processor while there are free ones.
+ * Nodes without processors are skipped.
+ *
+ * @param seq of the thread, zero-based
+ * @param cpus the number of processors of each node
+ * @return {0, 0} if there are no processors
+ */
+constexpr cpu get_ideal_processor(unsigned int seq, const unsigned int *cpus, unsigned int nodes)
+{
+        unsigned int used = 0; // nodes with processors
+        for (unsigned int i = 0; i < nodes; ++i) {
+                used += !!cpus[i];
+        }
+
+        if (!used) {
+                return {};
+        }
+
+        auto nth = seq % used;
+
+        for (unsigned int i = 0; i < nodes; ++i) {
+                if (!cpus[i]) {
+                        continue;
+                } else if (!nth--) {
+                        return { i, (seq / used) % cpus[i] };
+                }
+        }
+
+        return {};
+}
+
+/*
+ * @return index of n-th (zero-based) set bit or -1
+ */
+constexpr int nth_set_bit(unsigned long long mask, unsigned int n)
+{
+        for (int i = 0; mask; ++i, mask >>= 1) {
+                if ((mask & 1) && !n--) {
+                        return i;
+                }
+        }
+
+        return -1;
+}
+
+constexpr unsigned int popcount(unsigned long long mask)
+{
+        unsigned int cnt = 0;
+        for ( ; mask; mask &= mask - 1, ++cnt);
+        return cnt;
+}
+
+} // namespace usbip::recv_policy
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Transfers of a device that are waiting to be sent, see device_ctx::pending.
+ * It does not depend on WDK and can be used in user mode as is. It is not thread-safe.
+ * Zero-initialized object is an empty queue.
+ *
+ * The transfer of the highest priority is sent first, transfers of the same priority are sent in FIFO order.
+ * The oldest transfer of lower priority is sent first if it waits for longer than max_wait,
+ * so a steady stream of higher priority cannot starve it.
+ */
+namespace usbip
+{
+
+struct send_queue_entry
+{
+        send_queue_entry *next;
+        unsigned long long time; // when it was queued
+        unsigned int priority; // zero is the highest
+};
+
+template<unsigned int Priorities>
+class send_queue
+{
+public:
+        static_assert(Priorities && Priorities <= 32);
+        enum { PRIORITIES = Priorities };
+
+        bool empty() const { return !m_size; }
+        auto size() const { return m_size; }
+
+        void push(send_queue_entry &e, unsigned int priority, unsigned long long now);
+
+        /*
+         * @param skip bit (priority) is set if such transfers can't be sent now
+         * @return transfer to send next, nullptr if there is no one
+         */
+        send_queue_entry* front(unsigned long long now, unsigned long long max_wait, unsigned int skip = 0) const;
+
+        /*
+         * @param e must be returned by front()
+         */
+        void pop(send_queue_entry &e);
+
+        /*
+         * @param pred(const send_queue_entry&)
+         * @return the first transfer for which pred returns true, it is removed; nullptr if there is no one
+         */
+        template<typename Pred>
+        send_queue_entry* remove(Pred &&pred);
+
+private:
+        struct fifo
+        {
+                send_queue_entry *head;
+                send_queue_entry *tail;
+        };
+
+        fifo m_queues[Priorities];
+        unsigned int m_size;
+};
+
+template<unsigned int Priorities>
+void send_queue<Priorities>::push(send_queue_entry &e, unsigned int priority, unsigned long long now)
+{
+        if (priority >= Priorities) {
+                priority = Priorities - 1;
+        }
+
+        e = { nullptr, now, priority };
+        auto &q = m_queues[priority];
+
+        if (q.tail) {
+                q.tail->next = &e;
+        } else {
+                q.head = &e;
+        }
+
+        q.tail = &e;
+        ++m_size;
+}
+
+template<unsigned int Priorities>
+send_queue_entry* send_queue<Priorities>::front(
+        unsigned long long now, unsigned long long max_wait, unsigned int skip) const
+{
+        send_queue_entry *highest{};
+        send_queue_entry *starving{};
+
+        for (unsigned int i = 0; i < Priorities; ++i) {
+
+                auto e = m_queues[i].head;
+                if (!e || (skip & (1U << i))) {
+                        continue;
+                }
+
+                if (!highest) {
+                        highest = e;
+                } else if (now > e->time + max_wait && (!starving || e->time < starving->time)) {
+                        starving = e;
+                }
+        }
+
+        return starving ? starving : highest;
+}
+
+template<unsigned int Priorities>
+void send_queue<Priorities>::pop(send_queue_entry &e)
+{
+        auto &q = m_queues[e.priority];
+
+        if (!(q.head = e.next)) {
+                q.tail = nullptr;
+        }
+
+        e.next = nullptr;
+        --m_size;
+}
+
+template<unsigned int Priorities>
+template<typename Pred>
+send_queue_entry* send_queue<Priorities>::remove(Pred &&pred)
+{
+        for (auto &q: m_queues) {
+
+                send_queue_entry *prev{};
+
+                for (auto e = q.head; e; prev = e, e = e->next) {
+
+                        if (!pred(static_cast<const send_queue_entry&>(*e))) {
+                                continue;
+                        }
+
+                        (prev ? prev->next : q.head) = e->next;
+
+                        if (q.tail == e) {
+                                q.tail = prev;
+                        }
+
+                        e->next = nullptr;
+                        --m_size;
+
+                        return e;
+                }
+        }
+
+        return nullptr;
+}
+
+} // namespace usbip
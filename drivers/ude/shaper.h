@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Token bucket that limits the send rate of a device, see device_ctx::shaper.
+ * It does not depend on WDK and can be used in user mode as is. It is not thread-safe.
+ *
+ * Only bulk transfers wait for tokens. Transfers of higher priority are sent at once
+ * and borrow the tokens, thereby bulk transfers yield the bandwidth to them.
+ */
+namespace usbip::shaper
+{
+
+/*
+ * In descending order.
+ */
+enum class priority { isoch, interrupt, control, bulk };
+enum { PRIORITIES = 4 };
+
+/*
+ * @param type USBD_PIPE_TYPE, the same as bmAttributes & USB_ENDPOINT_TYPE_MASK
+ */
+constexpr priority get_priority(int type)
+{
+        switch (type) {
+        case 1: // UsbdPipeTypeIsochronous
+                return priority::isoch;
+        case 2: // UsbdPipeTypeBulk
+                return priority::bulk;
+        case 3: // UsbdPipeTypeInterrupt
+                return priority::interrupt;
+        }
+
+        return priority::control;
+}
+
+/*
+ * Units of time, as for KeQueryInterruptTime.
+ */
+enum : unsigned long long { UNITS_PER_SECOND = 10'000'000 };
+
+/*
+ * Zero-initialized object does not limit the rate.
+ */
+struct token_bucket
+{
+        unsigned long long rate; // bytes per second, zero if unlimited
+        unsigned long long burst; // bytes, the capacity
+        long long tokens; // bytes, negative if borrowed
+        unsigned long long time; // of the last refill
+};
+
+/*
+ * @param burst zero selects the amount of 100 ms, but not less than 64KiB
+ */
+constexpr void set_rate(token_bucket &b, unsigned long long rate, unsigned long long burst, unsigned long long now)
+{
+        if (!rate) {
+                b = {};
+                return;
+        }
+
+        if (!burst) {
+                burst = rate/10;
+                if (enum { MIN_BURST = 64*1024 }; burst < MIN_BURST) {
+                        burst = MIN_BURST;
+                }
+        }
+
+        b = { rate, burst, static_cast<long long>(burst), now };
+}
+
+/*
+ * A fraction of a token is not lost, the time is advanced by the amount of added tokens only.
+ */
+constexpr void refill(token_bucket &b, unsigned long long now)
+{
+        if (!b.rate || now <= b.time) {
+                return;
+        }
+
+        auto elapsed = now - b.time;
+        if (auto max_elapsed = 100*UNITS_PER_SECOND; elapsed > max_elapsed) { // elapsed*rate must not overflow
+                elapsed = max_elapsed;
+        }
+
+        auto add = elapsed*b.rate/UNITS_PER_SECOND;
+        if (!add) {
+                return;
+        }
+
+        auto room = static_cast<long long>(b.burst) - b.tokens;
+
+        if (static_cast<long long>(add) >= room) {
+                b.tokens = static_cast<long long>(b.burst);
+                b.time = now;
+        } else {
+                b.tokens += static_cast<long long>(add);
+                b.time += add*UNITS_PER_SECOND/b.rate;
+        }
+}
+
+/*
+ * Bulk transfer is sent if there are tokens, it can take more tokens than available.
+ * The debt of transfers of higher priority is limited by the capacity,
+ * so bulk transfers resume in burst/rate at most after such load is gone.
+ *
+ * @param len of data to send
+ * @return false if bulk transfer must wait, see get_delay
+ */
+constexpr bool consume(token_bucket &b, unsigned long long len, priority prio, unsigned long long now)
+{
+        if (!b.rate) {
+                return true;
+        }
+
+        refill(b, now);
+
+        if (prio == priority::bulk) {
+                if (b.tokens <= 0) {
+                        return false;
+                }
+                b.tokens -= static_cast<long long>(len);
+        } else if (auto min_tokens = -static_cast<long long>(b.burst); b.tokens > min_tokens) {
+                b.tokens -= static_cast<long long>(len);
+                if (b.tokens < min_tokens) {
+                        b.tokens = min_tokens;
+                }
+        }
+
+        return true;
+}
+
+/*
+ * @return time to wait until bulk transfer can be sent, zero if it can be sent now
+ */
+constexpr unsigned long long get_delay(token_bucket &b, unsigned long long now)
+{
+        refill(b, now);
+
+        if (!b.rate || b.tokens > 0) {
+                return 0;
+        }
+
+        auto need = static_cast<unsigned long long>(1 - b.tokens);
+        auto when = b.time + (need*UNITS_PER_SECOND + b.rate - 1)/b.rate;
+
+        return when > now ? when - now : 1;
+}
+
+} // namespace usbip::shaper
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Lifecycle of the detach of a device, see device_ctx::teardown.
+ * It does not depend on WDK and can be used in user mode as is.
+ * Units of time are defined by the caller, they must be the same for all arguments.
+ * Zero time means that the event has not occurred yet, so "now" must not be zero.
+ */
+namespace usbip::teardown
+{
+
+using time_type = unsigned long long;
+
+enum class state { attached, detaching, detached };
+
+struct times
+{
+        time_type started; // detach was initiated
+        time_type finished; // detach_completed is signaled
+};
+
+constexpr auto get_state(const times &t)
+{
+        return !t.started ? state::attached :
+               !t.finished ? state::detaching : state::detached;
+}
+
+/*
+ * @return false if detach was already initiated
+ */
+constexpr auto on_start(times &t, time_type now)
+{
+        if (t.started) {
+                return false;
+        }
+
+        t.started = now;
+        return true;
+}
+
+constexpr void on_finish(times &t, time_type now)
+{
+        if (!t.started) { // detach was not initiated by on_start
+                t.started = now;
+        }
+
+        if (!t.finished) {
+                t.finished = now;
+        }
+}
+
+/*
+ * @return elapsed time if detach is still ongoing
+ */
+constexpr time_type get_duration(const times &t, time_type now)
+{
+        switch (get_state(t)) {
+        case state::attached:
+                break;
+        case state::detaching:
+                return now > t.started ? now - t.started : 0;
+        case state::detached:
+                return t.finished - t.started;
+        }
+
+        return 0;
+}
+
+/*
+ * @param r record that has members "ms" and "completed"
+ * @param unit the number of units of time in a millisecond
+ * @return false if detach was not initiated
+ */
+template<typename R>
+constexpr bool fill(R &r, const times &t, time_type now, time_type unit)
+{
+        auto st = get_state(t);
+        if (st == state::attached) {
+                return false;
+        }
+
+        r.ms = static_cast<decltype(r.ms)>(get_duration(t, now)/unit);
+        r.completed = st == state::detached;
+
+        return true;
+}
+
+/*
+ * @return the time left till the deadline shared by a batch of detaches
+ */
+constexpr time_type get_remaining(time_type deadline, time_type now)
+{
+        return now < deadline ? deadline - now : 0;
+}
+
+} // namespace usbip::teardown
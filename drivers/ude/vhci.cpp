@@ -6,9 +6,13 @@
 #include "trace.h"
 #include "vhci.tmh"
 
+#include "driver.h"
 #include "device.h"
 #include "vhci_ioctl.h"
 #include "persistent.h"
+#include "addrinfo_cache.h"
+
+#include <usbip\consts.h>
 
 #include <ntstrsafe.h>
 
@@ -92,6 +96,85 @@ PAGED auto create_read_queue(_Out_ WDFQUEUE &queue, _In_ WDF_OBJECT_ATTRIBUTES &
 
 using init_func_t = NTSTATUS(WDFDEVICE);
 
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto get_port_count(_In_ WDFKEY key, _In_ PCWSTR value_name, _In_ int default_value)
+{
+        PAGED_CODE();
+
+        UNICODE_STRING name;
+        RtlUnicodeStringInit(&name, value_name);
+
+        ULONG val = default_value;
+
+        if (!key) {
+                // use default value
+        } else if (auto err = WdfRegistryQueryULong(key, &name, &val)) {
+                if (err != STATUS_OBJECT_NAME_NOT_FOUND) {
+                        Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryULong('%!USTR!') %!STATUS!", &name, err);
+                }
+                val = default_value;
+        } else if (!val || val > MAX_PORTS) {
+                Trace(TRACE_LEVEL_ERROR, "%!USTR! %lu is out of range [1, %d]", &name, val, MAX_PORTS);
+                val = default_value;
+        }
+
+        return static_cast<int>(val);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void init_ports(_Inout_ vhci_ctx &ctx, _In_opt_ WDFKEY key)
+{
+        PAGED_CODE();
+
+        ctx.usb2_ports = get_port_count(key, usb2_ports_value_name, USB2_PORTS);
+        ctx.total_ports = ctx.usb2_ports + get_port_count(key, usb3_ports_value_name, USB3_PORTS);
+
+        Trace(TRACE_LEVEL_INFORMATION, "usb2 ports %d, usb3 ports %d", ctx.usb2_ports, ctx.total_ports - ctx.usb2_ports);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void init_recv_priority(_Inout_ vhci_ctx &ctx, _In_opt_ WDFKEY key)
+{
+        PAGED_CODE();
+        static_assert(recv_policy::default_priority[int(recv_policy::level::high)] == LOW_REALTIME_PRIORITY);
+
+        const PCWSTR names[] {
+                recv_priority_normal_value_name,
+                recv_priority_above_normal_value_name,
+                recv_priority_high_value_name,
+        };
+        static_assert(ARRAYSIZE(names) == recv_policy::LEVELS);
+
+        for (int i = 0; i < recv_policy::LEVELS; ++i) {
+
+                auto def = recv_policy::default_priority[i];
+                ULONG val = def;
+
+                UNICODE_STRING name;
+                RtlUnicodeStringInit(&name, names[i]);
+
+                if (!key) {
+                        // use default value
+                } else if (auto err = WdfRegistryQueryULong(key, &name, &val)) {
+                        if (err != STATUS_OBJECT_NAME_NOT_FOUND) {
+                                Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryULong('%!USTR!') %!STATUS!", &name, err);
+                        }
+                        val = def;
+                } else if (val < recv_policy::MIN_PRIORITY || val > recv_policy::MAX_PRIORITY) {
+                        Trace(TRACE_LEVEL_ERROR, "%!USTR! %lu is out of range [%d, %d]", &name, val, 
+                                                  recv_policy::MIN_PRIORITY, recv_policy::MAX_PRIORITY);
+                }
+
+                ctx.recv_priority[i] = recv_policy::get_priority(val, def);
+        }
+
+        Trace(TRACE_LEVEL_INFORMATION, "priority of receive threads: normal %ld, above normal %ld, high %ld", 
+                ctx.recv_priority[0], ctx.recv_priority[1], ctx.recv_priority[2]);
+}
+
 _Function_class_(init_func_t)
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
@@ -100,6 +183,14 @@ PAGED auto init_context(_In_ WDFDEVICE vhci)
         PAGED_CODE();
         auto &ctx = *get_vhci_ctx(vhci);
 
+        {
+                Registry key;
+                open_parameters_key(key, KEY_QUERY_VALUE); // default values are used on error
+
+                init_ports(ctx, key.get());
+                init_recv_priority(ctx, key.get());
+        }
+
         WDF_OBJECT_ATTRIBUTES attr;
         WDF_OBJECT_ATTRIBUTES_INIT(&attr);
         attr.ParentObject = vhci;
@@ -118,9 +209,17 @@ PAGED auto init_context(_In_ WDFDEVICE vhci)
                 return err;
         }
 
+        if (auto err = init_addrinfo_cache(vhci)) {
+                return err;
+        }
+
         KeInitializeEvent(&ctx.attach_thread_stop, NotificationEvent, false);
         InitializeListHead(&ctx.fileobjects);
 
+        LARGE_INTEGER now;
+        KeQuerySystemTimePrecise(&now);
+        ctx.epoch = now.QuadPart; // not zero, two instances can't be created in the same 100ns interval
+
         return STATUS_SUCCESS;
 }
 
@@ -243,19 +342,6 @@ PAGED NTSTATUS vhci_query_remove(_In_ WDFDEVICE vhci)
         return STATUS_SUCCESS;
 }
 
-_IRQL_requires_same_
-_IRQL_requires_max_(PASSIVE_LEVEL)
-PAGED auto create_collection(_Out_ WDFCOLLECTION &result, _In_ WDFOBJECT parent)
-{
-        PAGED_CODE();
-
-        WDF_OBJECT_ATTRIBUTES attr;
-        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
-        attr.ParentObject = parent;
-
-        return WdfCollectionCreate(&attr, &result);
-}
-
 _Function_class_(EVT_WDF_DEVICE_FILE_CREATE)
 _IRQL_requires_same_
 _IRQL_requires_max_(PASSIVE_LEVEL)
@@ -264,19 +350,15 @@ PAGED void device_file_create(_In_ WDFDEVICE vhci, _In_ WDFREQUEST request, _In_
         PAGED_CODE();
         TraceDbg("vhci %04x, fobj %04x", ptr04x(vhci), ptr04x(fileobj));
 
-        auto &fobj = *get_fileobject_ctx(fileobj);
+        auto &fobj = *get_fileobject_ctx(fileobj); // fileobject_ctx::events is empty
         InitializeListHead(&fobj.entry);
 
-        auto st = create_collection(fobj.events, fileobj);
-
-        if (NT_ERROR(st)) {
-                Trace(TRACE_LEVEL_ERROR, "WdfCollectionCreate %!STATUS!", st);
-        } else if (auto v = get_vhci_ctx(vhci)) {
+        if (auto v = get_vhci_ctx(vhci)) {
                 wdf::WaitLock lck(v->events_lock);
                 InsertTailList(&v->fileobjects, &fobj.entry);
         }
 
-        WdfRequestComplete(request, st);
+        WdfRequestComplete(request, STATUS_SUCCESS);
 }
 
 _Function_class_(EVT_WDF_FILE_CLEANUP)
@@ -299,6 +381,11 @@ PAGED void file_cleanup(_In_ WDFFILEOBJECT fileobj)
         if (fobj.process_events) {
                 --ctx.events_subscribers;
         }
+
+        WDFMEMORY evt{};
+        for (unsigned int seqnum, lost; fobj.events.pop(evt, seqnum, lost); ) {
+                WdfObjectDereference(evt);
+        }
 }
 
 /*
@@ -369,8 +456,9 @@ PAGED auto add_usbdevice_emulation(_In_ WDFDEVICE vhci)
         UDECX_WDF_DEVICE_CONFIG cfg;
         UDECX_WDF_DEVICE_CONFIG_INIT(&cfg, query_usb_capability);
 
-        cfg.NumberOfUsb20Ports = USB2_PORTS;
-        cfg.NumberOfUsb30Ports = USB3_PORTS;
+        auto &ctx = *get_vhci_ctx(vhci);
+        cfg.NumberOfUsb20Ports = static_cast<USHORT>(ctx.usb2_ports);
+        cfg.NumberOfUsb30Ports = static_cast<USHORT>(ctx.total_ports - ctx.usb2_ports);
 
         if (auto err = UdecxWdfDeviceAddUsbDeviceEmulation(vhci, &cfg)) {
                 Trace(TRACE_LEVEL_ERROR, "UdecxWdfDeviceAddUsbDeviceEmulation %!STATUS!", err);
@@ -453,16 +541,16 @@ PAGED auto create_vhci(_Out_ WDFDEVICE &vhci, _In_ WDFDEVICE_INIT *init)
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-auto get_port_range(_In_ usb_device_speed speed)
+auto get_port_range(_In_ const vhci_ctx &vhci, _In_ usb_device_speed speed)
 {
         struct{ int begin;  int end; } r;
 
         if (speed < USB_SPEED_SUPER) {
                 r.begin = 0;
-                r.end = USB2_PORTS;
+                r.end = vhci.usb2_ports;
         } else {
-                r.begin = USB2_PORTS;
-                r.end = TOTAL_PORTS;
+                r.begin = vhci.usb2_ports;
+                r.end = vhci.total_ports;
         }
 
         return r;
@@ -502,6 +590,8 @@ PAGED auto make_device_state(
 
 /*
  * vhci_ctx::events_lock must be acquired.
+ * The ring is empty if there is a pending read request, the request gets this event only.
+ * Events that arrive before the next read are accumulated and returned by it at once.
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
@@ -510,25 +600,22 @@ PAGED void process_event(_In_ WDFQUEUE queue, _Inout_ fileobject_ctx &fobj, _In_
         PAGED_CODE();
 
         auto fileobj = get_handle(&fobj);
+        WdfObjectReference(evt);
+
+        if (WDFMEMORY dropped{}; fobj.events.push(evt, dropped)) {
+                TraceDbg("fobj %04x, drop %04x, add %04x", ptr04x(fileobj), ptr04x(dropped), ptr04x(evt));
+                WdfObjectDereference(dropped);
+        } else {
+                TraceDbg("fobj %04x, add %04x[%u]", ptr04x(fileobj), ptr04x(evt), fobj.events.size() - 1);
+        }
+
         WDFREQUEST request{};
 
         switch (auto st = WdfIoQueueRetrieveRequestByFileObject(queue, fileobj, &request)) {
         case STATUS_SUCCESS:
-                NT_ASSERT(!WdfCollectionGetCount(fobj.events));
-                vhci::complete_read(request, evt);
+                vhci::complete_read(request, fobj);
                 break;
         case STATUS_NO_MORE_ENTRIES:
-                if (auto err = WdfCollectionAdd(fobj.events, evt)) { // append and increment reference count
-                        Trace(TRACE_LEVEL_ERROR, "WdfCollectionAdd %!STATUS!", err);
-                } else if (auto cnt = WdfCollectionGetCount(fobj.events); cnt > fobj.MAX_EVENTS) {
-                        auto head = WdfCollectionGetFirstItem(fobj.events);
-                        WdfCollectionRemove(fobj.events, head); // decrements reference count
-
-                        TraceDbg("fobj %04x, drop %04x[0], add %04x[%lu]",
-                                  ptr04x(fileobj), ptr04x(head), ptr04x(evt), --cnt - 1);
-                } else {
-                        TraceDbg("fobj %04x, add %04x[%lu]", ptr04x(fileobj), ptr04x(evt), cnt - 1);
-                }
                 break;
         default:
                 Trace(TRACE_LEVEL_ERROR, "WdfIoQueueRetrieveRequestByFileObject %!STATUS!", st);
@@ -541,15 +628,21 @@ PAGED void process_event(_In_ vhci_ctx &vhci, _In_ WDFMEMORY evt)
 {
         PAGED_CODE();
 
+        auto &r = *static_cast<vhci::device_state*>(WdfMemoryGetBuffer(evt, nullptr));
         int cnt = 0;
+
         wdf::WaitLock lck(vhci.events_lock);
 
         for (auto head = &vhci.fileobjects, entry = head->Flink; entry != head; entry = entry->Flink) {
                 auto &fobj = *CONTAINING_RECORD(entry, fileobject_ctx, entry);
-                if (fobj.process_events) {
+                if (!fobj.process_events) {
+                        continue;
+                }
+
+                if (matches(fobj.filter, r.port, static_cast<int>(r.state), r.host)) {
                         process_event(vhci.reads, fobj, evt);
-                        ++cnt;
                 }
+                ++cnt;
         }
 
         NT_ASSERT(cnt == vhci.events_subscribers);
@@ -579,11 +672,70 @@ PAGED auto get_detach_function(_In_ vhci::detach_call how)
         return f;
 }
 
+/*
+ * Unplugs are initiated concurrently, the references keep the devices till the end of the wait.
+ * @return the number of records written to times
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED ULONG detach_all_devices_and_wait(
+        _In_ WDFDEVICE vhci, _Out_writes_opt_(max_cnt) vhci::ioctl::plugout_hardware_time *times, _In_ ULONG max_cnt)
+{
+        PAGED_CODE();
+
+        auto total_ports = get_vhci_ctx(vhci)->total_ports;
+        ULONG written = 0;
+
+        unique_ptr buf(PagedPool, total_ports*sizeof(UDECXUSBDEVICE));
+        if (!buf) {
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate memory for %d device(s)", total_ports);
+
+                for (int port = 1; port <= total_ports; ++port) {
+                        if (auto dev = vhci::get_device(vhci, port); auto hdev = dev.get<UDECXUSBDEVICE>()) {
+                                device::async_detach_and_wait(hdev);
+
+                                if (written < max_cnt) {
+                                        times[written].port = port;
+                                        written += device::get_teardown(times[written], hdev);
+                                }
+                        }
+                }
+                return written;
+        }
+
+        auto devices = buf.get<UDECXUSBDEVICE>();
+        ULONG cnt = 0;
+
+        for (int port = 1; port <= total_ports; ++port) {
+                if (auto dev = vhci::get_device(vhci, port)) {
+                        if (cnt < max_cnt) {
+                                times[cnt].port = port; // is released by the detach
+                        }
+                        devices[cnt++] = static_cast<UDECXUSBDEVICE>(dev.release()); // keep the reference
+                }
+        }
+
+        if (auto err = device::async_detach_and_wait(devices, cnt)) {
+                Trace(TRACE_LEVEL_ERROR, "%lu device(s), async_detach_and_wait %!STATUS!", cnt, err);
+        }
+
+        for (ULONG i = 0; i < cnt; ++i) {
+                if (i < max_cnt && device::get_teardown(times[i], devices[i])) {
+                        times[written++] = times[i];
+                }
+                WdfObjectDereference(devices[i]);
+        }
+
+        return written;
+}
+
 } // namespace
 
 
 /*
  * usb2.0 devices don't work in usb3.x ports, and visa versa, tested.
+ * A free port is claimed without a lock, the slot of claimed port is owned exclusively till reclaim_roothub_port.
+ * The device is referenced before it is published for get_device.
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -593,27 +745,29 @@ int usbip::vhci::claim_roothub_port(_In_ UDECXUSBDEVICE device)
         auto &vhci = *get_vhci_ctx(dev.vhci); 
 
         NT_ASSERT(!dev.port);
-        int port = 0;
 
-        auto [begin, end] = get_port_range(dev.speed());
+        auto [begin, end] = get_port_range(vhci, dev.speed());
 
-        wdf::Lock lck(vhci.devices_lock); // function must be resident, do not use PAGED
+        auto i = vhci.claimed_ports.claim(begin, end);
+        if (i < 0) {
+                return 0;
+        }
 
-        for (auto i = begin; i < end; ++i) {
-                NT_ASSERT(i < ARRAYSIZE(vhci.devices));
+        NT_ASSERT(i < vhci.total_ports);
+        auto &handle = vhci.devices[i];
+        NT_ASSERT(!handle);
 
-                if (auto &handle = vhci.devices[i]; !handle) {
-                        WdfObjectReference(handle = device);
-                        
-                        port = i + 1;
-                        NT_ASSERT(is_valid_port(port));
+        auto port = i + 1;
+        NT_ASSERT(is_valid_port(port));
+        dev.port = port;
 
-                        dev.port = port;
-                        break;
-                }
-        }
+        WdfObjectReference(device);
 
+        wdf::Lock lck(vhci.devices_lock); // function must be resident, do not use PAGED
+        handle = device;
+        vhci.port_generation[i] = ++vhci.generation;
         lck.release();
+
         return port;
 }
 
@@ -636,11 +790,14 @@ int usbip::vhci::reclaim_roothub_port(_In_ UDECXUSBDEVICE device)
                 NT_ASSERT(handle == device);
 
                 handle = WDF_NO_HANDLE;
+                vhci.port_generation[port - 1] = ++vhci.generation;
+
                 port = 0;
         }
         lck.release(); // explicit call to satisfy code analyzer and get rid of warning C28166
 
         if (portnum) {
+                NT_VERIFY(vhci.claimed_ports.release(portnum - 1)); // can be claimed again
                 WdfObjectDereference(device);
         }
         
@@ -651,6 +808,16 @@ _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 wdf::ObjectRef usbip::vhci::get_device(_In_ WDFDEVICE vhci, _In_ int port)
 {
+        UINT64 generation;
+        return get_device(vhci, port, generation);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+wdf::ObjectRef usbip::vhci::get_device(_In_ WDFDEVICE vhci, _In_ int port, _Out_ UINT64 &generation)
+{
+        generation = 0;
+
         wdf::ObjectRef ptr;
         if (!is_valid_port(port)) {
                 return ptr;
@@ -663,25 +830,49 @@ wdf::ObjectRef usbip::vhci::get_device(_In_ WDFDEVICE vhci, _In_ int port)
                 NT_ASSERT(get_device_ctx(handle)->port == port);
                 ptr.reset(handle); // adds reference
         }
+        generation = ctx.port_generation[port - 1];
         lck.release(); // explicit call to satisfy code analyzer and get rid of warning C28166
 
         return ptr;
 }
 
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+UINT64 usbip::vhci::get_generation(_In_ WDFDEVICE vhci)
+{
+        auto &ctx = *get_vhci_ctx(vhci);
+
+        wdf::Lock lck(ctx.devices_lock); 
+        auto generation = ctx.generation;
+        lck.release();
+
+        return generation;
+}
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED void usbip::vhci::detach_all_devices(_In_ WDFDEVICE vhci, _In_ detach_call how)
+PAGED ULONG usbip::vhci::detach_all_devices(
+        _In_ WDFDEVICE vhci, _In_ detach_call how,
+        _Out_writes_opt_(max_cnt) ioctl::plugout_hardware_time *times, _In_ ULONG max_cnt)
 {
         PAGED_CODE();
 
         TraceDbg("%04x", ptr04x(vhci));
+
+        if (how == detach_call::async_wait) {
+                return detach_all_devices_and_wait(vhci, times, max_cnt);
+        }
+
         auto detach = get_detach_function(how);
+        auto total_ports = get_vhci_ctx(vhci)->total_ports;
 
-        for (int port = 1; port <= ARRAYSIZE(vhci_ctx::devices); ++port) {
+        for (int port = 1; port <= total_ports; ++port) {
                 if (auto dev = get_device(vhci, port); auto hdev = dev.get<UDECXUSBDEVICE>()) {
                         detach(hdev);
                 }
         }
+
+        return 0;
 }
 
 _IRQL_requires_same_
@@ -704,28 +895,48 @@ PAGED NTSTATUS usbip::vhci::fill(_Out_ imported_device &dev, _In_ const device_c
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED void usbip::vhci::complete_read(_In_ WDFREQUEST request, _In_ WDFMEMORY evt)
+PAGED void usbip::vhci::complete_read(_In_ WDFREQUEST request, _Inout_ fileobject_ctx &fobj)
 {
         PAGED_CODE();
 
         device_state *dst{};
-        auto dst_sz = sizeof(*dst);
+        size_t length{};
+        size_t cnt = 0;
+
+        auto st = WdfRequestRetrieveOutputBuffer(request, sizeof(*dst), reinterpret_cast<PVOID*>(&dst), &length);
 
-        auto st = WdfRequestRetrieveOutputBuffer(request, dst_sz, reinterpret_cast<PVOID*>(&dst), nullptr);
-        
         if (NT_SUCCESS(st)) {
-                size_t size{};
-                *dst = *reinterpret_cast<device_state*>(WdfMemoryGetBuffer(evt, &size));
-                NT_ASSERT(size == dst_sz);
+                NT_ASSERT(!fobj.events.empty());
+
+                WDFMEMORY evt{};
+                unsigned int seqnum{};
+                unsigned int lost{};
+
+                for (auto max_cnt = length/sizeof(*dst); cnt < max_cnt && fobj.events.pop(evt, seqnum, lost); ++cnt) {
+                        size_t size{};
+                        auto &r = dst[cnt];
+
+                        r = *reinterpret_cast<device_state*>(WdfMemoryGetBuffer(evt, &size));
+                        NT_ASSERT(size == sizeof(r));
+
+                        r.seqnum = seqnum;
+                        r.lost = lost;
+
+                        if (lost) {
+                                Trace(TRACE_LEVEL_WARNING, "fobj %04x, %u event(s) lost before #%u",
+                                        ptr04x(WdfRequestGetFileObject(request)), lost, seqnum);
+                        }
+
+                        WdfObjectDereference(evt);
+                }
         } else {
                 Trace(TRACE_LEVEL_ERROR, "WdfRequestRetrieveOutputBuffer %!STATUS!", st);
-                dst_sz = 0;
         }
 
-        TraceDbg("fobj %04x, req %04x, device_state %04x, %!STATUS!", ptr04x(WdfRequestGetFileObject(request)), 
-                  ptr04x(request), ptr04x(evt), st);
+        TraceDbg("fobj %04x, req %04x, %Iu device_state(s), %!STATUS!", ptr04x(WdfRequestGetFileObject(request)), 
+                  ptr04x(request), cnt, st);
 
-        WdfRequestCompleteWithInformation(request, st, dst_sz);
+        WdfRequestCompleteWithInformation(request, st, cnt*sizeof(*dst));
 }
 
 /*
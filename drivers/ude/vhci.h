@@ -32,11 +32,31 @@ _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 wdf::ObjectRef get_device(_In_ WDFDEVICE vhci, _In_ int port);
 
+/*
+ * @param generation of the last change of the port, see vhci_ctx::port_generation
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+wdf::ObjectRef get_device(_In_ WDFDEVICE vhci, _In_ int port, _Out_ UINT64 &generation);
+
+/*
+ * A port that was changed after this call will have greater generation.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+UINT64 get_generation(_In_ WDFDEVICE vhci);
+
 enum class detach_call { async_wait, async_nowait, direct };
 
+/*
+ * @param times teardown times of the devices, are returned for detach_call::async_wait only
+ * @return the number of records written to times
+ */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED void detach_all_devices(_In_ WDFDEVICE vhci, _In_ detach_call how);
+PAGED ULONG detach_all_devices(
+        _In_ WDFDEVICE vhci, _In_ detach_call how,
+        _Out_writes_opt_(max_cnt) ioctl::plugout_hardware_time *times = nullptr, _In_ ULONG max_cnt = 0);
 
 struct imported_device;
 enum class state;
@@ -50,9 +70,12 @@ inline auto fill(_Out_ imported_device &dev, _In_ const device_ctx &ctx)
         return fill(dev, *ctx.ext, ctx.port);
 }
 
+/*
+ * vhci_ctx::events_lock must be acquired.
+ */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED void complete_read(_In_ WDFREQUEST request, _In_ WDFMEMORY evt);
+PAGED void complete_read(_In_ WDFREQUEST request, _Inout_ fileobject_ctx &fobj);
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
@@ -7,13 +7,18 @@
 #include "vhci_ioctl.tmh"
 
 #include "context.h"
+#include "driver.h"
 #include "vhci.h"
 #include "device.h"
+#include "device_ioctl.h"
 #include "network.h"
 #include "ioctl.h"
 #include "persistent.h"
+#include "plugin_batch.h"
+#include "addrinfo_cache.h"
 
 #include <usbip\proto_op.h>
+#include <usbip\device_record.h>
 
 #include <libdrv\dbgcommon.h>
 #include <libdrv\strconv.h>
@@ -39,6 +44,7 @@ struct workitem_ctx
 
         device_ctx_ext *ext;
         ADDRINFOEXW *addrinfo; // list head
+        ADDRINFOEXW *cached_addrinfo; // list head, @see lookup_addrinfo
 };
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(workitem_ctx, get_workitem_ctx)
 
@@ -56,6 +62,15 @@ PAGED auto set_args(_In_ WDFREQUEST request, _In_ const char *function, _In_ con
         return irp;
 }
 
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto& get_plugin_hardware(_In_ WDFREQUEST request)
+{
+        vhci::ioctl::plugin_hardware *r{};
+        NT_VERIFY(NT_SUCCESS(WdfRequestRetrieveInputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), nullptr)));
+        return *r;
+}
+
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 PAGED void log(_In_ const usbip_usb_device &d)
@@ -250,9 +265,7 @@ PAGED auto connected(_In_ WDFREQUEST request, _Inout_ device_ctx_ext* &ext)
         PAGED_CODE();
         Trace(TRACE_LEVEL_INFORMATION, "%!USTR!:%!USTR!", &ext->node_name, &ext->service_name);
 
-        vhci::ioctl::plugin_hardware *r{};
-        NT_VERIFY(NT_SUCCESS(WdfRequestRetrieveInputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), nullptr)));
-
+        auto &r = get_plugin_hardware(request);
         auto vhci = get_vhci(request);
         device_state_changed(vhci, *ext, 0, vhci::state::connected);
 
@@ -266,12 +279,12 @@ PAGED auto connected(_In_ WDFREQUEST request, _Inout_ device_ctx_ext* &ext)
         }
         ext = nullptr; // now dev owns it
 
-        if (auto err = start_device(r->port, dev)) {
+        if (auto err = start_device(r.port, dev)) {
                 WdfObjectDelete(dev); // UdecxUsbDevicePlugIn failed or was not called
                 return err;
         }
 
-        Trace(TRACE_LEVEL_INFORMATION, "dev %04x plugged in, port %d", ptr04x(dev), r->port);
+        Trace(TRACE_LEVEL_INFORMATION, "dev %04x plugged in, port %d", ptr04x(dev), r.port);
 
         if (auto ctx = get_device_ctx(dev)) {
                 device_state_changed(*ctx, vhci::state::plugged);
@@ -356,14 +369,19 @@ PAGED auto connect(
         return STATUS_PENDING;
 }
 
+/*
+ * @param unreachable set to true if connect has failed for the last address of the list
+ */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED auto on_connect(
-        _In_ WDFREQUEST request, _In_ WDFWORKITEM wi, _Inout_ device_ctx_ext* &ext, _In_ const ADDRINFOEXW &ai)
+        _In_ WDFREQUEST request, _In_ WDFWORKITEM wi, _Inout_ device_ctx_ext* &ext, _In_ const ADDRINFOEXW &ai,
+        _Out_ bool &unreachable)
 {
         PAGED_CODE();
 
         auto st = WdfRequestGetStatus(request);
+        unreachable = false;
 
         if (NT_SUCCESS(st)) {
                 st = connected(request, ext);
@@ -372,14 +390,40 @@ PAGED auto on_connect(
                 NT_VERIFY(NT_SUCCESS(close(ext->sock)));
                 free(ext->sock);
 
-                if (st != STATUS_CANCELLED && ai.ai_next) {
+                if (st == STATUS_CANCELLED) {
+                        //
+                } else if (ai.ai_next) {
                         st = connect(request, wi, ext->sock, *ai.ai_next);
+                } else {
+                        unreachable = true;
                 }
         }
 
         return st;
 }
 
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void getaddrinfo(_In_ WDFREQUEST request, _In_ WDFWORKITEM wi, _Inout_ workitem_ctx &ctx)
+{
+        PAGED_CODE();
+        auto &ext = *ctx.ext;
+
+        ADDRINFOEXW hints {
+                .ai_flags = AI_NUMERICSERV,
+                .ai_family = AF_UNSPEC,
+                .ai_socktype = SOCK_STREAM,
+                .ai_protocol = IPPROTO_TCP // zero isn't work
+        };
+
+        auto irp = set_args(request, __func__);
+        IoSetCompletionRoutine(irp, irp_complete, wi, true, true, true);
+                         
+        NT_ASSERT(!ctx.addrinfo);
+        auto st = wsk::getaddrinfo(ctx.addrinfo, &ext.node_name, &ext.service_name, &hints, irp);
+        TraceDbg("%!STATUS!", st);
+}
+
 _Function_class_(EVT_WDF_WORKITEM)
 _IRQL_requires_same_
 _IRQL_requires_max_(PASSIVE_LEVEL)
@@ -397,11 +441,26 @@ PAGED void NTAPI complete(_In_ WDFWORKITEM wi)
         auto st = WdfRequestGetStatus(request);
         TraceDbg("%s %!STATUS!", function, st);
 
+        auto &r = get_plugin_hardware(request);
+
         if (auto ai = libdrv::argv<ADDRINFOEXW*, ARG_AI>(irp)) {
-                st = on_connect(request, wi, ctx.ext, *ai);
-        } else if (NT_SUCCESS(st)) { // on_addrinfo
-                NT_ASSERT(ctx.addrinfo);
-                st = connect(request, wi, ctx.ext->sock, *ctx.addrinfo);
+                bool unreachable;
+                st = on_connect(request, wi, ctx.ext, *ai, unreachable);
+                if (unreachable && ctx.cached_addrinfo) { // import errors do not invalidate the addresses
+                        remove_addrinfo(ctx.vhci, r.host, r.service);
+
+                        free_addrinfo(ctx.cached_addrinfo); // the addresses could be changed, resolve them once again
+                        ctx.cached_addrinfo = nullptr;
+
+                        getaddrinfo(request, wi, ctx); // completion handler will be called anyway
+                        st = STATUS_PENDING;
+                }
+        } else { // on_addrinfo
+                update_addrinfo_cache(ctx.vhci, r.host, r.service, st, ctx.addrinfo);
+                if (NT_SUCCESS(st)) {
+                        NT_ASSERT(ctx.addrinfo);
+                        st = connect(request, wi, ctx.ext->sock, *ctx.addrinfo);
+                }
         }
 
         if (st != STATUS_PENDING) {
@@ -430,6 +489,9 @@ PAGED void workitem_cleanup(_In_ WDFOBJECT obj)
         wsk::free(ctx.addrinfo);
         ctx.addrinfo = nullptr;
 
+        free_addrinfo(ctx.cached_addrinfo);
+        ctx.cached_addrinfo = nullptr;
+
         if (auto &ext = ctx.ext) {
                 close_socket(ext->sock);
                 device_state_changed(ctx.vhci, *ext, 0, vhci::state::disconnected);
@@ -458,28 +520,6 @@ PAGED auto create_workitem(_Out_ WDFWORKITEM &wi, _In_ WDFOBJECT parent)
         return WdfWorkItemCreate(&cfg, &attr, &wi);
 }
 
-_IRQL_requires_same_
-_IRQL_requires_(PASSIVE_LEVEL)
-PAGED void getaddrinfo(_In_ WDFREQUEST request, _In_ WDFWORKITEM wi, _Inout_ workitem_ctx &ctx)
-{
-        PAGED_CODE();
-        auto &ext = *ctx.ext;
-
-        ADDRINFOEXW hints {
-                .ai_flags = AI_NUMERICSERV,
-                .ai_family = AF_UNSPEC,
-                .ai_socktype = SOCK_STREAM,
-                .ai_protocol = IPPROTO_TCP // zero isn't work
-        };
-
-        auto irp = set_args(request, __func__);
-        IoSetCompletionRoutine(irp, irp_complete, wi, true, true, true);
-                         
-        NT_ASSERT(!ctx.addrinfo);
-        auto st = wsk::getaddrinfo(ctx.addrinfo, &ext.node_name, &ext.service_name, &hints, irp);
-        TraceDbg("%!STATUS!", st);
-}
-
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED auto plugin_hardware( _In_ WDFREQUEST request, _In_ const vhci::ioctl::plugin_hardware &r)
@@ -506,6 +546,19 @@ PAGED auto plugin_hardware( _In_ WDFREQUEST request, _In_ const vhci::ioctl::plu
 
         device_state_changed(vhci, *ctx.ext, 0, vhci::state::connecting);
 
+        if (auto err = lookup_addrinfo(vhci, r.host, r.service, ctx.cached_addrinfo)) { // cached failure
+                WdfObjectDelete(wi);
+                return err;
+        }
+
+        if (auto ai = ctx.cached_addrinfo) {
+                auto st = connect(request, wi, ctx.ext->sock, *ai);
+                if (st != STATUS_PENDING) {
+                        WdfObjectDelete(wi);
+                }
+                return st;
+        }
+
         getaddrinfo(request, wi, ctx); // completion handler will be called anyway
         return STATUS_PENDING;
 }
@@ -541,7 +594,7 @@ PAGED NTSTATUS plugin_hardware(_In_ WDFREQUEST request)
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED NTSTATUS plugout_hardware(_In_ WDFREQUEST request)
+PAGED NTSTATUS plugout_hardware(_In_ WDFREQUEST request, _In_ size_t outlen)
 {
         PAGED_CODE();
 
@@ -559,19 +612,40 @@ PAGED NTSTATUS plugout_hardware(_In_ WDFREQUEST request)
                 return USBIP_ERROR_ABI;
         }
 
-        TraceDbg("port %d", r->port);
+        auto port = r->port; // the output buffer is the input one
+        TraceDbg("port %d", port);
+
+        vhci::ioctl::plugout_hardware_time *times{};
+        auto max_cnt = static_cast<ULONG>(outlen/sizeof(*times));
+
+        if (!max_cnt) {
+                //
+        } else if (auto err = WdfRequestRetrieveOutputBuffer(request, sizeof(*times), 
+                                                             reinterpret_cast<PVOID*>(&times), nullptr)) {
+                return err;
+        }
+
         auto st = STATUS_SUCCESS;
+        ULONG cnt = 0;
 
-        if (auto vhci = get_vhci(request); r->port <= 0) {
-                detach_all_devices(vhci, vhci::detach_call::async_wait); // detach_call::direct can't be used here
-        } else if (!is_valid_port(r->port)) {
+        if (auto vhci = get_vhci(request); port <= 0) {
+                // detach_call::direct can't be used here
+                cnt = detach_all_devices(vhci, vhci::detach_call::async_wait, times, max_cnt);
+        } else if (!is_valid_port(port)) {
                 st = STATUS_INVALID_PARAMETER;
-        } else if (auto dev = vhci::get_device(vhci, r->port)) {
-                st = device::async_detach_and_wait(dev.get<UDECXUSBDEVICE>());
+        } else if (auto dev = vhci::get_device(vhci, port)) {
+                auto hdev = dev.get<UDECXUSBDEVICE>();
+                st = device::async_detach_and_wait(hdev);
+
+                if (max_cnt) {
+                        times->port = port;
+                        cnt = device::get_teardown(*times, hdev);
+                }
         } else {
                 st = STATUS_DEVICE_NOT_CONNECTED;
         }
 
+        WdfRequestSetInformation(request, cnt*sizeof(*times));
         return st;
 }
 
@@ -602,7 +676,7 @@ PAGED NTSTATUS get_imported_devices(_In_ WDFREQUEST request)
         auto vhci = get_vhci(request);
         ULONG cnt = 0;
 
-        for (int port = 1; port <= ARRAYSIZE(vhci_ctx::devices); ++port) {
+        for (int port = 1, total_ports = get_vhci_ctx(vhci)->total_ports; port <= total_ports; ++port) {
                 if (auto dev = vhci::get_device(vhci, port); !dev) {
                         //
                 } else if (cnt == max_cnt) {
@@ -621,6 +695,119 @@ PAGED NTSTATUS get_imported_devices(_In_ WDFREQUEST request)
         return STATUS_SUCCESS;
 }
 
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto make_record(_Out_ device_record::fields &f, _Out_ vhci::imported_device &tmp, _In_ const device_ctx &ctx)
+{
+        PAGED_CODE();
+
+        if (auto err = fill(tmp, ctx)) {
+                return err;
+        }
+
+        auto str = [] (auto &s) { return device_record::string{ s, static_cast<unsigned int>(strlen(s)) }; };
+
+        f = device_record::fields {
+                .port = tmp.port,
+                .devid = tmp.devid,
+                .speed = tmp.speed,
+                .vendor = tmp.vendor,
+                .product = tmp.product,
+                .busid = str(tmp.busid),
+                .service = str(tmp.service),
+                .host = str(tmp.host),
+        };
+
+        return STATUS_SUCCESS;
+}
+
+/*
+ * Ports are read after the generation, a concurrent change is reported now or by the next call.
+ * Free ports are not reported if all devices are requested.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS get_changed_devices(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        WdfRequestSetInformation(request, 0);
+
+        vhci::ioctl::get_changed_devices *r{};
+
+        if (size_t length; 
+            auto err = WdfRequestRetrieveInputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &length)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "get_changed_devices.size %lu != sizeof(get_changed_devices) %Iu", 
+                                          r->size, sizeof(*r));
+
+                return USBIP_ERROR_ABI;
+        }
+
+        auto epoch = r->epoch; // the same buffer is used for output
+        auto since = r->generation;
+
+        size_t outlen;
+        if (auto err = WdfRequestRetrieveOutputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &outlen)) {
+                return err;
+        }
+
+        auto vhci = get_vhci(request);
+        auto &ctx = *get_vhci_ctx(vhci);
+
+        auto generation = vhci::get_generation(vhci);
+
+        if (epoch != ctx.epoch) { // the first call or the driver was reloaded
+                since = 0;
+        }
+
+        unique_ptr tmp(PagedPool, sizeof(vhci::imported_device));
+        if (!tmp) {
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        auto buf = reinterpret_cast<char*>(r + 1);
+        auto len = outlen - sizeof(*r);
+        ULONG cnt = 0;
+
+        for (int port = 1; since != generation && port <= ctx.total_ports; ++port) {
+                UINT64 port_generation;
+                auto dev = vhci::get_device(vhci, port, port_generation);
+
+                if (port_generation <= since || (!since && !dev)) {
+                        continue;
+                }
+
+                device_record::fields f{ .port = port, .removed = !dev };
+
+                if (dev) {
+                        if (auto err = make_record(f, *tmp.get<vhci::imported_device>(), *get_device_ctx(dev.get()))) {
+                                return err;
+                        }
+                }
+
+                auto written = device_record::encode(buf, len, f);
+                if (!written) {
+                        return STATUS_BUFFER_TOO_SMALL;
+                }
+
+                buf += written;
+                len -= written;
+                ++cnt;
+        }
+
+        r->epoch = ctx.epoch;
+        r->generation = generation;
+        r->count = cnt;
+        r->reserved = 0;
+
+        auto written = outlen - len;
+        TraceDbg("generation %I64u -> %I64u, %lu record(s), %Iu bytes", since, generation, cnt, written);
+
+        WdfRequestSetInformation(request, written);
+        return STATUS_SUCCESS;
+}
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED auto set_persistent(_In_ WDFREQUEST request)
@@ -685,6 +872,91 @@ PAGED auto get_persistent(_In_ WDFREQUEST request)
         return st;
 }
 
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto set_event_filter(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+
+        vhci::ioctl::set_event_filter *r{};
+
+        if (size_t length; 
+            auto err = WdfRequestRetrieveInputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &length)) {
+                return err;
+        } else if (length != sizeof(*r)) {
+                return STATUS_INVALID_BUFFER_SIZE;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "set_event_filter.size %lu != sizeof(set_event_filter) %Iu",
+                                          r->size, sizeof(*r));
+
+                return USBIP_ERROR_ABI;
+        }
+
+        static_assert(sizeof(r->ports) == sizeof(event_filter::ports));
+        static_assert(sizeof(r->host) == sizeof(event_filter::host));
+        static_assert(MAX_TOTAL_PORTS <= event_filter::MAX_PORT);
+
+        r->host[sizeof(r->host) - 1] = '\0';
+        TraceDbg("states %#x, host '%s'", r->states, r->host);
+
+        auto fileobj = WdfRequestGetFileObject(request);
+        auto &fobj = *get_fileobject_ctx(fileobj);
+
+        auto &vhci = *get_vhci_ctx(get_vhci(request));
+        wdf::WaitLock lck(vhci.events_lock);
+
+        auto &f = fobj.filter;
+        RtlCopyMemory(f.ports, r->ports, sizeof(f.ports));
+        f.states = r->states;
+        RtlCopyMemory(f.host, r->host, sizeof(f.host));
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto set_device_rate(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+
+        vhci::ioctl::set_device_rate *r{};
+
+        if (size_t length; 
+            auto err = WdfRequestRetrieveInputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &length)) {
+                return err;
+        } else if (length != sizeof(*r)) {
+                return STATUS_INVALID_BUFFER_SIZE;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "set_device_rate.size %lu != sizeof(set_device_rate) %Iu",
+                                          r->size, sizeof(*r));
+
+                return USBIP_ERROR_ABI;
+        }
+
+        TraceDbg("port %d, rate %lu, burst %lu", r->port, r->rate, r->burst);
+
+        auto vhci = get_vhci(request);
+
+        if (r->port > 0) {
+                if (!is_valid_port(r->port)) {
+                        return STATUS_INVALID_PARAMETER;
+                } else if (auto dev = vhci::get_device(vhci, r->port)) {
+                        device::set_rate(dev.get<UDECXUSBDEVICE>(), r->rate, r->burst);
+                        return STATUS_SUCCESS;
+                } else {
+                        return STATUS_DEVICE_NOT_CONNECTED;
+                }
+        }
+
+        for (int port = 1, total_ports = get_vhci_ctx(vhci)->total_ports; port <= total_ports; ++port) {
+                if (auto dev = vhci::get_device(vhci, port)) {
+                        device::set_rate(dev.get<UDECXUSBDEVICE>(), r->rate, r->burst);
+                }
+        }
+
+        return STATUS_SUCCESS;
+}
+
 /*
  * IRP_MJ_DEVICE_CONTROL
  * 
@@ -718,7 +990,7 @@ PAGED void device_control(
                 st = plugin_hardware(Request);
                 break;
         case vhci::ioctl::PLUGOUT_HARDWARE:
-                st = plugout_hardware(Request);
+                st = plugout_hardware(Request, OutputBufferLength);
                 break;
         case IOCTL_USB_USER_REQUEST:
                 NT_ASSERT(!has_urb(Request));
@@ -752,17 +1024,30 @@ PAGED void device_control(
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED decltype(get_persistent) *get_parallel_handler(_In_ ULONG IoControlCode)
+PAGED decltype(get_persistent) *get_parallel_handler(_In_ WDFREQUEST Request, _In_ ULONG IoControlCode)
 {
         PAGED_CODE();
 
         switch (IoControlCode) {
+        case vhci::ioctl::PLUGIN_HARDWARE: // applications' requests are serialized by the sequential queue
+                if (WdfRequestGetRequestorMode(Request) == KernelMode) { // see plugin_batch.cpp, persistent.cpp
+                        return plugin_hardware;
+                }
+                return nullptr;
+        case vhci::ioctl::PLUGIN_HARDWARE_BATCH:
+                return plugin_hardware_batch;
         case vhci::ioctl::GET_IMPORTED_DEVICES:
                 return get_imported_devices;
+        case vhci::ioctl::GET_CHANGED_DEVICES:
+                return get_changed_devices;
         case vhci::ioctl::SET_PERSISTENT:
                 return set_persistent;
         case vhci::ioctl::GET_PERSISTENT:
                 return get_persistent;
+        case vhci::ioctl::SET_EVENT_FILTER:
+                return set_event_filter;
+        case vhci::ioctl::SET_DEVICE_RATE:
+                return set_device_rate;
         default:
                 return nullptr;
         }
@@ -782,7 +1067,7 @@ PAGED void device_control_parallel(
 
         NTSTATUS st;
 
-        if (auto handler = get_parallel_handler(IoControlCode)) {
+        if (auto handler = get_parallel_handler(Request, IoControlCode)) {
                 TraceDbg("%s(%#08lX), OutputBufferLength %Iu, InputBufferLength %Iu", 
                           device_control_name(IoControlCode), IoControlCode, OutputBufferLength, InputBufferLength);
 
@@ -818,7 +1103,7 @@ PAGED void device_read(_In_ WDFQUEUE queue, _In_ WDFREQUEST request, _In_ size_t
 
         TraceDbg("fobj %04x, request %04x, length %Iu", ptr04x(fileobj), ptr04x(request), length);
 
-        if (length != sizeof(vhci::device_state)) {
+        if (!length || length % sizeof(vhci::device_state)) {
                 WdfRequestCompleteWithInformation(request, STATUS_INVALID_BUFFER_SIZE, 0);
                 return;
         }
@@ -833,9 +1118,8 @@ PAGED void device_read(_In_ WDFQUEUE queue, _In_ WDFREQUEST request, _In_ size_t
                 val = true;
         }
 
-        if (auto evt = (WDFMEMORY)WdfCollectionGetFirstItem(fobj.events)) {
-                vhci::complete_read(request, evt);
-                WdfCollectionRemove(fobj.events, evt); // decrements reference count
+        if (!fobj.events.empty()) {
+                vhci::complete_read(request, fobj);
         } else if (auto err = WdfRequestForwardToIoQueue(request, vhci.reads)) {
                 Trace(TRACE_LEVEL_ERROR, "WdfRequestForwardToIoQueue %!STATUS!", err);
                 if (err == STATUS_WDF_BUSY) { // the queue is not accepting new requests, purged
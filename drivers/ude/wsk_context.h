@@ -8,6 +8,9 @@
 
 #include <usbip\proto.h>
 #include <libdrv\mdl_cpp.h>
+#include <wsk.h>
+
+#include "send_queue.h"
 
 namespace usbip
 {
@@ -23,6 +26,9 @@ struct wsk_context
         WDFREQUEST request; // can be WDF_NO_HANDLE
         Mdl mdl_buf; // describes URB_FROM_IRP()->TransferBuffer(MDL)
 
+        send_queue_entry queued; // device_ctx::pending
+        WSK_BUF buf; // to send
+
         // preallocated data
 
         IRP *wsk_irp;
@@ -397,8 +397,8 @@ PAGED auto make_mdl_chain(_In_ wsk_context &ctx)
 	MDL *head{};
 
 	if (!ctx.is_isoc) { // IN
-		head = ctx.mdl_buf.get();
-		NT_ASSERT(!head->Next);
+		head = ctx.mdl_buf.get(); // can be a chain of partial MDLs
+		NT_ASSERT(!ctx.mdl_buf.next());
 	} else if (auto &chain = ctx.mdl_buf) { // isoch IN
 		auto t = tail(chain);
 		t->Next = ctx.mdl_isoc.get();
@@ -620,14 +620,72 @@ PAGED auto recv_usbip_header(_Inout_ wsk_context &ctx)
 	return validate_header(ctx.hdr) ? STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
 }
 
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto set_priority(_Inout_ device_ctx &dev, _In_ recv_policy::level lvl)
+{
+	PAGED_CODE();
+
+	auto prio = get_vhci_ctx(dev.vhci)->recv_priority[int(lvl)];
+	auto old = KeSetPriorityThread(KeGetCurrentThread(), prio);
+
+	TraceDbg("dev %04x, level %d, priority %ld -> %ld", ptr04x(get_handle(&dev)), int(lvl), old, prio);
+	return lvl;
+}
+
+/*
+ * The ideal processor is a hint for the scheduler, the thread can run on any processor.
+ * Threads of adjacent ports are spread across NUMA nodes and processors.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void set_ideal_processor(_In_ device_ctx &dev)
+{
+	PAGED_CODE();
+
+	enum { MAX_NODES = 32 };
+	GROUP_AFFINITY affinity[MAX_NODES]{};
+	unsigned int cpus[MAX_NODES]{};
+
+	auto nodes = min(KeQueryHighestNodeNumber() + 1UL, ULONG(MAX_NODES));
+
+	for (USHORT i = 0; i < nodes; ++i) {
+		auto &a = affinity[i];
+		KeQueryNodeActiveAffinity(i, &a, nullptr); // the primary group if a node spans several groups
+		cpus[i] = recv_policy::popcount(a.Mask);
+	}
+
+	auto cpu = recv_policy::get_ideal_processor(dev.port - 1, cpus, nodes);
+	auto &a = affinity[cpu.node];
+
+	auto bit = recv_policy::nth_set_bit(a.Mask, cpu.index);
+	if (bit < 0) {
+		return;
+	}
+
+	PROCESSOR_NUMBER num{ .Group = a.Group, .Number = static_cast<UCHAR>(bit) };
+
+	if (auto err = ZwSetInformationThread(ZwCurrentThread(), ThreadIdealProcessorEx, &num, sizeof(num))) {
+		Trace(TRACE_LEVEL_ERROR, "ZwSetInformationThread(ThreadIdealProcessorEx) %!STATUS!", err);
+	} else {
+		TraceDbg("dev %04x, port %d, node %u, processor %d:%d", 
+			  ptr04x(get_handle(&dev)), dev.port, cpu.node, num.Group, num.Number);
+	}
+}
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED void recv_loop(_Inout_ device_ctx &dev, _Inout_ wsk_context &ctx)
 {
 	PAGED_CODE();
+	auto applied = set_priority(dev, dev.recv_level);
 
 	for (NTSTATUS status{}; !(status || dev.unplugged || recv_usbip_header(ctx)); ) {
 
+		if (auto lvl = dev.recv_level; lvl != applied) { // interfaces were selected
+			applied = set_priority(dev, lvl);
+		}
+
 		NT_ASSERT(!ctx.request); // must be completed and zeroed on every loop
 		ctx.request = ret_command(ctx);
 
@@ -659,8 +717,8 @@ PAGED void usbip::recv_thread_function(_In_ void *context)
 	auto device = static_cast<UDECXUSBDEVICE>(context);
 	TraceDbg("dev %04x", ptr04x(device));
 
-	//KeSetPriorityThread(KeGetCurrentThread(), LOW_REALTIME_PRIORITY);
 	auto dev = get_device_ctx(device);
+	set_ideal_processor(*dev);
 
 	if (auto ctx = alloc_wsk_context(dev, WDF_NO_HANDLE)) {
 		recv_loop(*dev, *ctx);
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#if defined(_M_X64) || defined(__SSE2__)
+  #include <emmintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__)
+  #include <arm_neon.h>
+#endif
+
+/*
+ * Fast path of UTF-8 <-> UTF-16 conversion for ASCII strings, which are the most of them
+ * (hostnames, busids, hardware ids). Sixteen characters are converted at a time.
+ * The caller converts the rest of the string by the full converter, if any.
+ * The rest starts at the character boundary because all the preceding characters are ASCII.
+ *
+ * It does not depend on WDK and Windows SDK, can be used on any platform as is.
+ * CharT is a code unit of UTF-16 (wchar_t on Windows, char16_t on other platforms).
+ */
+namespace usbip::ascii
+{
+
+/*
+ * @param dst must have room for len characters
+ * @return the number of converted characters, less than len if src[result] is not ASCII
+ */
+template<typename CharT>
+inline size_t widen(CharT *dst, const char *src, size_t len) noexcept
+{
+        static_assert(sizeof(CharT) == 2);
+        size_t i = 0;
+
+        for ( ; i + 16 <= len; i += 16) {
+#if defined(_M_X64) || defined(__SSE2__)
+                auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                if (_mm_movemask_epi8(v)) { // the most significant bit is set
+                        break;
+                }
+
+                auto zero = _mm_setzero_si128();
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8(v, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpackhi_epi8(v, zero));
+#elif defined(_M_ARM64) || defined(__aarch64__)
+                auto v = vld1q_u8(reinterpret_cast<const uint8_t*>(src + i));
+                if (vmaxvq_u8(v) & 0x80) {
+                        break;
+                }
+
+                vst1q_u16(reinterpret_cast<uint16_t*>(dst + i), vmovl_u8(vget_low_u8(v)));
+                vst1q_u16(reinterpret_cast<uint16_t*>(dst + i + 8), vmovl_u8(vget_high_u8(v)));
+#else
+                break;
+#endif
+        }
+
+        for ( ; i < len; ++i) {
+                auto c = static_cast<unsigned char>(src[i]);
+                if (c & 0x80) {
+                        break;
+                }
+                dst[i] = static_cast<CharT>(c);
+        }
+
+        return i;
+}
+
+/*
+ * @param dst must have room for len characters
+ * @return the number of converted characters, less than len if src[result] is not ASCII
+ */
+template<typename CharT>
+inline size_t narrow(char *dst, const CharT *src, size_t len) noexcept
+{
+        static_assert(sizeof(CharT) == 2);
+        size_t i = 0;
+
+        for ( ; i + 16 <= len; i += 16) {
+#if defined(_M_X64) || defined(__SSE2__)
+                auto lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                auto hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+
+                auto high_bits = _mm_and_si128(_mm_or_si128(lo, hi), _mm_set1_epi16(short(0xFF80)));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi16(high_bits, _mm_setzero_si128())) != 0xFFFF) {
+                        break;
+                }
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+#elif defined(_M_ARM64) || defined(__aarch64__)
+                auto lo = vld1q_u16(reinterpret_cast<const uint16_t*>(src + i));
+                auto hi = vld1q_u16(reinterpret_cast<const uint16_t*>(src + i + 8));
+
+                if (vmaxvq_u16(vorrq_u16(lo, hi)) > 0x7F) {
+                        break;
+                }
+
+                vst1q_u8(reinterpret_cast<uint8_t*>(dst + i), vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+#else
+                break;
+#endif
+        }
+
+        for ( ; i < len; ++i) {
+                auto c = static_cast<unsigned int>(src[i]);
+                if (c > 0x7F) {
+                        break;
+                }
+                dst[i] = static_cast<char>(c);
+        }
+
+        return i;
+}
+
+} // namespace usbip::ascii
@@ -6,6 +6,13 @@ namespace usbip
 constexpr auto &tcp_port = "3240";
 constexpr auto &driver_filename = L"usbip2_ude"; // used by filter driver
 constexpr auto &persistent_devices_value_name = L"PersistentDevices";
+constexpr auto &usb2_ports_value_name = L"Usb2Ports"; // REG_DWORD, the number of roothub ports
+constexpr auto &usb3_ports_value_name = L"Usb3Ports";
+
+// REG_DWORD, priority [1, 31] of receive threads of devices, see recv_policy::level
+constexpr auto &recv_priority_normal_value_name = L"RecvPriorityNormal"; // mass storage, printers, etc.
+constexpr auto &recv_priority_above_normal_value_name = L"RecvPriorityAboveNormal"; // network, serial
+constexpr auto &recv_priority_high_value_name = L"RecvPriorityHigh"; // HID, audio, video
 
 enum op_status_t // op_common.status
 {
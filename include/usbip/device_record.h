@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Compact variable-length record of imported device, see vhci::ioctl::get_changed_devices.
+ * Strings are not zero-terminated, unused bytes of imported_device_location are not stored.
+ * It does not depend on WDK and Windows SDK, can be used on any platform as is.
+ */
+namespace usbip::device_record
+{
+
+enum { ALIGNMENT = 8 };
+enum : unsigned char { REMOVED = 1 }; // header::flags, the port is free
+
+struct header
+{
+        unsigned short size; // of the record including strings and padding, multiple of ALIGNMENT
+        unsigned short port;
+
+        unsigned int devid;
+        int speed; // usb_device_speed
+
+        unsigned short vendor;
+        unsigned short product;
+
+        unsigned short host_len;
+        unsigned char busid_len;
+        unsigned char service_len;
+
+        unsigned char flags;
+        unsigned char reserved[3];
+};
+static_assert(sizeof(header) == 24);
+static_assert(!(sizeof(header) % ALIGNMENT));
+
+struct string
+{
+        const char *data;
+        unsigned int len;
+};
+
+struct fields
+{
+        int port;
+        bool removed;
+
+        unsigned int devid;
+        int speed;
+
+        unsigned short vendor;
+        unsigned short product;
+
+        string busid;
+        string service;
+        string host;
+};
+
+constexpr auto align(unsigned int size)
+{
+        return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1U);
+}
+
+/*
+ * @return the size of the record, zero if a field does not fit into the record
+ */
+constexpr unsigned int get_size(const fields &f)
+{
+        if (f.port <= 0 || f.port > 0xFFFF || f.busid.len > 0xFF || f.service.len > 0xFF || f.host.len > 0xFFFF) {
+                return 0;
+        }
+
+        auto sz = f.removed ? sizeof(header) : align(sizeof(header) + f.busid.len + f.service.len + f.host.len);
+        return sz <= 0xFFFF ? static_cast<unsigned int>(sz) : 0;
+}
+
+namespace detail
+{
+
+constexpr void copy(char *dst, const char *src, unsigned int len)
+{
+        for (unsigned int i = 0; i < len; ++i) {
+                dst[i] = src[i];
+        }
+}
+
+} // namespace detail
+
+/*
+ * @param buf must be aligned to ALIGNMENT
+ * @return the number of bytes written, zero if the buffer is too small or the fields are invalid
+ */
+inline unsigned int encode(void *buf, unsigned long long len, const fields &f)
+{
+        auto size = get_size(f);
+        if (!size || size > len) {
+                return 0;
+        }
+
+        auto &h = *static_cast<header*>(buf);
+
+        h = header {
+                .size = static_cast<unsigned short>(size),
+                .port = static_cast<unsigned short>(f.port),
+                .flags = static_cast<unsigned char>(f.removed ? REMOVED : 0),
+        };
+
+        if (f.removed) {
+                return size;
+        }
+
+        h.devid = f.devid;
+        h.speed = f.speed;
+        h.vendor = f.vendor;
+        h.product = f.product;
+
+        h.busid_len = static_cast<unsigned char>(f.busid.len);
+        h.service_len = static_cast<unsigned char>(f.service.len);
+        h.host_len = static_cast<unsigned short>(f.host.len);
+
+        auto s = reinterpret_cast<char*>(&h + 1);
+        auto end = static_cast<char*>(buf) + size;
+
+        const string strings[] { f.busid, f.service, f.host };
+
+        for (auto &i: strings) {
+                detail::copy(s, i.data, i.len);
+                s += i.len;
+        }
+
+        while (s < end) {
+                *s++ = '\0'; // padding
+        }
+
+        return size;
+}
+
+/*
+ * Strings of the result point into the buffer.
+ * @return the size of the record, zero if the record is malformed or truncated
+ */
+inline unsigned int decode(fields &f, const void *buf, unsigned long long len)
+{
+        if (len < sizeof(header)) {
+                return 0;
+        }
+
+        auto &h = *static_cast<const header*>(buf);
+
+        if (h.size < sizeof(header) || h.size > len || h.size % ALIGNMENT || !h.port) {
+                return 0;
+        }
+
+        f = fields {
+                .port = h.port,
+                .removed = bool(h.flags & REMOVED),
+        };
+
+        if (f.removed) {
+                return h.size;
+        }
+
+        if (sizeof(header) + h.busid_len + h.service_len + h.host_len > h.size) {
+                return 0;
+        }
+
+        f.devid = h.devid;
+        f.speed = h.speed;
+        f.vendor = h.vendor;
+        f.product = h.product;
+
+        auto s = reinterpret_cast<const char*>(&h + 1);
+
+        f.busid = { s, h.busid_len };
+        s += h.busid_len;
+
+        f.service = { s, h.service_len };
+        s += h.service_len;
+
+        f.host = { s, h.host_len };
+
+        return h.size;
+}
+
+} // namespace usbip::device_record
@@ -59,9 +59,15 @@ struct imported_device : imported_device_location, imported_device_properties {}
 
 enum class state { unplugged, connecting, connected, plugged, disconnected, unplugging };
 
+/*
+ * IRP_MJ_READ returns as many records as fit into the buffer, its length must be a multiple of the record's size.
+ */
 struct device_state : base, imported_device
 {
         state state;
+
+        UINT32 seqnum; // of the event for this handle, the first one is 1
+        UINT32 lost; // the number of events dropped before this one, get_imported_devices must be used to resync
 };
 
 } // namespace usbip::vhci
@@ -76,6 +82,10 @@ enum class function { // 12 bit
         get_imported_devices,
         set_persistent,
         get_persistent,
+        set_event_filter,
+        get_changed_devices,
+        set_device_rate,
+        plugin_hardware_batch,
 };
 
 constexpr auto make(function id)
@@ -89,6 +99,10 @@ enum {
         GET_IMPORTED_DEVICES = make(function::get_imported_devices),
         SET_PERSISTENT = make(function::set_persistent),
         GET_PERSISTENT = make(function::get_persistent),
+        SET_EVENT_FILTER = make(function::set_event_filter),
+        GET_CHANGED_DEVICES = make(function::get_changed_devices),
+        SET_DEVICE_RATE = make(function::set_device_rate),
+        PLUGIN_HARDWARE_BATCH = make(function::plugin_hardware_batch),
 };
 
 struct plugin_hardware : base, imported_device_location {};
@@ -98,6 +112,17 @@ struct plugout_hardware : base
         int port; // all ports if <= 0
 };
 
+/*
+ * Optional output of PLUGOUT_HARDWARE, a record for each device that was detached by the call.
+ * As many records are returned as fit into the output buffer.
+ */
+struct plugout_hardware_time
+{
+        int port;
+        UINT32 ms; // from the initiation of the detach till its completion or till the end of the wait
+        UINT32 completed; // zero if the device is still detaching after the timeout of the call
+};
+
 struct get_imported_devices : base
 {
         imported_device devices[ANYSIZE_ARRAY];
@@ -108,4 +133,65 @@ constexpr auto get_imported_devices_size(_In_ ULONG n)
         return offsetof(get_imported_devices, devices) + n*sizeof(*get_imported_devices::devices);
 }
 
+/*
+ * Applies to IRP_MJ_READ of the same handle, events that do not match are not queued.
+ * Zeroed filter matches any event.
+ */
+struct set_event_filter : base
+{
+        UINT64 ports[4]; // bit (port - 1), empty set matches any port
+        UINT32 states; // bit (vhci::state), empty set matches any state
+        char host[sizeof(imported_device_location::host)]; // case-insensitive, empty string matches any host
+};
+
+/*
+ * Output is this header followed by "count" records of ports that were changed since the given generation,
+ * see usbip/device_record.h. Generations of different loads of the driver are not comparable.
+ * All imported devices are returned if the generation is zero or the epoch is not the current one,
+ * the caller must discard the devices it has got before.
+ * STATUS_BUFFER_TOO_SMALL is returned if the records do not fit into the output buffer.
+ */
+struct get_changed_devices : base
+{
+        UINT64 epoch; // IN: of the previous call, zero for the first one; OUT: unique for each load of the driver
+        UINT64 generation; // IN: of the previous call; OUT: current, the same if nothing has changed
+        UINT32 count; // OUT: the number of records
+        UINT32 reserved;
+};
+static_assert(sizeof(get_changed_devices) % 8 == 0); // device_record::ALIGNMENT
+
+/*
+ * Limits the rate of sending to a server, applies to the devices that are currently imported.
+ * Bulk transfers wait for the tokens, transfers of other types are not delayed and borrow the tokens.
+ */
+struct set_device_rate : base
+{
+        int port; // all ports if <= 0
+        UINT32 rate; // bytes per second, zero removes the limit
+        UINT32 burst; // bytes, zero selects the default
+};
+
+/*
+ * Attaches the devices as PLUGIN_HARDWARE does, but simultaneously.
+ * Devices of the same host and service share the result of name resolution,
+ * the first of them is attached before the others.
+ * The output buffer is the input one, the result of each device is in its entry.
+ */
+struct plugin_hardware_batch_entry : imported_device_location
+{
+        LONG status; // OUT, NTSTATUS
+};
+
+struct plugin_hardware_batch : base
+{
+        UINT32 count; // IN, of entries
+        UINT32 max_inflight; // IN, the number of simultaneous attaches, zero selects the default
+        plugin_hardware_batch_entry entries[ANYSIZE_ARRAY];
+};
+
+constexpr auto plugin_hardware_batch_size(_In_ ULONG n)
+{
+        return offsetof(plugin_hardware_batch, entries) + n*sizeof(*plugin_hardware_batch::entries);
+}
+
 } // namespace usbip::vhci::ioctl
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/ascii.h>
+#include "check.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+
+namespace
+{
+
+using namespace usbip;
+
+/*
+ * One character at a time, as the fallback of ascii.h.
+ */
+template<typename DstT, typename SrcT>
+size_t convert(DstT *dst, const SrcT *src, size_t len)
+{
+        for (size_t i = 0; i < len; ++i) {
+                auto c = static_cast<unsigned int>(static_cast<std::make_unsigned_t<SrcT>>(src[i]));
+                if (c > 0x7F) {
+                        return i;
+                }
+                dst[i] = static_cast<DstT>(c);
+        }
+
+        return len;
+}
+
+/*
+ * Random strings with at most one non-ASCII character at a random position, the rest of the output is not touched.
+ */
+void random_strings()
+{
+        std::mt19937 rnd(1);
+
+        for (int iter = 0; iter < 200'000; ++iter) {
+                auto len = size_t(rnd() % 80);
+                auto bad = len && rnd() % 2 ? rnd() % len : len;
+
+                std::string s(len, '\0');
+                for (auto &c: s) {
+                        c = char(rnd() % 0x80);
+                }
+                if (bad < len) {
+                        s[bad] = char(0x80 | rnd());
+                }
+
+                std::u16string w(len + 1, u'?');
+                CHECK(ascii::widen(w.data(), s.data(), len) == bad);
+
+                std::u16string ref(len + 1, u'?');
+                CHECK(convert(ref.data(), s.data(), len) == bad);
+                CHECK(std::u16string_view(w).substr(0, bad) == std::u16string_view(ref).substr(0, bad));
+                CHECK(w[bad] == u'?');
+
+                for (auto &c: w) {
+                        c = char16_t(rnd() % 0x80);
+                }
+                if (bad < len) {
+                        w[bad] = char16_t(0x80 + rnd() % 0xFF80);
+                }
+
+                std::string n(len + 1, '?');
+                CHECK(ascii::narrow(n.data(), w.data(), len) == bad);
+
+                std::string nref(len + 1, '?');
+                CHECK(convert(nref.data(), w.data(), len) == bad);
+                CHECK(std::string_view(n).substr(0, bad) == std::string_view(nref).substr(0, bad));
+                CHECK(n[bad] == '?');
+        }
+}
+
+/*
+ * A typical hardware id and a hostname.
+ */
+void benchmark()
+{
+        using namespace std::chrono;
+        constexpr int N = 1'000'000;
+
+        std::string s = "USB\\VID_1234&PID_5678&REV_0100 usbip-server.example.com:3240";
+        std::u16string w(s.size(), u'\0');
+
+        volatile size_t sink{};
+
+        auto t0 = steady_clock::now();
+        for (int i = 0; i < N; ++i) {
+                sink = ascii::widen(w.data(), s.data() + (sink & 0), s.size());
+        }
+        auto t1 = steady_clock::now();
+        for (int i = 0; i < N; ++i) {
+                sink = convert(w.data(), s.data() + (sink & 0), s.size());
+        }
+        auto t2 = steady_clock::now();
+        for (int i = 0; i < N; ++i) {
+                sink = ascii::narrow(s.data(), w.data() + (sink & 0), w.size());
+        }
+        auto t3 = steady_clock::now();
+        for (int i = 0; i < N; ++i) {
+                sink = convert(s.data(), w.data() + (sink & 0), w.size());
+        }
+        auto t4 = steady_clock::now();
+
+        auto ns = [] (auto d) { return duration<double, std::nano>(d).count()/N; };
+
+        std::printf("%zu characters: widen %.1f ns, narrow %.1f ns; one at a time %.1f ns and %.1f ns\n",
+                    s.size(), ns(t1 - t0), ns(t3 - t2), ns(t2 - t1), ns(t4 - t3));
+}
+
+} // namespace
+
+
+int main()
+{
+        random_strings();
+        benchmark();
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "async.h"
+#include "check.h"
+
+#include <thread>
+#include <deque>
+#include <random>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+
+/*
+ * Completions are dequeued by several threads, as from I/O completion port.
+ */
+class fake_port
+{
+public:
+        explicit fake_port(int threads)
+        {
+                for (int i = 0; i < threads; ++i) {
+                        m_threads.emplace_back([this] { run(); });
+                }
+        }
+
+        ~fake_port()
+        {
+                {
+                        std::lock_guard lck(m_mtx);
+                        m_stop = true;
+                }
+                m_cv.notify_all();
+        }
+
+        void post(std::function<void()> f)
+        {
+                {
+                        std::lock_guard lck(m_mtx);
+                        m_queue.push_back(std::move(f));
+                }
+                m_cv.notify_one();
+        }
+
+private:
+        std::mutex m_mtx;
+        std::condition_variable m_cv;
+        std::deque<std::function<void()>> m_queue;
+        bool m_stop{};
+        std::vector<std::jthread> m_threads; // must be the last member
+
+        void run();
+};
+
+void fake_port::run()
+{
+        for (std::unique_lock lck(m_mtx); ; ) {
+                m_cv.wait(lck, [this] { return m_stop || !m_queue.empty(); });
+                if (m_queue.empty()) {
+                        break;
+                }
+
+                auto f = std::move(m_queue.front());
+                m_queue.pop_front();
+
+                lck.unlock();
+                f();
+                lck.lock();
+        }
+}
+
+void counter()
+{
+        async::counter cnt;
+        CHECK(!cnt.size());
+        cnt.wait();
+
+        cnt.add();
+        cnt.add();
+        CHECK(cnt.size() == 2);
+
+        std::jthread t([&cnt] { cnt.remove(); cnt.remove(); });
+        cnt.wait();
+        CHECK(!cnt.size());
+}
+
+/*
+ * Every operation must be started once, the window must not be exceeded,
+ * exactly one call of run/complete must report that the batch is done.
+ */
+void random_batches()
+{
+        std::mt19937 rnd(7);
+
+        for (int iter = 0; iter < 3000; ++iter) {
+
+                size_t count = rnd() % 50;
+                size_t window = rnd() % 8;
+                unsigned int sync_pct = rnd() % 3 ? 0 : rnd() % 100; // operations that complete synchronously
+
+                async::counter pending;
+
+                std::vector<std::atomic<int>> started(count);
+                std::atomic<size_t> inflight{};
+                std::atomic<size_t> peak{};
+                std::atomic<size_t> done{};
+                std::atomic<int> finished{};
+                std::atomic<unsigned int> seed{ unsigned(rnd()) };
+
+                fake_port port(1 + rnd() % 4); // is destroyed first
+
+                struct context { std::unique_ptr<async::batch> batch; };
+                auto ctx = std::make_shared<context>();
+
+                auto start = [&, weak = std::weak_ptr(ctx)] (size_t idx)
+                {
+                        auto self = weak.lock(); // the batch is alive while its operations are
+                        CHECK(self);
+
+                        ++started[idx];
+
+                        auto cur = ++inflight;
+                        for (auto p = peak.load(); cur > p && !peak.compare_exchange_weak(p, cur); );
+
+                        if ((seed.fetch_add(2654435761U) >> 8) % 100 < sync_pct) {
+                                --inflight;
+                                ++done;
+                                return false;
+                        }
+
+                        pending.add();
+                        port.post([&, self]
+                        {
+                                --inflight;
+                                ++done;
+                                if (self->batch->complete()) {
+                                        ++finished;
+                                }
+                                pending.remove();
+                        });
+
+                        return true;
+                };
+
+                ctx->batch = std::make_unique<async::batch>(count, window, start);
+                if (ctx->batch->run()) {
+                        ++finished;
+                }
+                ctx.reset();
+
+                while (done < count) {
+                        std::this_thread::yield();
+                }
+                pending.wait();
+
+                for (auto &n: started) {
+                        CHECK(n == 1);
+                }
+
+                CHECK(peak <= (window ? window : 1));
+                CHECK(finished == 1);
+        }
+}
+
+} // namespace
+
+
+int main()
+{
+        counter();
+        random_batches();
+}
@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "attach_policy.h"
+#include "check.h"
+
+#include <random>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+
+using namespace usbip::attach_policy;
+
+constexpr params p{ .max_inflight = 4, .base_delay = 5000, .max_delay = 30*60*1000 }; // ms, as in persistent.cpp
+
+static_assert(get_delay(p, 1, 0) == 2500);
+static_assert(get_delay(p, 1, 2500) == 5000);
+static_assert(get_delay(p, 2, 0) == 5000);
+static_assert(get_delay(p, 100, ~0U) <= p.max_delay);
+
+void delays()
+{
+        std::mt19937 rnd(1);
+
+        for (unsigned int failures = 1; failures < 40; ++failures) {
+                auto delay = std::min(p.base_delay << std::min(failures - 1, 20U), p.max_delay);
+
+                for (int i = 0; i < 100; ++i) {
+                        auto d = get_delay(p, failures, unsigned(rnd()));
+                        CHECK(d >= delay - delay/2 && d <= delay); // equal jitter
+                }
+        }
+
+        constexpr params zero{ .max_inflight = 1, .base_delay = 0, .max_delay = 0 };
+        CHECK(!get_delay(zero, 5, 123));
+}
+
+void probing()
+{
+        host_state h{};
+
+        CHECK(can_start(p, h, 0, 1));
+        CHECK(!can_start(p, h, p.max_inflight, 1));
+
+        on_start(h);
+        on_start(h);
+        CHECK(can_start(p, h, 2, 1)); // the host has not failed yet
+
+        on_failure(p, h, 10, 0);
+        CHECK(h.failures == 1 && h.not_before == 10 + 2500);
+
+        on_failure(p, h, 20, 0); // simultaneous failure is counted once
+        CHECK(h.failures == 1 && h.not_before == 10 + 2500);
+        CHECK(!h.inflight);
+
+        CHECK(!can_start(p, h, 0, h.not_before - 1));
+        CHECK(can_start(p, h, 0, h.not_before));
+
+        on_start(h);
+        CHECK(!can_start(p, h, 1, h.not_before)); // a single probe of a failed host
+
+        on_success(h);
+        CHECK(!h.failures && !h.inflight && !h.not_before);
+        CHECK(can_start(p, h, 0, 1));
+}
+
+/*
+ * 16 devices of 4 hosts. "up" is online from the start, "late" comes online at 60 s,
+ * "dead" never answers and its connect times out in 10 s. A failed attach takes 10 ms if the host refuses it.
+ * Prints when the devices were attached by the previous sequential loop with a round-wide delay and by attach_policy.
+ */
+enum host_kind { up, late, dead };
+
+struct host
+{
+        host_kind kind;
+        host_state state{};
+        unsigned long long attached_at{}; // of the last device, ms
+        unsigned int attempts{};
+};
+
+constexpr unsigned long long END = 30*60*1000;
+constexpr unsigned long long LATE = 60*1000;
+
+auto is_online(const host &h, unsigned long long now)
+{
+        return h.kind == up || (h.kind == late && now >= LATE);
+}
+
+auto attach_time(const host &h, unsigned long long now)
+{
+        return is_online(h, now) ? 100ULL : h.kind == dead ? 10'000ULL : 10ULL;
+}
+
+auto make_hosts()
+{
+        return std::vector<host>{ {up}, {dead}, {late}, {up} };
+}
+
+auto make_devices(size_t hosts)
+{
+        std::vector<size_t> v; // index of the host
+
+        for (int i = 0; i < 4; ++i) {
+                for (size_t h = 0; h < hosts; ++h) {
+                        v.push_back(h);
+                }
+        }
+
+        return v;
+}
+
+/*
+ * See get_delay in persistent.cpp before attach_policy.
+ */
+void sequential(std::vector<host> &hosts)
+{
+        auto devices = make_devices(hosts.size());
+        unsigned long long now = 0;
+
+        for (unsigned int attempt = 1; !devices.empty() && now < END; ++attempt) {
+
+                auto cnt = unsigned(devices.size());
+                now += attempt > 1 ? std::min(10*attempt/cnt, 30*60U)*1000ULL : 0;
+
+                std::erase_if(devices, [&hosts, &now] (auto idx)
+                {
+                        auto &h = hosts[idx];
+                        ++h.attempts;
+
+                        auto ok = is_online(h, now);
+                        now += attach_time(h, now);
+
+                        if (ok) {
+                                h.attached_at = now;
+                        }
+                        return ok;
+                });
+        }
+}
+
+void parallel(std::vector<host> &hosts)
+{
+        struct device
+        {
+                size_t host;
+                bool attached{};
+                unsigned long long done_at{}; // zero if not in flight
+        };
+
+        std::vector<device> devices;
+        for (auto idx: make_devices(hosts.size())) {
+                devices.push_back({ .host = idx });
+        }
+
+        std::mt19937 rnd(1);
+        unsigned int inflight = 0;
+
+        for (unsigned long long now = 1; now < END; now += 10) {
+
+                for (auto &d: devices) {
+                        if (!d.done_at || d.done_at > now) {
+                                continue;
+                        }
+
+                        auto &h = hosts[d.host];
+                        --inflight;
+                        d.done_at = 0;
+
+                        if (is_online(h, now)) {
+                                on_success(h.state);
+                                d.attached = true;
+                                h.attached_at = now;
+                        } else {
+                                on_failure(p, h.state, now, unsigned(rnd()));
+                        }
+                }
+
+                for (auto &d: devices) {
+                        auto &h = hosts[d.host];
+
+                        if (d.attached || d.done_at || !can_start(p, h.state, inflight, now)) {
+                                continue;
+                        }
+
+                        CHECK(!h.state.failures || !h.state.inflight);
+                        on_start(h.state);
+
+                        ++inflight;
+                        ++h.attempts;
+                        d.done_at = now + attach_time(h, now);
+                }
+
+                CHECK(inflight <= p.max_inflight);
+        }
+}
+
+void simulation()
+{
+        const char *names[] { "up", "late", "dead" };
+
+        auto seq = make_hosts();
+        sequential(seq);
+
+        auto par = make_hosts();
+        parallel(par);
+
+        for (size_t i = 0; i < seq.size(); ++i) {
+                std::printf("host %zu (%s): attached at %7.1f s and %5.1f s, %3u and %2u attempts\n",
+                            i, names[seq[i].kind], seq[i].attached_at/1000.0, par[i].attached_at/1000.0,
+                            seq[i].attempts, par[i].attempts);
+
+                switch (par[i].kind) {
+                case up:
+                        CHECK(par[i].attached_at < 11'000); // a dead host delays it by one connect timeout at most
+                        CHECK(par[i].attached_at < seq[i].attached_at);
+                        break;
+                case late:
+                        CHECK(par[i].attached_at >= LATE && par[i].attached_at < 3*LATE); // the backoff has reached 40..80 s
+                        break;
+                case dead:
+                        CHECK(!par[i].attached_at);
+                        CHECK(par[i].attempts < 20); // ~log2(END/base_delay) probes
+                        break;
+                }
+        }
+}
+
+} // namespace
+
+
+int main()
+{
+        delays();
+        probing();
+        simulation();
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "batch_policy.h"
+#include "check.h"
+
+#include <vector>
+#include <random>
+#include <algorithm>
+
+namespace
+{
+
+using namespace usbip::batch_policy;
+
+static_assert([] { entry v[3]{}; return make_groups(v, 3, [] (auto, auto) { return true; }); }() == 1);
+static_assert([] { entry v[3]{}; return make_groups(v, 3, [] (auto, auto) { return false; }); }() == 3);
+
+/*
+ * Runs random batches with random completions and failures of the leaders.
+ */
+void random_batches()
+{
+        enum { HOSTS = 4 };
+
+        for (unsigned int seed = 0; seed < 2000; ++seed) {
+
+                std::mt19937 rnd(seed);
+
+                unsigned int cnt = rnd() % 20;
+                unsigned int max_inflight = 1 + rnd() % 5;
+
+                std::vector<unsigned int> host(cnt);
+                for (auto &h: host) {
+                        h = rnd() % HOSTS;
+                }
+
+                std::vector<entry> v(cnt);
+                auto groups = make_groups(v.data(), cnt, [&host] (auto i, auto j) { return host[i] == host[j]; });
+
+                auto hosts = host;
+                std::ranges::sort(hosts);
+                CHECK(groups == std::ranges::distance(hosts.begin(), std::unique(hosts.begin(), hosts.end())));
+
+                std::vector<bool> failed(HOSTS);
+                std::vector<unsigned int> active;
+                unsigned int done = 0;
+
+                while (done < cnt) {
+                        for (unsigned int i; (i = next(v.data(), cnt, unsigned(active.size()), max_inflight)) != cnt; ) {
+                                auto &e = v[i];
+                                CHECK(e.state == state::waiting);
+
+                                if (!is_leader(v.data(), i)) { // waits for the leader
+                                        CHECK(v[e.leader].state == state::done);
+                                        CHECK(!failed[host[i]]);
+                                }
+
+                                e.state = state::inflight;
+                                active.push_back(i);
+                                CHECK(active.size() <= max_inflight);
+                        }
+
+                        CHECK(!active.empty());
+
+                        auto k = rnd() % active.size();
+                        auto i = active[k];
+                        active.erase(active.begin() + k);
+
+                        v[i].state = state::done;
+                        ++done;
+
+                        if (is_leader(v.data(), i) && !(rnd() % 3)) {
+                                failed[host[i]] = true;
+                                done += skip_group(v.data(), cnt, i, [&host, i] (auto j) { CHECK(host[j] == host[i]); });
+                        }
+                }
+
+                CHECK(std::ranges::all_of(v, [] (auto &e) { return e.state == state::done; }));
+        }
+}
+
+} // namespace
+
+
+int main()
+{
+        random_batches();
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "cache.h"
+#include "check.h"
+
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using namespace std::chrono_literals;
+
+struct fake_clock
+{
+        using duration = std::chrono::milliseconds;
+        using rep = duration::rep;
+        using period = duration::period;
+        using time_point = std::chrono::time_point<fake_clock>;
+        static constexpr bool is_steady = true;
+};
+
+using store = usbip::cache::store<int, fake_clock>;
+
+auto value(int v) { return std::make_shared<const int>(v); }
+
+void expiry()
+{
+        store s(100ms, 100ms); // no refresh
+        fake_clock::time_point t{ 1s };
+
+        CHECK(s.ttl() == 100ms);
+        CHECK(!s.get("a", t));
+
+        s.put("a", value(1), t);
+        CHECK(*s.get("a", t + 99ms) == 1);
+        CHECK(!s.get("a", t + 100ms));
+        CHECK(!s.get("a", t)); // has been erased
+
+        s.put("a", value(1), t);
+        s.put("a", value(2), t - 1ms); // older, ignored
+        CHECK(*s.get("a", t) == 1);
+        s.put("a", value(3), t + 1ms);
+        CHECK(*s.get("a", t) == 3);
+
+        int cnt = 0;
+        s.put("b", value(4), t - 50ms);
+        s.for_each(t + 60ms, [&cnt] (auto&, auto&, auto) { ++cnt; }); // "b" has expired
+        CHECK(cnt == 1);
+
+        s.erase("a");
+        CHECK(!s.get("a", t));
+
+        s.clear();
+        CHECK(!s.get("b", t));
+}
+
+void refresh_ahead()
+{
+        store s(100ms, 50ms);
+        fake_clock::time_point t{ 1s };
+
+        std::stop_source stop;
+
+        s.put("a", value(1), t);
+        CHECK(*s.get("a", t + 49ms) == 1);
+        CHECK(*s.get("a", t + 50ms) == 1); // queued
+        CHECK(*s.get("a", t + 60ms) == 1); // not queued twice
+
+        auto v = s.wait_pending(stop.get_token());
+        CHECK(v.size() == 1 && v[0].key == "a");
+
+        CHECK(!s.get("a", t + 100ms)); // expired, the entry is kept for the refresher
+
+        s.refreshed(v[0], value(2), t + 110ms);
+        CHECK(*s.get("a", t + 120ms) == 2);
+
+        CHECK(*s.get("a", t + 170ms) == 2); // queued again
+        v = s.wait_pending(stop.get_token());
+        CHECK(v.size() == 1);
+
+        s.refreshed(v[0], nullptr, t + 170ms); // failed
+        CHECK(*s.get("a", t + 171ms) == 2);
+        CHECK(s.wait_pending(stop.get_token()).size() == 1); // queued by the previous get
+
+        stop.request_stop();
+        CHECK(s.wait_pending(stop.get_token()).empty());
+}
+
+/*
+ * The result of a refresh is dropped if the entry has been erased or replaced after it was queued.
+ */
+void stale_refresh()
+{
+        store s(100ms, 50ms);
+        fake_clock::time_point t{ 1s };
+
+        std::stop_source stop;
+
+        s.put("a", value(1), t);
+        s.get("a", t + 60ms);
+        auto v = s.wait_pending(stop.get_token());
+
+        s.erase("a");
+        s.refreshed(v[0], value(2), t + 70ms);
+        CHECK(!s.get("a", t + 71ms));
+
+        s.put("b", value(1), t);
+        s.get("b", t + 60ms);
+        v = s.wait_pending(stop.get_token());
+
+        s.put("b", value(3), t + 65ms); // replaced
+        s.refreshed(v[0], value(2), t + 70ms);
+        CHECK(*s.get("b", t + 71ms) == 3);
+
+        s.put("c", value(1), t);
+        s.get("c", t + 60ms);
+        s.erase("c"); // removes the queued refresh
+        s.put("c", value(1), t + 60ms);
+
+        stop.request_stop();
+        CHECK(s.wait_pending(stop.get_token()).empty());
+}
+
+/*
+ * Readers, writers and the refresher on the real clock, run it under ThreadSanitizer.
+ */
+void concurrency()
+{
+        using namespace std::chrono;
+        usbip::cache::store<int> s(20ms, 5ms);
+
+        std::atomic<int> refreshed{};
+        std::atomic<int> hits{};
+
+        std::jthread refresher([&s, &refreshed] (std::stop_token stop)
+        {
+                while (!stop.stop_requested()) {
+                        for (auto &r: s.wait_pending(stop)) {
+                                auto ok = refreshed++ % 3;
+                                s.refreshed(r, ok ? value(1) : nullptr, steady_clock::now());
+                        }
+                }
+        });
+
+        {
+                std::vector<std::jthread> threads;
+
+                for (int i = 0; i < 8; ++i) {
+                        threads.emplace_back([&s, &hits, i]
+                        {
+                                for (int j = 0; j < 200'000; ++j) {
+                                        auto key = std::to_string((i + j) % 16);
+
+                                        if (auto p = s.get(key, steady_clock::now())) {
+                                                CHECK(*p == 1);
+                                                ++hits;
+                                        } else {
+                                                s.put(key, value(1), steady_clock::now());
+                                        }
+
+                                        if (!(j % 50'000)) {
+                                                s.erase(key);
+                                        }
+                                }
+                        });
+                }
+        }
+
+        std::printf("hits %d, refreshes %d\n", hits.load(), refreshed.load());
+        CHECK(hits);
+}
+
+} // namespace
+
+
+int main()
+{
+        expiry();
+        refresh_ahead();
+        stale_refresh();
+        concurrency();
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "chain_range.h"
+#include "check.h"
+
+#include <vector>
+#include <random>
+
+namespace
+{
+
+using namespace usbip;
+
+struct node
+{
+        node *next;
+        unsigned long long size;
+        unsigned long long start; // offset in the chain
+};
+
+struct range
+{
+        const node *n;
+        unsigned long long offset;
+        unsigned long long length;
+};
+
+auto make_chain(std::vector<node> &v)
+{
+        unsigned long long start = 0;
+
+        for (size_t i = 0; i < v.size(); ++i) {
+                v[i].next = i + 1 < v.size() ? &v[i + 1] : nullptr;
+                v[i].start = start;
+                start += v[i].size;
+        }
+
+        return v.empty() ? nullptr : v.data();
+}
+
+auto get_ranges(node *head, unsigned long long offset, unsigned long long length, std::vector<range> &out)
+{
+        out.clear();
+
+        return for_each_range(head, offset, length,
+                [] (auto n) { return n->next; },
+                [] (auto n) { return n->size; },
+                [&out] (auto n, auto off, auto len) { out.push_back({ n, off, len }); return true; });
+}
+
+constexpr bool stops_if_f_fails()
+{
+        struct item { const item *next; unsigned int size; };
+        item c{ nullptr, 4 }, b{ &c, 4 }, a{ &b, 4 };
+
+        int calls = 0;
+        const item *head = &a;
+
+        auto ok = for_each_range(head, 2, 8, [] (auto n) { return n->next; }, [] (auto n) { return n->size; },
+                                 [&calls] (auto, auto, auto) { return ++calls < 2; });
+
+        return !ok && calls == 2;
+}
+static_assert(stops_if_f_fails());
+
+void fixed()
+{
+        std::vector<node> v(5);
+        for (size_t i = 0; auto sz: {0, 10, 0, 5, 20}) {
+                v[i++].size = sz;
+        }
+        auto head = make_chain(v);
+
+        std::vector<range> r;
+
+        CHECK(get_ranges(head, 0, 35, r));
+        CHECK(r.size() == 3); // empty nodes are skipped
+
+        CHECK(get_ranges(head, 8, 4, r)); // crosses the boundary
+        CHECK(r.size() == 2);
+        CHECK(r[0].n == &v[1] && r[0].offset == 8 && r[0].length == 2);
+        CHECK(r[1].n == &v[3] && !r[1].offset && r[1].length == 2);
+
+        CHECK(get_ranges(head, 10, 5, r)); // exactly one node
+        CHECK(r.size() == 1 && r[0].n == &v[3] && !r[0].offset && r[0].length == 5);
+
+        CHECK(get_ranges(head, 35, 0, r) && r.empty());
+        CHECK(!get_ranges(head, 30, 6, r)); // too short
+        CHECK(!get_ranges(head, 40, 1, r));
+        CHECK(!get_ranges(nullptr, 0, 1, r));
+        CHECK(get_ranges(nullptr, 0, 0, r));
+}
+
+/*
+ * The ranges must cover [offset, offset + length) of the chain contiguously.
+ */
+void random_chains()
+{
+        std::mt19937 rnd(1);
+        std::vector<range> r;
+
+        for (int i = 0; i < 20'000; ++i) {
+
+                std::vector<node> v(rnd() % 6);
+                unsigned long long total = 0;
+
+                for (auto &n: v) {
+                        n.size = rnd() % 3 ? rnd() % 16 : 0;
+                        total += n.size;
+                }
+
+                auto head = make_chain(v);
+
+                unsigned long long offset = rnd() % (total + 4);
+                unsigned long long length = rnd() % (total + 4);
+
+                auto ok = get_ranges(head, offset, length, r);
+                CHECK(ok == (!length || offset + length <= total)); // nodes are not walked for an empty range
+
+                auto pos = offset;
+                for (auto &x: r) {
+                        CHECK(x.length && x.offset + x.length <= x.n->size);
+                        CHECK(x.n->start + x.offset == pos);
+                        pos += x.length;
+                }
+
+                CHECK(pos == (ok ? offset + length : std::max(offset, total)));
+        }
+}
+
+} // namespace
+
+
+int main()
+{
+        fixed();
+        random_chains();
+}
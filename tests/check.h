@@ -0,0 +1,14 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+/*
+ * The same as assert, but it is not disabled by NDEBUG.
+ */
+#define CHECK(expr) \
+        ((expr) ? (void)0 : (std::fprintf(stderr, "%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #expr), std::abort()))
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/device_record.h>
+#include "check.h"
+
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+namespace
+{
+
+using namespace usbip::device_record;
+
+auto str(const std::string &s) { return string{ s.data(), unsigned(s.size()) }; }
+auto str(const string &s) { return std::string(s.data, s.len); }
+
+auto make_fields(const std::string &busid, const std::string &service, const std::string &host)
+{
+        return fields {
+                .port = 5, .removed = false, .devid = 0x10002, .speed = 3, .vendor = 0x1d6b, .product = 2,
+                .busid = str(busid), .service = str(service), .host = str(host)
+        };
+}
+
+void sizes()
+{
+        CHECK(get_size(make_fields("1-1", "3240", "host")) == 24 + 16); // 11 bytes of strings are padded
+        CHECK(get_size(make_fields("", "", "")) == sizeof(header));
+
+        auto f = make_fields("1-1", "3240", "host");
+        f.removed = true;
+        CHECK(get_size(f) == sizeof(header));
+
+        f.removed = false;
+        f.port = 0;
+        CHECK(!get_size(f));
+        f.port = 0x10000;
+        CHECK(!get_size(f));
+
+        std::string s(256, 'x');
+        CHECK(!get_size(make_fields(s, "", "")));
+        CHECK(!get_size(make_fields("", s, "")));
+        CHECK(get_size(make_fields("", "", s)));
+        CHECK(!get_size(make_fields("", "", std::string(0xFFFF, 'x')))); // the size does not fit
+}
+
+/*
+ * Random records are packed back-to-back and decoded as GET_CHANGED_DEVICES returns them.
+ */
+void round_trip()
+{
+        std::mt19937 rnd(1);
+
+        auto rand_str = [&rnd] (unsigned int maxlen)
+        {
+                std::string s(rnd() % (maxlen + 1), '\0');
+                for (auto &c: s) {
+                        c = char(rnd());
+                }
+                return s;
+        };
+
+        for (int iter = 0; iter < 1000; ++iter) {
+                std::deque<std::string> strings; // the views of fields must stay valid
+                std::vector<fields> v;
+
+                for (int i = 0, cnt = int(rnd() % 20); i < cnt; ++i) {
+                        auto &busid = strings.emplace_back(rand_str(32));
+                        auto &service = strings.emplace_back(rand_str(32));
+                        auto &host = strings.emplace_back(rand_str(1024));
+
+                        auto f = make_fields(busid, service, host);
+                        f.port = 1 + int(rnd() % 0xFFFF);
+                        f.removed = !(rnd() % 4);
+                        f.devid = unsigned(rnd());
+                        f.speed = int(rnd() % 6);
+                        f.vendor = static_cast<unsigned short>(rnd());
+                        f.product = static_cast<unsigned short>(rnd());
+                        v.push_back(f);
+                }
+
+                std::vector<uint64_t> buf(v.size()*(1024 + 2*32 + 32)/8 + 1); // aligned
+                auto p = reinterpret_cast<char*>(buf.data());
+
+                unsigned long long len = 0;
+                for (auto &f: v) {
+                        auto n = encode(p + len, buf.size()*8 - len, f);
+                        CHECK(n == get_size(f) && !(n % ALIGNMENT));
+                        len += n;
+                }
+
+                size_t i = 0;
+                for (unsigned long long off = 0; off < len; ++i) {
+                        fields f{};
+                        auto n = decode(f, p + off, len - off);
+                        CHECK(n && i < v.size());
+
+                        auto &e = v[i];
+                        CHECK(f.port == e.port && f.removed == e.removed);
+
+                        if (!f.removed) {
+                                CHECK(f.devid == e.devid && f.speed == e.speed);
+                                CHECK(f.vendor == e.vendor && f.product == e.product);
+                                CHECK(str(f.busid) == str(e.busid));
+                                CHECK(str(f.service) == str(e.service));
+                                CHECK(str(f.host) == str(e.host));
+                        }
+
+                        off += n;
+                }
+
+                CHECK(i == v.size());
+        }
+}
+
+void malformed()
+{
+        std::string busid = "1-1", service = "3240", host = "host";
+        auto f = make_fields(busid, service, host);
+
+        alignas(ALIGNMENT) char buf[64];
+        auto n = encode(buf, sizeof(buf), f);
+        CHECK(n == 40);
+
+        CHECK(!encode(buf, n - 1, f)); // too small
+
+        fields out{};
+        CHECK(decode(out, buf, n) == n);
+        CHECK(!decode(out, buf, n - 1)); // truncated
+        CHECK(!decode(out, buf, sizeof(header) - 1));
+
+        auto &h = *reinterpret_cast<header*>(buf);
+
+        auto corrupt = [&buf, n, &out] (auto change)
+        {
+                alignas(ALIGNMENT) char copy[sizeof(buf)];
+                std::memcpy(copy, buf, sizeof(buf));
+                change(*reinterpret_cast<header*>(copy));
+                return !decode(out, copy, n);
+        };
+
+        CHECK(corrupt([] (auto &h) { h.port = 0; }));
+        CHECK(corrupt([] (auto &h) { h.size = 20; }));
+        CHECK(corrupt([] (auto &h) { h.size = 44; })); // is not aligned
+        CHECK(corrupt([] (auto &h) { h.size = 48; })); // beyond the buffer
+        CHECK(corrupt([] (auto &h) { h.host_len = 100; }));
+        CHECK(!corrupt([] (auto &h) { h.host_len = 5; })); // fits into padding
+
+        h.flags = REMOVED; // strings are ignored
+        h.host_len = 0xFFFF;
+        CHECK(decode(out, buf, n) == n && out.removed && out.port == 5);
+}
+
+} // namespace
+
+
+int main()
+{
+        sizes();
+        round_trip();
+        malformed();
+}
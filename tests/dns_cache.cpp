@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "dns_cache.h"
+#include "check.h"
+
+#include <mutex>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip::dns;
+
+using cache_type = cache<int, 4, 3>;
+constexpr params p{ .ttl = 100, .stale_ttl = 1000, .negative_ttl = 10 };
+
+auto make_cache()
+{
+        return std::make_unique<cache_type>(); // zero-initialized
+}
+
+void fresh_and_stale()
+{
+        auto c = make_cache();
+        cache_type::answer ans;
+        bool refresh;
+
+        CHECK(c->lookup("host", "3240", 1, ans, refresh) == result::miss && !ans.cnt && !refresh);
+
+        const int addrs[]{ 1, 2, 3, 4 };
+        c->insert(p, "host", "3240", 1, addrs, 4);
+
+        CHECK(c->lookup("HOST", "3240", 100, ans, refresh) == result::fresh && !refresh); // case-insensitive
+        CHECK(ans.cnt == 3 && ans.addrs[0] == 1 && ans.addrs[2] == 3); // MaxAddresses
+        CHECK(c->lookup("host", "3241", 100, ans, refresh) == result::miss);
+
+        CHECK(c->lookup("host", "3240", 101, ans, refresh) == result::stale && refresh && ans.cnt == 3);
+        CHECK(c->lookup("host", "3240", 102, ans, refresh) == result::stale && !refresh); // one revalidation
+
+        c->cancel_refresh("host", "3240");
+        CHECK(c->lookup("host", "3240", 103, ans, refresh) == result::stale && refresh);
+
+        c->insert_negative(p, "host", "3240", 104, -1); // failed revalidation keeps the stale answer
+        CHECK(c->lookup("host", "3240", 105, ans, refresh) == result::stale && refresh && ans.cnt == 3);
+
+        const int renewed[]{ 5 };
+        c->insert(p, "host", "3240", 106, renewed, 1);
+        CHECK(c->lookup("host", "3240", 107, ans, refresh) == result::fresh && ans.cnt == 1 && ans.addrs[0] == 5);
+
+        CHECK(c->lookup("host", "3240", 106 + p.ttl + p.stale_ttl, ans, refresh) == result::miss); // expired
+        CHECK(c->lookup("host", "3240", 107, ans, refresh) == result::miss); // and removed
+
+        c->insert(p, "host", "3240", 1, addrs, 0); // ignored
+        CHECK(c->lookup("host", "3240", 1, ans, refresh) == result::miss);
+}
+
+void negative()
+{
+        auto c = make_cache();
+        cache_type::answer ans;
+        bool refresh;
+
+        c->insert_negative(p, "bad", "3240", 1, -5);
+        CHECK(c->lookup("bad", "3240", 10, ans, refresh) == result::negative && ans.status == -5 && !ans.cnt);
+        CHECK(c->lookup("bad", "3240", 11, ans, refresh) == result::miss);
+
+        c->insert_negative(p, "bad", "3240", 20, -5);
+        const int addrs[]{ 7 };
+        c->insert(p, "bad", "3240", 21, addrs, 1); // positive answer replaces negative one
+        CHECK(c->lookup("bad", "3240", 22, ans, refresh) == result::fresh && !ans.status);
+
+        c->remove("bad", "3240");
+        CHECK(c->lookup("bad", "3240", 22, ans, refresh) == result::miss);
+}
+
+/*
+ * The server has changed its address, see complete() in vhci_ioctl.cpp.
+ * Unreachable cached addresses are removed and the host is resolved once again.
+ */
+void address_changed()
+{
+        auto c = make_cache();
+        cache_type::answer ans;
+        bool refresh;
+
+        const int addrs[]{ 1 };
+        c->insert(p, "host", "3240", 1, addrs, 1);
+
+        CHECK(c->lookup("host", "3240", 500, ans, refresh) == result::stale && refresh && ans.addrs[0] == 1);
+        c->remove("host", "3240"); // connect has failed for all addresses
+
+        CHECK(c->lookup("host", "3240", 501, ans, refresh) == result::miss);
+
+        const int changed[]{ 2 };
+        c->insert(p, "host", "3240", 502, changed, 1);
+        CHECK(c->lookup("host", "3240", 503, ans, refresh) == result::fresh && ans.addrs[0] == 2);
+}
+
+void eviction()
+{
+        auto c = make_cache();
+        cache_type::answer ans;
+        bool refresh;
+
+        const int addrs[]{ 1 };
+
+        for (int i = 0; i < 4; ++i) {
+                c->insert(p, std::to_string(i).c_str(), "3240", i + 1, addrs, 1);
+        }
+
+        CHECK(c->lookup("0", "3240", 10, ans, refresh) == result::fresh); // "1" is the least recently used now
+        c->insert(p, "4", "3240", 11, addrs, 1);
+
+        CHECK(c->lookup("1", "3240", 12, ans, refresh) == result::miss);
+
+        for (auto host: {"0", "2", "3", "4"}) {
+                CHECK(c->lookup(host, "3240", 12, ans, refresh) == result::fresh);
+        }
+}
+
+/*
+ * Lookups, revalidations and insertions by several threads, the cache is serialized by a lock as in addrinfo_cache.cpp.
+ * Only one thread at a time must be asked to revalidate a stale answer. Run it under ThreadSanitizer.
+ */
+void concurrency()
+{
+        using namespace std::chrono;
+        using big_cache = cache<int, 32, 8>;
+
+        enum { KEYS = 16 };
+        constexpr params cp{ .ttl = 1, .stale_ttl = 60'000'000, .negative_ttl = 1 }; // us
+
+        auto c = std::make_unique<big_cache>();
+        std::mutex lock;
+
+        std::array<std::atomic<bool>, KEYS> refreshing{};
+        std::atomic<int> refreshes{};
+
+        auto t0 = steady_clock::now();
+        auto now = [t0] { return time_type(duration_cast<microseconds>(steady_clock::now() - t0).count()) + 1; };
+
+        std::vector<std::jthread> threads;
+
+        for (int i = 0; i < 8; ++i) {
+                threads.emplace_back([&, i]
+                {
+                        std::mt19937 rnd(i);
+
+                        for (int j = 0; j < 100'000; ++j) {
+                                auto key = int(rnd() % KEYS);
+                                auto host = "host" + std::to_string(key);
+
+                                big_cache::answer ans;
+                                bool refresh{};
+                                result res;
+                                {
+                                        std::lock_guard lck(lock);
+                                        res = c->lookup(host.c_str(), "3240", now(), ans, refresh);
+                                }
+
+                                if (res == result::fresh || res == result::stale) {
+                                        CHECK(ans.cnt == 1 && ans.addrs[0] == key);
+                                }
+
+                                if (refresh) {
+                                        CHECK(!refreshing[key].exchange(true));
+                                        ++refreshes;
+                                } else if (res != result::miss) {
+                                        continue;
+                                }
+
+                                std::lock_guard lck(lock);
+
+                                if (refresh) {
+                                        refreshing[key] = false;
+                                }
+
+                                switch (rnd() % 3) {
+                                case 0:
+                                        c->insert(cp, host.c_str(), "3240", now(), &key, 1);
+                                        break;
+                                case 1:
+                                        c->insert_negative(cp, host.c_str(), "3240", now(), -1);
+                                        break;
+                                case 2:
+                                        c->cancel_refresh(host.c_str(), "3240");
+                                }
+                        }
+                });
+        }
+
+        threads.clear();
+        std::printf("%d revalidations\n", refreshes.load());
+        CHECK(refreshes);
+}
+
+} // namespace
+
+
+int main()
+{
+        fresh_and_stale();
+        negative();
+        address_changed();
+        eviction();
+        concurrency();
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "endpoint_table.h"
+#include "check.h"
+
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+struct endpoint
+{
+        unsigned char address;
+        const void *handle;
+};
+
+using table = usbip::endpoint_table<endpoint>;
+
+constexpr auto address(int addr) { return static_cast<unsigned char>(addr); }
+auto handle(int i) { return reinterpret_cast<const void*>(uintptr_t(0x1000 + 0x40*i)); }
+
+static_assert(table::index(0x00) == 0);
+static_assert(table::index(0x0F) == 15);
+static_assert(table::index(0x80) == 16);
+static_assert(table::index(0x8F) == 31);
+static_assert(table::index(0x10) < 0 && table::index(0xC1) < 0);
+
+void insert_remove()
+{
+        auto t = std::make_unique<table>();
+
+        endpoint ep0{ 0x00, handle(0) };
+        endpoint in1{ 0x81, handle(1) };
+        endpoint out1{ 0x01, nullptr };
+
+        CHECK(t->insert(ep0.address, &ep0, ep0.handle));
+        CHECK(t->insert(in1.address, &in1, in1.handle));
+        CHECK(t->insert(out1.address, &out1, nullptr));
+        CHECK(!t->insert(0x20, &out1, nullptr));
+
+        CHECK(t->find(ep0.address) == &ep0 && t->find(in1.address) == &in1 && t->find(out1.address) == &out1);
+        CHECK(!t->find(address(0x02)) && !t->find(address(0x70)));
+
+        CHECK(t->find(handle(0)) == &ep0 && t->find(handle(1)) == &in1);
+        CHECK(!t->find(handle(2)) && !t->find(nullptr));
+
+        CHECK(t->set_handle(0x01, &out1, handle(2)));
+        CHECK(t->find(handle(2)) == &out1);
+        CHECK(!t->set_handle(0x01, &in1, handle(3))); // another element
+        CHECK(t->set_handle(0x01, &out1, nullptr));
+        CHECK(!t->find(handle(2)));
+
+        CHECK(!t->remove(0x81, &ep0));
+        CHECK(t->remove(0x81, &in1));
+        CHECK(!t->find(in1.address) && !t->find(handle(1)));
+        CHECK(t->find(handle(0)) == &ep0);
+}
+
+/*
+ * An outdated endpoint is replaced by the new one with the same address.
+ * It is still found by its handle until it is removed.
+ */
+void replace()
+{
+        auto t = std::make_unique<table>();
+
+        endpoint outdated{ 0x82, handle(1) };
+        endpoint current{ 0x82, handle(2) };
+
+        t->insert(outdated.address, &outdated, outdated.handle);
+        t->insert(current.address, &current, current.handle);
+
+        CHECK(t->find(current.address) == &current);
+        CHECK(t->find(handle(2)) == &current);
+        CHECK(t->find(handle(1)) == &outdated);
+
+        CHECK(t->set_handle(0x82, &outdated, handle(3)));
+        CHECK(!t->find(handle(1)) && t->find(handle(3)) == &outdated);
+
+        CHECK(t->remove(0x82, &outdated));
+        CHECK(!t->find(handle(3)));
+        CHECK(!t->remove(0x82, &outdated));
+
+        CHECK(t->find(current.address) == &current);
+        CHECK(t->find(handle(2)) == &current);
+
+        t->insert(outdated.address, &outdated, outdated.handle); // current is retired
+        t->insert(current.address, &current, current.handle); // outdated is retired, current is not kept twice
+
+        CHECK(t->remove(0x82, &current));
+        CHECK(!t->find(handle(2)) && !t->find(current.address));
+        CHECK(t->find(handle(1)) == &outdated);
+}
+
+/*
+ * A replaced element is not retired if there is no room for it.
+ */
+void retired_overflow()
+{
+        auto t = std::make_unique<table>();
+        std::vector<endpoint> v;
+
+        for (int i = 0; i <= table::RETIRED + 1; ++i) {
+                v.push_back({ 0x01, handle(i) });
+        }
+
+        for (auto &e: v) {
+                CHECK(t->insert(e.address, &e, e.handle));
+        }
+
+        CHECK(t->find(address(0x01)) == &v.back());
+
+        for (int i = 0; i < table::RETIRED; ++i) {
+                CHECK(t->find(v[i].handle) == &v[i]);
+        }
+        CHECK(!t->find(v[table::RETIRED].handle));
+
+        CHECK(t->remove(0x01, &v[0]));
+        CHECK(t->insert(0x01, &v[table::RETIRED], v[table::RETIRED].handle)); // takes the freed entry
+
+        CHECK(t->find(v.back().handle) == &v.back());
+        CHECK(!t->find(v[0].handle));
+}
+
+/*
+ * All 32 handles collide in the hash.
+ */
+void full()
+{
+        auto t = std::make_unique<table>();
+        std::vector<endpoint> v;
+
+        for (int i = 0; i < table::SIZE; ++i) {
+                v.push_back({ address((i & 0xF) | (i & 0x10) << 3), handle(i) });
+        }
+
+        for (auto &e: v) {
+                CHECK(t->insert(e.address, &e, e.handle));
+        }
+
+        for (auto &e: v) {
+                CHECK(t->find(e.address) == &e);
+                CHECK(t->find(e.handle) == &e);
+        }
+}
+
+/*
+ * A writer inserts, removes and replaces endpoints, readers look them up lock-free.
+ * A found element must have the address or the handle that was looked up. Run it under ThreadSanitizer.
+ */
+void concurrency()
+{
+        constexpr int VARIANTS = 4;
+
+        auto t = std::make_unique<table>();
+        std::vector<endpoint> v; // immutable, outlive the table
+
+        for (int i = 0; i < table::SIZE*VARIANTS; ++i) {
+                auto slot = i % table::SIZE;
+                v.push_back({ address((slot & 0xF) | (slot & 0x10) << 3), handle(i) });
+        }
+
+        std::atomic<bool> stop{};
+        std::atomic<long long> found{};
+
+        std::vector<std::jthread> readers;
+
+        for (int i = 0; i < 3; ++i) {
+                readers.emplace_back([&, i]
+                {
+                        std::mt19937 rnd(i);
+                        long long cnt = 0;
+
+                        while (!stop) {
+                                auto &e = v[rnd() % v.size()];
+
+                                if (auto p = t->find(e.address)) {
+                                        CHECK(p->address == e.address);
+                                        ++cnt;
+                                }
+
+                                if (auto p = t->find(e.handle)) {
+                                        CHECK(p == &e);
+                                        ++cnt;
+                                }
+                        }
+
+                        found += cnt;
+                });
+        }
+
+        std::mt19937 rnd(100);
+
+        for (int i = 0; i < 1'000'000; ++i) {
+                auto &e = v[rnd() % v.size()];
+
+                switch (rnd() % 3) {
+                case 0:
+                        t->insert(e.address, &e, e.handle);
+                        break;
+                case 1:
+                        t->remove(e.address, &e);
+                        break;
+                case 2:
+                        t->set_handle(e.address, &e, rnd() % 2 ? e.handle : nullptr);
+                }
+        }
+
+        stop = true;
+        readers.clear();
+
+        CHECK(found);
+}
+
+} // namespace
+
+
+int main()
+{
+        insert_remove();
+        replace();
+        retired_overflow();
+        full();
+        concurrency();
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "event_filter.h"
+#include "check.h"
+
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using usbip::event_filter;
+using usbip::matches;
+
+enum { CONNECTED = 2, PLUGGED = 3, UNPLUGGED = 0 }; // vhci::state
+
+void set_port(event_filter &f, int port)
+{
+        auto idx = port - 1;
+        f.ports[idx/64] |= 1ULL << (idx % 64);
+}
+
+void set_host(event_filter &f, const char *host)
+{
+        std::strncpy(f.host, host, sizeof(f.host) - 1);
+}
+
+void match()
+{
+        auto f = std::make_unique<event_filter>();
+
+        CHECK(matches(*f, 1, PLUGGED, "host"));
+        CHECK(matches(*f, 0, PLUGGED, nullptr)); // empty filter
+        CHECK(!matches(*f, -1, PLUGGED, "host"));
+        CHECK(!matches(*f, event_filter::MAX_PORT + 1, PLUGGED, "host"));
+        CHECK(!matches(*f, 1, -1, "host"));
+        CHECK(!matches(*f, 1, 32, "host"));
+
+        set_port(*f, 1);
+        set_port(*f, 130);
+        set_port(*f, event_filter::MAX_PORT);
+
+        CHECK(matches(*f, 1, PLUGGED, "host"));
+        CHECK(matches(*f, 130, PLUGGED, "host"));
+        CHECK(matches(*f, event_filter::MAX_PORT, PLUGGED, "host"));
+        CHECK(!matches(*f, 2, PLUGGED, "host"));
+        CHECK(matches(*f, 0, PLUGGED, "host")); // not plugged in yet
+
+        f->states = 1U << PLUGGED | 1U << UNPLUGGED;
+        CHECK(matches(*f, 1, UNPLUGGED, "host"));
+        CHECK(!matches(*f, 1, CONNECTED, "host"));
+
+        set_host(*f, "Server.Example");
+        CHECK(matches(*f, 1, PLUGGED, "server.EXAMPLE"));
+        CHECK(!matches(*f, 1, PLUGGED, "server.example.com"));
+        CHECK(!matches(*f, 1, PLUGGED, "server"));
+        CHECK(!matches(*f, 1, PLUGGED, nullptr));
+}
+
+/*
+ * 16 subscribers, each is interested in its own port, host or state.
+ * Prints the time process_event spends matching an event against all of them
+ * and how many subscribers are woken with and without the filters.
+ */
+void benchmark()
+{
+        using namespace std::chrono;
+
+        constexpr int SUBSCRIBERS = 16, EVENTS = 1'000'000, HOSTS = 8;
+
+        std::vector<std::unique_ptr<event_filter>> filters;
+
+        for (int i = 0; i < SUBSCRIBERS; ++i) {
+                auto &f = *filters.emplace_back(std::make_unique<event_filter>());
+
+                switch (i % 4) {
+                case 0:
+                        set_port(f, i + 1);
+                        break;
+                case 1:
+                        set_host(f, ("host" + std::to_string(i % HOSTS) + ".example").c_str());
+                        break;
+                case 2:
+                        f.states = 1U << PLUGGED;
+                        break;
+                case 3: // port and state
+                        set_port(f, i + 1);
+                        set_port(f, i + 2);
+                        f.states = 1U << UNPLUGGED;
+                }
+        }
+
+        struct event
+        {
+                int port;
+                int state;
+                std::string host;
+        };
+
+        std::mt19937 rnd(1);
+        std::vector<event> events(EVENTS);
+
+        for (auto &e: events) {
+                e.port = 1 + int(rnd() % 60);
+                e.state = int(rnd() % 6);
+                e.host = "host" + std::to_string(rnd() % HOSTS) + ".example";
+        }
+
+        size_t woken = 0;
+
+        auto t0 = steady_clock::now();
+        for (auto &e: events) {
+                for (auto &f: filters) {
+                        woken += matches(*f, e.port, e.state, e.host.c_str());
+                }
+        }
+        auto t1 = steady_clock::now();
+
+        CHECK(woken && woken < size_t(EVENTS)*SUBSCRIBERS);
+
+        std::printf("%d subscribers: %.1f ns per event, %.2f subscribers are woken instead of %d\n",
+                    SUBSCRIBERS, duration<double, std::nano>(t1 - t0).count()/EVENTS,
+                    double(woken)/EVENTS, SUBSCRIBERS);
+}
+
+} // namespace
+
+
+int main()
+{
+        match();
+        benchmark();
+}
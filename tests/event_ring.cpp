@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "event_ring.h"
+#include "check.h"
+
+#include <deque>
+#include <random>
+
+namespace
+{
+
+using ring = usbip::event_ring<int, 8>;
+
+using usbip::event_ring_capacity;
+static_assert(event_ring_capacity(0) == 1 && event_ring_capacity(1) == 1);
+static_assert(event_ring_capacity(8) == 8 && event_ring_capacity(9) == 16);
+static_assert(event_ring_capacity(3*2*127) == 1024); // fileobject_ctx::MAX_EVENTS
+
+void overwrite()
+{
+        ring r{};
+        int val{}, dropped{};
+        unsigned int seqnum{}, lost{};
+
+        CHECK(r.empty() && !r.pop(val, seqnum, lost));
+
+        for (int i = 1; i <= 8; ++i) {
+                CHECK(!r.push(i, dropped));
+        }
+        CHECK(r.size() == 8);
+
+        CHECK(r.push(9, dropped) && dropped == 1);
+        CHECK(r.push(10, dropped) && dropped == 2);
+        CHECK(r.size() == 8);
+
+        CHECK(r.pop(val, seqnum, lost));
+        CHECK(val == 3 && seqnum == 3 && lost == 2);
+
+        CHECK(r.pop(val, seqnum, lost));
+        CHECK(val == 4 && seqnum == 4 && !lost);
+}
+
+/*
+ * Random pushes and pops against a deque, seqnum must be the number of the element since the start.
+ */
+void random_ops()
+{
+        ring r{};
+        std::deque<int> model;
+
+        unsigned int pushed = 0;
+        unsigned int model_lost = 0;
+
+        std::mt19937 rnd(1);
+
+        for (int i = 0; i < 1'000'000; ++i) {
+                if (rnd() % 3) {
+                        int dropped{};
+                        auto full = r.push(int(++pushed), dropped);
+
+                        CHECK(full == (model.size() == ring::CAPACITY));
+                        if (full) {
+                                CHECK(dropped == model.front());
+                                model.pop_front();
+                                ++model_lost;
+                        }
+                        model.push_back(int(pushed));
+                } else {
+                        int val{};
+                        unsigned int seqnum{}, lost{};
+
+                        auto ok = r.pop(val, seqnum, lost);
+                        CHECK(ok == !model.empty());
+
+                        if (ok) {
+                                CHECK(val == model.front() && seqnum == unsigned(val));
+                                CHECK(lost == model_lost);
+                                model.pop_front();
+                                model_lost = 0;
+                        }
+                }
+
+                CHECK(r.size() == model.size());
+        }
+}
+
+/*
+ * Sequence numbers continue after the ring was emptied.
+ */
+void sequence()
+{
+        ring r{};
+        int val{}, dropped{};
+        unsigned int seqnum{}, lost{};
+
+        for (unsigned int i = 0; i < 1000; ++i) {
+                r.push(int(i), dropped);
+                r.pop(val, seqnum, lost);
+        }
+
+        r.push(7, dropped);
+        CHECK(r.pop(val, seqnum, lost) && val == 7 && seqnum == 1001);
+}
+
+} // namespace
+
+
+int main()
+{
+        overwrite();
+        random_ops();
+        sequence();
+}
@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "host_pool.h"
+#include "check.h"
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+/*
+ * A loopback stand-in server answers OP_REQ_DEVLIST of 40 hosts, some of them with injected delays.
+ * The hosts are queried through host_pool, a worker is interrupted by shutdown of its socket.
+ */
+namespace
+{
+
+using namespace std::chrono_literals;
+using namespace usbip::host_pool;
+
+constexpr size_t REPLY_SIZE = 12 + 100*(312 + 4); // op_common, ndev and 100 devices with one interface
+
+enum class behavior { fast, slow, dead, trickle };
+
+struct host
+{
+        behavior how;
+};
+
+auto elapsed_ms(clock_type::time_point t0)
+{
+        return std::chrono::duration<double, std::milli>(clock_type::now() - t0).count();
+}
+
+/*
+ * Accepts the connections and serves each one in its own thread, the host index is the request.
+ */
+class server
+{
+public:
+        explicit server(const std::vector<host> &hosts);
+        ~server();
+
+        auto port() const { return m_port; }
+
+private:
+        const std::vector<host> &m_hosts;
+        int m_sock = -1;
+        uint16_t m_port{};
+        std::jthread m_acceptor;
+
+        void serve(int s, std::stop_token stop) const;
+};
+
+server::server(const std::vector<host> &hosts) : m_hosts(hosts)
+{
+        m_sock = socket(AF_INET, SOCK_STREAM, 0);
+        CHECK(m_sock >= 0);
+
+        sockaddr_in addr{ .sin_family = AF_INET };
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        CHECK(!bind(m_sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+        CHECK(!listen(m_sock, 64));
+
+        socklen_t len = sizeof(addr);
+        CHECK(!getsockname(m_sock, reinterpret_cast<sockaddr*>(&addr), &len));
+        m_port = ntohs(addr.sin_port);
+
+        m_acceptor = std::jthread([this] (std::stop_token stop)
+        {
+                std::vector<std::jthread> threads;
+
+                for (int s; (s = accept(m_sock, nullptr, nullptr)) >= 0; ) {
+                        threads.emplace_back([this, s] (std::stop_token stop) { serve(s, stop); });
+                }
+
+                CHECK(stop.stop_requested());
+        }); // ~jthread of each connection requests stop and joins
+}
+
+server::~server()
+{
+        m_acceptor.request_stop();
+        shutdown(m_sock, SHUT_RDWR); // interrupts accept
+
+        m_acceptor.join();
+        close(m_sock);
+}
+
+void server::serve(int s, std::stop_token stop) const
+{
+        uint32_t idx{};
+        CHECK(recv(s, &idx, sizeof(idx), MSG_WAITALL) == sizeof(idx));
+
+        std::vector<char> reply(REPLY_SIZE);
+
+        auto sleep = [&stop] (auto d) // returns false if the server is stopping
+        {
+                for (auto end = clock_type::now() + d; clock_type::now() < end; std::this_thread::sleep_for(5ms)) {
+                        if (stop.stop_requested()) {
+                                return false;
+                        }
+                }
+                return true;
+        };
+
+        switch (m_hosts[idx].how) {
+        case behavior::fast:
+                send(s, reply.data(), reply.size(), MSG_NOSIGNAL);
+                break;
+        case behavior::slow:
+                if (sleep(150ms)) {
+                        send(s, reply.data(), reply.size(), MSG_NOSIGNAL);
+                }
+                break;
+        case behavior::dead:
+                sleep(10s);
+                break;
+        case behavior::trickle: // a slow stream of partial replies, each recv returns in time
+                for (size_t i = 0; i < reply.size() && sleep(50ms); ++i) {
+                        send(s, reply.data() + i, 1, MSG_NOSIGNAL);
+                }
+        }
+
+        close(s);
+}
+
+struct result
+{
+        bool ok;
+        double ms; // from the start of the query of the host
+};
+
+/*
+ * The same as enum_host, see remote.cpp.
+ * @param rearm set SO_RCVTIMEO to the time left before each recv
+ */
+bool query(uint16_t port, uint32_t idx, clock_type::time_point deadline, bool rearm, int &sock)
+{
+        sockaddr_in addr{ .sin_family = AF_INET, .sin_port = htons(port) };
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+                return false;
+        }
+
+        if (send(sock, &idx, sizeof(idx), MSG_NOSIGNAL) != sizeof(idx)) {
+                return false;
+        }
+
+        std::vector<char> buf(REPLY_SIZE);
+
+        for (size_t len = 0; len < buf.size(); ) {
+
+                if (rearm) {
+                        auto ms = time_left(deadline);
+                        if (!ms) {
+                                return false;
+                        }
+
+                        timeval tv{ .tv_sec = ms/1000, .tv_usec = (ms % 1000)*1000 };
+                        CHECK(!setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+                }
+
+                auto ret = recv(sock, buf.data() + len, buf.size() - len, 0);
+                if (ret <= 0) {
+                        return false;
+                }
+
+                len += ret;
+        }
+
+        return true;
+}
+
+/*
+ * @param rearm see query
+ * @param interrupt shut down the socket of a worker that has exceeded its deadline
+ */
+auto run_hosts(const std::vector<host> &hosts, unsigned int max_workers, std::chrono::milliseconds deadline,
+               bool rearm, bool interrupt, double &total_ms)
+{
+        server srv(hosts);
+        std::vector<result> results(hosts.size());
+
+        auto t0 = clock_type::now();
+
+        run(hosts.size(), max_workers, [&] (auto &wd, auto id, auto i)
+        {
+                auto start = clock_type::now();
+
+                auto sock = socket(AF_INET, SOCK_STREAM, 0);
+                CHECK(sock >= 0);
+
+                wd.arm(id, start + deadline, [sock, interrupt]
+                {
+                        if (interrupt) {
+                                shutdown(sock, SHUT_RDWR);
+                        }
+                });
+
+                auto ok = query(srv.port(), uint32_t(i), start + deadline, rearm, sock);
+                wd.disarm(id);
+
+                close(sock);
+                results[i] = { .ok = ok, .ms = elapsed_ms(start) };
+        });
+
+        total_ms = elapsed_ms(t0);
+        return results;
+}
+
+auto make_hosts()
+{
+        std::vector<host> v;
+
+        for (int i = 0; i < 40; ++i) {
+                auto how = i % 10 == 3 ? behavior::dead :
+                           i % 10 == 7 ? behavior::trickle :
+                           i % 2 ? behavior::slow : behavior::fast;
+
+                v.push_back({ how });
+        }
+
+        return v;
+}
+
+void left()
+{
+        auto now = clock_type::now();
+
+        CHECK(time_left(now + 10ms, now) == 10);
+        CHECK(time_left(now + 1us, now) == 1); // zero means no timeout for SO_RCVTIMEO
+        CHECK(!time_left(now, now) && !time_left(now - 1ms, now));
+        CHECK(time_left(clock_type::time_point::max(), now) > 1'000'000'000);
+}
+
+void watchdog_expiry()
+{
+        watchdog wd(2);
+        std::jthread thread([&wd] (auto stop) { wd.run(stop); });
+
+        std::atomic<int> calls{};
+        auto now = clock_type::now();
+
+        wd.arm(0, now + 20ms, [&calls] { ++calls; });
+        wd.arm(1, now + 10s, [&calls] { calls += 100; });
+
+        std::this_thread::sleep_for(100ms);
+
+        CHECK(wd.disarm(0));
+        CHECK(!wd.disarm(1));
+        CHECK(calls == 1);
+}
+
+void pool(bool rearm, bool interrupt)
+{
+        constexpr auto deadline = 500ms;
+        constexpr double slack_ms = 100;
+
+        auto hosts = make_hosts();
+        double total_ms{};
+
+        auto results = run_hosts(hosts, 8, deadline, rearm, interrupt, total_ms);
+
+        double max_ms = 0;
+
+        for (size_t i = 0; i < hosts.size(); ++i) {
+                auto &r = results[i];
+                auto how = hosts[i].how;
+
+                CHECK(r.ok == (how == behavior::fast || how == behavior::slow));
+                CHECK(r.ms < deadline.count() + slack_ms);
+
+                max_ms = std::max(max_ms, r.ms);
+        }
+
+        std::printf("re-armed SO_RCVTIMEO %d, watchdog %d: %zu hosts in %.0f ms, the longest host %.0f ms\n",
+                    rearm, interrupt, hosts.size(), total_ms, max_ms);
+}
+
+} // namespace
+
+
+int main()
+{
+        left();
+        watchdog_expiry();
+
+        pool(true, true);
+        pool(true, false);
+        pool(false, true);
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "mapped_file.h"
+#include "usb_ids_db.h"
+#include "usb_ids_compile.h"
+#include "check.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/*
+ * Loads of usb.ids text and of its binary index by read() and by mmap, see win::MappedFile.
+ * The page cache of the file is evicted before a cold load.
+ *
+ * @param argv[1] path to usb.ids
+ */
+namespace
+{
+
+using namespace usbip;
+using namespace usbip::usb_ids;
+using namespace usbip::usb_ids::compile;
+using usbip::usb_ids::index; // not ::index from <strings.h>
+
+void write_file(const char *path, std::string_view data)
+{
+        auto fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        CHECK(fd >= 0);
+        CHECK(write(fd, data.data(), data.size()) == ssize_t(data.size()));
+        CHECK(!fsync(fd)); // dirty pages are not evicted
+        close(fd);
+}
+
+void evict(const char *path)
+{
+        auto fd = open(path, O_RDONLY);
+        CHECK(fd >= 0);
+        CHECK(!posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED));
+        close(fd);
+}
+
+/*
+ * @return content of the file, vector of uint64_t is used to align an index
+ */
+auto read_aligned(const char *path, size_t &size)
+{
+        auto fd = open(path, O_RDONLY);
+        CHECK(fd >= 0);
+
+        struct stat st{};
+        CHECK(!fstat(fd, &st));
+        size = size_t(st.st_size);
+
+        std::vector<uint64_t> buf((size + sizeof(uint64_t) - 1)/sizeof(uint64_t));
+        CHECK(read(fd, buf.data(), size) == ssize_t(size));
+
+        close(fd);
+        return buf;
+}
+
+void errors(const char *dir)
+{
+        mapped_file f;
+        CHECK(!f);
+        CHECK(f.str().empty());
+
+        auto missing = std::string(dir) + "/missing";
+        CHECK(f.open(missing.c_str()) == ENOENT);
+        CHECK(!f);
+
+        auto empty = std::string(dir) + "/empty";
+        write_file(empty.c_str(), {});
+        CHECK(f.open(empty.c_str()) == EINVAL);
+        CHECK(!f);
+
+        CHECK(f.open(dir)); // a directory
+        CHECK(!f);
+
+        unlink(empty.c_str());
+}
+
+void mapping(const char *path, std::string_view content)
+{
+        mapped_file f(path);
+        CHECK(f);
+        CHECK(f.str() == content);
+
+        auto g = std::move(f);
+        CHECK(!f && g && g.str() == content);
+
+        mapped_file h;
+        CHECK(!h.open(path));
+        h = std::move(g);
+        CHECK(!g && h.str() == content);
+
+        h.close();
+        CHECK(!h);
+}
+
+/*
+ * Load and 3 product lookups, usbip parses the text lazily.
+ */
+template<typename F>
+auto run(const char *path, bool cold, const F &load)
+{
+        using namespace std::chrono;
+        std::vector<long long> v;
+
+        for (int i = 0; i < 21; ++i) {
+                if (cold) {
+                        evict(path);
+                }
+
+                auto t0 = steady_clock::now();
+                load([] (std::string_view content, bool lazy)
+                {
+                        database db;
+                        db.load(content, lazy);
+
+                        CHECK(db.find_product(0x1d6b, 0x0002) == "2.0 root hub");
+                        CHECK(!db.find_product(0x046d, 0xc52b).empty());
+                        CHECK(!db.find_product(0x0781, 0x5567).empty());
+                });
+                v.push_back(duration_cast<microseconds>(steady_clock::now() - t0).count());
+        }
+
+        std::ranges::nth_element(v, v.begin() + v.size()/2);
+        return v[v.size()/2];
+}
+
+void benchmark(const char *text_path, const char *index_path)
+{
+        for (auto [name, path, lazy]: { std::tuple("text", text_path, true), std::tuple("index", index_path, false) }) {
+
+                auto by_read = [path, lazy] (auto &&use)
+                {
+                        size_t size{};
+                        auto buf = read_aligned(path, size);
+                        use(std::string_view(reinterpret_cast<const char*>(buf.data()), size), lazy);
+                };
+
+                auto by_mmap = [path, lazy] (auto &&use)
+                {
+                        mapped_file f(path);
+                        CHECK(f);
+                        use(f.str(), lazy);
+                };
+
+                std::printf("%-5s, read(): cold %5lld us, warm %5lld us\n", name, run(path, true, by_read), run(path, false, by_read));
+                std::printf("%-5s, mmap  : cold %5lld us, warm %5lld us\n", name, run(path, true, by_mmap), run(path, false, by_mmap));
+        }
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+        CHECK(argc > 1);
+        auto text = read_file(argv[1]);
+        CHECK(!text.empty());
+
+        char dir[] = "mapped_file.XXXXXX"; // in the current directory, /tmp can be tmpfs that is not evicted
+        CHECK(mkdtemp(dir));
+
+        tables t;
+        parse(t, text);
+
+        size_t size{};
+        auto buf = make_index(t, size);
+
+        auto text_path = std::string(dir) + "/usb.ids";
+        write_file(text_path.c_str(), text);
+
+        auto index_path = std::string(dir) + "/usb.ids.idx";
+        write_file(index_path.c_str(), as_view(buf, size));
+
+        errors(dir);
+        mapping(text_path.c_str(), text);
+        mapping(index_path.c_str(), as_view(buf, size));
+
+        CHECK(usb_ids::index(mapped_file(index_path.c_str()).str())); // a mapping is page-aligned
+
+        benchmark(text_path.c_str(), index_path.c_str()); // pages of a mapped file are not evicted
+
+        unlink(text_path.c_str());
+        unlink(index_path.c_str());
+        rmdir(dir);
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "output_format.h"
+#include "check.h"
+
+#include <chrono>
+#include <string>
+#include <functional>
+
+/*
+ * Cost of a message of libusbip::output that is disabled and enabled, see src/output.h.
+ * "before" is the former output that formatted every message and left the filtering to the sink.
+ */
+namespace
+{
+
+using namespace libusbip;
+
+enum class level { debug, info, warning, error, off }; // see libusbip/output.h
+
+std::atomic<level> output_level = level::off;
+std::function<void(std::string)> output_function;
+
+template<typename... Args>
+void output(level lvl, std::format_string<Args...> fmt, Args&&... args)
+{
+        if (output_enabled(output_level, lvl)) {
+                auto s = std::format(fmt, std::forward<Args>(args)...);
+                output_function(std::move(s));
+        }
+}
+
+template<typename... Args>
+void output_before(std::format_string<Args...> fmt, Args&&... args)
+{
+        auto s = std::format(fmt, std::forward<Args>(args)...);
+        output_function(std::move(s));
+}
+
+void levels()
+{
+        std::string last;
+        output_function = [&last] (auto s) { last = std::move(s); };
+
+        int evaluated = 0;
+        auto expensive = [&evaluated] { ++evaluated; return std::string("expensive"); };
+
+        output_level = level::off;
+        output(level::error, "{} {}", 1, defer(expensive));
+        CHECK(last.empty());
+        CHECK(!evaluated);
+
+        output_level = level::warning;
+        output(level::info, "{}", defer(expensive));
+        CHECK(last.empty());
+        CHECK(!evaluated);
+
+        output(level::warning, "[{:>10}]", defer(expensive)); // format spec of the result
+        CHECK(last == "[ expensive]");
+        CHECK(evaluated == 1);
+
+        output(level::error, "{:#x}", defer([] { return 255; }));
+        CHECK(last == "0xff");
+
+        output_level = level::off;
+        output_function = {};
+}
+
+/*
+ * @return nanoseconds per call
+ */
+template<typename F>
+auto run(const F &f)
+{
+        using namespace std::chrono;
+        const int N = 1'000'000;
+
+        auto t0 = steady_clock::now();
+        for (int i = 0; i < N; ++i) {
+                f(i);
+        }
+
+        return double(duration_cast<nanoseconds>(steady_clock::now() - t0).count())/N;
+}
+
+void benchmark()
+{
+        std::string addr = "192.168.1.100:3240";
+        size_t total = 0;
+
+        auto connecting = [&addr] (int) { output(level::debug, "connecting to {}", addr); };
+        auto deferred = [&addr] (int) { output(level::debug, "connecting to {}", defer([&addr] { return addr + "/tcp"; })); };
+        auto before = [&addr] (int) { output_before("connecting to {}", addr); };
+
+        output_function = [&total] (auto s) { total += s.size(); }; // the sink drops a message of a level below its own
+
+        output_level = level::info;
+        std::printf("disabled: %5.1f ns, defer() %5.1f ns, before %5.1f ns\n", run(connecting), run(deferred), run(before));
+
+        output_level = level::debug;
+        std::printf("enabled : %5.1f ns, defer() %5.1f ns, before %5.1f ns\n", run(connecting), run(deferred), run(before));
+
+        CHECK(total);
+        output_level = level::off;
+        output_function = {};
+}
+
+} // namespace
+
+
+int main()
+{
+        levels();
+        benchmark();
+}
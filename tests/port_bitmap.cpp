@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "port_bitmap.h"
+#include "check.h"
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include <utility>
+
+namespace
+{
+
+using usbip::port_bitmap;
+
+enum { PORTS = 2*127 }; // usb2 and usb3 ports, see vhci::claim_roothub_port
+
+void claim_release()
+{
+        auto b = std::make_unique<port_bitmap<PORTS>>();
+
+        for (int i = 0; i < PORTS; ++i) {
+                CHECK(!b->test(i));
+                CHECK(b->claim(0, PORTS) == i);
+        }
+
+        CHECK(b->claim(0, PORTS) < 0);
+        CHECK(!b->test(-1) && !b->test(PORTS));
+
+        CHECK(b->release(100));
+        CHECK(!b->release(100));
+        CHECK(!b->release(-1) && !b->release(PORTS));
+
+        CHECK(b->claim(0, 100) < 0); // [begin, end)
+        CHECK(b->claim(101, PORTS) < 0);
+        CHECK(b->claim(-5, 1000) == 100); // the range is clamped
+
+        for (auto i: {63, 64, 127, 128, 253}) { // word boundaries
+                CHECK(b->release(i));
+        }
+
+        CHECK(b->claim(64, 128) == 64);
+        CHECK(b->claim(64, 128) == 127);
+        CHECK(b->claim(64, 128) < 0);
+        CHECK(b->claim(127, 254) == 128);
+        CHECK(b->claim(0, 254) == 63);
+        CHECK(b->claim(0, 253) < 0);
+        CHECK(b->claim(253, 254) == 253);
+        CHECK(b->claim(5, 5) < 0);
+}
+
+/*
+ * The same as vhci::claim_roothub_port before port_bitmap.
+ */
+class locked_ports
+{
+public:
+        int claim(int begin, int end)
+        {
+                std::lock_guard lck(m_lock);
+                for (auto i = begin; i < end; ++i) {
+                        if (!m_used[i]) {
+                                m_used[i] = true;
+                                return i;
+                        }
+                }
+                return -1;
+        }
+
+        bool release(int idx)
+        {
+                std::lock_guard lck(m_lock);
+                return std::exchange(m_used[idx], false);
+        }
+
+private:
+        std::mutex m_lock;
+        bool m_used[PORTS]{};
+};
+
+/*
+ * Each thread claims a port of the usb2 or usb3 half and releases it.
+ * A port must not be claimed twice. Run it under ThreadSanitizer.
+ * @return nanoseconds per claim and release
+ */
+template<typename T>
+double claim_reclaim(T &ports, unsigned int threads, int held)
+{
+        using namespace std::chrono;
+        constexpr int N = 100'000;
+
+        auto owners = std::make_unique<std::atomic<int>[]>(PORTS);
+        std::vector<std::jthread> v;
+
+        auto t0 = steady_clock::now();
+
+        for (unsigned int i = 0; i < threads; ++i) {
+                v.emplace_back([&ports, &owners, i, held]
+                {
+                        std::mt19937 rnd(i);
+                        std::vector<int> claimed;
+
+                        for (int j = 0; j < N; ++j) {
+                                auto usb3 = rnd() % 2;
+                                auto begin = usb3 ? PORTS/2 : 0;
+
+                                if (auto port = ports.claim(begin, begin + PORTS/2); port >= 0) {
+                                        CHECK(port >= begin && port < begin + PORTS/2);
+                                        CHECK(!owners[port].exchange(int(i) + 1));
+                                        claimed.push_back(port);
+                                }
+
+                                if (int(claimed.size()) > held || (!claimed.empty() && rnd() % 2)) {
+                                        auto k = rnd() % claimed.size();
+                                        auto port = claimed[k];
+
+                                        claimed[k] = claimed.back();
+                                        claimed.pop_back();
+
+                                        CHECK(owners[port].exchange(0) == int(i) + 1);
+                                        CHECK(ports.release(port));
+                                }
+                        }
+
+                        for (auto port: claimed) {
+                                owners[port] = 0;
+                                CHECK(ports.release(port));
+                        }
+                });
+        }
+
+        v.clear();
+        return duration<double, std::nano>(steady_clock::now() - t0).count()/(N*threads);
+}
+
+void benchmark()
+{
+        for (auto threads: {1U, 4U, 16U}) {
+                auto b = std::make_unique<port_bitmap<PORTS>>();
+                auto bitmap = claim_reclaim(*b, threads, 4);
+
+                for (int i = 0; i < PORTS; ++i) {
+                        CHECK(!b->test(i));
+                }
+
+                auto locked = std::make_unique<locked_ports>();
+                auto mutex = claim_reclaim(*locked, threads, 4);
+
+                std::printf("%2u threads: port_bitmap %6.1f ns, mutex and scan %6.1f ns per claim and release\n",
+                            threads, bitmap, mutex);
+        }
+}
+
+} // namespace
+
+
+int main()
+{
+        claim_release();
+        benchmark();
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "recv_buffer.h"
+#include "check.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * Reads of OP_REP_DEVLIST by recv_buffer and by recv(MSG_WAITALL) of each record as before, see enum_devices.
+ * Sizes of the records are taken from <usbip/proto_op.h> that requires Windows SDK.
+ */
+namespace
+{
+
+using namespace usbip;
+
+enum {
+        OP_COMMON_SIZE = 8,
+        OP_DEVLIST_REPLY_SIZE = 4,
+        USB_DEVICE_SIZE = 312,
+        USB_INTERFACE_SIZE = 4,
+};
+
+/*
+ * Delivers the data by 1..7 bytes at a time, then EOF.
+ */
+struct fake_recv
+{
+        std::string_view data;
+        size_t step = 1;
+
+        long long operator()(char *buf, size_t len)
+        {
+                auto n = std::min({ len, data.size(), step });
+                step = step % 7 + 1;
+
+                std::copy_n(data.data(), n, buf);
+                data.remove_prefix(n);
+
+                return static_cast<long long>(n);
+        }
+};
+
+void records()
+{
+        std::string data(3*recv_buffer<fake_recv>::CHUNK_SIZE, '\0');
+        for (size_t i = 0; i < data.size(); ++i) {
+                data[i] = char(i % 251);
+        }
+
+        recv_buffer buf(fake_recv{ data });
+        size_t off = 0;
+
+        for (size_t len: { 1, 8, 4, 312, 4*4, 0, 100'000, 77 }) { // a record can be larger than a chunk
+                auto p = buf.get<char>(len);
+                CHECK(p);
+                CHECK(std::string_view(p, len) == data.substr(off, len));
+                off += len;
+        }
+
+        auto rest = data.size() - off;
+        CHECK(!buf.get<char>(rest + 1)); // EOF in the middle of a record
+
+        recv_buffer<fake_recv> empty(fake_recv{});
+        CHECK(!empty.get<char>());
+        CHECK(empty.get<char>(0));
+}
+
+void error()
+{
+        int calls = 0;
+
+        recv_buffer buf([&calls] (char*, size_t) -> long long { ++calls; return -1; });
+        CHECK(!buf.get<uint32_t>());
+        CHECK(calls == 1);
+        CHECK(buf.calls() == 1);
+}
+
+auto make_devlist(int ndev, int nintf)
+{
+        std::string s(OP_COMMON_SIZE + OP_DEVLIST_REPLY_SIZE, '\0');
+
+        for (int i = 0; i < ndev; ++i) {
+                std::string dev(USB_DEVICE_SIZE, char('a' + i % 26));
+                dev.back() = char(nintf); // bNumInterfaces
+                s += dev;
+                s.append(nintf*USB_INTERFACE_SIZE, '\1');
+        }
+
+        return s;
+}
+
+/*
+ * @return the number of bytes of the devices and interfaces
+ */
+template<typename Get>
+size_t parse_devlist(int ndev, const Get &get)
+{
+        CHECK(get(OP_COMMON_SIZE));
+        CHECK(get(OP_DEVLIST_REPLY_SIZE));
+
+        size_t total = 0;
+
+        for (int i = 0; i < ndev; ++i) {
+                auto dev = get(USB_DEVICE_SIZE);
+                CHECK(dev && *dev == char('a' + i % 26));
+
+                auto cnt = dev[USB_DEVICE_SIZE - 1];
+                auto intf = get(cnt*USB_INTERFACE_SIZE);
+                CHECK(intf && *intf == '\1');
+
+                total += USB_DEVICE_SIZE + cnt*USB_INTERFACE_SIZE;
+        }
+
+        return total;
+}
+
+void devlist()
+{
+        int ndev = 5'000;
+        auto data = make_devlist(ndev, 3);
+
+        recv_buffer buf(fake_recv{ data });
+        auto size = parse_devlist(ndev, [&buf] (size_t len) { return buf.get<char>(len); });
+        CHECK(size + OP_COMMON_SIZE + OP_DEVLIST_REPLY_SIZE == data.size());
+}
+
+/*
+ * @return microseconds, the number of recv calls
+ */
+template<typename Read>
+auto run(const std::string &data, const Read &read)
+{
+        int sv[2]{};
+        CHECK(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+
+        std::jthread writer([fd = sv[0], &data]
+        {
+                for (auto p = data.data(), end = p + data.size(); p < end; ) {
+                        auto n = ::send(fd, p, size_t(end - p), 0);
+                        CHECK(n > 0);
+                        p += n;
+                }
+        });
+
+        auto t0 = std::chrono::steady_clock::now();
+        auto calls = read(sv[1]);
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+
+        writer.join();
+        close(sv[0]);
+        close(sv[1]);
+
+        return std::pair(us, calls);
+}
+
+void benchmark()
+{
+        for (int ndev: { 100, 1'000, 5'000 }) {
+                auto data = make_devlist(ndev, 4);
+
+                auto by_record = [ndev] (int fd)
+                {
+                        std::vector<char> buf(USB_DEVICE_SIZE);
+                        size_t calls = 0;
+
+                        parse_devlist(ndev, [fd, &buf, &calls] (size_t len)
+                        {
+                                ++calls;
+                                auto n = ::recv(fd, buf.data(), len, MSG_WAITALL);
+                                return n == ssize_t(len) ? buf.data() : nullptr;
+                        });
+
+                        return calls;
+                };
+
+                auto buffered = [ndev] (int fd)
+                {
+                        recv_buffer buf([fd] (char *p, size_t len) -> long long { return ::recv(fd, p, len, 0); });
+                        parse_devlist(ndev, [&buf] (size_t len) { return buf.get<char>(len); });
+                        return buf.calls();
+                };
+
+                std::vector<long long> a, b;
+                size_t calls_a{}, calls_b{};
+
+                for (int i = 0; i < 21; ++i) {
+                        auto [us_a, ca] = run(data, by_record);
+                        auto [us_b, cb] = run(data, buffered);
+                        a.push_back(us_a);
+                        b.push_back(us_b);
+                        calls_a = ca;
+                        calls_b = cb;
+                }
+
+                std::ranges::nth_element(a, a.begin() + a.size()/2);
+                std::ranges::nth_element(b, b.begin() + b.size()/2);
+
+                std::printf("%5d devices, %8zu bytes: recv per record %6lld us, %5zu calls; recv_buffer %6lld us, %3zu calls\n",
+                            ndev, data.size(), a[a.size()/2], calls_a, b[b.size()/2], calls_b);
+        }
+}
+
+} // namespace
+
+
+int main()
+{
+        records();
+        error();
+        devlist();
+        benchmark();
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "recv_policy.h"
+#include "check.h"
+
+#include <vector>
+#include <set>
+
+namespace
+{
+
+using namespace usbip::recv_policy;
+
+static_assert(get_level(0x03, 1, 2) == level::high); // HID keyboard
+static_assert(get_level(0x01, 1, 0) == level::high);
+static_assert(get_level(0x0E, 2, 0) == level::high);
+static_assert(get_level(0x02, 2, 1) == level::above_normal);
+static_assert(get_level(0xE0, 1, 1) == level::above_normal);
+static_assert(get_level(0xEF, 4, 1) == level::above_normal); // RNDIS
+static_assert(get_level(0xEF, 2, 1) == level::normal); // IAD
+static_assert(get_level(0x08, 6, 0x50) == level::normal); // mass storage
+static_assert(get_level(0xFF, 0, 0) == level::normal);
+
+static_assert(max(level::normal, level::high) == level::high);
+static_assert(max(level::above_normal, level::normal) == level::above_normal);
+static_assert(level{} == level::normal);
+
+static_assert(get_priority(0, 8) == 8);
+static_assert(get_priority(1, 8) == 1);
+static_assert(get_priority(31, 8) == 31);
+static_assert(get_priority(32, 8) == 8);
+
+static_assert(nth_set_bit(0, 0) == -1);
+static_assert(nth_set_bit(0b1011'0000, 0) == 4);
+static_assert(nth_set_bit(0b1011'0000, 2) == 7);
+static_assert(nth_set_bit(0b1011'0000, 3) == -1);
+static_assert(nth_set_bit(1ULL << 63, 0) == 63);
+
+static_assert(!popcount(0));
+static_assert(popcount(0b1011'0000) == 3);
+static_assert(popcount(~0ULL) == 64);
+
+/*
+ * Adjacent threads must go to different nodes first, then to different processors of a node.
+ */
+void ideal_processor()
+{
+        {
+                const unsigned int cpus[]{ 4, 0, 2 }; // node 1 has no processors
+                const cpu expected[]{ {0, 0}, {2, 0}, {0, 1}, {2, 1}, {0, 2}, {2, 0}, {0, 3}, {2, 1}, {0, 0} };
+
+                for (unsigned int seq = 0; seq < std::size(expected); ++seq) {
+                        auto c = get_ideal_processor(seq, cpus, std::size(cpus));
+                        CHECK(c.node == expected[seq].node && c.index == expected[seq].index);
+                }
+        }
+
+        {
+                const unsigned int cpus[]{ 0, 0 };
+                auto c = get_ideal_processor(5, cpus, std::size(cpus));
+                CHECK(!c.node && !c.index);
+                CHECK(!get_ideal_processor(0, nullptr, 0).node);
+        }
+
+        const unsigned int cpus[]{ 8, 8, 8, 8 };
+        std::set<std::pair<unsigned int, unsigned int>> used;
+
+        for (unsigned int seq = 0; seq < 32; ++seq) { // each processor once while there are free ones
+                auto c = get_ideal_processor(seq, cpus, std::size(cpus));
+                CHECK(used.insert({c.node, c.index}).second);
+        }
+}
+
+/*
+ * The level must go down if a latency-sensitive interface is no longer selected.
+ */
+void levels_of_interfaces()
+{
+        interface_levels v;
+        CHECK(v.get() == level::normal);
+
+        CHECK(v.set(0, get_level(0x08, 6, 0x50)) == level::normal); // mass storage
+        CHECK(v.set(1, get_level(0x01, 2, 0)) == level::high); // audio streaming, alternate setting 1
+        CHECK(v.set(2, get_level(0x02, 2, 1)) == level::high);
+
+        CHECK(v.set(1, level::normal) == level::above_normal); // alternate setting 0 of audio has no endpoints
+        CHECK(v.set(2, level::normal) == level::normal);
+
+        CHECK(v.set(255, level::high) == level::high);
+        v.clear(); // another configuration
+        CHECK(v.get() == level::normal);
+        CHECK(v.set(0, get_level(0x03, 1, 2)) == level::high);
+}
+
+} // namespace
+
+
+int main()
+{
+        ideal_processor();
+        levels_of_interfaces();
+}
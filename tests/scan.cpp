@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "scan.h"
+#include "check.h"
+
+#include <vector>
+#include <random>
+#include <algorithm>
+
+namespace
+{
+
+using namespace usbip::scan;
+using namespace std::chrono_literals;
+
+struct fake_clock
+{
+        using duration = std::chrono::microseconds;
+        using rep = duration::rep;
+        using period = duration::period;
+        using time_point = std::chrono::time_point<fake_clock>;
+        static constexpr bool is_steady = true;
+};
+
+void cidr()
+{
+        network n{};
+
+        CHECK(parse_cidr(n, "192.168.1.0/24") && n.first == 0xC0A80101 && n.count == 254);
+        CHECK(parse_cidr(n, "192.168.1.77/24") && n.first == 0xC0A80101 && n.count == 254);
+        CHECK(parse_cidr(n, "10.0.0.7") && n.first == 0x0A000007 && n.count == 1);
+        CHECK(parse_cidr(n, "10.0.0.7/32") && n.first == 0x0A000007 && n.count == 1);
+        CHECK(parse_cidr(n, "10.0.0.0/31") && n.first == 0x0A000000 && n.count == 2); // RFC 3021
+        CHECK(parse_cidr(n, "0.0.0.0/0") && n.first == 1 && n.count == 0xFFFFFFFE);
+        CHECK(n[n.count - 1] == 0xFFFFFFFE);
+
+        for (auto s: {"", "10.0.0", "10.0.0/8", "10.0.0.256", "10.0.0.1/33", "10.0.0.1/", "10.0.0.1x",
+                      "10.0.0.1/8x", "10..0.1", "0010.0.0.1", "-1.0.0.1", " 10.0.0.1", "10.0.0.1 "}) {
+                CHECK(!parse_cidr(n, s));
+        }
+}
+
+/*
+ * The starts are paced and limited by max_inflight, probes expire once.
+ */
+void pacing()
+{
+        scheduler<fake_clock> s(10, { .max_inflight = 3, .rate = 1000, .timeout = 5ms });
+        fake_clock::time_point t{};
+
+        CHECK(s.size() == 10 && !s.done());
+
+        CHECK(s.next(t) == 0);
+        CHECK(s.next(t) == s.size()); // 1 ms between starts
+        CHECK(s.wakeup() == t + 1ms);
+
+        t += 1ms;
+        CHECK(s.next(t) == 1);
+        t += 1ms;
+        CHECK(s.next(t) == 2);
+        t += 1ms;
+        CHECK(s.next(t) == s.size()); // max_inflight
+        CHECK(s.inflight() == 3);
+        CHECK(s.wakeup() == fake_clock::time_point{} + 5ms); // deadline of #0
+
+        s.complete(1);
+        CHECK(s.next(t) == 3);
+
+        std::vector<uint32_t> expired;
+        auto on_expire = [&expired] (auto idx) { expired.push_back(idx); };
+
+        t = fake_clock::time_point{} + 7ms;
+        s.expire(t, on_expire);
+        CHECK((expired == std::vector<uint32_t>{ 0, 2 }));
+
+        s.expire(t, on_expire); // once for a probe
+        CHECK(expired.size() == 2);
+
+        s.complete(0);
+        s.complete(2);
+        s.complete(3);
+        CHECK(!s.inflight());
+
+        for (uint32_t idx; (idx = s.next(t)) != s.size(); t += 1ms) {
+                s.complete(idx);
+        }
+
+        CHECK(s.done());
+        CHECK(s.wakeup() == fake_clock::time_point::max());
+}
+
+/*
+ * Starts that are late because of timer resolution are caught up, but not more than max_lag.
+ */
+void catch_up()
+{
+        scheduler<fake_clock> s(1000, { .max_inflight = 1000, .rate = 1000, .timeout = 1s });
+        fake_clock::time_point t{};
+
+        CHECK(s.next(t) == 0);
+
+        t += 16ms; // a tick of a coarse timer
+        int started = 0;
+        for ( ; s.next(t) != s.size(); ++started);
+        CHECK(started == 16);
+
+        t += 1000ms; // the thread was not scheduled for a long time
+        for (started = 0; s.next(t) != s.size(); ++started);
+        CHECK(started == 33); // max_lag + 1
+}
+
+void unlimited()
+{
+        scheduler<fake_clock> s(100, { .max_inflight = 0, .rate = 0, .timeout = 1s });
+        fake_clock::time_point t{};
+
+        CHECK(s.next(t) == 0);
+        CHECK(s.next(t) == s.size()); // max_inflight zero is one
+        s.complete(0);
+        CHECK(s.next(t) == 1);
+}
+
+/*
+ * Random completions and expirations against the invariants.
+ */
+void random_runs()
+{
+        std::mt19937 rnd(1);
+
+        for (int iter = 0; iter < 500; ++iter) {
+
+                uint32_t count = rnd() % 300;
+                unsigned int max_inflight = rnd() % 20;
+                unsigned int rate = rnd() % 2 ? 0 : 100 + rnd() % 5000;
+                auto timeout = std::chrono::milliseconds(1 + rnd() % 50);
+
+                scheduler<fake_clock> s(count, { .max_inflight = max_inflight, .rate = rate, .timeout = timeout });
+
+                std::vector<int> started(count);
+                std::vector<int> expired(count);
+                std::vector<uint32_t> inflight;
+
+                fake_clock::time_point t{};
+
+                while (!s.done()) {
+                        for (uint32_t idx; (idx = s.next(t)) != s.size(); ) {
+                                ++started[idx];
+                                inflight.push_back(idx);
+                                CHECK(inflight.size() <= std::max(max_inflight, 1U));
+                                CHECK(s.inflight() == inflight.size());
+                        }
+
+                        s.expire(t, [&] (auto idx) { ++expired[idx]; CHECK(std::ranges::count(inflight, idx)); });
+                        CHECK(s.wakeup() > t); // nothing to do now
+
+                        if (!inflight.empty() && rnd() % 2) {
+                                auto k = rnd() % inflight.size();
+                                s.complete(inflight[k]);
+                                inflight.erase(inflight.begin() + k);
+                        }
+
+                        t += std::chrono::microseconds(rnd() % 3000);
+                }
+
+                CHECK(std::ranges::all_of(started, [] (auto n) { return n == 1; }));
+                CHECK(std::ranges::all_of(expired, [] (auto n) { return n <= 1; }));
+        }
+}
+
+} // namespace
+
+
+int main()
+{
+        cidr();
+        pacing();
+        catch_up();
+        unlimited();
+        random_runs();
+}
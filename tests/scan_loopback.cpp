@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "scan.h"
+#include "check.h"
+
+#include <vector>
+#include <algorithm>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+/*
+ * Scans 127.1.0.0/22 with three listeners, epoll stands in for ConnectEx and I/O completion port.
+ * Prints the time of the scan for several rates, see usbip::discover.
+ */
+namespace
+{
+
+using namespace usbip::scan;
+using clock_type = std::chrono::steady_clock;
+
+constexpr uint16_t port = 3240;
+constexpr uint32_t listeners[]{ 5, 300, 1000 }; // indices of the hosts
+
+auto make_addr(uint32_t host)
+{
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(host);
+        return addr;
+}
+
+auto listen_on(uint32_t host)
+{
+        auto s = socket(AF_INET, SOCK_STREAM, 0);
+        CHECK(s >= 0);
+
+        int on = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        auto addr = make_addr(host);
+        CHECK(!bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+        CHECK(!listen(s, 16));
+
+        return s;
+}
+
+/*
+ * @return indices of the hosts that have accepted the connection
+ */
+auto scan(const network &net, unsigned int rate, double &seconds)
+{
+        scheduler sched(net.count, { .max_inflight = 256, .rate = rate, .timeout = std::chrono::milliseconds(200) });
+
+        auto ep = epoll_create1(0);
+        CHECK(ep >= 0);
+
+        std::vector<int> sockets(net.count, -1);
+        std::vector<uint32_t> accepted;
+
+        auto t0 = clock_type::now();
+
+        while (!sched.done()) {
+
+                auto now = clock_type::now();
+
+                for (uint32_t idx; (idx = sched.next(now)) != sched.size(); ) {
+                        auto s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+                        CHECK(s >= 0);
+
+                        auto addr = make_addr(net[idx]);
+                        connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+
+                        epoll_event ev{ .events = EPOLLOUT, .data = { .u32 = idx } };
+                        CHECK(!epoll_ctl(ep, EPOLL_CTL_ADD, s, &ev));
+
+                        sockets[idx] = s;
+                }
+
+                sched.expire(now, [&sockets] (auto idx) { shutdown(sockets[idx], SHUT_RDWR); }); // completes it
+
+                auto wakeup = sched.wakeup();
+                auto ms = wakeup == clock_type::time_point::max() ? -1 :
+                          std::max(0L, long(std::chrono::ceil<std::chrono::milliseconds>(wakeup - clock_type::now()).count()));
+
+                epoll_event events[64];
+                auto cnt = epoll_wait(ep, events, std::size(events), int(ms));
+
+                for (int i = 0; i < cnt; ++i) {
+                        auto idx = events[i].data.u32;
+
+                        int err{};
+                        socklen_t len = sizeof(err);
+                        getsockopt(sockets[idx], SOL_SOCKET, SO_ERROR, &err, &len);
+
+                        if (!err) {
+                                accepted.push_back(idx);
+                        }
+
+                        close(sockets[idx]);
+                        sockets[idx] = -1;
+
+                        sched.complete(idx);
+                }
+        }
+
+        seconds = std::chrono::duration<double>(clock_type::now() - t0).count();
+        close(ep);
+
+        std::ranges::sort(accepted);
+        return accepted;
+}
+
+} // namespace
+
+
+int main()
+{
+        network net{};
+        CHECK(parse_cidr(net, "127.1.0.0/22"));
+        CHECK(net.count == 1022);
+
+        std::vector<int> sockets;
+        for (auto idx: listeners) {
+                sockets.push_back(listen_on(net[idx]));
+        }
+
+        for (auto rate: {0U, 4096U, 1000U}) {
+                double seconds{};
+                auto accepted = scan(net, rate, seconds);
+
+                std::printf("rate %u: %u probes in %.3f s, %zu hosts have accepted the connection\n",
+                            rate, net.count, seconds, accepted.size());
+
+                CHECK(std::ranges::equal(accepted, listeners));
+
+                if (rate) {
+                        CHECK(seconds >= double(net.count - 1)/rate - 0.05); // max_lag
+                }
+        }
+
+        for (auto s: sockets) {
+                close(s);
+        }
+}
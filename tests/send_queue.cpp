@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "send_queue.h"
+#include "check.h"
+
+#include <vector>
+#include <deque>
+#include <random>
+#include <algorithm>
+
+namespace
+{
+
+using namespace usbip;
+using queue = send_queue<4>;
+
+auto pop_front(queue &q, unsigned long long now, unsigned long long max_wait, unsigned int skip = 0)
+{
+        auto e = q.front(now, max_wait, skip);
+        if (e) {
+                q.pop(*e);
+        }
+        return e;
+}
+
+void priorities()
+{
+        queue q{};
+        send_queue_entry e[6]{};
+
+        CHECK(q.empty() && !q.front(0, 0));
+
+        q.push(e[0], 3, 0);
+        q.push(e[1], 1, 0);
+        q.push(e[2], 3, 0);
+        q.push(e[3], 0, 0);
+        q.push(e[4], 1, 0);
+        q.push(e[5], 10, 0); // the lowest priority
+        CHECK(q.size() == 6);
+        CHECK(e[5].priority == 3);
+
+        for (auto i: {3, 1, 4, 0, 2, 5}) {
+                CHECK(pop_front(q, 0, 100) == &e[i]);
+        }
+
+        CHECK(q.empty());
+}
+
+void skip()
+{
+        queue q{};
+        send_queue_entry e[2]{};
+
+        q.push(e[0], 3, 0);
+        q.push(e[1], 1, 0);
+
+        CHECK(q.front(0, 100, 1U << 1) == &e[0]);
+        CHECK(!q.front(0, 100, 1U << 1 | 1U << 3));
+}
+
+/*
+ * The oldest transfer of lower priority goes first if it waits for longer than max_wait.
+ */
+void starvation()
+{
+        queue q{};
+        send_queue_entry e[4]{};
+
+        q.push(e[0], 3, 0);
+        q.push(e[1], 2, 5);
+        q.push(e[2], 0, 20);
+
+        CHECK(q.front(10, 10) == &e[2]);
+        CHECK(q.front(11, 10) == &e[0]);
+        CHECK(pop_front(q, 16, 10) == &e[0]); // e[1] is starving too, but it is younger
+        CHECK(pop_front(q, 16, 10) == &e[1]);
+        CHECK(pop_front(q, 16, 10) == &e[2]);
+}
+
+void remove()
+{
+        queue q{};
+        send_queue_entry e[6]{};
+
+        for (int i = 0; i < 6; ++i) {
+                q.push(e[i], i % 2, i);
+        }
+
+        auto same = [] (auto &x) { return [&x] (auto &y) { return &x == &y; }; };
+
+        CHECK(q.remove(same(e[3])) == &e[3]); // middle
+        CHECK(q.remove(same(e[5])) == &e[5]); // tail
+        CHECK(q.size() == 4);
+
+        for (auto i: {0, 2, 4}) { // empties the FIFO
+                CHECK(q.remove(same(e[i])) == &e[i]);
+        }
+
+        CHECK(!q.remove(same(e[2])));
+        CHECK(q.size() == 1);
+
+        q.push(e[0], 0, 10); // the emptied FIFO
+        q.push(e[2], 1, 10); // the FIFO whose tail was removed
+
+        for (auto i: {0, 1, 2}) {
+                CHECK(pop_front(q, 10, 100) == &e[i]);
+        }
+
+        CHECK(q.empty());
+}
+
+/*
+ * Compares with a reference implementation on random operations.
+ */
+void random_ops()
+{
+        enum { CNT = 64, MAX_WAIT = 50 };
+
+        queue q{};
+        std::vector<send_queue_entry> e(CNT);
+        std::vector<bool> queued(CNT);
+
+        std::deque<int> ref; // indices in the order of push
+
+        std::mt19937 rnd(1);
+        unsigned long long now = 0;
+
+        for (int i = 0; i < 200'000; ++i) {
+
+                now += rnd() % 4;
+                auto idx = int(rnd() % CNT);
+
+                switch (rnd() % 3) {
+                case 0:
+                        if (!queued[idx]) {
+                                q.push(e[idx], rnd() % 4, now);
+                                queued[idx] = true;
+                                ref.push_back(idx);
+                        }
+                        break;
+                case 1: {
+                        auto r = q.remove([&e, idx] (auto &x) { return &x == &e[idx]; });
+                        CHECK((r == &e[idx]) == queued[idx]);
+                        if (r) {
+                                queued[idx] = false;
+                                std::erase(ref, idx);
+                        }
+                }       break;
+                case 2:
+                        int head[queue::PRIORITIES]{ -1, -1, -1, -1 };
+                        for (auto j: ref) {
+                                if (auto &h = head[e[j].priority]; h < 0) {
+                                        h = j;
+                                }
+                        }
+
+                        int expected = -1; // the head of the highest priority
+                        int starving = -1; // the oldest head of lower priority that waits too long
+
+                        for (auto j: head) {
+                                if (j < 0) {
+                                        //
+                                } else if (expected < 0) {
+                                        expected = j;
+                                } else if (now > e[j].time + MAX_WAIT && (starving < 0 || e[j].time < e[starving].time)) {
+                                        starving = j;
+                                }
+                        }
+
+                        if (starving >= 0) {
+                                expected = starving;
+                        }
+
+                        auto r = pop_front(q, now, MAX_WAIT);
+                        CHECK(expected < 0 ? !r : r == &e[expected]);
+                        if (r) {
+                                queued[expected] = false;
+                                std::erase(ref, expected);
+                        }
+                }
+
+                CHECK(q.size() == ref.size());
+        }
+}
+
+} // namespace
+
+
+int main()
+{
+        priorities();
+        skip();
+        starvation();
+        remove();
+        random_ops();
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "send_queue.h"
+#include "check.h"
+
+#include <cstdio>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+/*
+ * Simulation of interrupt latency under bulk OUT load at 100 Mbit/s.
+ * The link sends the socket buffer in FIFO order, the writer keeps 64 bulk transfers queued.
+ *
+ * fifo: transfers are handed to the socket in the order of arrival, as before send_queue.
+ * send_queue: the order of priority, at most MAX_INFLIGHT bytes are in the socket, see device_ctx::pending.
+ */
+namespace
+{
+
+using namespace usbip;
+
+constexpr unsigned long long U = 10'000'000; // units per second, as for KeQueryInterruptTime
+
+constexpr unsigned int INTERRUPT = 1; // priorities
+constexpr unsigned int BULK = 3;
+
+constexpr unsigned long long MAX_WAIT = 50*U/1000;
+constexpr unsigned long long MAX_INFLIGHT = 512*1024;
+
+struct transfer : send_queue_entry
+{
+        unsigned long long len;
+        unsigned long long born;
+        bool interrupt;
+};
+
+struct result
+{
+        double median; // ms
+        double p99; // ms
+        double bulk; // bytes per second
+};
+
+auto run(bool scheduler)
+{
+        const unsigned long long link = 12'500'000; // bytes per second
+        const unsigned long long duration = 5*U;
+        const unsigned long long step = U/100'000;
+
+        send_queue<4> q{};
+        std::deque<std::unique_ptr<transfer>> owned; // in the queue or in the socket
+        std::deque<transfer*> sock;
+
+        unsigned long long inflight = 0; // bytes in the socket
+        unsigned long long busy = 0; // the link is sending till that time
+        unsigned long long next_interrupt = 0;
+        unsigned long long bulk = 0;
+        int bulk_queued = 0;
+
+        std::vector<double> latency;
+
+        auto push = [&q, &owned] (auto len, auto prio, auto now)
+        {
+                auto &t = *owned.emplace_back(new transfer{ {}, len, now, prio == INTERRUPT });
+                q.push(t, prio, now);
+        };
+
+        for (unsigned long long t = 0; t < duration; t += step) {
+
+                for ( ; !sock.empty() && busy <= t; sock.pop_front()) {
+                        auto r = sock.front();
+                        busy = std::max(busy, t) + r->len*U/link;
+                        inflight -= r->len;
+
+                        if (r->interrupt) {
+                                latency.push_back(double(busy - r->born)*1000/U);
+                        } else {
+                                bulk += r->len;
+                                --bulk_queued;
+                        }
+
+                        std::erase_if(owned, [r] (auto &p) { return p.get() == r; });
+                }
+
+                if (t >= next_interrupt) { // every 1 ms
+                        push(48ULL, INTERRUPT, t);
+                        next_interrupt += U/1000;
+                }
+
+                for ( ; bulk_queued < 64; ++bulk_queued) {
+                        push(64*1024ULL + 48, BULK, t);
+                }
+
+                while (!scheduler || inflight < MAX_INFLIGHT) {
+                        auto e = q.front(t, scheduler ? MAX_WAIT : 0ULL);
+                        if (!e) {
+                                break;
+                        }
+                        q.pop(*e);
+
+                        auto r = static_cast<transfer*>(e);
+                        inflight += r->len;
+                        sock.push_back(r);
+                }
+        }
+
+        std::ranges::sort(latency);
+
+        return result {
+                .median = latency[latency.size()/2],
+                .p99 = latency[latency.size()*99/100],
+                .bulk = double(bulk)*U/duration
+        };
+}
+
+} // namespace
+
+
+int main()
+{
+        auto fifo = run(false);
+        auto sched = run(true);
+
+        for (auto [name, r]: { std::pair{"fifo", fifo}, std::pair{"send_queue", sched} }) {
+                std::printf("%s: interrupt latency median %.2f ms, p99 %.2f ms, bulk %.0f KB/s\n",
+                            name, r.median, r.p99, r.bulk/1000);
+        }
+
+        CHECK(sched.median*5 < fifo.median);
+        CHECK(sched.bulk >= fifo.bulk);
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "shaper.h"
+#include "check.h"
+
+#include <initializer_list>
+
+namespace
+{
+
+using namespace usbip::shaper;
+
+static_assert(get_priority(0) == priority::control);
+static_assert(get_priority(1) == priority::isoch);
+static_assert(get_priority(2) == priority::bulk);
+static_assert(get_priority(3) == priority::interrupt);
+
+constexpr unsigned long long U = UNITS_PER_SECOND;
+
+void unlimited()
+{
+        token_bucket b{};
+
+        for (int i = 0; i < 10; ++i) {
+                CHECK(consume(b, 1ULL << 40, priority::bulk, 0));
+        }
+        CHECK(!get_delay(b, 0));
+
+        set_rate(b, 1000, 0, 0);
+        set_rate(b, 0, 1000, 0);
+        CHECK(!b.rate && consume(b, 1ULL << 40, priority::bulk, 0));
+}
+
+void burst()
+{
+        token_bucket b{};
+
+        set_rate(b, 1'000'000, 0, 0);
+        CHECK(b.burst == 100'000); // 100 ms
+        CHECK(b.tokens == 100'000);
+
+        set_rate(b, 100'000, 0, 0);
+        CHECK(b.burst == 64*1024);
+
+        set_rate(b, 100'000, 5000, 0);
+        CHECK(b.burst == 5000);
+}
+
+void bulk_waits()
+{
+        token_bucket b{};
+        set_rate(b, 1000, 1000, 0); // 1 byte per ms
+
+        CHECK(consume(b, 1500, priority::bulk, 0)); // can take more than available
+        CHECK(b.tokens == -500);
+        CHECK(!consume(b, 1, priority::bulk, 0));
+
+        auto delay = get_delay(b, 0);
+        CHECK(delay == 501*U/1000);
+
+        CHECK(!consume(b, 1, priority::bulk, delay - 1));
+        CHECK(consume(b, 1, priority::bulk, delay));
+}
+
+/*
+ * A fraction of a token is not lost if the time is advanced by small steps.
+ */
+void no_lost_fractions()
+{
+        token_bucket b{};
+        set_rate(b, 3, 1000, 0); // 3 bytes per second
+        b.tokens = 0;
+
+        for (unsigned long long t = 0; t <= 10*U; t += U/7) {
+                refill(b, t);
+        }
+
+        CHECK(b.tokens == 29); // 10*U is not reached exactly, 3*(10*U/(U/7))*(U/7)/U rounded down
+
+        set_rate(b, 1000, 1000, 0);
+        b.tokens = 0;
+        refill(b, 1000*U); // elapsed is clamped, no overflow
+        CHECK(b.tokens == 1000);
+}
+
+/*
+ * Higher priorities are sent at once and borrow the tokens, the debt is limited by the capacity.
+ */
+void borrowing()
+{
+        token_bucket b{};
+        set_rate(b, 1000, 1000, 0);
+
+        for (auto prio: {priority::isoch, priority::interrupt, priority::control}) {
+                CHECK(consume(b, 1'000'000, prio, 0));
+                CHECK(b.tokens == -1000);
+        }
+
+        CHECK(!consume(b, 1, priority::bulk, 0));
+        CHECK(get_delay(b, 0) == 1001*U/1000); // burst/rate at most
+
+        CHECK(consume(b, 1, priority::bulk, 1001*U/1000));
+}
+
+} // namespace
+
+
+int main()
+{
+        unlimited();
+        burst();
+        bulk_waits();
+        no_lost_fractions();
+        borrowing();
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "shaper.h"
+#include "check.h"
+
+#include <cstdio>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+/*
+ * Simulation of isoch latency under bulk load on a slow link.
+ * The link sends in FIFO order, a bulk writer keeps its socket buffer full if the shaper allows that.
+ */
+namespace
+{
+
+using namespace usbip::shaper;
+
+constexpr unsigned long long U = UNITS_PER_SECOND;
+
+struct packet
+{
+        unsigned long long time; // when it was queued
+        unsigned long long len;
+        bool isoch;
+};
+
+struct result
+{
+        double median; // ms
+        double p99; // ms
+        double bulk; // bytes per second
+};
+
+auto run(unsigned long long rate)
+{
+        const unsigned long long link = 2'000'000; // bytes per second
+        const unsigned long long sndbuf = 4'000'000;
+        const unsigned long long duration = 10*U;
+        const unsigned long long step = U/10'000;
+
+        token_bucket b{};
+        set_rate(b, rate, 0, 0);
+
+        std::deque<packet> q;
+        unsigned long long queued = 0;
+        unsigned long long busy = 0; // the link is sending till that time
+        unsigned long long bulk = 0;
+        unsigned long long next_isoch = 0;
+
+        std::vector<double> latency;
+
+        for (unsigned long long t = 0; t < duration; t += step) {
+
+                for ( ; !q.empty() && busy <= t; q.pop_front()) {
+                        auto &p = q.front();
+                        queued -= p.len;
+                        busy = std::max(busy, t) + p.len*U/link;
+
+                        if (p.isoch) {
+                                latency.push_back(double(busy - p.time)*1000/U);
+                        } else {
+                                bulk += p.len;
+                        }
+                }
+
+                if (t >= next_isoch) { // 192 bytes every 1 ms
+                        q.push_back({ t, 192, true });
+                        queued += 192;
+                        consume(b, 192, priority::isoch, t);
+                        next_isoch += U/1000;
+                }
+
+                while (queued < sndbuf && consume(b, 64*1024, priority::bulk, t)) {
+                        q.push_back({ t, 64*1024, false });
+                        queued += 64*1024;
+                }
+        }
+
+        std::ranges::sort(latency);
+
+        return result {
+                .median = latency[latency.size()/2],
+                .p99 = latency[latency.size()*99/100],
+                .bulk = double(bulk)*U/duration
+        };
+}
+
+} // namespace
+
+
+int main()
+{
+        auto unlimited = run(0);
+        std::printf("unlimited: isoch latency median %.1f ms, p99 %.1f ms, bulk %.0f KB/s\n",
+                    unlimited.median, unlimited.p99, unlimited.bulk/1000);
+
+        for (auto rate: {1'800'000ULL, 1'000'000ULL}) {
+                auto r = run(rate);
+                std::printf("rate %llu: isoch latency median %.1f ms, p99 %.1f ms, bulk %.0f KB/s\n",
+                            rate, r.median, r.p99, r.bulk/1000);
+
+                CHECK(r.median*10 < unlimited.median);
+                CHECK(r.bulk <= rate*1.05);
+        }
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "teardown.h"
+#include "check.h"
+
+namespace
+{
+
+using namespace usbip::teardown;
+
+constexpr auto detached(time_type started, time_type finished)
+{
+        times t{};
+        on_start(t, started);
+        on_finish(t, finished);
+        return t;
+}
+
+static_assert(get_state(times{}) == state::attached);
+static_assert(get_state(detached(5, 8)) == state::detached);
+static_assert(get_duration(detached(5, 8), 100) == 3);
+static_assert(get_remaining(10, 4) == 6);
+static_assert(!get_remaining(10, 10) && !get_remaining(10, 11));
+
+void lifecycle()
+{
+        times t{};
+        CHECK(!get_duration(t, 10));
+
+        CHECK(on_start(t, 10));
+        CHECK(!on_start(t, 20)); // already initiated
+        CHECK(get_state(t) == state::detaching);
+        CHECK(get_duration(t, 25) == 15);
+        CHECK(!get_duration(t, 5)); // the clock of another processor is behind
+
+        on_finish(t, 30);
+        on_finish(t, 40); // ignored
+        CHECK(get_state(t) == state::detached);
+        CHECK(get_duration(t, 100) == 20);
+}
+
+/*
+ * The device was gone, f.e. its server has closed the connection, and detach was not initiated.
+ */
+void finish_without_start()
+{
+        times t{};
+        on_finish(t, 50);
+
+        CHECK(get_state(t) == state::detached);
+        CHECK(!get_duration(t, 60));
+        CHECK(!on_start(t, 70));
+}
+
+/*
+ * The same members as vhci::ioctl::plugout_hardware_time.
+ */
+struct record
+{
+        int port;
+        unsigned int ms;
+        unsigned int completed;
+};
+
+void fill_record()
+{
+        constexpr time_type msec = 10'000; // units of KeQueryInterruptTime
+
+        record r{ .port = 5, .ms = 7, .completed = 7 };
+        times t{};
+
+        CHECK(!fill(r, t, 10, msec)); // not initiated
+        CHECK(r.port == 5 && r.ms == 7 && r.completed == 7);
+
+        on_start(t, 1*msec);
+        CHECK(fill(r, t, 31*msec + 9, msec)); // still detaching after the timeout
+        CHECK(r.port == 5 && r.ms == 30 && !r.completed);
+
+        on_finish(t, 251*msec);
+        CHECK(fill(r, t, 1'000*msec, msec));
+        CHECK(r.port == 5 && r.ms == 250 && r.completed);
+}
+
+} // namespace
+
+
+int main()
+{
+        lifecycle();
+        finish_without_start();
+        fill_record();
+}
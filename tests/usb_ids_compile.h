@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "usb_ids_index.h"
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+
+/*
+ * Stand-in for CompileUsbIds task that produces the binary index, see userspace/usbip/usb_ids.targets.
+ */
+namespace usbip::usb_ids::compile
+{
+
+struct name_entry
+{
+        uint32_t key;
+        std::string_view name;
+};
+
+using tables = std::vector<name_entry>[TABLES];
+
+inline auto parse_hex(std::string_view s, size_t digits, uint32_t &val)
+{
+        val = 0;
+        if (s.size() < digits) {
+                return false;
+        }
+
+        for (size_t i = 0; i < digits; ++i) {
+                auto c = s[i];
+                int d = c >= '0' && c <= '9' ? c - '0' :
+                        c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                        c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+                if (d < 0) {
+                        return false;
+                }
+                val = val << 4 | d;
+        }
+
+        return true;
+}
+
+/*
+ * The same as CompileUsbIds::Parse, see userspace/usbip/usb_ids.targets.
+ */
+inline void parse(tables &t, std::string_view text)
+{
+        auto add = [&t] (table_id id, uint32_t key, std::string_view line, size_t pos) // "id  name", pos is after id
+        {
+                pos = std::min(pos + 2, line.size());
+                t[id].push_back({ key, line.substr(pos) });
+        };
+
+        bool in_classes = false;
+        int vid = -1, cls = -1, sub = -1;
+
+        while (!text.empty()) {
+                auto end = text.find('\n');
+                auto line = text.substr(0, end);
+                text.remove_prefix(end == text.npos ? text.size() : end + 1);
+
+                if (line.ends_with('\r')) {
+                        line.remove_suffix(1);
+                }
+
+                uint32_t val;
+
+                if (line.empty()) {
+                        //
+                } else if (!in_classes) {
+                        if (line.starts_with("# List of known device classes, subclasses and protocols")) {
+                                in_classes = true;
+                        } else if (line[0] == '#' || line.starts_with("\t\t")) {
+                                // interfaces are not used
+                        } else if (line[0] == '\t') {
+                                if (vid >= 0 && parse_hex(line.substr(1), 4, val)) {
+                                        add(products, product_key(uint16_t(vid), uint16_t(val)), line, 5);
+                                }
+                        } else if (parse_hex(line, 4, val)) {
+                                vid = int(val);
+                                add(vendors, vendor_key(uint16_t(val)), line, 4);
+                        }
+                } else if (line.starts_with("# List of Audio Class Terminal Types")) {
+                        break;
+                } else if (line[0] == '#') {
+                        //
+                } else if (line.starts_with("\t\t")) {
+                        if (cls >= 0 && sub >= 0 && parse_hex(line.substr(2), 2, val)) {
+                                add(protocols, protocol_key(uint8_t(cls), uint8_t(sub), uint8_t(val)), line, 4);
+                        }
+                } else if (line[0] == '\t') {
+                        if (cls >= 0 && parse_hex(line.substr(1), 2, val)) {
+                                sub = int(val);
+                                add(subclasses, subclass_key(uint8_t(cls), uint8_t(val)), line, 3);
+                        }
+                } else if (line.starts_with("C ") && parse_hex(line.substr(2), 2, val)) {
+                        cls = int(val);
+                        sub = -1;
+                        add(classes, class_key(uint8_t(val)), line, 4);
+                }
+        }
+
+        for (auto &v: t) { // sort by key, the first of duplicates is kept
+                std::ranges::stable_sort(v, {}, &name_entry::key);
+                auto [first, last] = std::ranges::unique(v, {}, &name_entry::key);
+                v.erase(first, last);
+        }
+}
+
+/*
+ * The same as CompileUsbIds::Write.
+ * @return the index, vector of uint64_t is used to align it
+ */
+inline auto make_index(const tables &t, size_t &size)
+{
+        header hdr{};
+        memcpy(hdr.magic, MAGIC, sizeof(MAGIC));
+        hdr.version = VERSION;
+
+        uint32_t offset = sizeof(hdr);
+
+        for (int i = 0; i < TABLES; ++i) {
+                hdr.tables[i] = { .offset = offset, .count = uint32_t(t[i].size()) };
+                offset += uint32_t(t[i].size()*sizeof(entry));
+        }
+
+        std::string pool;
+        std::vector<entry> entries;
+
+        for (auto &v: t) {
+                for (auto &e: v) {
+                        entries.push_back({ .key = e.key, .name = uint32_t(pool.size()), .length = uint32_t(e.name.size()) });
+                        pool += e.name;
+                }
+        }
+
+        hdr.strings = offset;
+        hdr.strings_size = uint32_t(pool.size());
+        hdr.size = offset + hdr.strings_size;
+
+        size = hdr.size;
+        std::vector<uint64_t> buf((size + sizeof(uint64_t) - 1)/sizeof(uint64_t));
+
+        auto p = reinterpret_cast<char*>(buf.data());
+        memcpy(p, &hdr, sizeof(hdr));
+        memcpy(p + sizeof(hdr), entries.data(), entries.size()*sizeof(entry));
+        memcpy(p + hdr.strings, pool.data(), pool.size());
+
+        return buf;
+}
+
+inline auto as_view(const std::vector<uint64_t> &buf, size_t size)
+{
+        return std::string_view(reinterpret_cast<const char*>(buf.data()), size);
+}
+
+/*
+ * @return content of the file, empty if it can't be read
+ */
+inline auto read_file(const char *path)
+{
+        std::ifstream f(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(f), {});
+}
+
+} // namespace usbip::usb_ids::compile
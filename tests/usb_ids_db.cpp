@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "usb_ids_db.h"
+#include "usb_ids_compile.h"
+#include "check.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+/*
+ * @param argv[1] path to usb.ids
+ */
+namespace
+{
+
+using namespace usbip::usb_ids;
+using namespace usbip::usb_ids::compile;
+using usbip::usb_ids::index; // not ::index from <strings.h>
+
+/*
+ * Every name of the index must be found in the database.
+ */
+void same_as_index(const database &db, const index &idx)
+{
+        size_t cnt = 0;
+
+        for (int i = 0; i < TABLES; ++i) {
+                auto id = static_cast<table_id>(i);
+                auto t = idx.get_table(id);
+
+                for (auto e = t.first; e != t.first + t.count; ++e) {
+                        auto name = idx.find(id, e->key);
+
+                        if (id == products) {
+                                CHECK(db.find_product(uint16_t(e->key >> 16), uint16_t(e->key)) == name);
+                        } else {
+                                CHECK(db.find(id, e->key) == name);
+                        }
+
+                        ++cnt;
+                }
+        }
+
+        CHECK(cnt);
+        CHECK(db.find(vendors, 0x1'0000).empty());
+        CHECK(db.find_product(0x1d6b, 0xfff0).empty());
+        CHECK(db.find(protocols, protocol_key(0xff, 0xff, 0xfe)).empty());
+}
+
+/*
+ * @param data binary index of the text
+ */
+void eager(std::string_view text, std::string_view data)
+{
+        index idx(data);
+        CHECK(idx);
+
+        database db;
+        CHECK(db.empty());
+
+        db.load(text, false);
+        CHECK(!db.empty());
+
+        CHECK(db.find(vendors, vendor_key(0x1d6b)) == "Linux Foundation");
+        CHECK(db.find_product(0x1d6b, 0x0002) == "2.0 root hub");
+        CHECK(db.find(classes, class_key(0x00)) == "(Defined at Interface level)");
+        CHECK(db.find(protocols, protocol_key(0x03, 0x01, 0x01)) == "Keyboard");
+
+        same_as_index(db, idx);
+
+        database from_index;
+        from_index.load(data, false);
+        CHECK(!from_index.empty());
+        same_as_index(from_index, idx);
+}
+
+/*
+ * Products of a vendor are parsed on the first lookup of the vendor only.
+ */
+void lazy(std::string_view text, std::string_view data)
+{
+        index idx(data);
+        CHECK(idx);
+
+        database db;
+        db.load(text, true);
+        CHECK(!db.empty());
+
+        auto &blocks = db.layers().front().lazy;
+        CHECK(blocks.size() == idx.get_table(vendors).count);
+        CHECK(db.layers().front().tables[products].size() == 2); // after a comment inside the blocks of 0638, 9148
+
+        auto parsed = [&blocks] { return std::ranges::count_if(blocks, [] (auto &b) { return b.parsed; }); };
+
+        CHECK(!parsed());
+        CHECK(db.find(vendors, vendor_key(0x1d6b)) == "Linux Foundation"); // vendor names are parsed at load
+        CHECK(!parsed());
+
+        CHECK(db.find_product(0x1d6b, 0x0002) == "2.0 root hub");
+        CHECK(parsed() == 1);
+        CHECK(db.find_product(0x1d6b, 0x0003) == "3.0 root hub");
+        CHECK(parsed() == 1);
+
+        same_as_index(db, idx);
+        CHECK(std::ranges::all_of(blocks, [] (auto &b) { return b.parsed || b.lines.empty(); }));
+}
+
+/*
+ * Concurrent first lookups of the same vendors, run it under ThreadSanitizer.
+ */
+void lazy_concurrency(std::string_view text, std::string_view data)
+{
+        index idx(data);
+        auto t = idx.get_table(products);
+
+        database db;
+        db.load(text, true);
+
+        std::vector<std::jthread> threads;
+
+        for (int i = 0; i < 4; ++i) {
+                threads.emplace_back([&db, &idx, t, i]
+                {
+                        for (auto e = t.first + i; e < t.first + t.count; e += 2) {
+                                auto name = db.find_product(uint16_t(e->key >> 16), uint16_t(e->key));
+                                CHECK(name == idx.find(products, e->key));
+                        }
+                });
+        }
+}
+
+/*
+ * The scan must return the same as the loop byte by byte for any length and alignment of the text.
+ */
+void find_unindented_reference()
+{
+        auto reference = [] (std::string_view s)
+        {
+                for (size_t i = 0; i < s.size(); ++i) {
+                        if (s[i] == '\n' && (i + 1 == s.size() || s[i + 1] != '\t')) {
+                                return i + 1;
+                        }
+                }
+                return s.size();
+        };
+
+        std::mt19937 rnd(1);
+        const char alphabet[]{ '\t', '\n', 'a', '0' };
+
+        for (int i = 0; i < 20'000; ++i) {
+                std::string s(1 + rnd() % 100, '\t');
+
+                for (auto &c: s) {
+                        if (auto r = rnd() % 16; r < std::size(alphabet)) { // mostly '\t'
+                                c = alphabet[r];
+                        }
+                }
+
+                for (size_t off = 0; off < std::min<size_t>(s.size(), 17); ++off) {
+                        auto v = std::string_view(s).substr(off);
+                        CHECK(find_unindented(v) == reference(v));
+                }
+        }
+
+        CHECK(!find_unindented({}));
+        CHECK(find_unindented("\t1\n\t2\n3") == 6);
+        CHECK(find_unindented("\t1\n\t2\n") == 6);
+        CHECK(find_unindented("\t1\n\t2") == 5);
+}
+
+/*
+ * Time to first lookup: the load plus the names of the devices, f.e. of "usbip port" or "usbip list -r".
+ */
+void time_to_first_lookup(std::string_view text)
+{
+        using namespace std::chrono;
+
+        const std::pair<uint16_t, uint16_t> devices[]{
+                { 0x1d6b, 0x0002 }, { 0x046d, 0xc52b }, { 0x0781, 0x5567 }, { 0x8087, 0x0024 },
+                { 0x04f2, 0xb604 }, { 0x0bda, 0x8153 }, { 0x1050, 0x0407 }, { 0x05ac, 0x12a8 },
+        };
+
+        for (size_t cnt: {3, 8}) {
+                for (auto mode: {false, true}) {
+                        std::vector<long long> v;
+
+                        for (int i = 0; i < 51; ++i) {
+                                auto t0 = steady_clock::now();
+
+                                database db;
+                                db.load(text, mode);
+
+                                for (size_t j = 0; j < cnt; ++j) {
+                                        auto [vid, pid] = devices[j];
+                                        CHECK(!db.find(vendors, vendor_key(vid)).empty());
+                                        CHECK(!db.find_product(vid, pid).empty());
+                                }
+
+                                v.push_back(duration_cast<microseconds>(steady_clock::now() - t0).count());
+                        }
+
+                        std::ranges::nth_element(v, v.begin() + v.size()/2);
+                        std::printf("%s, %zu devices: %lld us\n", mode ? "lazy" : "eager", cnt, v[v.size()/2]);
+                }
+        }
+}
+
+/*
+ * The first loaded name of a key wins, whether it comes from a text or an index.
+ */
+void first_name_wins()
+{
+        std::string_view first = "1d6b  Linux Foundation\n"
+                                 "\t0002  2.0 root hub\n"
+                                 "# List of known device classes, subclasses and protocols\n"
+                                 "C 03  Human Interface Device\n";
+
+        std::string_view second = "1d6b  Other\n"
+                                  "\t0002  Other hub\n"
+                                  "\t0003  3.0 root hub\n"
+                                  "1d6c  Another\n"
+                                  "# List of known device classes, subclasses and protocols\n"
+                                  "C 03  HID\n"
+                                  "C 08  Mass Storage\n";
+
+        tables t;
+        parse(t, second);
+
+        size_t size{};
+        auto buf = make_index(t, size);
+        auto second_idx = as_view(buf, size);
+        CHECK(index(second_idx));
+
+        auto check = [] (const database &db, bool first_wins)
+        {
+                CHECK(db.find(vendors, vendor_key(0x1d6b)) == (first_wins ? "Linux Foundation" : "Other"));
+                CHECK(db.find_product(0x1d6b, 0x0002) == (first_wins ? "2.0 root hub" : "Other hub"));
+                CHECK(db.find(classes, class_key(0x03)) == (first_wins ? "Human Interface Device" : "HID"));
+
+                CHECK(db.find_product(0x1d6b, 0x0003) == "3.0 root hub"); // merged
+                CHECK(db.find(vendors, vendor_key(0x1d6c)) == "Another");
+                CHECK(db.find(classes, class_key(0x08)) == "Mass Storage");
+        };
+
+        for (auto content: {second, second_idx}) {
+                database db;
+                db.load(first, false);
+                db.load(content, false);
+                check(db, true);
+
+                database rev;
+                rev.load(content, false);
+                rev.load(first, false);
+                check(rev, false);
+
+                database lazy_first;
+                lazy_first.load(first, true);
+                lazy_first.load(content, false);
+                check(lazy_first, true);
+
+                database lazy_second;
+                lazy_second.load(content, content == second);
+                lazy_second.load(first, false);
+                check(lazy_second, false);
+        }
+
+        database dup; // the same vendor twice in a text
+        dup.load("1d6b  Linux Foundation\n\t0002  2.0 root hub\n1d6b  Other\n\t0002  Other hub\n\t0003  3.0 root hub\n", false);
+        CHECK(dup.empty()); // no classes
+        CHECK(dup.find(vendors, vendor_key(0x1d6b)) == "Linux Foundation");
+        CHECK(dup.find_product(0x1d6b, 0x0002) == "2.0 root hub");
+        CHECK(dup.find_product(0x1d6b, 0x0003) == "3.0 root hub");
+
+        database dup_lazy;
+        dup_lazy.load("1d6b  Linux Foundation\n\t0002  2.0 root hub\n1d6b  Other\n\t0002  Other hub\n\t0003  3.0 root hub\n", true);
+        CHECK(dup_lazy.find(vendors, vendor_key(0x1d6b)) == "Linux Foundation");
+        CHECK(dup_lazy.find_product(0x1d6b, 0x0002) == "2.0 root hub");
+        CHECK(dup_lazy.find_product(0x1d6b, 0x0003) == "3.0 root hub");
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+        CHECK(argc > 1);
+        auto text = read_file(argv[1]);
+        CHECK(!text.empty());
+
+        tables t;
+        parse(t, text);
+
+        size_t size{};
+        auto buf = make_index(t, size);
+
+        eager(text, as_view(buf, size));
+        lazy(text, as_view(buf, size));
+        lazy_concurrency(text, as_view(buf, size));
+        find_unindented_reference();
+        first_name_wins();
+        time_to_first_lookup(text);
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "usb_ids_compile.h"
+#include "check.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+/*
+ * @param argv[1] path to usb.ids
+ */
+namespace
+{
+
+using namespace usbip::usb_ids;
+using namespace usbip::usb_ids::compile;
+using usbip::usb_ids::index; // not ::index from <strings.h>
+
+/*
+ * find_entry must return the same as lower_bound for tables of any size.
+ */
+void find_entry_exhaustive()
+{
+        std::mt19937 rnd(1);
+
+        for (size_t n = 0; n < 300; ++n) {
+                std::vector<entry> v(n);
+                uint32_t key = 0;
+
+                for (auto &e: v) {
+                        key += 1 + rnd() % 3;
+                        e.key = key;
+                }
+
+                CHECK(!find_entry(v.data(), n, 0));
+                CHECK(!find_entry(v.data(), n, key + 1));
+
+                for (uint32_t k = 0; k <= key; ++k) {
+                        auto i = std::ranges::lower_bound(v, k, {}, &entry::key);
+                        auto e = find_entry(v.data(), n, k);
+                        CHECK(e == (i != v.end() && i->key == k ? &*i : nullptr));
+                }
+        }
+
+        CHECK(!find_entry<entry>(nullptr, 10, 0));
+}
+
+void validation(const std::vector<uint64_t> &buf, size_t size)
+{
+        CHECK(index(as_view(buf, size)));
+        CHECK(!index(as_view(buf, size - 1))); // truncated
+        CHECK(!index(as_view(buf, sizeof(header) - 1)));
+        CHECK(!index());
+
+        auto corrupt = [&buf, size] (auto f)
+        {
+                auto copy = buf;
+                f(*reinterpret_cast<header*>(copy.data()));
+                return !index(as_view(copy, size));
+        };
+
+        CHECK(corrupt([] (auto &h) { h.magic[0] = '#'; }));
+        CHECK(corrupt([] (auto &h) { ++h.version; }));
+        CHECK(corrupt([] (auto &h) { ++h.size; }));
+        CHECK(corrupt([] (auto &h) { ++h.tables[products].offset; })); // misaligned
+        CHECK(corrupt([] (auto &h) { h.tables[vendors].count = h.size; }));
+        CHECK(corrupt([] (auto &h) { h.tables[classes].offset = h.size + 4; }));
+        CHECK(corrupt([] (auto &h) { h.strings_size += 1; }));
+        CHECK(corrupt([] (auto &h) { h.strings = h.size + 1; }));
+
+        std::vector<uint64_t> misaligned(buf.size() + 1);
+        auto p = reinterpret_cast<char*>(misaligned.data()) + 1;
+        memcpy(p, buf.data(), size);
+        CHECK(!index(std::string_view(p, size)));
+}
+
+void lookups(const tables &t, const index &idx)
+{
+        size_t cnt = 0;
+
+        for (int i = 0; i < TABLES; ++i) {
+                auto id = static_cast<table_id>(i);
+                CHECK(idx.get_table(id).count == t[i].size());
+
+                for (auto &e: t[i]) {
+                        CHECK(idx.find(id, e.key) == e.name);
+                        ++cnt;
+                }
+        }
+
+        std::printf("%zu names of %zu vendors, %zu products, %zu classes have been found\n",
+                    cnt, t[vendors].size(), t[products].size(), t[classes].size());
+
+        CHECK(idx.find(vendors, vendor_key(0x1d6b)) == "Linux Foundation");
+        CHECK(idx.find(products, product_key(0x1d6b, 0x0002)) == "2.0 root hub");
+        CHECK(idx.find(classes, class_key(0x08)) == "Mass Storage");
+        CHECK(idx.find(classes, class_key(0x00)) == "(Defined at Interface level)");
+        CHECK(idx.find(subclasses, subclass_key(0x03, 0x01)) == "Boot Interface Subclass");
+        CHECK(idx.find(protocols, protocol_key(0x03, 0x01, 0x01)) == "Keyboard");
+
+        CHECK(idx.find(vendors, 0x1'0000).empty());
+        CHECK(idx.find(products, product_key(0x1d6b, 0xfff0)).empty());
+}
+
+void benchmark(const tables &t, const index &idx, std::string_view data)
+{
+        using namespace std::chrono;
+        enum { N = 1'000'000 };
+
+        auto t0 = steady_clock::now();
+        index opened(data);
+        auto t1 = steady_clock::now();
+        CHECK(opened);
+
+        std::mt19937 rnd(1);
+        std::vector<uint32_t> prod(N);
+        std::vector<uint32_t> cls(N);
+
+        for (size_t i = 0; i < N; ++i) {
+                prod[i] = t[products][rnd() % t[products].size()].key;
+                cls[i] = t[classes][rnd() % t[classes].size()].key;
+        }
+
+        size_t total = 0;
+
+        auto t2 = steady_clock::now();
+        for (size_t i = 0; i < N; ++i) {
+                total += idx.find(products, prod[i]).size();
+                total += idx.find(classes, cls[i]).size();
+        }
+        auto t3 = steady_clock::now();
+
+        CHECK(total);
+        std::printf("open %lld ns, %d product and %d class lookups %lld ms\n",
+                    static_cast<long long>(duration_cast<nanoseconds>(t1 - t0).count()), N, N,
+                    static_cast<long long>(duration_cast<milliseconds>(t3 - t2).count()));
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+        find_entry_exhaustive();
+
+        CHECK(argc > 1);
+        auto text = read_file(argv[1]);
+        CHECK(!text.empty());
+
+        tables t;
+        parse(t, text);
+        CHECK(!t[vendors].empty() && !t[classes].empty());
+
+        size_t size{};
+        auto buf = make_index(t, size);
+
+        validation(buf, size);
+
+        usbip::usb_ids::index idx(as_view(buf, size));
+        lookups(t, idx);
+        benchmark(t, idx, as_view(buf, size));
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ * Copyright (C) 2023 - 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
  */
 
 #pragma once
@@ -13,7 +13,7 @@ namespace libusbip
 {
 
 /*
- * @param utf-8 encoded message 
+ * @param utf-8 encoded message
  */
 using output_func_type = std::function<void(std::string)>;
 
@@ -27,4 +27,36 @@ USBIP_API void set_debug_output(const output_func_type &f);
  */
 USBIP_API const output_func_type& get_debug_output() noexcept;
 
+/*
+ * In ascending order of severity.
+ */
+enum class level { debug, info, warning, error, off };
+
+/*
+ * Messages of lower level are not formatted, level::debug is the default.
+ */
+USBIP_API void set_output_level(level lvl) noexcept;
+USBIP_API level get_output_level() noexcept;
+
+/*
+ * Sink for set_debug_output that queues messages without locks and passes them to the function
+ * in a worker thread. Thus the function is never called concurrently and the threads
+ * that produce messages do not wait for it. Queued messages are passed before the destructor returns.
+ */
+class USBIP_API BufferedOutput
+{
+public:
+        BufferedOutput(const output_func_type &f);
+        ~BufferedOutput();
+
+        BufferedOutput(const BufferedOutput&) = delete;
+        BufferedOutput& operator =(const BufferedOutput&) = delete;
+
+        void operator()(std::string s) const;
+
+private:
+        class Impl;
+        Impl *m_impl{}; // std::unique_ptr is not compatible with __declspec(dllexport) for the class
+};
+
 } // namespace libusbip
@@ -8,7 +8,11 @@
 #include "win_socket.h"
 
 #include <usbspec.h>
+
 #include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
 
 namespace usbip
 {
@@ -97,6 +101,9 @@ using usb_interface_f = std::function<void(_In_ int dev_idx, _In_ const usb_devi
 using usb_device_cnt_f = std::function<void(_In_ int count)>;
 
 /**
+ * The reply is read in large chunks, so bytes that follow OP_REP_DEVLIST may be consumed as well.
+ * Do not use the socket for other requests after this call.
+ *
  * @param s socket handle
  * @param on_dev will be called for every usb device
  * @param on_intf will be called for every usb interface of usb device
@@ -109,4 +116,76 @@ USBIP_API bool enum_exportable_devices(
         _In_ const usb_interface_f &on_intf,
         _In_opt_ const usb_device_cnt_f &on_dev_cnt = nullptr);
 
+struct host_address
+{
+        std::string hostname;
+        std::string service = get_tcp_port();
+};
+
+struct exportable_device
+{
+        usb_device dev;
+        std::vector<usb_interface> interfaces;
+};
+
+/**
+ * @param host_idx zero-based index of the host in the list
+ * @param error zero if devices were enumerated, otherwise error code, see GetLastError
+ * @param devices exportable devices of the host, empty if error is not zero
+ */
+using host_devices_f = std::function<void(_In_ int host_idx, _In_ DWORD error, 
+                                          _In_ const std::vector<exportable_device> &devices)>;
+
+/**
+ * Connect to the hosts and enumerate their exportable devices concurrently.
+ * The call is blocking, it returns when each host has been handled.
+ * 
+ * @param hosts list of hosts to query
+ * @param on_host will be called once for every host as soon as it is done, calls are serialized,
+ *        the order is the order in which the hosts have answered
+ * @param max_workers maximum number of hosts that are queried simultaneously
+ * @param deadline time limit for each host, includes name resolution, connect and devlist reply;
+ *        on expiration on_host is called with ERROR_TIMEOUT
+ */
+USBIP_API void enum_exportable_devices(
+        _In_ const std::vector<host_address> &hosts, 
+        _In_ const host_devices_f &on_host,
+        _In_ unsigned int max_workers,
+        _In_ std::chrono::milliseconds deadline);
+
+struct discover_params
+{
+        unsigned int max_inflight = 1024; // simultaneous connects
+        unsigned int rate = 4096; // connects per second, zero means unlimited
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(500); // of connect
+
+        unsigned int max_workers = 16; // see enum_exportable_devices
+        std::chrono::milliseconds deadline = std::chrono::seconds(5);
+};
+
+/**
+ * @param hostname IP address of the server
+ * @param error zero if devices were enumerated, otherwise error code, see GetLastError
+ * @param devices exportable devices of the server, empty if error is not zero
+ */
+using discovered_host_f = std::function<void(_In_ const std::string &hostname, _In_ DWORD error, 
+                                             _In_ const std::vector<exportable_device> &devices)>;
+
+/**
+ * Find USB/IP servers in IPv4 network.
+ * Connections to the service are initiated to every host of the network without waiting for each other,
+ * the hosts that have accepted the connection are queried for exportable devices.
+ * The call is blocking, it returns when each host has been handled.
+ *
+ * @param cidr "A.B.C.D/N", f.e. "192.168.1.0/24", the prefix must be at least 16
+ * @param service TCP/IP port number or symbolic name
+ * @param on_host will be called for every server, see enum_exportable_devices(hosts, ...)
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool discover(
+        _In_ const char *cidr, 
+        _In_ const char *service, 
+        _In_ const discovered_host_f &on_host,
+        _In_ const discover_params &params = {});
+
 } // namespace usbip
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "remote.h"
+
+namespace usbip
+{
+
+struct cache_params
+{
+        std::chrono::milliseconds ttl = std::chrono::seconds(60); // cached devices are not returned after that
+        std::chrono::milliseconds refresh = std::chrono::seconds(30); // age when background refresh is started
+
+        unsigned int max_workers = 16; // see enum_exportable_devices
+        std::chrono::milliseconds deadline = std::chrono::seconds(15);
+
+        std::string path; // UTF-8, file to load the cache from and save it to, empty for in-process cache only
+};
+
+/**
+ * Cache of exportable devices of the hosts, the key is host:service.
+ * Only successful results are cached, errors are always reported by the host.
+ *
+ * An entry that is older than cache_params::refresh is returned as is and is refreshed
+ * by the internal thread, so the next call gets fresh devices without waiting for the host.
+ * An entry that is older than cache_params::ttl is not returned, the host is queried again.
+ *
+ * The object can be used by several threads simultaneously.
+ */
+class USBIP_API ExportableDevicesCache
+{
+public:
+        /**
+         * Loads cache_params::path if it is not empty, the errors are ignored.
+         */
+        explicit ExportableDevicesCache(_In_ const cache_params &params = {});
+
+        /**
+         * Saves to cache_params::path if it is not empty. Waits for the refresh in progress.
+         */
+        ~ExportableDevicesCache();
+
+        ExportableDevicesCache(const ExportableDevicesCache&) = delete;
+        ExportableDevicesCache& operator =(const ExportableDevicesCache&) = delete;
+
+        /**
+         * The same as enum_exportable_devices(hosts, on_host, max_workers, deadline).
+         * on_host is called from this thread for the hosts that are found in the cache before any host is queried.
+         */
+        void enum_exportable_devices(_In_ const std::vector<host_address> &hosts, _In_ const host_devices_f &on_host);
+
+        /**
+         * The next call will query the host.
+         */
+        void invalidate(_In_ const host_address &host);
+        void clear();
+
+        /**
+         * @return call GetLastError() if false is returned
+         */
+        bool save() const;
+
+private:
+        class Impl;
+        Impl *m_impl{}; // std::unique_ptr is not compatible with __declspec(dllexport) for the class
+};
+
+} // namespace usbip
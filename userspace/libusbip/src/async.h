@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ * Scheduling of asynchronous operations, see vhci::AsyncDevice.
+ * It does not depend on Windows SDK and can be used on any platform as is.
+ * Operations are started and completed by a backend, f.e. overlapped I/O and I/O completion port.
+ */
+namespace usbip::async
+{
+
+/*
+ * The number of operations in flight.
+ */
+class counter
+{
+public:
+        void add();
+        void remove();
+
+        size_t size() const;
+
+        /*
+         * Returns when there are no operations in flight.
+         */
+        void wait();
+
+private:
+        mutable std::mutex m_mtx;
+        std::condition_variable m_cv;
+        size_t m_cnt{};
+};
+
+inline void counter::add()
+{
+        std::lock_guard lck(m_mtx);
+        ++m_cnt;
+}
+
+inline void counter::remove()
+{
+        std::lock_guard lck(m_mtx);
+
+        if (!--m_cnt) {
+                m_cv.notify_all();
+        }
+}
+
+inline size_t counter::size() const
+{
+        std::lock_guard lck(m_mtx);
+        return m_cnt;
+}
+
+inline void counter::wait()
+{
+        std::unique_lock lck(m_mtx);
+        m_cv.wait(lck, [this] { return !m_cnt; });
+}
+
+/*
+ * Starts operations [0, count) in ascending order, at most window of them are in flight.
+ * The next operation is started by the thread that reports the completion of the previous one,
+ * so no thread waits for the batch. Thread-safe.
+ *
+ * An operation can complete in other thread before start function returns,
+ * thus the object must be kept alive by each started operation (f.e. by std::shared_ptr).
+ */
+class batch
+{
+public:
+        /*
+         * @return false if the operation has completed synchronously, complete() must not be called for it
+         */
+        using start_f = std::function<bool(size_t idx)>;
+
+        /*
+         * @param window zero is treated as one
+         */
+        batch(size_t count, size_t window, start_f start) :
+                m_count(count), m_window(window ? window : 1), m_start(std::move(start)) {}
+
+        auto size() const noexcept { return m_count; }
+
+        /*
+         * Starts the first window of operations, must be called once.
+         * @return true if the batch is done, f.e. all operations have completed synchronously
+         */
+        bool run() { return m_count ? pump() : true; }
+
+        /*
+         * Must be called once for each operation that was started asynchronously.
+         * Starts the next operation if any.
+         * @return true if the batch is done, only one call of run/complete returns true
+         */
+        bool complete();
+
+private:
+        const size_t m_count;
+        const size_t m_window;
+        start_f m_start;
+
+        std::mutex m_mtx;
+        size_t m_next{}; // operation to start
+        size_t m_inflight{};
+        size_t m_done{};
+
+        bool pump();
+};
+
+inline bool batch::complete()
+{
+        {
+                std::lock_guard lck(m_mtx);
+                --m_inflight;
+
+                if (++m_done == m_count) {
+                        return true;
+                }
+        }
+
+        return pump();
+}
+
+inline bool batch::pump()
+{
+        for (std::unique_lock lck(m_mtx); m_next < m_count && m_inflight < m_window; ) {
+
+                auto idx = m_next++;
+                ++m_inflight;
+
+                lck.unlock();
+                auto pending = m_start(idx);
+                lck.lock();
+
+                if (!pending) {
+                        --m_inflight;
+                        if (++m_done == m_count) {
+                                return true;
+                        }
+                }
+        }
+
+        return false;
+}
+
+} // namespace usbip::async
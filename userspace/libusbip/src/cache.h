@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <mutex>
+#include <stop_token>
+#include <unordered_map>
+#include <condition_variable>
+
+/*
+ * Storage of ExportableDevicesCache.
+ * It does not depend on Windows SDK and can be used on any platform as is.
+ */
+namespace usbip::cache
+{
+
+/*
+ * Entries are refreshed ahead of their expiration.
+ * An entry whose age is less than ttl is returned by get(). If its age is refresh or more,
+ * its key is queued once for the refresher that waits in wait_pending().
+ * The result of the refresh is dropped if the entry has been erased or replaced after it was queued.
+ * Values are immutable and shared, so a returned value stays valid after the entry has been replaced.
+ * Thread-safe.
+ */
+template<typename T, typename Clock = std::chrono::steady_clock>
+class store
+{
+public:
+        using value_type = std::shared_ptr<const T>;
+        using time_point = typename Clock::time_point;
+        using duration = typename Clock::duration;
+
+        struct pending
+        {
+                std::string key;
+                unsigned long long seq; // of the refresh
+        };
+
+        store(duration ttl, duration refresh) : m_ttl(ttl), m_refresh(std::min(refresh, ttl)) {}
+
+        auto ttl() const noexcept { return m_ttl; }
+
+        /*
+         * @return nullptr if there is no entry or it has expired
+         */
+        value_type get(const std::string &key, time_point now);
+
+        /*
+         * @param updated when the value was obtained, an entry that is older than the existing one is ignored
+         */
+        void put(const std::string &key, value_type value, time_point updated);
+
+        /*
+         * Completes the refresh returned by wait_pending().
+         * @param value nullptr if the refresh has failed, the entry will be queued again by the next get()
+         */
+        void refreshed(const pending &r, value_type value, time_point updated);
+
+        /*
+         * @return entries to refresh, empty if stop is requested
+         */
+        std::vector<pending> wait_pending(std::stop_token stop);
+
+        void erase(const std::string &key);
+        void clear();
+
+        /*
+         * @param f(key, value, updated) is called for each entry that has not expired
+         */
+        template<typename F>
+        void for_each(time_point now, F &&f) const;
+
+private:
+        struct entry
+        {
+                value_type value;
+                time_point updated;
+                unsigned long long refresh_seq; // is queued or is being refreshed if not zero
+        };
+
+        const duration m_ttl;
+        const duration m_refresh;
+
+        mutable std::mutex m_mtx;
+        std::condition_variable_any m_cv;
+
+        std::unordered_map<std::string, entry> m_entries;
+        std::vector<pending> m_pending;
+        unsigned long long m_seq{};
+};
+
+template<typename T, typename Clock>
+auto store<T, Clock>::get(const std::string &key, time_point now) -> value_type
+{
+        std::lock_guard lck(m_mtx);
+
+        auto i = m_entries.find(key);
+        if (i == m_entries.end()) {
+                return {};
+        }
+
+        auto &e = i->second;
+        auto age = now - e.updated;
+
+        if (age >= m_ttl) {
+                if (!e.refresh_seq) { // otherwise the refresher will put it back
+                        m_entries.erase(i);
+                }
+                return {};
+        }
+
+        if (age >= m_refresh && !e.refresh_seq) {
+                e.refresh_seq = ++m_seq;
+                m_pending.push_back({ .key = key, .seq = e.refresh_seq });
+                m_cv.notify_one();
+        }
+
+        return e.value;
+}
+
+template<typename T, typename Clock>
+void store<T, Clock>::put(const std::string &key, value_type value, time_point updated)
+{
+        std::lock_guard lck(m_mtx);
+
+        auto [i, inserted] = m_entries.try_emplace(key);
+        auto &e = i->second;
+
+        if (inserted || updated >= e.updated) {
+                e = { .value = std::move(value), .updated = updated, .refresh_seq = 0 };
+        } else {
+                e.refresh_seq = 0;
+        }
+}
+
+template<typename T, typename Clock>
+void store<T, Clock>::refreshed(const pending &r, value_type value, time_point updated)
+{
+        std::lock_guard lck(m_mtx);
+
+        auto i = m_entries.find(r.key);
+        if (i == m_entries.end() || i->second.refresh_seq != r.seq) { // erased or replaced
+                return;
+        }
+
+        auto &e = i->second;
+        e.refresh_seq = 0;
+
+        if (value && updated >= e.updated) {
+                e.value = std::move(value);
+                e.updated = updated;
+        }
+}
+
+template<typename T, typename Clock>
+auto store<T, Clock>::wait_pending(std::stop_token stop) -> std::vector<pending>
+{
+        std::vector<pending> v;
+
+        std::unique_lock lck(m_mtx);
+        if (m_cv.wait(lck, stop, [this] { return !m_pending.empty(); })) {
+                v.swap(m_pending);
+        }
+
+        return v;
+}
+
+template<typename T, typename Clock>
+void store<T, Clock>::erase(const std::string &key)
+{
+        std::lock_guard lck(m_mtx);
+
+        m_entries.erase(key);
+        std::erase_if(m_pending, [&key] (auto &r) { return r.key == key; });
+}
+
+template<typename T, typename Clock>
+void store<T, Clock>::clear()
+{
+        std::lock_guard lck(m_mtx);
+
+        m_entries.clear();
+        m_pending.clear();
+}
+
+template<typename T, typename Clock>
+template<typename F>
+void store<T, Clock>::for_each(time_point now, F &&f) const
+{
+        std::lock_guard lck(m_mtx);
+
+        for (auto &[key, e]: m_entries) {
+                if (now - e.updated < m_ttl) {
+                        f(key, e.value, e.updated);
+                }
+        }
+}
+
+} // namespace usbip::cache
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "..\remote.h"
+#include "..\win_handle.h"
+
+#include "scan.h"
+#include "last_error.h"
+#include "output.h"
+
+#include <array>
+#include <span>
+#include <algorithm>
+#include <cassert>
+
+#include <ws2tcpip.h>
+#include <mswsock.h>
+
+namespace
+{
+
+using namespace usbip;
+using clock_type = std::chrono::steady_clock;
+
+constexpr uint32_t max_hosts = 1U << 16; // see discover, cidr
+
+/*
+ * Connection attempt to a host of the network. Slots are reused, their number is params.max_inflight.
+ */
+struct probe : OVERLAPPED
+{
+        Socket sock;
+        uint32_t idx; // of the host
+};
+
+auto get_connectex(_Inout_ set_last_error &last)
+{
+        LPFN_CONNECTEX f{};
+
+        Socket s(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+        if (!s) {
+                last.error = WSAGetLastError();
+                libusbip::output("socket error {}", last.error);
+                return f;
+        }
+
+        GUID guid = WSAID_CONNECTEX;
+        DWORD bytes{};
+
+        if (WSAIoctl(s.get(), SIO_GET_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid), &f, sizeof(f),
+                     &bytes, nullptr, nullptr)) {
+                last.error = WSAGetLastError();
+                libusbip::output("WSAIoctl(SIO_GET_EXTENSION_FUNCTION_POINTER) error {}", last.error);
+                f = nullptr;
+        }
+
+        return f;
+}
+
+/*
+ * @return TCP port number in network byte order, zero if error
+ */
+auto get_port(_Inout_ set_last_error &last, _In_ const char *service)
+{
+        const ADDRINFOA hints{ .ai_flags = AI_PASSIVE, .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+        ADDRINFOA *ai{};
+
+        if (auto err = getaddrinfo(nullptr, service, &hints, &ai)) {
+                last.error = err;
+                libusbip::output("getaddrinfo('{}') error {}", service, err);
+                return USHORT();
+        }
+
+        auto port = reinterpret_cast<const sockaddr_in*>(ai->ai_addr)->sin_port;
+        freeaddrinfo(ai);
+
+        return port;
+}
+
+/*
+ * The completion is queued to the port even if ConnectEx has completed synchronously.
+ * @return error code, zero if the completion will be queued
+ */
+DWORD start(_In_ LPFN_CONNECTEX ConnectEx, _In_ HANDLE iocp, _Inout_ probe &r, _In_ const sockaddr_in &addr)
+{
+        r.sock.reset(WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED));
+        if (!r.sock) {
+                return WSAGetLastError();
+        }
+
+        if (sockaddr_in any{ .sin_family = AF_INET }; // ConnectEx requires bound socket
+            bind(r.sock.get(), reinterpret_cast<const sockaddr*>(&any), sizeof(any))) {
+                return WSAGetLastError();
+        }
+
+        if (!CreateIoCompletionPort(reinterpret_cast<HANDLE>(r.sock.get()), iocp, 0, 0)) {
+                return GetLastError();
+        }
+
+        *static_cast<OVERLAPPED*>(&r) = {};
+
+        if (ConnectEx(r.sock.get(), reinterpret_cast<const sockaddr*>(&addr), sizeof(addr),
+                      nullptr, 0, nullptr, &r)) {
+                return 0;
+        } else if (auto err = WSAGetLastError(); err != ERROR_IO_PENDING) {
+                return err;
+        }
+
+        return 0;
+}
+
+/*
+ * @return milliseconds till the given time, INFINITE for time_point::max()
+ */
+auto get_timeout(_In_ clock_type::time_point when)
+{
+        if (when == clock_type::time_point::max()) {
+                return INFINITE;
+        }
+
+        using namespace std::chrono;
+        auto ms = ceil<milliseconds>(when - clock_type::now()).count();
+
+        return static_cast<DWORD>(std::clamp<decltype(ms)>(ms, 0, INFINITE - 1));
+}
+
+/*
+ * Probes are started and completed by this thread, completions are dequeued from I/O completion port.
+ * An expired probe is cancelled by CancelIoEx and completes with ERROR_OPERATION_ABORTED.
+ *
+ * @param port in network byte order
+ * @param accepted indices of the hosts that have accepted the connection
+ */
+auto scan_network(
+        _Inout_ set_last_error &last, _In_ const scan::network &net, _In_ USHORT port,
+        _In_ const discover_params &params, _Out_ std::vector<uint32_t> &accepted)
+{
+        accepted.clear();
+
+        auto ConnectEx = get_connectex(last);
+        if (!ConnectEx) {
+                return false;
+        }
+
+        NullableHandle iocp(CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1));
+        if (!iocp) {
+                last.error = GetLastError();
+                libusbip::output("CreateIoCompletionPort error {}", last.error);
+                return false;
+        }
+
+        scan::scheduler sched(net.count, {
+                .max_inflight = params.max_inflight,
+                .rate = params.rate,
+                .timeout = params.timeout });
+
+        std::vector<probe> probes(std::min(net.count, std::max(params.max_inflight, 1U)));
+
+        std::vector<probe*> free_slots;
+        free_slots.reserve(probes.size());
+
+        for (auto &r: probes) {
+                free_slots.push_back(&r);
+        }
+
+        auto cancel = [&probes] (auto idx)
+        {
+                auto r = std::ranges::find_if(probes, [idx] (auto &p) { return p.sock && p.idx == idx; });
+                assert(r != probes.end());
+
+                if (!CancelIoEx(reinterpret_cast<HANDLE>(r->sock.get()), &*r)) {
+                        if (auto err = GetLastError(); err != ERROR_NOT_FOUND) { // has completed
+                                libusbip::output("CancelIoEx error {}", err);
+                        }
+                }
+        };
+
+        std::array<OVERLAPPED_ENTRY, 64> entries;
+        bool failed{}; // the probes in flight are cancelled and drained, the memory of OVERLAPPED is in use
+
+        while (failed ? sched.inflight() : !sched.done()) {
+
+                auto now = clock_type::now();
+
+                for (uint32_t idx; !failed && (idx = sched.next(now)) != sched.size(); ) {
+                        auto &r = *free_slots.back();
+                        free_slots.pop_back();
+                        r.idx = idx;
+
+                        sockaddr_in addr{ .sin_family = AF_INET, .sin_port = port };
+                        addr.sin_addr.s_addr = htonl(net[idx]);
+
+                        if (auto err = start(ConnectEx, iocp.get(), r, addr)) {
+                                libusbip::output("start probe #{} error {}", idx, err);
+                                r.sock.close();
+                                free_slots.push_back(&r);
+                                sched.complete(idx);
+                        }
+                }
+
+                sched.expire(failed ? clock_type::time_point::max() : now, cancel);
+
+                ULONG cnt{};
+                if (!GetQueuedCompletionStatusEx(iocp.get(), entries.data(), ULONG(entries.size()), &cnt,
+                                                 failed ? INFINITE : get_timeout(sched.wakeup()), false)) {
+                        if (auto err = GetLastError(); err == WAIT_TIMEOUT) {
+                                continue;
+                        } else if (failed) {
+                                break;
+                        } else {
+                                last.error = err;
+                                libusbip::output("GetQueuedCompletionStatusEx error {}", err);
+                                failed = true;
+                        }
+                        continue;
+                }
+
+                for (auto &e: std::span(entries.data(), cnt)) {
+                        auto &r = *static_cast<probe*>(e.lpOverlapped);
+
+                        DWORD transferred{};
+                        DWORD flags{};
+
+                        if (WSAGetOverlappedResult(r.sock.get(), &r, &transferred, false, &flags)) {
+                                accepted.push_back(r.idx);
+                        }
+
+                        r.sock.close();
+                        free_slots.push_back(&r);
+                        sched.complete(r.idx);
+                }
+        }
+
+        std::ranges::sort(accepted);
+        return !failed;
+}
+
+} // namespace
+
+
+/*
+ * The scan is limited by the number of connects in flight and by the rate,
+ * a slow or filtering network does not exhaust ephemeral ports and does not trigger IDS.
+ */
+bool usbip::discover(
+        _In_ const char *cidr,
+        _In_ const char *service,
+        _In_ const discovered_host_f &on_host,
+        _In_ const discover_params &params)
+{
+        set_last_error last(NO_ERROR);
+
+        scan::network net{};
+        if (!(cidr && scan::parse_cidr(net, cidr) && net.count <= max_hosts)) {
+                last.error = ERROR_INVALID_PARAMETER;
+                return false;
+        }
+
+        auto port = get_port(last, service);
+        if (!port) {
+                return false;
+        }
+
+        libusbip::output("scanning {} hosts of {}, port {}", net.count, cidr, ntohs(port));
+
+        std::vector<uint32_t> accepted;
+        if (!scan_network(last, net, port, params, accepted)) {
+                return false;
+        }
+
+        libusbip::output("{} of {} hosts have accepted the connection", accepted.size(), net.count);
+        if (accepted.empty()) {
+                return true;
+        }
+
+        std::vector<host_address> hosts;
+        hosts.reserve(accepted.size());
+
+        for (auto idx: accepted) {
+                in_addr addr{};
+                addr.s_addr = htonl(net[idx]);
+
+                char buf[INET_ADDRSTRLEN];
+                hosts.push_back({ .hostname = inet_ntop(AF_INET, &addr, buf, sizeof(buf)), .service = service });
+        }
+
+        auto f = [&hosts, &on_host] (auto idx, auto err, auto &devices) { on_host(hosts[idx].hostname, err, devices); };
+        enum_exportable_devices(hosts, f, params.max_workers, params.deadline);
+
+        return true;
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <stop_token>
+#include <condition_variable>
+
+/*
+ * Bounded pool of workers that query hosts, see usbip::enum_exportable_devices(hosts, ...).
+ * It does not depend on Windows SDK and can be used on any platform as is.
+ * A blocking call of a worker that has exceeded its deadline is interrupted by a backend,
+ * f.e. by APC on Windows or by shutdown of the socket.
+ */
+namespace usbip::host_pool
+{
+
+using clock_type = std::chrono::steady_clock;
+
+/*
+ * A socket timeout bounds a single call, not the whole exchange.
+ * It must be set to the time left before each blocking call, otherwise
+ * a slow stream of partial replies can run far past the deadline.
+ *
+ * @return milliseconds left till the deadline rounded up, zero if it has expired
+ */
+inline long long time_left(clock_type::time_point deadline, clock_type::time_point now = clock_type::now())
+{
+        using namespace std::chrono;
+
+        if (deadline == clock_type::time_point::max()) {
+                return std::numeric_limits<long long>::max();
+        }
+
+        return deadline > now ? ceil<milliseconds>(deadline - now).count() : 0;
+}
+
+/*
+ * Interrupts workers that have exceeded their deadline.
+ */
+class watchdog
+{
+public:
+        using interrupt_f = std::function<void()>;
+
+        explicit watchdog(size_t workers) : m_slots(workers) {}
+
+        /*
+         * @param interrupt is called once if the deadline expires before disarm, under the lock of the watchdog
+         */
+        void arm(size_t worker, clock_type::time_point deadline, interrupt_f interrupt);
+
+        /*
+         * interrupt will not be called after it returns.
+         * @return true if the deadline has expired
+         */
+        bool disarm(size_t worker);
+
+        void run(std::stop_token stop);
+
+private:
+        struct slot
+        {
+                interrupt_f interrupt;
+                clock_type::time_point deadline;
+                bool armed{};
+                bool expired{};
+        };
+
+        std::mutex m_mtx;
+        std::condition_variable_any m_cv;
+        std::vector<slot> m_slots;
+        bool m_changed{};
+};
+
+inline void watchdog::arm(size_t worker, clock_type::time_point deadline, interrupt_f interrupt)
+{
+        {
+                std::lock_guard lck(m_mtx);
+                m_slots[worker] = { .interrupt = std::move(interrupt), .deadline = deadline, .armed = true };
+                m_changed = true;
+        }
+        m_cv.notify_one();
+}
+
+inline bool watchdog::disarm(size_t worker)
+{
+        std::lock_guard lck(m_mtx);
+        auto &r = m_slots[worker];
+
+        r.armed = false;
+        r.interrupt = nullptr;
+
+        return r.expired;
+}
+
+inline void watchdog::run(std::stop_token stop)
+{
+        std::unique_lock lck(m_mtx);
+
+        while (!stop.stop_requested()) {
+
+                auto now = clock_type::now();
+                auto next = clock_type::time_point::max();
+
+                for (auto &r: m_slots) {
+                        if (!r.armed || r.expired) {
+                                //
+                        } else if (r.deadline > now) {
+                                next = std::min(next, r.deadline);
+                        } else {
+                                r.expired = true;
+                                r.interrupt();
+                        }
+                }
+
+                m_changed = false;
+                m_cv.wait_until(lck, stop, next, [this] { return m_changed; });
+        }
+}
+
+/*
+ * Calls work(wd, worker, idx) for every idx of [0, count), at most max_workers calls run concurrently.
+ * The call is blocking, it returns when each idx has been handled.
+ *
+ * @param work is called concurrently, worker is zero-based index of the thread that must be passed
+ *        to watchdog::arm/disarm
+ */
+template<typename F>
+void run(size_t count, unsigned int max_workers, const F &work)
+{
+        auto cnt = std::min<size_t>(std::max(max_workers, 1U), count);
+        if (!cnt) {
+                return;
+        }
+
+        watchdog wd(cnt);
+        std::jthread wd_thread([&wd] (auto stop) { wd.run(stop); });
+
+        std::atomic<size_t> next{};
+
+        auto worker = [&wd, &next, count, &work] (size_t id)
+        {
+                for (size_t i; (i = next++) < count; ) {
+                        work(wd, id, i);
+                }
+        };
+
+        std::vector<std::jthread> workers;
+        workers.reserve(cnt);
+
+        for (size_t i = 0; i < cnt; ++i) {
+                workers.emplace_back(worker, i);
+        }
+
+        workers.clear(); // join
+}
+
+} // namespace usbip::host_pool
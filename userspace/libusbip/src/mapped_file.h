@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <filesystem>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <cerrno>
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+/*
+ * Read-only mapping of a whole file, processes that map the same file share its pages.
+ * It can be used on Windows and POSIX systems as is,
+ * CreateFileMapping is used on Windows and mmap on POSIX systems.
+ */
+namespace usbip
+{
+
+class mapped_file
+{
+public:
+        using char_type = std::filesystem::path::value_type; // wchar_t on Windows
+
+        /*
+         * GetLastError() on Windows, errno on POSIX systems.
+         */
+        using error_type = unsigned long;
+
+        mapped_file() = default;
+        explicit mapped_file(const char_type *path) { open(path); }
+
+        ~mapped_file() { close(); }
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator =(const mapped_file&) = delete;
+
+        mapped_file(mapped_file &&obj) noexcept : m_str(obj.m_str) { obj.m_str = {}; }
+        mapped_file& operator =(mapped_file &&obj) noexcept;
+
+        explicit operator bool() const noexcept { return m_str.data(); }
+        auto operator!() const noexcept { return !m_str.data(); }
+
+        /*
+         * The mapping keeps the file open, its handle is not needed.
+         * An empty file can't be mapped.
+         * @return zero or error code, see error_type
+         */
+        error_type open(const char_type *path);
+
+        void close() noexcept;
+
+        auto str() const noexcept { return m_str; }
+
+private:
+        std::string_view m_str;
+};
+
+
+inline auto mapped_file::operator =(mapped_file &&obj) noexcept -> mapped_file&
+{
+        if (&obj != this) {
+                close();
+                m_str = obj.m_str;
+                obj.m_str = {};
+        }
+
+        return *this;
+}
+
+#ifdef _WIN32
+
+inline auto mapped_file::open(const char_type *path) -> error_type
+{
+        close();
+
+        auto file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+                return GetLastError();
+        }
+
+        DWORD err = ERROR_SUCCESS;
+
+        if (LARGE_INTEGER size{}; !GetFileSizeEx(file, &size)) {
+                err = GetLastError();
+        } else if (!size.QuadPart) {
+                err = ERROR_FILE_INVALID; // can't be mapped
+        } else if (size.QuadPart > UINT32_MAX) {
+                err = ERROR_FILE_TOO_LARGE;
+        } else if (auto mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr); !mapping) {
+                err = GetLastError();
+        } else {
+                if (auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) { // the view keeps the mapping
+                        m_str = std::string_view(static_cast<const char*>(view), static_cast<size_t>(size.QuadPart));
+                } else {
+                        err = GetLastError();
+                }
+                CloseHandle(mapping);
+        }
+
+        CloseHandle(file);
+        return err;
+}
+
+inline void mapped_file::close() noexcept
+{
+        if (auto view = m_str.data()) {
+                UnmapViewOfFile(view);
+                m_str = {};
+        }
+}
+
+#else
+
+inline auto mapped_file::open(const char_type *path) -> error_type
+{
+        close();
+
+        auto fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                return errno;
+        }
+
+        error_type err{};
+
+        if (struct stat st{}; fstat(fd, &st)) {
+                err = errno;
+        } else if (!st.st_size) {
+                err = EINVAL; // can't be mapped
+        } else if (static_cast<uint64_t>(st.st_size) > UINT32_MAX) {
+                err = EFBIG;
+        } else if (auto view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0); view == MAP_FAILED) {
+                err = errno;
+        } else { // the mapping keeps the file
+                m_str = std::string_view(static_cast<const char*>(view), size_t(st.st_size));
+        }
+
+        ::close(fd);
+        return err;
+}
+
+inline void mapped_file::close() noexcept
+{
+        if (auto view = m_str.data()) {
+                munmap(const_cast<char*>(view), m_str.size());
+                m_str = {};
+        }
+}
+
+#endif // _WIN32
+
+} // namespace usbip
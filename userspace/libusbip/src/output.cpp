@@ -2,17 +2,137 @@
  * Copyright (C) 2023 - 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
  */
 
-#pragma once
-
 #include "..\output.h"
 #include "output.h"
 
+#include <thread>
+
+namespace
+{
+
+using namespace libusbip;
+
+void update_output_level()
+{
+        output_level = output_function ? output_threshold : level::off;
+}
+
+} // namespace
+
+
 void libusbip::set_debug_output(const output_func_type &f)
 {
         output_function = f;
+        update_output_level();
 }
 
 auto libusbip::get_debug_output() noexcept -> const output_func_type&
 {
         return output_function;
 }
+
+void libusbip::set_output_level(level lvl) noexcept
+{
+        output_threshold = lvl;
+        update_output_level();
+}
+
+auto libusbip::get_output_level() noexcept -> level
+{
+        return output_threshold;
+}
+
+
+/*
+ * Producers push to the head of a singly linked list (Treiber stack),
+ * the worker takes the whole list at once and reverses it to get FIFO order.
+ * ABA problem does not arise because a node is never removed alone.
+ */
+class libusbip::BufferedOutput::Impl
+{
+public:
+        Impl(const output_func_type &f) : m_func(f) {}
+        ~Impl();
+
+        void push(std::string s);
+
+private:
+        struct node
+        {
+                node *next;
+                std::string msg;
+        };
+
+        std::atomic<node*> m_head{};
+        node m_wakeup{}; // is not a message
+        output_func_type m_func;
+
+        std::jthread m_thread{ [this] (auto stop) { run(stop); } }; // must be the last
+
+        void run(std::stop_token stop);
+        void wakeup();
+        void drain();
+};
+
+libusbip::BufferedOutput::Impl::~Impl()
+{
+        m_thread.request_stop();
+        wakeup();
+        m_thread.join();
+}
+
+void libusbip::BufferedOutput::Impl::push(std::string s)
+{
+        auto n = new node{ nullptr, std::move(s) };
+        auto head = m_head.load(std::memory_order_relaxed);
+
+        do {
+                n->next = head;
+        } while (!m_head.compare_exchange_weak(head, n, std::memory_order_release, std::memory_order_relaxed));
+
+        if (!head) { // the worker can sleep
+                m_head.notify_one();
+        }
+}
+
+void libusbip::BufferedOutput::Impl::wakeup()
+{
+        if (node *expected{}; m_head.compare_exchange_strong(expected, &m_wakeup)) {
+                m_head.notify_one();
+        }
+}
+
+void libusbip::BufferedOutput::Impl::run(std::stop_token stop)
+{
+        while (!stop.stop_requested()) {
+                m_head.wait(nullptr, std::memory_order_acquire);
+                drain();
+        }
+
+        drain();
+}
+
+void libusbip::BufferedOutput::Impl::drain()
+{
+        node *fifo{};
+
+        for (auto n = m_head.exchange(nullptr, std::memory_order_acquire); n; ) {
+                auto next = n->next;
+                if (n != &m_wakeup) {
+                        n->next = fifo;
+                        fifo = n;
+                }
+                n = next;
+        }
+
+        while (auto n = fifo) {
+                fifo = n->next;
+                m_func(std::move(n->msg));
+                delete n;
+        }
+}
+
+libusbip::BufferedOutput::BufferedOutput(const output_func_type &f) : m_impl(new Impl(f)) {}
+libusbip::BufferedOutput::~BufferedOutput() { delete m_impl; }
+
+void libusbip::BufferedOutput::operator()(std::string s) const { m_impl->push(std::move(s)); }
@@ -1,35 +1,61 @@
 /*
- * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ * Copyright (C) 2023 - 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
  */
 
 #pragma once
 
 #include "..\output.h"
 #include "strconv.h"
-
-#include <format>
+#include "output_format.h"
 
 namespace libusbip
 {
 
 inline output_func_type output_function;
+inline level output_threshold = level::debug; // set_output_level
 
+/*
+ * level::off if output_function is not set, otherwise output_threshold.
+ */
+inline std::atomic<level> output_level = level::off;
+
+inline auto output_enabled(level lvl) noexcept
+{
+        return output_enabled(output_level, lvl);
+}
+
+/*
+ * Arguments are evaluated by the caller, use defer() for expensive ones.
+ * The format string is checked at compile time.
+ */
 template<typename... Args>
-inline void output(std::string_view fmt, Args&&... args)
+inline void output(level lvl, std::format_string<Args...> fmt, Args&&... args)
 {
-        if (output_function) {
-                auto s = vformat(fmt, std::make_format_args(args...));
+        if (output_enabled(lvl)) {
+                auto s = std::format(fmt, std::forward<Args>(args)...);
                 output_function(std::move(s));
         }
 }
 
 template<typename... Args>
-inline void output(std::wstring_view fmt, Args&&... args)
+inline void output(level lvl, std::wformat_string<Args...> fmt, Args&&... args)
 {
-        if (output_function) {
-                auto ws = vformat(fmt, std::make_wformat_args(args...));
+        if (output_enabled(lvl)) {
+                auto ws = std::format(fmt, std::forward<Args>(args)...);
                 output_function(usbip::wchar_to_utf8(ws));
         }
 }
 
+template<typename... Args>
+inline void output(std::format_string<Args...> fmt, Args&&... args)
+{
+        output(level::debug, fmt, std::forward<Args>(args)...);
+}
+
+template<typename... Args>
+inline void output(std::wformat_string<Args...> fmt, Args&&... args)
+{
+        output(level::debug, fmt, std::forward<Args>(args)...);
+}
+
 } // namespace libusbip
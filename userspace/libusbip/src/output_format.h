@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <format>
+#include <atomic>
+#include <type_traits>
+
+/*
+ * Level check and deferred arguments of libusbip::output, see output.h.
+ * It does not depend on Windows SDK and can be used on any platform as is.
+ */
+namespace libusbip
+{
+
+/*
+ * A message is formatted only if this returns true, it costs a relaxed load.
+ */
+template<typename Level>
+inline auto output_enabled(const std::atomic<Level> &threshold, Level lvl) noexcept
+{
+        return lvl >= threshold.load(std::memory_order_relaxed);
+}
+
+/*
+ * Argument that is evaluated only if the message is formatted, see defer().
+ */
+template<typename F>
+struct deferred
+{
+        F f;
+};
+
+/*
+ * Usage: output("{}", defer([&] { return expensive(); }));
+ */
+template<typename F>
+inline auto defer(F &&f)
+{
+        return deferred<std::decay_t<F>>{ std::forward<F>(f) };
+}
+
+} // namespace libusbip
+
+
+template<typename F, typename CharT>
+struct std::formatter<libusbip::deferred<F>, CharT> :
+        std::formatter<std::remove_cvref_t<std::invoke_result_t<const F&>>, CharT>
+{
+        auto format(const libusbip::deferred<F> &d, auto &ctx) const
+        {
+                using base = std::formatter<std::remove_cvref_t<std::invoke_result_t<const F&>>, CharT>;
+                return base::format(d.f(), ctx);
+        }
+};
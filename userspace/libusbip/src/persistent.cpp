@@ -25,7 +25,7 @@ auto make_multi_sz(_Out_ std::wstring &result, _In_ const std::vector<device_loc
 
         for (auto &i: v) {
                 if (is_malformed(i)) {
-                        libusbip::output("malformed device_location{ hostname='{}', service='{}', busid='{}' }", 
+                        libusbip::output("malformed device_location{{ hostname='{}', service='{}', busid='{}' }}", 
                                           i.hostname, i.service, i.busid);
 
                         return ERROR_INVALID_PARAMETER;
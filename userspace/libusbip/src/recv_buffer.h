@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+/*
+ * Reads data in large chunks to reduce the number of recv calls, records are decoded in place.
+ * It does not depend on Windows SDK and can be used on any platform as is.
+ *
+ * It can read beyond the end of the current message, this is fine for a connection
+ * that is used for a single request, like OP_REQ_DEVLIST.
+ */
+namespace usbip
+{
+
+/*
+ * @param Recv long long(char *buf, size_t len), returns the number of bytes received,
+ *        zero if the connection has been closed or negative if error
+ */
+template<typename Recv>
+class recv_buffer
+{
+public:
+        enum { CHUNK_SIZE = 64*1024 };
+
+        explicit recv_buffer(Recv recv) : m_recv(std::move(recv)) {}
+
+        /*
+         * @return pointer to cnt records that are valid till the next call, nullptr if error
+         */
+        template<typename T>
+        auto get(size_t cnt = 1) { return static_cast<T*>(get(cnt*sizeof(T))); }
+
+        /*
+         * @return the number of recv calls
+         */
+        auto calls() const noexcept { return m_calls; }
+
+private:
+        Recv m_recv;
+        std::vector<char> m_buf = std::vector<char>(CHUNK_SIZE);
+        size_t m_begin{};
+        size_t m_end{};
+        size_t m_calls{};
+
+        void* get(size_t len);
+        bool fill(size_t len);
+};
+
+
+template<typename Recv>
+void* recv_buffer<Recv>::get(size_t len)
+{
+        if (m_end - m_begin < len && !fill(len)) {
+                return nullptr;
+        }
+
+        auto ptr = m_buf.data() + m_begin;
+        m_begin += len;
+
+        return ptr;
+}
+
+template<typename Recv>
+bool recv_buffer<Recv>::fill(size_t len)
+{
+        auto avail = m_end - m_begin;
+
+        if (m_begin) {
+                memmove(m_buf.data(), m_buf.data() + m_begin, avail);
+                m_begin = 0;
+                m_end = avail;
+        }
+
+        if (m_buf.size() < len) {
+                m_buf.resize(len);
+        }
+
+        while (m_end < len) {
+                ++m_calls;
+                if (auto ret = m_recv(m_buf.data() + m_end, m_buf.size() - m_end); ret > 0) {
+                        m_end += static_cast<size_t>(ret);
+                } else {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+} // namespace usbip
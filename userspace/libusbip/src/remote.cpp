@@ -10,10 +10,13 @@
 #include "last_error.h"
 #include "strconv.h"
 #include "output.h"
+#include "host_pool.h"
+#include "recv_buffer.h"
 
 #include <usbip\proto_op.h>
 
 #include <chrono>
+#include <mutex>
 
 #include <ws2tcpip.h>
 #include <mstcpip.h>
@@ -124,33 +127,6 @@ auto set_options(_Inout_ set_last_error &last, _In_ SOCKET s)
 		set_nodelay(last, s);
 }
 
-auto recv(_In_ SOCKET s, _In_ void *buf, _In_ size_t len, _Out_opt_ bool *eof = nullptr)
-{
-	assert(s != INVALID_SOCKET);
-
-	if (eof) {
-		*eof = false;
-	}
-
-	switch (auto ret = ::recv(s, static_cast<char*>(buf), static_cast<int>(len), MSG_WAITALL)) {
-	case SOCKET_ERROR:
-		if (wsa_set_last_error wsa; wsa) {
-			libusbip::output("recv error {}", wsa.error);
-		}
-		return false;
-	case 0: // connection has been gracefully closed
-		if (len) {
-			libusbip::output("recv EOF");
-			if (eof) {
-				*eof = true;
-			}
-		}
-		[[fallthrough]];
-	default:
-		return ret == len;
-	}
-}
-
 auto send(_In_ SOCKET s, _In_ const void *buf, _In_ size_t len)
 {
 	assert(s != INVALID_SOCKET);
@@ -186,17 +162,11 @@ auto send_op_common(_In_ SOCKET s, _In_ uint16_t code)
 	return send(s, &r, sizeof(r));
 }
 
-auto recv_op_common(_In_ SOCKET s, _In_ uint16_t expected_code)
+/*
+ * @param r must be unpacked
+ */
+auto check_op_common(_In_ const op_common &r, _In_ uint16_t expected_code) -> DWORD
 {
-	assert(s != INVALID_SOCKET);
-
-	op_common r{};
-	if (recv(s, &r, sizeof(r))) {
-		PACK_OP_COMMON(false, &r);
-	} else {
-		return GetLastError();
-	}
-
 	if (r.version != USBIP_VERSION) {
 		return USBIP_ERROR_VERSION;
 	}
@@ -208,6 +178,56 @@ auto recv_op_common(_In_ SOCKET s, _In_ uint16_t expected_code)
 	return op_status_error(static_cast<op_status_t>(r.status));
 }
 
+using clock_type = host_pool::clock_type;
+
+/*
+ * SO_RCVTIMEO is set to the time left before each recv if the deadline is not time_point::max().
+ */
+bool set_recv_timeout(_In_ SOCKET s, _In_ clock_type::time_point deadline)
+{
+	if (deadline == clock_type::time_point::max()) {
+		return true;
+	}
+
+	auto ms = host_pool::time_left(deadline);
+	if (!ms) { // zero means no timeout
+		SetLastError(ERROR_TIMEOUT);
+		return false;
+	}
+
+	set_last_error last;
+	return do_setsockopt(last, s, SOL_SOCKET, SO_RCVTIMEO, static_cast<int>(std::min<long long>(ms, INT_MAX)));
+}
+
+/*
+ * @see recv_buffer
+ */
+auto make_recv_buffer(_In_ SOCKET s, _In_ clock_type::time_point deadline)
+{
+	assert(s != INVALID_SOCKET);
+
+	return recv_buffer([s, deadline] (char *buf, size_t len) -> long long
+	{
+		if (!set_recv_timeout(s, deadline)) {
+			return -1;
+		}
+
+		switch (auto ret = ::recv(s, buf, static_cast<int>(std::min<size_t>(len, INT_MAX)), 0)) {
+		case SOCKET_ERROR:
+			if (wsa_set_last_error wsa; wsa) {
+				libusbip::output("recv error {}", wsa.error);
+			}
+			return -1;
+		case 0: // connection has been gracefully closed
+			libusbip::output("recv EOF");
+			SetLastError(ERROR_HANDLE_EOF);
+			return 0;
+		default:
+			return ret;
+		}
+	});
+}
+
 auto as_usb_device(_In_ const usbip_usb_device &d)
 {
 	return usb_device {
@@ -256,7 +276,7 @@ auto prepare_event(_Inout_ set_last_error &last, _In_ SOCKET s, _In_ WSAEVENT ev
 
 auto try_connect(_In_ SOCKET s, _In_ WSAEVENT evt, _In_ const sockaddr &addr, _In_ DWORD len)
 {
-	libusbip::output(L"connecting to {}", address_to_string(addr, len));
+	libusbip::output(L"connecting to {}", libusbip::defer([&] { return address_to_string(addr, len); }));
 
 	if (auto err = connect(s, &addr, len) ? WSAGetLastError() : 0; !err) {
 		return 0;
@@ -372,6 +392,129 @@ inline auto connect_by_name(_In_ SOCKET s, _In_ LPCWSTR hostname, _In_ _In_ LPCW
 				nullptr, nullptr);
 }
 
+/*
+ * The timeout is applied after the connection has been established.
+ * OP_REQ_DEVLIST is sent by a single call, SO_RCVTIMEO is set by recv_buffer before each recv.
+ */
+auto set_send_timeout(_Inout_ set_last_error &last, _In_ SOCKET s, _In_ clock_type::time_point deadline)
+{
+	auto ms = host_pool::time_left(deadline);
+
+	if (!ms) {
+		last.error = ERROR_TIMEOUT;
+		return false;
+	}
+
+	return do_setsockopt(last, s, SOL_SOCKET, SO_SNDTIMEO, static_cast<int>(std::min<long long>(ms, INT_MAX)));
+}
+
+/*
+ * @param deadline of the reply, time_point::max() if there is no limit
+ */
+bool enum_devices(
+	_In_ SOCKET s, 
+	_In_ clock_type::time_point deadline,
+	_In_ const usb_device_f &on_dev, 
+	_In_ const usb_interface_f &on_intf,
+	_In_opt_ const usb_device_cnt_f &on_dev_cnt)
+{
+	assert(s != INVALID_SOCKET);
+	
+	if (!send_op_common(s, OP_REQ_DEVLIST)) {
+		return false;
+	}
+
+	auto buf = make_recv_buffer(s, deadline);
+
+	if (auto r = buf.get<op_common>(); !r) {
+		return false;
+	} else {
+		PACK_OP_COMMON(false, r);
+		if (auto err = check_op_common(*r, OP_REP_DEVLIST)) {
+			SetLastError(err);
+			return false;
+		}
+	}
+
+	UINT32 ndev{};
+	
+	if (auto r = buf.get<op_devlist_reply>()) {
+		PACK_OP_DEVLIST_REPLY(false, r);
+		ndev = r->ndev;
+	} else {
+		return false;
+	}
+
+	libusbip::output("{} exportable device(s)", ndev);
+	assert(ndev <= INT_MAX);
+
+	if (on_dev_cnt) {
+		on_dev_cnt(ndev);
+	}
+
+	usb_device lib_dev;
+
+	for (UINT32 i = 0; i < ndev; ++i) {
+
+		auto dev = buf.get<usbip_usb_device>();
+		if (!dev) {
+			return false;
+		}
+
+		usbip_net_pack_usb_device(false, dev);
+		lib_dev = as_usb_device(*dev);
+		on_dev(i, lib_dev);
+
+		auto cnt = lib_dev.bNumInterfaces; // dev is invalidated by the next get()
+		if (!cnt) {
+			continue;
+		}
+
+		auto intf = buf.get<usbip_usb_interface>(cnt); // all interfaces of the device at once
+		if (!intf) {
+			return false;
+		}
+
+		for (int j = 0; j < cnt; ++j) {
+			usbip_net_pack_usb_interface(false, intf + j);
+			static_assert(sizeof(*intf) == sizeof(usb_interface));
+			on_intf(i, lib_dev, j, reinterpret_cast<usb_interface&>(intf[j]));
+		}
+	}
+
+	return true;
+}
+
+DWORD enum_host(
+	_In_ const host_address &host, _In_ clock_type::time_point deadline, 
+	_Inout_ std::vector<exportable_device> &devices)
+{
+	auto sock = connect(host.hostname.c_str(), host.service.c_str(), CANCEL_BY_APC);
+	if (!sock) {
+		return GetLastError();
+	}
+
+	if (set_last_error last; !set_send_timeout(last, sock.get(), deadline)) {
+		return last.error;
+	}
+
+	auto on_dev_cnt = [&devices] (auto count)
+	{
+		enum { max_reserve = 128 }; // count is sent by the server, the vector grows if it is larger
+		devices.reserve(std::min(count, static_cast<decltype(count)>(max_reserve)));
+	};
+
+	auto on_dev = [&devices] (auto, auto &dev) 
+	{
+		auto &r = devices.emplace_back(exportable_device{ .dev = dev });
+		r.interfaces.reserve(dev.bNumInterfaces);
+	};
+
+	auto on_intf = [&devices] (auto, auto&, auto, auto &intf) { devices.back().interfaces.push_back(intf); };
+
+	return enum_devices(sock.get(), deadline, on_dev, on_intf, on_dev_cnt) ? NO_ERROR : GetLastError();
+}
+
 } // namespace
 
 
@@ -471,59 +614,55 @@ bool usbip::enum_exportable_devices(
 	_In_ const usb_interface_f &on_intf,
 	_In_opt_ const usb_device_cnt_f &on_dev_cnt)
 {
-	assert(s != INVALID_SOCKET);
-	
-	if (!send_op_common(s, OP_REQ_DEVLIST)) {
-		return false;
-	}
+	return enum_devices(s, clock_type::time_point::max(), on_dev, on_intf, on_dev_cnt);
+}
 
-	if (auto err = recv_op_common(s, OP_REP_DEVLIST)) {
-		SetLastError(err);
-		return false;
-	}
+void usbip::enum_exportable_devices(
+	_In_ const std::vector<host_address> &hosts, 
+	_In_ const host_devices_f &on_host,
+	_In_ unsigned int max_workers,
+	_In_ std::chrono::milliseconds deadline)
+{
+	std::mutex on_host_mtx;
 
-	op_devlist_reply reply{};
-	
-	if (recv(s, &reply, sizeof(reply))) {
-		PACK_OP_DEVLIST_REPLY(false, &reply);
-	} else {
-		return false;
-	}
+	auto work = [&] (auto &wd, auto id, auto i)
+	{
+		auto &host = hosts[i];
+		std::vector<exportable_device> devices;
 
-	libusbip::output("{} exportable device(s)", reply.ndev);
-	assert(reply.ndev <= INT_MAX);
+		NullableHandle thread(OpenThread(THREAD_SET_CONTEXT, false, GetCurrentThreadId())); // for QueueUserAPC
+		auto err = thread ? NO_ERROR : GetLastError();
 
-	if (on_dev_cnt) {
-		on_dev_cnt(reply.ndev);
-	}
+		if (err) {
+			libusbip::output("OpenThread error {}", err);
+		} else {
+			auto when = clock_type::now() + deadline;
 
-	usb_device lib_dev;
+			wd.arm(id, when, [h = thread.get()] // interrupts name resolution and connect, see CANCEL_BY_APC
+			{
+				auto apc = [] (ULONG_PTR) {}; // does nothing, it just interrupts alertable wait
+				if (!QueueUserAPC(apc, h, 0)) {
+					libusbip::output("QueueUserAPC error {}", GetLastError());
+				}
+			});
 
-	for (UINT32 i = 0; i < reply.ndev; ++i) {
+			err = enum_host(host, when, devices);
 
-		usbip_usb_device dev{};
+			if (auto expired = wd.disarm(id); err && (expired || err == WSAETIMEDOUT)) {
+				err = ERROR_TIMEOUT;
+			}
 
-		if (recv(s, &dev, sizeof(dev))) {
-			usbip_net_pack_usb_device(false, &dev);
-			lib_dev = as_usb_device(dev);
-			on_dev(i, lib_dev);
-		} else {
-			return false;
+			SleepEx(0, true); // execute APC that could be queued after the call had returned
 		}
 
-		for (int j = 0; j < dev.bNumInterfaces; ++j) {
-
-			usbip_usb_interface intf{};
-
-			if (recv(s, &intf, sizeof(intf))) {
-				usbip_net_pack_usb_interface(false, &intf);
-				static_assert(sizeof(intf) == sizeof(usb_interface));
-				on_intf(i, lib_dev, j, reinterpret_cast<usb_interface&>(intf));
-			} else {
-				return false;
-			}
+		if (err) {
+			libusbip::output("{}:{} error {:#x}", host.hostname, host.service, err);
+			devices.clear();
 		}
-	}
 
-	return true;
+		std::lock_guard lck(on_host_mtx);
+		on_host(static_cast<int>(i), err, devices);
+	};
+
+	host_pool::run(hosts.size(), max_workers, work);
 }
@@ -0,0 +1,453 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "..\remote_cache.h"
+#include "..\win_handle.h"
+
+#include "cache.h"
+#include "last_error.h"
+#include "strconv.h"
+#include "output.h"
+
+#include <thread>
+#include <cstring>
+
+namespace
+{
+
+using namespace usbip;
+using clock_type = std::chrono::steady_clock;
+using store_type = cache::store<std::vector<exportable_device>, clock_type>;
+
+/*
+ * Format of the file: header, then entries till the end of the file.
+ * Entry: key, time of update in milliseconds since the epoch, device count, devices.
+ * Device: usb_device, interface count, interfaces.
+ * Strings are prefixed by their length, numbers are in host byte order.
+ */
+constexpr UINT32 file_magic = 0x43445055; // "UPDC"
+constexpr UINT32 file_version = 1;
+
+constexpr size_t min_device_size = // encoded with empty strings
+        2*sizeof(UINT32) + // lengths of path and busid
+        2*sizeof(UINT32) + sizeof(USB_DEVICE_SPEED) + 3*sizeof(UINT16) + 6*sizeof(UINT8) +
+        sizeof(UINT32); // interface count
+
+constexpr size_t interface_size = 3*sizeof(UINT8);
+
+auto make_key(_In_ const host_address &host)
+{
+        return host.hostname + ':' + host.service;
+}
+
+/*
+ * The service can't contain a colon, the hostname can (IPv6 address).
+ */
+auto make_host(_In_ const std::string &key)
+{
+        auto pos = key.rfind(':');
+        return host_address{ .hostname = key.substr(0, pos), .service = key.substr(pos + 1) };
+}
+
+template<typename T>
+void write(_Inout_ std::string &buf, _In_ T val)
+{
+        static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>);
+        buf.append(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+void write(_Inout_ std::string &buf, _In_ const std::string &s)
+{
+        write(buf, static_cast<UINT32>(s.size()));
+        buf += s;
+}
+
+void write(_Inout_ std::string &buf, _In_ const usb_device &d)
+{
+        write(buf, d.path);
+        write(buf, d.busid);
+
+        write(buf, d.busnum);
+        write(buf, d.devnum);
+        write(buf, d.speed);
+
+        write(buf, d.idVendor);
+        write(buf, d.idProduct);
+        write(buf, d.bcdDevice);
+
+        write(buf, d.bDeviceClass);
+        write(buf, d.bDeviceSubClass);
+        write(buf, d.bDeviceProtocol);
+
+        write(buf, d.bConfigurationValue);
+
+        write(buf, d.bNumConfigurations);
+        write(buf, d.bNumInterfaces);
+}
+
+void write(_Inout_ std::string &buf, _In_ const usb_interface &r)
+{
+        write(buf, r.bInterfaceClass);
+        write(buf, r.bInterfaceSubClass);
+        write(buf, r.bInterfaceProtocol);
+}
+
+/*
+ * Reading stops at the first error, the following calls fail.
+ */
+class reader
+{
+public:
+        explicit reader(_In_ std::string_view s) : m_s(s) {}
+
+        explicit operator bool() const noexcept { return m_ok; }
+        auto operator !() const noexcept { return !m_ok; }
+
+        auto empty() const noexcept { return m_s.empty(); }
+        auto size() const noexcept { return m_s.size(); }
+
+        template<typename T>
+        reader& operator >>(_Out_ T &val)
+        {
+                static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>);
+
+                if (!(m_ok = m_ok && m_s.size() >= sizeof(val))) {
+                        val = T();
+                } else {
+                        memcpy(&val, m_s.data(), sizeof(val));
+                        m_s.remove_prefix(sizeof(val));
+                }
+
+                return *this;
+        }
+
+        reader& operator >>(_Out_ std::string &s)
+        {
+                UINT32 len{};
+
+                if (!(*this >> len && (m_ok = m_s.size() >= len))) {
+                        s.clear();
+                } else {
+                        s.assign(m_s.data(), len);
+                        m_s.remove_prefix(len);
+                }
+
+                return *this;
+        }
+
+        reader& operator >>(_Out_ usb_device &d)
+        {
+                return  *this >> d.path >> d.busid >> d.busnum >> d.devnum >> d.speed >>
+                        d.idVendor >> d.idProduct >> d.bcdDevice >>
+                        d.bDeviceClass >> d.bDeviceSubClass >> d.bDeviceProtocol >>
+                        d.bConfigurationValue >> d.bNumConfigurations >> d.bNumInterfaces;
+        }
+
+        reader& operator >>(_Out_ usb_interface &r)
+        {
+                r.padding = 0;
+                return *this >> r.bInterfaceClass >> r.bInterfaceSubClass >> r.bInterfaceProtocol;
+        }
+
+private:
+        std::string_view m_s;
+        bool m_ok = true;
+};
+
+/*
+ * Times of update are saved as system time, they are converted to and from the steady clock.
+ */
+auto to_system(_In_ clock_type::time_point t)
+{
+        using namespace std::chrono;
+        auto sys = system_clock::now() - duration_cast<system_clock::duration>(clock_type::now() - t);
+        return duration_cast<milliseconds>(sys.time_since_epoch()).count();
+}
+
+auto from_system(_In_ long long ms)
+{
+        using namespace std::chrono;
+        auto age = system_clock::now() - system_clock::time_point(duration_cast<system_clock::duration>(milliseconds(ms)));
+        return clock_type::now() - duration_cast<clock_type::duration>(std::max(age, system_clock::duration::zero()));
+}
+
+auto serialize(_In_ const store_type &store)
+{
+        std::string buf;
+        write(buf, file_magic);
+        write(buf, file_version);
+
+        auto f = [&buf] (auto &key, auto &value, auto updated)
+        {
+                write(buf, key);
+                write(buf, to_system(updated));
+                write(buf, static_cast<UINT32>(value->size()));
+
+                for (auto &d: *value) {
+                        write(buf, d.dev);
+                        write(buf, static_cast<UINT32>(d.interfaces.size()));
+
+                        for (auto &intf: d.interfaces) {
+                                write(buf, intf);
+                        }
+                }
+        };
+
+        store.for_each(clock_type::now(), f);
+        return buf;
+}
+
+/*
+ * @return false if the data is malformed, the entries that were read before the error are kept
+ */
+bool deserialize(_Inout_ store_type &store, _In_ std::string_view data)
+{
+        reader r(data);
+
+        UINT32 magic{};
+        UINT32 version{};
+
+        if (!(r >> magic >> version && magic == file_magic && version == file_version)) {
+                return false;
+        }
+
+        while (r && !r.empty()) {
+
+                std::string key;
+                long long updated{};
+                UINT32 cnt{};
+
+                if (!(r >> key >> updated >> cnt) || cnt > r.size()/min_device_size) {
+                        return false;
+                }
+
+                auto devices = std::make_shared<std::vector<exportable_device>>(cnt);
+
+                for (auto &d: *devices) {
+                        UINT32 intf_cnt{};
+                        if (!(r >> d.dev >> intf_cnt) || intf_cnt > r.size()/interface_size) {
+                                return false;
+                        }
+
+                        d.interfaces.resize(intf_cnt);
+                        for (auto &intf: d.interfaces) {
+                                r >> intf;
+                        }
+                }
+
+                if (r) {
+                        store.put(key, std::move(devices), from_system(updated)); // expired entries are dropped by get()
+                }
+        }
+
+        return static_cast<bool>(r);
+}
+
+auto read_file(_Inout_ set_last_error &last, _In_ const std::string &path, _Out_ std::string &data)
+{
+        data.clear();
+
+        Handle file(CreateFile(utf8_to_wchar(path).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL, nullptr));
+
+        if (!file) {
+                last.error = GetLastError();
+                return false;
+        }
+
+        LARGE_INTEGER size{};
+        if (!GetFileSizeEx(file.get(), &size)) {
+                last.error = GetLastError();
+                return false;
+        }
+
+        if (size.QuadPart > (1LL << 24)) { // a few thousand hosts with a dozen of devices each
+                last.error = ERROR_FILE_TOO_LARGE;
+                return false;
+        }
+
+        data.resize(static_cast<size_t>(size.QuadPart));
+        DWORD actual{};
+
+        if (!ReadFile(file.get(), data.data(), static_cast<DWORD>(data.size()), &actual, nullptr)) {
+                last.error = GetLastError();
+                return false;
+        }
+
+        data.resize(actual);
+        return true;
+}
+
+/*
+ * The file is replaced atomically, so a concurrent reader never sees a partial write.
+ */
+auto write_file(_Inout_ set_last_error &last, _In_ const std::string &path, _In_ const std::string &data)
+{
+        auto target = utf8_to_wchar(path);
+        auto tmp = target + L".tmp";
+
+        {
+                Handle file(CreateFile(tmp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+                if (!file) {
+                        last.error = GetLastError();
+                        libusbip::output("CreateFile('{}') error {}", path, last.error);
+                        return false;
+                }
+
+                DWORD actual{};
+                if (!WriteFile(file.get(), data.data(), static_cast<DWORD>(data.size()), &actual, nullptr)) {
+                        last.error = GetLastError();
+                        libusbip::output("WriteFile('{}') error {}", path, last.error);
+                        return false;
+                }
+        }
+
+        if (!MoveFileEx(tmp.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+                last.error = GetLastError();
+                libusbip::output("MoveFileEx('{}') error {}", path, last.error);
+                DeleteFile(tmp.c_str());
+                return false;
+        }
+
+        return true;
+}
+
+} // namespace
+
+
+/*
+ * Only one thread refreshes the entries, so the hosts are not hammered by the refresh itself.
+ */
+class usbip::ExportableDevicesCache::Impl
+{
+public:
+        Impl(_In_ const cache_params &params);
+        ~Impl();
+
+        void enum_exportable_devices(_In_ const std::vector<host_address> &hosts, _In_ const host_devices_f &on_host);
+
+        void invalidate(_In_ const host_address &host) { m_store.erase(make_key(host)); }
+        void clear() { m_store.clear(); }
+
+        bool save() const;
+
+private:
+        cache_params m_params;
+        store_type m_store;
+
+        std::jthread m_thread; // must be the last
+
+        void run(_In_ std::stop_token stop);
+};
+
+usbip::ExportableDevicesCache::Impl::Impl(_In_ const cache_params &params) :
+        m_params(params),
+        m_store(params.ttl, params.refresh)
+{
+        if (std::string data; !m_params.path.empty()) {
+                if (set_last_error last(NO_ERROR); !read_file(last, m_params.path, data)) {
+                        libusbip::output("cannot read '{}', error {}", m_params.path, last.error);
+                } else if (!deserialize(m_store, data)) {
+                        libusbip::output("'{}' is malformed", m_params.path);
+                }
+        }
+
+        m_thread = std::jthread([this] (auto stop) { run(stop); });
+}
+
+usbip::ExportableDevicesCache::Impl::~Impl()
+{
+        m_thread.request_stop();
+        m_thread.join();
+
+        if (!m_params.path.empty()) {
+                save();
+        }
+}
+
+bool usbip::ExportableDevicesCache::Impl::save() const
+{
+        set_last_error last(NO_ERROR);
+
+        if (m_params.path.empty()) {
+                last.error = ERROR_INVALID_PARAMETER;
+                return false;
+        }
+
+        return write_file(last, m_params.path, serialize(m_store));
+}
+
+void usbip::ExportableDevicesCache::Impl::enum_exportable_devices(
+        _In_ const std::vector<host_address> &hosts, _In_ const host_devices_f &on_host)
+{
+        std::vector<host_address> missed;
+        std::vector<int> missed_idx;
+
+        for (int i = 0; auto &host: hosts) {
+                if (auto devices = m_store.get(make_key(host), clock_type::now())) {
+                        on_host(i, NO_ERROR, *devices);
+                } else {
+                        missed.push_back(host);
+                        missed_idx.push_back(i);
+                }
+                ++i;
+        }
+
+        auto f = [this, &missed, &missed_idx, &on_host] (auto idx, auto err, auto &devices)
+        {
+                if (!err) {
+                        auto value = std::make_shared<const std::vector<exportable_device>>(devices);
+                        m_store.put(make_key(missed[idx]), std::move(value), clock_type::now());
+                }
+
+                on_host(missed_idx[idx], err, devices);
+        };
+
+        usbip::enum_exportable_devices(missed, f, m_params.max_workers, m_params.deadline);
+}
+
+void usbip::ExportableDevicesCache::Impl::run(_In_ std::stop_token stop)
+{
+        while (!stop.stop_requested()) {
+
+                auto pending = m_store.wait_pending(stop);
+                if (pending.empty()) {
+                        continue;
+                }
+
+                std::vector<host_address> hosts;
+                hosts.reserve(pending.size());
+
+                for (auto &r: pending) {
+                        hosts.push_back(make_host(r.key));
+                }
+
+                auto f = [this, &pending] (auto idx, auto err, auto &devices)
+                {
+                        store_type::value_type value;
+                        if (!err) {
+                                value = std::make_shared<const std::vector<exportable_device>>(devices);
+                        }
+                        m_store.refreshed(pending[idx], std::move(value), clock_type::now());
+                };
+
+                libusbip::output("refreshing {} host(s)", hosts.size());
+                usbip::enum_exportable_devices(hosts, f, m_params.max_workers, m_params.deadline);
+        }
+}
+
+
+usbip::ExportableDevicesCache::ExportableDevicesCache(_In_ const cache_params &params) : m_impl(new Impl(params)) {}
+usbip::ExportableDevicesCache::~ExportableDevicesCache() { delete m_impl; }
+
+void usbip::ExportableDevicesCache::enum_exportable_devices(
+        _In_ const std::vector<host_address> &hosts, _In_ const host_devices_f &on_host)
+{
+        m_impl->enum_exportable_devices(hosts, on_host);
+}
+
+void usbip::ExportableDevicesCache::invalidate(_In_ const host_address &host) { m_impl->invalidate(host); }
+void usbip::ExportableDevicesCache::clear() { m_impl->clear(); }
+
+bool usbip::ExportableDevicesCache::save() const { return m_impl->save(); }
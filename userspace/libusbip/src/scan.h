@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <algorithm>
+#include <vector>
+#include <string_view>
+#include <charconv>
+
+/*
+ * Scheduling of subnet scanning, see usbip::discover.
+ * It does not depend on Windows SDK and can be used on any platform as is.
+ * Probes are started and completed by a backend, f.e. ConnectEx and I/O completion port.
+ */
+namespace usbip::scan
+{
+
+/*
+ * Range of IPv4 host addresses, in host byte order.
+ */
+struct network
+{
+        uint32_t first;
+        uint32_t count;
+
+        auto operator[](uint32_t idx) const noexcept { return first + idx; }
+};
+
+/*
+ * "A.B.C.D/N" or "A.B.C.D" that is the same as /32.
+ * Network and broadcast addresses are excluded if the prefix is shorter than 31 bits.
+ * @return false if the string is malformed
+ */
+inline bool parse_cidr(network &net, std::string_view s) noexcept
+{
+        auto p = s.data();
+        auto end = p + s.size();
+
+        uint32_t addr = 0;
+
+        for (int i = 0; i < 4; ++i) {
+                if (i && (p == end || *p++ != '.')) {
+                        return false;
+                }
+
+                unsigned int octet;
+                auto [ptr, ec] = std::from_chars(p, end, octet);
+
+                if (ec != std::errc() || ptr - p > 3 || octet > 255) {
+                        return false;
+                }
+
+                addr = addr << 8 | octet;
+                p = ptr;
+        }
+
+        unsigned int prefix = 32;
+
+        if (p != end) {
+                if (*p++ != '/') {
+                        return false;
+                }
+
+                auto [ptr, ec] = std::from_chars(p, end, prefix);
+                if (ec != std::errc() || ptr != end || p == end || prefix > 32) {
+                        return false;
+                }
+        }
+
+        auto hostmask = prefix < 32 ? ~uint32_t() >> prefix : uint32_t();
+        auto first = addr & ~hostmask;
+        auto size = uint64_t(hostmask) + 1;
+
+        if (prefix < 31) { // RFC 3021
+                ++first;
+                size -= 2;
+        }
+
+        net = { .first = first, .count = static_cast<uint32_t>(size) };
+        return true;
+}
+
+struct params
+{
+        unsigned int max_inflight; // simultaneous probes, zero is treated as one
+        unsigned int rate; // probes per second, zero means unlimited
+        std::chrono::milliseconds timeout; // of a probe
+};
+
+/*
+ * Starts probes [0, count) in ascending order. At most max_inflight of them are in flight,
+ * the starts are spaced evenly to keep the rate. A probe that has not completed in time expires,
+ * the backend must cancel it and complete it as usual.
+ *
+ * The timeout is the same for all probes, so deadlines are ordered as starts are
+ * and the expired ones are at the front of the queue. Not thread-safe.
+ */
+template<typename Clock = std::chrono::steady_clock>
+class scheduler
+{
+public:
+        using time_point = typename Clock::time_point;
+
+        scheduler(uint32_t count, const params &p) :
+                m_count(count),
+                m_max_inflight(p.max_inflight ? p.max_inflight : 1),
+                m_interval(p.rate ? std::chrono::duration_cast<typename Clock::duration>(std::chrono::seconds(1))/p.rate :
+                                    Clock::duration::zero()),
+                m_timeout(p.timeout),
+                m_inflight(count) {}
+
+        auto size() const noexcept { return m_count; }
+        auto inflight() const noexcept { return m_cnt; }
+
+        bool done() const noexcept { return m_next == m_count && !m_cnt; }
+
+        /*
+         * @return index of the probe that must be started now, size() if there is none
+         */
+        uint32_t next(time_point now);
+
+        /*
+         * Must be called once for each started probe, including the expired ones.
+         */
+        void complete(uint32_t idx);
+
+        /*
+         * @param f(idx) is called for each probe in flight whose deadline has passed, once for a probe
+         */
+        template<typename F>
+        void expire(time_point now, F &&f);
+
+        /*
+         * @return the time when next() or expire() will have something to do, time_point::max() if never
+         */
+        time_point wakeup() const;
+
+private:
+        static constexpr std::chrono::milliseconds max_lag{32}; // starts that are late because of timer resolution are caught up
+
+        const uint32_t m_count;
+        const uint32_t m_max_inflight;
+        const typename Clock::duration m_interval;
+        const typename Clock::duration m_timeout;
+
+        uint32_t m_next{}; // probe to start
+        uint32_t m_cnt{}; // in flight
+        time_point m_not_before{}; // of the next start
+
+        std::vector<bool> m_inflight;
+        std::deque<std::pair<time_point, uint32_t>> m_deadlines;
+};
+
+template<typename Clock>
+uint32_t scheduler<Clock>::next(time_point now)
+{
+        if (m_next == m_count || m_cnt >= m_max_inflight || now < m_not_before) {
+                return m_count;
+        }
+
+        auto idx = m_next++;
+        ++m_cnt;
+        m_inflight[idx] = true;
+
+        m_not_before = std::max(m_not_before, now - max_lag) + m_interval;
+        m_deadlines.emplace_back(now + m_timeout, idx);
+
+        return idx;
+}
+
+template<typename Clock>
+void scheduler<Clock>::complete(uint32_t idx)
+{
+        if (m_inflight[idx]) {
+                m_inflight[idx] = false;
+                --m_cnt;
+        }
+
+        while (!m_deadlines.empty() && !m_inflight[m_deadlines.front().second]) {
+                m_deadlines.pop_front();
+        }
+}
+
+template<typename Clock>
+template<typename F>
+void scheduler<Clock>::expire(time_point now, F &&f)
+{
+        for ( ; !m_deadlines.empty() && m_deadlines.front().first <= now; m_deadlines.pop_front()) {
+                if (auto idx = m_deadlines.front().second; m_inflight[idx]) {
+                        f(idx);
+                }
+        }
+}
+
+template<typename Clock>
+auto scheduler<Clock>::wakeup() const -> time_point
+{
+        auto t = time_point::max();
+
+        if (!m_deadlines.empty()) {
+                t = m_deadlines.front().first;
+        }
+
+        if (m_next < m_count && m_cnt < m_max_inflight) {
+                t = std::min(t, m_not_before);
+        }
+
+        return t;
+}
+
+} // namespace usbip::scan
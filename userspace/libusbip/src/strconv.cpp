@@ -3,40 +3,57 @@
  */
 #include "strconv.h"
 
+#include <usbip\ascii.h>
+
 #include <windows.h>
 
 #include <cassert>
 #include <memory>
 #include <format>
 
+/*
+ * ASCII prefix is converted in a single pass, the rest (if any) by MultiByteToWideChar.
+ */
 std::wstring usbip::utf8_to_wchar(_In_ std::string_view s)
 {
-        std::wstring ws;
+        std::wstring ws(s.size(), L'\0'); // UTF-16 string has no more code units than UTF-8 has bytes
+
+        auto pos = ascii::widen(ws.data(), s.data(), s.size());
+        if (pos == s.size()) {
+                return ws;
+        }
+
+        s.remove_prefix(pos);
 
         auto f = [] (auto &s, auto buf, auto cch) { 
                 return MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, 
                                            s.data(), static_cast<int>(s.size()), buf, cch); 
         };
 
-        auto cch = f(s, nullptr, 0);
+        auto cch = f(s, ws.data() + pos, static_cast<int>(ws.size() - pos));
         if (!cch) {
                 auto err = GetLastError();
                 return ws = L"MultiByteToWideChar error " + std::format(L"{:#x}", err);
         }
 
-        ws.resize(cch);
-
-        if (auto n = f(s, ws.data(), cch); n != cch) [[unlikely]] {
-                ws.resize(n);
-                assert(!"MultiByteToWideChar");
-        }
+        ws.resize(pos + cch);
 
 	return ws;
 }
  
+/*
+ * ASCII prefix is converted in a single pass, the rest (if any) by WideCharToMultiByte.
+ */
 std::string usbip::wchar_to_utf8(_In_ std::wstring_view ws)
 {
-        std::string s;
+        std::string s(ws.size(), '\0');
+
+        auto pos = ascii::narrow(s.data(), ws.data(), ws.size());
+        if (pos == ws.size()) {
+                return s;
+        }
+
+        ws.remove_prefix(pos);
 
         auto f = [] (auto &ws, auto buf, auto cb) {
                 return WideCharToMultiByte(CP_UTF8, WC_ERR_INVALID_CHARS, ws.data(), static_cast<int>(ws.size()), 
@@ -49,10 +66,10 @@ std::string usbip::wchar_to_utf8(_In_ std::wstring_view ws)
                 return s = "WideCharToMultiByte error " + std::format("{:#x}", err);
         }
 
-        s.resize(cb);
+        s.resize(pos + cb);
 
-        if (auto n = f(ws, s.data(), cb); n != cb) [[unlikely]] {
-                s.resize(n);
+        if (auto n = f(ws, s.data() + pos, cb); n != cb) [[unlikely]] {
+                s.resize(pos + n);
                 assert(!"WideCharToMultiByte");
         }
 
@@ -3,57 +3,13 @@
  */
 
 #include "usb_ids.h"
+#include "usb_ids_db.h"
+#include "mapped_file.h"
 #include "output.h"
 
-#include <cassert>
-#include <charconv>
-#include <functional>
-
-namespace
-{
-
-uint16_t remove_prefix_hex(std::string_view &s, int cnt)
-{
-        int val{};
-        auto end = s.data() + cnt;
-
-        auto [ptr, ec] = std::from_chars(s.data(), end, val, 16);
-
-        if (ec != std::errc{}) {
-		return 0;
-	}
-
-        assert(ptr == end);
-        s.remove_prefix(cnt);
-
-        auto res = static_cast<uint16_t>(val);
-        assert(res == val);
-
-        return res;
-}
-
-using line_f = std::function<bool(std::string_view&, std::string_view&)>;
-
-void for_each_line(std::string_view text, const line_f &f)
-{
-        while (!text.empty()) {
-                auto pos = text.find('\n'); // usb.ids must be in Unix format, 0xA line endings
-                if (pos == text.npos) {
-                        std::string_view tail;
-                        f(text, tail);
-                        break;
-                }
-
-                auto line = text.substr(0, pos);
-                text.remove_prefix(pos + 1); // line + '\n'
-
-                if (!line.empty() && f(line, text)) {
-                        break;
-                }
-        }
-}
+#include "..\win_handle.h"
 
-} // namespace
+#include <cassert>
 
 
 class win::Resource::Impl
@@ -121,15 +77,47 @@ DWORD win::Resource::size(HMODULE hModule) const noexcept{ return m_impl->size(h
 std::string_view win::Resource::str() const noexcept { return m_impl->str(); }
 
 
+class win::MappedFile::Impl
+{
+public:
+        Impl(_In_ LPCTSTR path) : m_file(path) {}
+
+        explicit operator bool() const noexcept { return bool(m_file); }
+        DWORD open(_In_ LPCTSTR path) { return m_file.open(path); }
+
+        auto str() const noexcept { return m_file.str(); }
+
+private:
+        usbip::mapped_file m_file;
+};
+
+win::MappedFile::MappedFile(_In_ LPCTSTR path) : m_impl(new Impl(path)) {}
+win::MappedFile::~MappedFile() { delete m_impl; }
+
+auto win::MappedFile::operator =(MappedFile&& obj) noexcept -> MappedFile&
+{
+        if (&obj != this) {
+                delete m_impl;
+                m_impl = obj.release();
+        }
+
+        return *this;
+}
+
+win::MappedFile::operator bool() const noexcept { return static_cast<bool>(*m_impl); }
+DWORD win::MappedFile::open(_In_ LPCTSTR path) { return m_impl->open(path); }
+std::string_view win::MappedFile::str() const noexcept { return m_impl->str(); }
+
+
 class usbip::UsbIds::Impl
 {
 public:
-        Impl(std::string_view content);
+        Impl(std::string_view content, bool lazy);
 
-        auto operator!() const noexcept { return m_vendor.empty() || m_class.empty(); } 
+        auto operator!() const noexcept { return m_db.empty(); }
         explicit operator bool() const noexcept { return !!*this; }
 
-        void load(std::string_view content);
+        void load(std::string_view content, bool lazy) { m_db.load(content, lazy); }
 
         void dump_vendors() const;
         void dump_classes() const;
@@ -140,159 +128,80 @@ public:
                 find_class_subclass_proto(uint8_t class_id, uint8_t subclass_id, uint8_t prot_id) const noexcept;
 
 private:
-        using products_t = std::unordered_map<uint16_t, std::string_view>;
-        using vendors_t = std::unordered_map<uint16_t, std::pair<std::string_view, products_t>>;
-        vendors_t m_vendor;
-
-        using proto_t = std::unordered_map<uint8_t, std::string_view>;
-        using subclass_t = std::unordered_map<uint8_t, std::pair<std::string_view, proto_t>>;
-        using class_t = std::unordered_map<uint8_t, std::pair<std::string_view, subclass_t>>;
-        class_t m_class;
-
-        bool parse_vid_pid(uint16_t &vid, uint16_t &pid, std::string_view &line, std::string_view &tail);
-        bool parse_class_sub_proto(uint8_t &cls, uint8_t &subcls, std::string_view &line, std::string_view &tail);
+        usb_ids::database m_db;
 };
 
-usbip::UsbIds::Impl::Impl(std::string_view content)
+usbip::UsbIds::Impl::Impl(std::string_view content, bool lazy)
 {
-        load(content);
+        load(content, lazy);
         
         //dump_vendors();
         //printf("CLASSES\n");
         //dump_classes();
 }
 
-void usbip::UsbIds::Impl::load(std::string_view content)
-{
-        uint16_t vid{};
-        uint16_t pid{};
-        
-        auto f = [this, &vid, &pid] (auto&&... args) 
-        { 
-                return parse_vid_pid(vid, pid, std::forward<decltype(args)>(args)...); 
-        };
-        
-        for_each_line(content, std::move(f));
-}
-
+/*
+ * Names of the texts, the binary index is not dumped.
+ */
 void usbip::UsbIds::Impl::dump_vendors() const
 {
-        for (auto& [vid, pair]: m_vendor) {
+        for (auto &l: m_db.layers()) {
+                auto &prods = l.tables[usb_ids::products];
+                auto p = prods.begin();
 
-                auto& [vendor_name, products] = pair;
-                libusbip::output("{:04x}  {}", vid, vendor_name);
+                for (auto &v: l.tables[usb_ids::vendors]) {
+                        libusbip::output("{:04x}  {}", v.key, v.str());
 
-                for (auto& [pid, name]: products) {
-                        libusbip::output("\t{:04x}  {}", pid, name);
+                        for ( ; p != prods.end() && p->key >> 16 <= v.key; ++p) {
+                                if (p->key >> 16 == v.key) {
+                                        libusbip::output("\t{:04x}  {}", p->key & 0xFFFF, p->str());
+                                }
+                        }
                 }
         }
 }
 
 void usbip::UsbIds::Impl::dump_classes() const
 {
-        for (auto& [cls_id, pair]: m_class) {
-
-                auto& [cls_name, subclasses] = pair;
-                libusbip::output("C {:02x}  {}", cls_id, cls_name);
+        for (auto &l: m_db.layers()) {
+                auto &subs = l.tables[usb_ids::subclasses];
+                auto &protos = l.tables[usb_ids::protocols];
 
-                for (auto& [sub_id, sub_pair]: subclasses) {
+                auto s = subs.begin();
+                auto p = protos.begin();
 
-                        auto& [sub_name, protocols] = sub_pair;
-                        libusbip::output("\t{:02x}  {}", sub_id, sub_name);
+                for (auto &c: l.tables[usb_ids::classes]) {
+                        libusbip::output("C {:02x}  {}", c.key, c.str());
 
-                        for (auto& [prot_id, name]: protocols) {
-                                libusbip::output("\t\t{:02x}  {}", prot_id, name);
-                        }
-                }
-        }
-}
+                        for ( ; s != subs.end() && s->key >> 8 <= c.key; ++s) {
+                                if (s->key >> 8 != c.key) {
+                                        continue;
+                                }
 
-bool usbip::UsbIds::Impl::parse_vid_pid(
-        uint16_t &vid, uint16_t &pid, std::string_view &line, std::string_view &tail)
-{
-        if (line.starts_with("# List of known device classes, subclasses and protocols")) {
-                uint8_t cls{};
-                uint8_t subcls{};
-                auto f = [this, &cls, &subcls] (auto&&... args) 
-                { 
-                        return parse_class_sub_proto(cls, subcls, std::forward<decltype(args)>(args)...); 
-                };
-                for_each_line(tail, std::move(f));
-                return true;
-        } else if (line.starts_with('#')) {
-                // continue;
-        } else if (line.starts_with("\t\t")) { // \t \t interface  interface_name
-                assert(!"\\t\\t detected");
-        } else if (line.starts_with('\t')) { // \t device  device_name
-                line.remove_prefix(1);
-                if (bool(pid = remove_prefix_hex(line, 4))) {
-                        line.remove_prefix(2); // device_name
-                        auto &prod = m_vendor[vid].second;
-                        auto [it, inserted] = prod.emplace(pid, line);
-                        assert(inserted);
-                }
-        } else if (bool(vid = remove_prefix_hex(line, 4))) { // vendor  vendor_name
-                line.remove_prefix(2); // vendor_name
-                auto [it, inserted] = m_vendor.emplace(vid, std::make_pair(line, products_t()));
-                assert(inserted);
-        }
+                                libusbip::output("\t{:02x}  {}", s->key & 0xFF, s->str());
 
-        return false;
-}
-
-bool usbip::UsbIds::Impl::parse_class_sub_proto(
-        uint8_t &cls, uint8_t &subcls, std::string_view &line, std::string_view&)
-{
-        if (line.starts_with("# List of Audio Class Terminal Types")) {
-                return true;
-        } else if (line.starts_with('#')) {
-                // continue;
-        } else if (line.starts_with("\t\t")) {
-                line.remove_prefix(2);
-                if (auto prot = (uint8_t)remove_prefix_hex(line, 2)) {
-                        line.remove_prefix(2);
-                        auto &sub = m_class[cls].second;
-                        auto &proto = sub[subcls].second;
-                        auto [it, inserted] = proto.emplace(prot, line);
-                        assert(inserted);
-                }
-        } else if (line.starts_with('\t')) {
-                line.remove_prefix(1);
-                if (bool(subcls = (uint8_t)remove_prefix_hex(line, 2))) {
-                        line.remove_prefix(2);
-                        auto &sub = m_class[cls].second;
-                        auto [it, inserted] = sub.emplace(subcls, std::make_pair(line, proto_t()));
-                        assert(inserted);
+                                for ( ; p != protos.end() && p->key >> 8 <= s->key; ++p) {
+                                        if (p->key >> 8 == s->key) {
+                                                libusbip::output("\t\t{:02x}  {}", p->key & 0xFF, p->str());
+                                        }
+                                }
+                        }
                 }
-        } else if (line.starts_with("C ")) {
-                line.remove_prefix(2);
-
-                cls = (uint8_t)remove_prefix_hex(line, 2); // "C 00  (Defined at Interface level)"
-                line.remove_prefix(2);
-
-                auto [it, inserted] = m_class.emplace(cls, std::make_pair(line, subclass_t()));
-                assert(inserted);
         }
-
-        return false;
 }
 
 std::pair<std::string_view, std::string_view> 
 usbip::UsbIds::Impl::find_product(uint16_t vid, uint16_t pid) const noexcept
 {
+        using namespace usb_ids;
         std::pair<std::string_view, std::string_view> res;
 
-        auto v = m_vendor.find(vid);
-        if (v == m_vendor.end()) {
-                return res;
-        }
-
-        res.first = v->second.first;
-        auto &prod = v->second.second;
-
-        auto p = prod.find(pid);
-        if (p != prod.end()) {
-                res.second = p->second;
+        if (!(res.first = m_db.find(vendors, vendor_key(vid))).empty()) {
+                try {
+                        res.second = m_db.find_product(vid, pid);
+                } catch (std::exception &e) { // std::bad_alloc, std::system_error
+                        libusbip::output("find_product({:04x}, {:04x}) {}", vid, pid, e.what());
+                }
         }
 
         return res;
@@ -302,34 +211,21 @@ std::tuple<std::string_view, std::string_view, std::string_view>
 usbip::UsbIds::Impl::find_class_subclass_proto(
         uint8_t class_id, uint8_t subclass_id, uint8_t prot_id) const noexcept
 {
-        std::tuple<std::string_view, std::string_view, std::string_view>  res;
-
-        auto c = m_class.find(class_id);
-        if (c == m_class.end()) {
-                return res;
-        }
+        using namespace usb_ids;
 
-        std::get<0>(res) = c->second.first;
-        auto &subcls = c->second.second;
-
-        auto s = subcls.find(subclass_id);
-        if (s == subcls.end()) {
-                return res;
-        }
-
-        std::get<1>(res) = s->second.first;
-        auto &prot = s->second.second;
+        std::tuple<std::string_view, std::string_view, std::string_view>  res;
+        auto &[cls, sub, prot] = res;
 
-        auto p = prot.find(prot_id);
-        if (p != prot.end()) {
-                std::get<2>(res) = p->second;
+        if (!(cls = m_db.find(classes, class_key(class_id))).empty() &&
+            !(sub = m_db.find(subclasses, subclass_key(class_id, subclass_id))).empty()) {
+                prot = m_db.find(protocols, protocol_key(class_id, subclass_id, prot_id));
         }
 
         return res;
 }
 
 
-usbip::UsbIds::UsbIds(std::string_view content) : m_impl(new Impl(content)) {}
+usbip::UsbIds::UsbIds(std::string_view content, bool lazy) : m_impl(new Impl(content, lazy)) {}
 usbip::UsbIds::~UsbIds() { delete m_impl; }
 
 auto usbip::UsbIds::operator =(UsbIds&& obj) noexcept -> UsbIds&
@@ -345,7 +241,7 @@ auto usbip::UsbIds::operator =(UsbIds&& obj) noexcept -> UsbIds&
 usbip::UsbIds::operator bool() const noexcept { return static_cast<bool>(*m_impl); }
 bool usbip::UsbIds::operator !() const noexcept { return !*m_impl; }
 
-void usbip::UsbIds::load(std::string_view content) { m_impl->load(content); }
+void usbip::UsbIds::load(std::string_view content, bool lazy) { m_impl->load(content, lazy); }
 
 std::pair<std::string_view, std::string_view> 
 usbip::UsbIds::find_product(uint16_t vid, uint16_t pid) const noexcept 
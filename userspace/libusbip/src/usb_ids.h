@@ -47,6 +47,41 @@ private:
 	}
 };
 
+
+/*
+ * Read-only view of a whole file.
+ * The pages are shared by the processes that map the same file.
+ * @see usbip::mapped_file
+ */
+class USBIP_API MappedFile
+{
+public:
+	MappedFile(_In_ LPCTSTR path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator =(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& obj) noexcept : m_impl(obj.release()) {}
+	MappedFile& operator =(MappedFile&& obj) noexcept;
+
+	explicit operator bool() const noexcept;
+	auto operator!() const noexcept { return !bool(*this); }
+
+	DWORD open(_In_ LPCTSTR path);
+	std::string_view str() const noexcept;
+
+private:
+	class Impl;
+	Impl *m_impl{}; // std::unique_ptr is not compatible with __declspec(dllexport) for the class
+
+	Impl *release() {
+		auto p = m_impl;
+		m_impl = nullptr;
+		return p;
+	}
+};
+
 } // namespace win
 
 
@@ -56,7 +91,12 @@ namespace usbip
 class USBIP_API UsbIds
 {
 public:
-	UsbIds(std::string_view content);
+	/*
+	 * @param content usb.ids text or its binary index, must outlive this object
+	 * @param lazy products of a vendor are parsed on the first lookup,
+	 *        it saves the time if few names are looked up, f.e. by a command line utility
+	 */
+	UsbIds(std::string_view content, bool lazy = false);
 	~UsbIds();
 
 	UsbIds(const UsbIds&) = delete;
@@ -68,7 +108,10 @@ public:
 	explicit operator bool() const noexcept;
 	bool operator !() const noexcept;
 
-	void load(std::string_view content);
+	/*
+	 * Names of the content are merged with already loaded ones, the first loaded name of a key wins.
+	 */
+	void load(std::string_view content, bool lazy = false);
 
 	std::pair<std::string_view, std::string_view> find_product(uint16_t vid, uint16_t pid) const noexcept;
 
@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2022 - 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "usb_ids_index.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <charconv>
+#include <string_view>
+#include <algorithm>
+#include <vector>
+#include <mutex>
+
+#if defined(_M_X64) || defined(__SSE2__)
+  #include <emmintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__)
+  #include <arm_neon.h>
+#endif
+
+/*
+ * Names of usb.ids that are loaded from its text or binary index, see usbip::UsbIds.
+ * It does not depend on Windows SDK and can be used on any platform as is.
+ */
+namespace usbip::usb_ids
+{
+
+/*
+ * @return false if s does not start with cnt hex digits
+ */
+inline bool remove_prefix_hex(std::string_view &s, int cnt, uint32_t &val)
+{
+        if (s.size() < size_t(cnt)) {
+                return false;
+        }
+
+        auto end = s.data() + cnt;
+        auto [ptr, ec] = std::from_chars(s.data(), end, val, 16);
+
+        if (ec != std::errc{} || ptr != end) {
+                return false;
+        }
+
+        s.remove_prefix(cnt);
+        return true;
+}
+
+/*
+ * Sixteen bytes are checked at a time to find the chunk, the offset is found byte by byte.
+ * @return offset of the first line that does not start with '\t', text.size() if there is no such line
+ */
+inline size_t find_unindented(std::string_view text) noexcept
+{
+        auto data = text.data();
+        size_t pos = 0;
+
+        for ( ; pos + 16 < text.size(); pos += 16) { // next byte is read
+#if defined(_M_X64) || defined(__SSE2__)
+                auto cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+                auto next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos + 1));
+
+                auto eol = _mm_andnot_si128(_mm_cmpeq_epi8(next, _mm_set1_epi8('\t')),
+                                            _mm_cmpeq_epi8(cur, _mm_set1_epi8('\n')));
+
+                if (_mm_movemask_epi8(eol)) {
+                        break;
+                }
+#elif defined(_M_ARM64) || defined(__aarch64__)
+                auto cur = vld1q_u8(reinterpret_cast<const uint8_t*>(data + pos));
+                auto next = vld1q_u8(reinterpret_cast<const uint8_t*>(data + pos + 1));
+
+                auto eol = vandq_u8(vceqq_u8(cur, vdupq_n_u8('\n')), vmvnq_u8(vceqq_u8(next, vdupq_n_u8('\t'))));
+
+                if (vmaxvq_u8(eol)) {
+                        break;
+                }
+#else
+                break;
+#endif
+        }
+
+        for ( ; pos < text.size(); ++pos) {
+                if (data[pos] == '\n' && (pos + 1 == text.size() || data[pos + 1] != '\t')) {
+                        return pos + 1;
+                }
+        }
+
+        return text.size();
+}
+
+/*
+ * @return lines at the beginning of the text that start with '\t'
+ */
+inline auto remove_prefix_indented(std::string_view &text) noexcept
+{
+        auto pos = text.starts_with('\t') ? find_unindented(text) : 0;
+
+        auto lines = text.substr(0, pos);
+        text.remove_prefix(pos);
+
+        return lines;
+}
+
+/*
+ * @param f bool(std::string_view &line, std::string_view &tail), returns true to stop
+ */
+template<typename F>
+void for_each_line(std::string_view text, const F &f)
+{
+        while (!text.empty()) {
+                auto pos = text.find('\n'); // usb.ids must be in Unix format, 0xA line endings
+                if (pos == text.npos) {
+                        std::string_view tail;
+                        f(text, tail);
+                        break;
+                }
+
+                auto line = text.substr(0, pos);
+                text.remove_prefix(pos + 1); // line + '\n'
+
+                if (!line.empty() && f(line, text)) {
+                        break;
+                }
+        }
+}
+
+/*
+ * Every text or index is a layer, names are looked up in the layers in order of loading,
+ * so the first loaded name of a key wins.
+ */
+class database
+{
+public:
+        struct name_entry
+        {
+                uint32_t key; // see *_key()
+                uint32_t length;
+                const char *name;
+
+                auto str() const noexcept { return std::string_view(name, length); }
+        };
+
+        struct vendor_block
+        {
+                uint16_t vid;
+                mutable bool parsed;
+                std::string_view lines; // of products and interfaces, parsed on first lookup
+                mutable std::vector<name_entry> products; // sorted by key
+        };
+
+        struct layer
+        {
+                index idx; // if content is a binary index
+                std::vector<name_entry> tables[TABLES]; // sorted by key, if content is a text
+                std::vector<vendor_block> lazy; // sorted by vid
+
+                std::string_view find(table_id id, uint32_t key) const noexcept;
+        };
+
+        /*
+         * @return true if vendors or classes are not loaded
+         */
+        bool empty() const noexcept { return !has(vendors) || !has(classes); }
+
+        /*
+         * @param content usb.ids text or its binary index, must outlive this object
+         * @param lazy products of a vendor are parsed on the first lookup, see find_product
+         */
+        void load(std::string_view content, bool lazy);
+
+        /*
+         * @return empty string if not found
+         */
+        std::string_view find(table_id id, uint32_t key) const noexcept;
+
+        /*
+         * Parses the blocks of the vendor that are not parsed yet, a block stays unparsed if an exception is thrown.
+         * @return empty string if not found
+         */
+        std::string_view find_product(uint16_t vid, uint16_t pid) const;
+
+        const auto& layers() const noexcept { return m_layers; }
+
+private:
+        std::vector<layer> m_layers; // in order of loading
+        mutable std::mutex m_lazy_mtx; // for vendor_block::parsed, products
+
+        struct parse_state
+        {
+                layer &dst;
+                bool lazy;
+                bool classes;
+                int vid = -1;
+                int cls = -1;
+                int subcls = -1;
+        };
+
+        bool has(table_id id) const noexcept;
+
+        static bool parse_line(parse_state &st, std::string_view line, std::string_view &tail);
+        static void add(layer &dst, table_id id, uint32_t key, std::string_view name);
+
+        std::string_view find_lazy(const layer &l, uint16_t vid, uint16_t pid) const;
+};
+
+
+inline std::string_view database::layer::find(table_id id, uint32_t key) const noexcept
+{
+        if (idx) {
+                return idx.find(id, key);
+        }
+
+        auto &t = tables[id];
+        auto e = find_entry(t.data(), t.size(), key);
+
+        return e ? e->str() : std::string_view();
+}
+
+inline bool database::has(table_id id) const noexcept
+{
+        return std::any_of(m_layers.begin(), m_layers.end(), [id] (auto &l)
+        {
+                return l.idx ? l.idx.get_table(id).count : !l.tables[id].empty();
+        });
+}
+
+inline void database::load(std::string_view content, bool lazy)
+{
+        if (index idx(content); idx) {
+                m_layers.push_back({ .idx = idx });
+                return;
+        }
+
+        layer l;
+
+        parse_state st{ .dst = l, .lazy = lazy };
+        for_each_line(content, [&st] (auto &line, auto &tail) { return parse_line(st, line, tail); });
+
+        // usb.ids is sorted, stable_sort allocates a buffer
+        if (auto by_vid = [] (auto &a, auto &b) { return a.vid < b.vid; };
+            !std::is_sorted(l.lazy.begin(), l.lazy.end(), by_vid)) {
+                std::stable_sort(l.lazy.begin(), l.lazy.end(), by_vid);
+        }
+
+        for (auto &t: l.tables) {
+                if (auto by_key = [] (auto &a, auto &b) { return a.key < b.key; };
+                    !std::is_sorted(t.begin(), t.end(), by_key)) {
+                        std::stable_sort(t.begin(), t.end(), by_key);
+                }
+
+                auto last = std::unique(t.begin(), t.end(), [] (auto &a, auto &b) { return a.key == b.key; });
+                t.erase(last, t.end());
+
+                t.shrink_to_fit();
+        }
+
+        m_layers.push_back(std::move(l));
+}
+
+inline void database::add(layer &dst, table_id id, uint32_t key, std::string_view name)
+{
+        name.remove_prefix(std::min(name.size(), size_t(2))); // "id  name"
+        dst.tables[id].push_back({ key, static_cast<uint32_t>(name.size()), name.data() });
+}
+
+/*
+ * @return true to stop
+ */
+inline bool database::parse_line(parse_state &st, std::string_view line, std::string_view &tail)
+{
+        uint32_t id{};
+
+        if (!st.classes) {
+                if (line.starts_with("# List of known device classes, subclasses and protocols")) {
+                        st.classes = true;
+                } else if (line.starts_with('#') || line.starts_with("\t\t")) { // \t \t interface  interface_name
+                        // continue;
+                } else if (line.starts_with('\t')) { // \t device  device_name
+                        line.remove_prefix(1);
+                        if (st.vid >= 0 && remove_prefix_hex(line, 4, id)) {
+                                add(st.dst, products, product_key(uint16_t(st.vid), uint16_t(id)), line);
+                        }
+                } else if (remove_prefix_hex(line, 4, id)) { // vendor  vendor_name
+                        st.vid = int(id);
+                        add(st.dst, vendors, vendor_key(uint16_t(id)), line);
+                        if (st.lazy) { // skip the products of the vendor
+                                st.dst.lazy.push_back({ .vid = uint16_t(id), .lines = remove_prefix_indented(tail) });
+                        }
+                }
+        } else if (line.starts_with("# List of Audio Class Terminal Types")) {
+                return true;
+        } else if (line.starts_with('#')) {
+                // continue;
+        } else if (line.starts_with("\t\t")) {
+                line.remove_prefix(2);
+                if (st.cls >= 0 && st.subcls >= 0 && remove_prefix_hex(line, 2, id)) {
+                        add(st.dst, protocols, protocol_key(uint8_t(st.cls), uint8_t(st.subcls), uint8_t(id)), line);
+                }
+        } else if (line.starts_with('\t')) {
+                line.remove_prefix(1);
+                if (st.cls >= 0 && remove_prefix_hex(line, 2, id)) {
+                        st.subcls = int(id);
+                        add(st.dst, subclasses, subclass_key(uint8_t(st.cls), uint8_t(id)), line);
+                }
+        } else if (line.starts_with("C ")) { // "C 00  (Defined at Interface level)"
+                line.remove_prefix(2);
+                if (remove_prefix_hex(line, 2, id)) {
+                        st.cls = int(id);
+                        st.subcls = -1;
+                        add(st.dst, classes, class_key(uint8_t(id)), line);
+                }
+        }
+
+        return false;
+}
+
+inline std::string_view database::find(table_id id, uint32_t key) const noexcept
+{
+        for (auto &l: m_layers) {
+                if (auto s = l.find(id, key); !s.empty()) {
+                        return s;
+                }
+        }
+
+        return {};
+}
+
+inline std::string_view database::find_product(uint16_t vid, uint16_t pid) const
+{
+        for (auto key = product_key(vid, pid); auto &l: m_layers) {
+                if (auto s = l.find(products, key); !s.empty()) {
+                        return s;
+                } else if (!l.lazy.empty() && !(s = find_lazy(l, vid, pid)).empty()) {
+                        return s;
+                }
+        }
+
+        return {};
+}
+
+/*
+ * Blocks of the vendor are parsed once and searched in order of loading.
+ */
+inline std::string_view database::find_lazy(const layer &l, uint16_t vid, uint16_t pid) const
+{
+        auto [first, last] = std::equal_range(l.lazy.begin(), l.lazy.end(), vendor_block{ .vid = vid },
+                                              [] (auto &a, auto &b) { return a.vid < b.vid; });
+
+        std::lock_guard<std::mutex> lock(m_lazy_mtx);
+
+        for (auto b = first; b != last; ++b) {
+
+                if (!b->parsed) {
+                        decltype(b->products) v;
+
+                        for_each_line(b->lines, [&v] (auto &line, auto&)
+                        {
+                                uint32_t id{};
+                                if (line.starts_with('\t') && !line.starts_with("\t\t")) { // \t device  device_name
+                                        line.remove_prefix(1);
+                                        if (remove_prefix_hex(line, 4, id)) {
+                                                line.remove_prefix(std::min(line.size(), size_t(2)));
+                                                v.push_back({ id, static_cast<uint32_t>(line.size()), line.data() });
+                                        }
+                                }
+                                return false;
+                        });
+
+                        std::stable_sort(v.begin(), v.end(), [] (auto &a, auto &b) { return a.key < b.key; });
+                        v.erase(std::unique(v.begin(), v.end(), [] (auto &a, auto &b) { return a.key == b.key; }), v.end());
+
+                        b->products = std::move(v);
+                        b->parsed = true;
+                }
+
+                auto &v = b->products;
+                if (auto e = find_entry(v.data(), v.size(), pid)) {
+                        return e->str();
+                }
+        }
+
+        return {};
+}
+
+} // namespace usbip::usb_ids
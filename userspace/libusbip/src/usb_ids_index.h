@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+/*
+ * Binary index of usb.ids that is used in place, without parsing and allocations.
+ * It is produced at build time by CompileUsbIds task, see userspace/usbip/usb_ids.targets.
+ *
+ * Layout (little-endian): header, tables of entries sorted by key, pool of strings.
+ * The strings are not null-terminated.
+ */
+namespace usbip::usb_ids
+{
+
+constexpr char MAGIC[8]{ 'U', 'S', 'B', 'I', 'D', 'X', '\r', '\n' }; // usb.ids text starts with '#'
+enum { VERSION = 1 };
+
+enum table_id { vendors, products, classes, subclasses, protocols, TABLES };
+
+struct entry
+{
+        uint32_t key; // see *_key()
+        uint32_t name; // offset in the pool of strings
+        uint32_t length; // of the name
+};
+static_assert(sizeof(entry) == 12);
+
+struct table
+{
+        uint32_t offset; // of entries, from the beginning of the index
+        uint32_t count;
+};
+
+struct header
+{
+        char magic[sizeof(MAGIC)];
+        uint32_t version;
+        uint32_t size; // of the index
+        table tables[TABLES]; // indexed by table_id
+        uint32_t strings; // offset of the pool of strings
+        uint32_t strings_size;
+};
+static_assert(sizeof(header) == 64);
+
+constexpr uint32_t vendor_key(uint16_t vid) { return vid; }
+constexpr uint32_t product_key(uint16_t vid, uint16_t pid) { return uint32_t(vid) << 16 | pid; }
+
+constexpr uint32_t class_key(uint8_t cls) { return cls; }
+constexpr uint32_t subclass_key(uint8_t cls, uint8_t sub) { return uint32_t(cls) << 8 | sub; }
+constexpr uint32_t protocol_key(uint8_t cls, uint8_t sub, uint8_t prot) { return uint32_t(cls) << 16 | sub << 8 | prot; }
+
+/*
+ * Entries sorted by key, the keys are unique.
+ * Products of a vendor are adjacent because vid is the high part of the key.
+ */
+struct table_view
+{
+        const entry *first;
+        uint32_t count;
+};
+
+/*
+ * Branchless binary search, the loop has a fixed number of iterations for a given count
+ * and the choice of the half is compiled into a conditional move.
+ *
+ * @param first entries sorted by unique key, T must have member "key"
+ * @return nullptr if not found
+ */
+template<typename T>
+inline const T* find_entry(const T *first, size_t count, uint32_t key) noexcept
+{
+        if (!first || !count) {
+                return nullptr;
+        }
+
+        for (auto n = count; n > 1; ) {
+                auto half = n/2;
+                first = first[half].key <= key ? first + half : first;
+                n -= half;
+        }
+
+        return first->key == key ? first : nullptr;
+}
+
+/*
+ * Read-only view of the index, the data must outlive it.
+ */
+class index
+{
+public:
+        index() = default;
+
+        /*
+         * @return empty object if the data is not a valid index
+         */
+        explicit index(std::string_view data) noexcept;
+
+        explicit operator bool() const noexcept { return m_hdr; }
+        auto operator !() const noexcept { return !m_hdr; }
+
+        /*
+         * @return empty string if not found
+         */
+        std::string_view find(table_id id, uint32_t key) const noexcept;
+
+        table_view get_table(table_id id) const noexcept;
+        const char *strings() const noexcept;
+
+private:
+        const header *m_hdr{};
+};
+
+
+inline index::index(std::string_view data) noexcept
+{
+        auto hdr = reinterpret_cast<const header*>(data.data());
+
+        if (data.size() < sizeof(*hdr) || reinterpret_cast<uintptr_t>(hdr) % alignof(header) ||
+            memcmp(hdr->magic, MAGIC, sizeof(MAGIC)) || hdr->version != VERSION || hdr->size != data.size()) {
+                return;
+        }
+
+        for (auto &t: hdr->tables) {
+                if (t.offset % alignof(entry) || t.offset > hdr->size ||
+                    t.count > (hdr->size - t.offset)/sizeof(entry)) {
+                        return;
+                }
+        }
+
+        if (hdr->strings <= hdr->size && hdr->strings_size <= hdr->size - hdr->strings) {
+                m_hdr = hdr;
+        }
+}
+
+inline table_view index::get_table(table_id id) const noexcept
+{
+        if (!m_hdr) {
+                return {};
+        }
+
+        auto &t = m_hdr->tables[id];
+        return { reinterpret_cast<const entry*>(reinterpret_cast<const char*>(m_hdr) + t.offset), t.count };
+}
+
+inline const char* index::strings() const noexcept
+{
+        return m_hdr ? reinterpret_cast<const char*>(m_hdr) + m_hdr->strings : nullptr;
+}
+
+inline std::string_view index::find(table_id id, uint32_t key) const noexcept
+{
+        auto t = get_table(id);
+        auto e = find_entry(t.first, t.count, key);
+        if (!e || e->name > m_hdr->strings_size || e->length > m_hdr->strings_size - e->name) {
+                return {};
+        }
+
+        return std::string_view(strings() + e->name, e->length);
+}
+
+} // namespace usbip::usb_ids
@@ -9,9 +9,13 @@
 
 #include <resources\messages.h>
 #include <cfgmgr32.h>
+#include <ntsecapi.h>
 
 #include <initguid.h>
 #include <usbip\vhci.h>
+#include <usbip\device_record.h>
+
+#include "vhci_ioctl.h"
 
 namespace
 {
@@ -53,7 +57,7 @@ auto assign(_Out_ vhci::imported_device_location &dst, _In_ const device_locatio
         for (auto &i: v) {
                 if (auto err = strncpy_s(i.dst, i.len, i.src.data(), i.src.size())) {
                         libusbip::output("strncpy_s('{}') error #{} {}", i.src, err, 
-                                          std::generic_category().message(err));
+                                          libusbip::defer([err] { return std::generic_category().message(err); }));
                         return false;
                 }
         }
@@ -94,11 +98,31 @@ auto make_imported_device(_In_ const vhci::imported_device &s)
         return d;
 }
 
+auto make_imported_device(_In_ const device_record::fields &f)
+{
+        imported_device d { 
+                .location = {
+                        .hostname = std::string(f.host.data, f.host.len),
+                        .service = std::string(f.service.data, f.service.len),
+                        .busid = std::string(f.busid.data, f.busid.len),
+                },
+                .port = f.port,
+                .devid = f.devid,
+                .speed = win_speed(static_cast<usb_device_speed>(f.speed)),
+                .vendor = f.vendor,
+                .product = f.product,
+        };
+
+        return d;
+}
+
 auto make_device_state(_In_ const vhci::device_state &r)
 {
         return device_state {
                 .device = make_imported_device(r),
-                .state = static_cast<state>(r.state)
+                .state = static_cast<state>(r.state),
+                .seqnum = r.seqnum,
+                .lost = r.lost
         };
 }
 
@@ -203,79 +227,252 @@ auto usbip::vhci::open(_In_ bool overlapped) -> Handle
         return h;
 }
 
+bool usbip::vhci::make_attach_request(_Out_ ioctl::plugin_hardware &r, _In_ const device_location &location)
+{
+        r = {{ .size = sizeof(r) }};
+
+        if (assign(r, location)) {
+                return true;
+        }
+
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return false;
+}
+
+DWORD usbip::vhci::get_attach_result(
+        _Out_ int &port, _In_ const ioctl::plugin_hardware &r, _In_ DWORD error, _In_ DWORD BytesReturned)
+{
+        port = 0;
+
+        if (error) {
+                return map_attach_error(error);
+        } else if (BytesReturned != attach_reply_size) [[unlikely]] {
+                return USBIP_ERROR_DRIVER_RESPONSE;
+        }
+
+        assert(r.port > 0);
+        port = r.port;
+
+        return NO_ERROR;
+}
+
+DWORD usbip::vhci::parse_imported_devices(
+        _Out_ std::vector<usbip::imported_device> &result, _In_ const void *reply, _In_ DWORD length)
+{
+        result.clear();
+        constexpr auto devices_offset = offsetof(ioctl::get_imported_devices, devices);
+
+        if (length < devices_offset) [[unlikely]] {
+                return USBIP_ERROR_DRIVER_RESPONSE;
+        }
+
+        auto r = static_cast<const ioctl::get_imported_devices*>(reply);
+        auto devices_size = length - devices_offset;
+
+        if (devices_size % sizeof(*r->devices)) {
+                libusbip::output("{}: N*sizeof(imported_device) != {}", __func__, devices_size);
+                return USBIP_ERROR_DRIVER_RESPONSE;
+        } else if (auto cnt = devices_size/sizeof(*r->devices)) {
+                assign(result, r->devices, cnt);
+        }
+
+        return NO_ERROR;
+}
+
 std::vector<usbip::imported_device> usbip::vhci::get_imported_devices(_In_ HANDLE dev, _Out_ bool &success)
 {
         success = false;
         std::vector<usbip::imported_device> result;
 
-        constexpr auto devices_offset = offsetof(ioctl::get_imported_devices, devices);
-
-        ioctl::get_imported_devices *r{};
         std::vector<char> buf;
+        DWORD BytesReturned{}; // must be set if the last arg is NULL
 
         for (auto cnt = 4; true; cnt <<= 1) {
                 buf.resize(ioctl::get_imported_devices_size(cnt));
 
-                r = reinterpret_cast<ioctl::get_imported_devices*>(buf.data());
+                auto r = reinterpret_cast<ioctl::get_imported_devices*>(buf.data());
                 r->size = sizeof(*r);
 
-                if (DWORD BytesReturned{}; // must be set if the last arg is NULL
-                    DeviceIoControl(dev, ioctl::GET_IMPORTED_DEVICES, r, sizeof(r->size), 
+                if (DeviceIoControl(dev, ioctl::GET_IMPORTED_DEVICES, r, sizeof(r->size), 
                                     buf.data(), DWORD(buf.size()), &BytesReturned, nullptr)) {
-
-                        if (BytesReturned < devices_offset) [[unlikely]] {
-                                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
-                                return result;
-                        }
-                                
-                        buf.resize(BytesReturned);
                         break;
-
                 } else if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
                         return result;
                 }
         }
 
-        auto devices_size = buf.size() - devices_offset;
-        success = !(devices_size % sizeof(*r->devices));
+        if (auto err = parse_imported_devices(result, buf.data(), BytesReturned)) {
+                SetLastError(err);
+        } else {
+                success = true;
+        }
 
-        if (!success) {
-                libusbip::output("{}: N*sizeof(imported_device) != {}", __func__, devices_size);
+        return result;
+}
+
+bool usbip::vhci::get_changed_devices(
+        _In_ HANDLE dev, _Inout_ changes_cursor &cursor, 
+        _Out_ std::vector<usbip::imported_device> &changed, _Out_ std::vector<int> &removed, _Out_ bool &all)
+{
+        changed.clear();
+        removed.clear();
+        all = false;
+
+        ioctl::get_changed_devices *r{};
+        std::vector<UINT64> buf; // aligned to device_record::ALIGNMENT
+        DWORD BytesReturned{}; // must be set if the last arg is NULL
+
+        for (size_t len = 4096; true; len <<= 1) {
+                buf.resize(len/sizeof(buf[0]));
+
+                r = reinterpret_cast<ioctl::get_changed_devices*>(buf.data());
+                *r = { {.size = sizeof(*r)}, cursor.epoch, cursor.generation };
+
+                if (DeviceIoControl(dev, ioctl::GET_CHANGED_DEVICES, r, sizeof(*r), buf.data(), DWORD(len), 
+                                    &BytesReturned, nullptr)) {
+                        break;
+                } else if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+                        return false;
+                }
+        }
+
+        if (BytesReturned < sizeof(*r)) [[unlikely]] {
                 SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
-        } else if (auto cnt = devices_size/sizeof(*r->devices)) {
-                assign(result, r->devices, cnt);
+                return false;
         }
 
-        return result;
+        auto data = reinterpret_cast<const char*>(r + 1);
+        auto len = BytesReturned - sizeof(*r);
+
+        for (UINT32 i = 0; i < r->count; ++i) {
+                device_record::fields f;
+
+                auto n = device_record::decode(f, data, len);
+                if (!n) {
+                        libusbip::output("{}: malformed record #{}", __func__, i);
+                        SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                        return false;
+                }
+
+                if (f.removed) {
+                        removed.push_back(f.port);
+                } else {
+                        changed.push_back(make_imported_device(f));
+                }
+
+                data += n;
+                len -= n;
+        }
+
+        all = r->epoch != cursor.epoch || !cursor.generation;
+        cursor = { .epoch = r->epoch, .generation = r->generation };
+
+        return true;
 }
 
 int usbip::vhci::attach(_In_ HANDLE dev, _In_ const device_location &location)
 {
-        ioctl::plugin_hardware r {{ .size = sizeof(r) }};
-        if (!assign(r, location)) {
-                SetLastError(ERROR_INVALID_PARAMETER);
+        ioctl::plugin_hardware r;
+        if (!make_attach_request(r, location)) {
                 return 0;
         }
 
-        constexpr auto outlen = offsetof(ioctl::plugin_hardware, port) + sizeof(r.port);
+        DWORD BytesReturned{}; // must be set if the last arg is NULL
+        auto ok = DeviceIoControl(dev, ioctl::PLUGIN_HARDWARE, &r, sizeof(r), &r, attach_reply_size, &BytesReturned, nullptr);
 
-        if (DWORD BytesReturned{}; // must be set if the last arg is NULL
-            DeviceIoControl(dev, ioctl::PLUGIN_HARDWARE, &r, sizeof(r), &r, outlen, &BytesReturned, nullptr)) {
+        int port{};
+        if (auto err = get_attach_result(port, r, ok ? NO_ERROR : GetLastError(), BytesReturned)) {
+                SetLastError(err);
+        }
 
-                if (BytesReturned != outlen) [[unlikely]] {
-                        SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+        return port;
+}
+
+bool usbip::vhci::attach(
+        _In_ HANDLE dev, _In_ const std::vector<device_location> &locations,
+        _Out_ std::vector<attach_result> &result, _In_ unsigned int max_inflight)
+{
+        result.clear();
+        if (locations.empty()) {
+                return true;
+        }
+
+        auto cnt = static_cast<ULONG>(locations.size());
+        std::vector<char> buf(ioctl::plugin_hardware_batch_size(cnt));
+
+        auto r = reinterpret_cast<ioctl::plugin_hardware_batch*>(buf.data());
+        r->size = sizeof(*r);
+        r->count = cnt;
+        r->max_inflight = max_inflight;
+
+        for (ULONG i = 0; i < cnt; ++i) {
+                if (!assign(r->entries[i], locations[i])) {
+                        SetLastError(ERROR_INVALID_PARAMETER);
+                        return false;
+                }
+        }
+
+        auto len = static_cast<DWORD>(buf.size());
+
+        if (DWORD BytesReturned{};
+            !DeviceIoControl(dev, ioctl::PLUGIN_HARDWARE_BATCH, r, len, r, len, &BytesReturned, nullptr)) {
+                return false;
+        } else if (BytesReturned != len) [[unlikely]] {
+                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                return false;
+        }
+
+        result.reserve(cnt);
+
+        for (ULONG i = 0; i < cnt; ++i) {
+                auto &e = r->entries[i];
+
+                if (auto err = LsaNtStatusToWinError(e.status)) {
+                        result.push_back({ .error = map_attach_error(err) });
+                } else {
+                        assert(e.port > 0);
+                        result.push_back({ .port = e.port });
+                }
+        }
+
+        return true;
+}
+
+bool usbip::vhci::set_event_filter(_In_ HANDLE dev, _In_ const event_filter &filter)
+{
+        ioctl::set_event_filter r {{ .size = sizeof(r) }};
+
+        for (auto port: filter.ports) {
+                if (auto idx = port - 1; idx >= 0 && idx < int(8*sizeof(r.ports))) {
+                        r.ports[idx/64] |= 1ULL << (idx % 64);
                 } else {
-                        assert(r.port > 0);
-                        return r.port;
+                        SetLastError(ERROR_INVALID_PARAMETER);
+                        return false;
                 }
         }
 
-        auto err = GetLastError();
-        if (auto code = map_attach_error(err); code != err) {
-                SetLastError(code);
+        for (auto st: filter.states) {
+                r.states |= 1U << static_cast<int>(st);
+        }
+
+        if (auto err = strncpy_s(r.host, ARRAYSIZE(r.host), filter.hostname.data(), filter.hostname.size())) {
+                libusbip::output("strncpy_s('{}') error #{} {}", filter.hostname, err, 
+                                  libusbip::defer([err] { return std::generic_category().message(err); }));
+                SetLastError(ERROR_INVALID_PARAMETER);
+                return false;
         }
 
-        return 0;
+        DWORD BytesReturned{}; // must be set if the last arg is NULL
+        return DeviceIoControl(dev, ioctl::SET_EVENT_FILTER, &r, sizeof(r), nullptr, 0, &BytesReturned, nullptr);
+}
+
+bool usbip::vhci::set_device_rate(_In_ HANDLE dev, _In_ int port, _In_ UINT32 rate, _In_ UINT32 burst)
+{
+        ioctl::set_device_rate r { .port = port, .rate = rate, .burst = burst };
+        r.size = sizeof(r);
+
+        DWORD BytesReturned{}; // must be set if the last arg is NULL
+        return DeviceIoControl(dev, ioctl::SET_DEVICE_RATE, &r, sizeof(r), nullptr, 0, &BytesReturned, nullptr);
 }
 
 bool usbip::vhci::detach(_In_ HANDLE dev, _In_ int port)
@@ -287,6 +484,35 @@ bool usbip::vhci::detach(_In_ HANDLE dev, _In_ int port)
         return DeviceIoControl(dev, ioctl::PLUGOUT_HARDWARE, &r, sizeof(r), nullptr, 0, &BytesReturned, nullptr);
 }
 
+bool usbip::vhci::detach(_In_ HANDLE dev, _In_ int port, _Out_ std::vector<detach_time> &times)
+{
+        times.clear();
+
+        union {
+                ioctl::plugout_hardware r;
+                ioctl::plugout_hardware_time records[256]; // more than ports of the hub, the detach can't be repeated
+        } buf;
+
+        buf.r = { .port = port };
+        buf.r.size = sizeof(buf.r);
+
+        DWORD BytesReturned{}; // must be set if the last arg is NULL
+        if (!DeviceIoControl(dev, ioctl::PLUGOUT_HARDWARE, &buf.r, sizeof(buf.r), 
+                             buf.records, sizeof(buf.records), &BytesReturned, nullptr)) {
+                return false;
+        }
+
+        auto cnt = DWORD(BytesReturned/sizeof(*buf.records));
+        times.reserve(cnt);
+
+        for (DWORD i = 0; i < cnt; ++i) {
+                auto &t = buf.records[i];
+                times.push_back({ .port = t.port, .ms = t.ms, .completed = bool(t.completed) });
+        }
+
+        return true;
+}
+
 USBIP_API DWORD usbip::vhci::get_device_state_size() noexcept
 {
         return sizeof(vhci::device_state);
@@ -327,3 +553,45 @@ bool usbip::vhci::read_device_state(_In_ HANDLE dev, _Out_ usbip::device_state &
                 return get_device_state(result, &r, actual);
         }
 }
+
+/*
+ * The driver returns as many records as fit into the buffer.
+ */
+bool usbip::vhci::read_device_states(
+        _In_ HANDLE dev, _Out_ std::vector<usbip::device_state> &result, _In_ unsigned int max_cnt)
+{
+        result.clear();
+
+        if (!max_cnt) {
+                SetLastError(ERROR_INVALID_PARAMETER);
+                return false;
+        }
+
+        std::vector<vhci::device_state> v(max_cnt);
+        auto length = static_cast<DWORD>(v.size()*sizeof(v[0]));
+
+        DWORD actual{};
+        if (!ReadFile(dev, v.data(), length, &actual, nullptr)) {
+                return false;
+        } else if (!actual) {
+                SetLastError(ERROR_HANDLE_EOF);
+                return false;
+        } else if (actual % sizeof(v[0])) {
+                SetLastError(USBIP_ERROR_ABI);
+                return false;
+        }
+
+        auto cnt = actual/sizeof(v[0]);
+        result.reserve(cnt);
+
+        for (size_t i = 0; i < cnt; ++i) {
+                if (auto &r = v[i]; r.size == sizeof(r)) {
+                        result.push_back(make_device_state(r));
+                } else {
+                        SetLastError(USBIP_ERROR_ABI);
+                        return false;
+                }
+        }
+
+        return true;
+}
@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "..\vhci_async.h"
+
+#include "vhci_ioctl.h"
+#include "async.h"
+#include "output.h"
+
+#include <memory>
+#include <thread>
+#include <shared_mutex>
+
+namespace
+{
+
+using namespace usbip;
+
+/*
+ * The completion is queued to the port even if the operation has completed synchronously,
+ * it is not queued if the operation has failed to start.
+ */
+class request : public OVERLAPPED
+{
+public:
+        request() : OVERLAPPED{} {}
+        virtual ~request() = default;
+
+        /*
+         * @return call GetLastError() if false is returned
+         */
+        virtual bool start(_In_ HANDLE dev) = 0;
+
+        /*
+         * @param error of the operation
+         * @return true if the request was started again and is in flight
+         */
+        virtual bool complete(_In_ HANDLE dev, _In_ DWORD error, _In_ DWORD transferred) = 0;
+
+protected:
+        bool device_io_control(
+                _In_ HANDLE dev, _In_ DWORD code, _In_ void *in, _In_ DWORD inlen, _Out_ void *out, _In_ DWORD outlen)
+        {
+                *static_cast<OVERLAPPED*>(this) = {};
+                return DeviceIoControl(dev, code, in, inlen, out, outlen, nullptr, this) ||
+                       GetLastError() == ERROR_IO_PENDING;
+        }
+
+        bool read_file(_In_ HANDLE dev, _Out_ void *buf, _In_ DWORD len)
+        {
+                *static_cast<OVERLAPPED*>(this) = {};
+                return ReadFile(dev, buf, len, nullptr, this) || GetLastError() == ERROR_IO_PENDING;
+        }
+};
+
+class attach_request : public request
+{
+public:
+        attach_request(_In_ vhci::attach_f f) : m_func(std::move(f)) {}
+
+        auto init(_In_ const device_location &location) { return vhci::make_attach_request(m_req, location); }
+
+        bool start(_In_ HANDLE dev) override
+        {
+                if (device_io_control(dev, vhci::ioctl::PLUGIN_HARDWARE, &m_req, sizeof(m_req),
+                                      &m_req, DWORD(vhci::attach_reply_size))) {
+                        return true;
+                }
+
+                int port;
+                SetLastError(vhci::get_attach_result(port, m_req, GetLastError(), 0));
+                return false;
+        }
+
+        bool complete(_In_ HANDLE, _In_ DWORD error, _In_ DWORD transferred) override
+        {
+                int port;
+                error = vhci::get_attach_result(port, m_req, error, transferred);
+
+                m_func(error, port);
+                return false;
+        }
+
+private:
+        vhci::ioctl::plugin_hardware m_req;
+        vhci::attach_f m_func;
+};
+
+class detach_request : public request
+{
+public:
+        detach_request(_In_ int port, _In_ const vhci::detach_f &f) : m_req{ .port = port }, m_func(f)
+        {
+                m_req.size = sizeof(m_req);
+        }
+
+        bool start(_In_ HANDLE dev) override
+        {
+                return device_io_control(dev, vhci::ioctl::PLUGOUT_HARDWARE, &m_req, sizeof(m_req), nullptr, 0);
+        }
+
+        bool complete(_In_ HANDLE, _In_ DWORD error, _In_ DWORD) override
+        {
+                m_func(error);
+                return false;
+        }
+
+private:
+        vhci::ioctl::plugout_hardware m_req;
+        vhci::detach_f m_func;
+};
+
+/*
+ * The buffer is doubled until the reply fits, as vhci::get_imported_devices does.
+ */
+class imported_devices_request : public request
+{
+public:
+        imported_devices_request(_In_ const vhci::imported_devices_f &f) : m_func(f) {}
+
+        bool start(_In_ HANDLE dev) override
+        {
+                for ( ; true; m_cnt <<= 1) {
+                        m_buf.resize(vhci::ioctl::get_imported_devices_size(m_cnt));
+
+                        auto r = reinterpret_cast<vhci::ioctl::get_imported_devices*>(m_buf.data());
+                        r->size = sizeof(*r);
+
+                        if (device_io_control(dev, vhci::ioctl::GET_IMPORTED_DEVICES, r, sizeof(r->size),
+                                              m_buf.data(), DWORD(m_buf.size()))) {
+                                return true;
+                        } else if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+                                return false;
+                        }
+                }
+        }
+
+        bool complete(_In_ HANDLE dev, _In_ DWORD error, _In_ DWORD transferred) override
+        {
+                if (error == ERROR_INSUFFICIENT_BUFFER) {
+                        m_cnt <<= 1;
+                        if (start(dev)) {
+                                return true;
+                        }
+                        error = GetLastError();
+                }
+
+                std::vector<imported_device> devices;
+
+                if (!error) {
+                        error = vhci::parse_imported_devices(devices, m_buf.data(), transferred);
+                }
+
+                if (error) {
+                        devices.clear();
+                }
+
+                m_func(error, devices);
+                return false;
+        }
+
+private:
+        ULONG m_cnt = 4;
+        std::vector<char> m_buf;
+        vhci::imported_devices_f m_func;
+};
+
+/*
+ * @see vhci::read_device_state
+ */
+class device_state_request : public request
+{
+public:
+        device_state_request(_In_ const vhci::device_state_f &f) : m_func(f) {}
+
+        bool start(_In_ HANDLE dev) override
+        {
+                return read_file(dev, &m_state, sizeof(m_state));
+        }
+
+        bool complete(_In_ HANDLE, _In_ DWORD error, _In_ DWORD transferred) override
+        {
+                device_state result{};
+
+                if (error) {
+                        //
+                } else if (!transferred) {
+                        error = ERROR_HANDLE_EOF;
+                } else if (!vhci::get_device_state(result, &m_state, transferred)) {
+                        error = GetLastError();
+                }
+
+                m_func(error, result);
+                return false;
+        }
+
+private:
+        vhci::device_state m_state;
+        vhci::device_state_f m_func;
+};
+
+} // namespace
+
+
+/*
+ * The handle is bound to the port for its lifetime, so the device is opened by the object itself.
+ * Requests are owned by the port while they are in flight, see run().
+ */
+class usbip::vhci::AsyncDevice::Impl
+{
+public:
+        Impl();
+        ~Impl();
+
+        explicit operator bool() const noexcept { return m_thread.joinable(); }
+
+        /*
+         * @return call GetLastError() if false is returned
+         */
+        bool submit(_In_ std::unique_ptr<request> r);
+
+        void attach(
+                _In_ const std::vector<device_location> &locations,
+                _In_ const batch_attach_f &on_attach,
+                _In_ unsigned int max_inflight);
+
+        void cancel();
+        void wait() { m_inflight.wait(); }
+
+private:
+        Handle m_dev;
+        NullableHandle m_port;
+
+        async::counter m_inflight;
+
+        std::shared_mutex m_close_mtx; // new requests are not started after the destructor has cancelled I/O
+        bool m_closing{};
+
+        std::thread m_thread; // must be the last
+
+        void run();
+};
+
+usbip::vhci::AsyncDevice::Impl::Impl() : m_dev(vhci::open(true))
+{
+        if (!m_dev) {
+                return;
+        }
+
+        m_port.reset(CreateIoCompletionPort(m_dev.get(), nullptr, 0, 1));
+        if (!m_port) {
+                auto err = GetLastError();
+                libusbip::output("CreateIoCompletionPort error {}", err);
+                SetLastError(err);
+                return;
+        }
+
+        m_thread = std::thread(&Impl::run, this);
+}
+
+usbip::vhci::AsyncDevice::Impl::~Impl()
+{
+        if (!m_thread.joinable()) {
+                return;
+        }
+
+        {
+                std::lock_guard lck(m_close_mtx);
+                m_closing = true;
+                cancel();
+        }
+
+        wait();
+
+        if (PostQueuedCompletionStatus(m_port.get(), 0, 0, nullptr)) { // see run()
+                m_thread.join();
+        } else {
+                libusbip::output("PostQueuedCompletionStatus error {}", GetLastError());
+                m_thread.detach();
+        }
+}
+
+void usbip::vhci::AsyncDevice::Impl::cancel()
+{
+        if (!CancelIoEx(m_dev.get(), nullptr)) {
+                if (auto err = GetLastError(); err != ERROR_NOT_FOUND) {
+                        libusbip::output("CancelIoEx error {}", err);
+                }
+        }
+}
+
+bool usbip::vhci::AsyncDevice::Impl::submit(_In_ std::unique_ptr<request> r)
+{
+        if (!*this) {
+                SetLastError(ERROR_INVALID_HANDLE);
+                return false;
+        }
+
+        std::shared_lock lck(m_close_mtx);
+
+        if (m_closing) {
+                SetLastError(ERROR_OPERATION_ABORTED);
+                return false;
+        }
+
+        m_inflight.add();
+
+        if (r->start(m_dev.get())) {
+                r.release(); // will be deleted by run()
+                return true;
+        }
+
+        auto err = GetLastError();
+        m_inflight.remove();
+
+        SetLastError(err);
+        return false;
+}
+
+/*
+ * The callbacks are called before the request is removed from m_inflight, so wait() waits for them.
+ */
+void usbip::vhci::AsyncDevice::Impl::run()
+{
+        while (true) {
+                DWORD transferred{};
+                ULONG_PTR key{};
+                OVERLAPPED *ovlp{};
+
+                auto ok = GetQueuedCompletionStatus(m_port.get(), &transferred, &key, &ovlp, INFINITE);
+                if (!ovlp) { // posted by the destructor
+                        if (!ok) {
+                                libusbip::output("GetQueuedCompletionStatus error {}", GetLastError());
+                        }
+                        break;
+                }
+
+                std::unique_ptr<request> r(static_cast<request*>(ovlp));
+
+                if (r->complete(m_dev.get(), ok ? NO_ERROR : GetLastError(), transferred)) {
+                        r.release(); // in flight again
+                } else {
+                        r.reset();
+                        m_inflight.remove();
+                }
+        }
+}
+
+/*
+ * The batch is kept alive by the attach requests of its locations.
+ */
+void usbip::vhci::AsyncDevice::Impl::attach(
+        _In_ const std::vector<device_location> &locations,
+        _In_ const batch_attach_f &on_attach,
+        _In_ unsigned int max_inflight)
+{
+        struct context
+        {
+                std::vector<device_location> locations;
+                batch_attach_f on_attach;
+                std::unique_ptr<async::batch> batch;
+        };
+
+        auto ctx = std::make_shared<context>(locations, on_attach);
+
+        auto start = [this, weak = std::weak_ptr(ctx)] (auto idx) // strong reference would be a cycle
+        {
+                auto self = weak.lock(); // the caller of run() or complete() holds it
+                auto i = static_cast<int>(idx);
+
+                auto r = std::make_unique<attach_request>([self, i] (auto error, auto port)
+                {
+                        self->on_attach(i, error, port);
+                        self->batch->complete();
+                });
+
+                if (r->init(self->locations[idx]) && submit(std::move(r))) {
+                        return true;
+                }
+
+                self->on_attach(i, GetLastError(), 0);
+                return false;
+        };
+
+        ctx->batch = std::make_unique<async::batch>(locations.size(), max_inflight, std::move(start));
+        ctx->batch->run();
+}
+
+
+usbip::vhci::AsyncDevice::AsyncDevice() : m_impl(new Impl) {}
+usbip::vhci::AsyncDevice::~AsyncDevice() { delete m_impl; }
+
+usbip::vhci::AsyncDevice::operator bool() const noexcept { return static_cast<bool>(*m_impl); }
+
+bool usbip::vhci::AsyncDevice::attach(_In_ const device_location &location, _In_ const attach_f &on_attach)
+{
+        auto r = std::make_unique<attach_request>(on_attach);
+        return r->init(location) && m_impl->submit(std::move(r));
+}
+
+void usbip::vhci::AsyncDevice::attach(
+        _In_ const std::vector<device_location> &locations,
+        _In_ const batch_attach_f &on_attach,
+        _In_ unsigned int max_inflight)
+{
+        m_impl->attach(locations, on_attach, max_inflight);
+}
+
+bool usbip::vhci::AsyncDevice::detach(_In_ int port, _In_ const detach_f &on_detach)
+{
+        return m_impl->submit(std::make_unique<detach_request>(port, on_detach));
+}
+
+bool usbip::vhci::AsyncDevice::get_imported_devices(_In_ const imported_devices_f &on_devices)
+{
+        return m_impl->submit(std::make_unique<imported_devices_request>(on_devices));
+}
+
+bool usbip::vhci::AsyncDevice::read_device_state(_In_ const device_state_f &on_state)
+{
+        return m_impl->submit(std::make_unique<device_state_request>(on_state));
+}
+
+void usbip::vhci::AsyncDevice::cancel() { m_impl->cancel(); }
+void usbip::vhci::AsyncDevice::wait() { m_impl->wait(); }
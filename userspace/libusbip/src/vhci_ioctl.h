@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "..\vhci.h"
+#include <usbip\vhci.h>
+
+/*
+ * Requests and replies of the driver that are shared by synchronous and asynchronous API, see vhci.cpp.
+ */
+namespace usbip::vhci
+{
+
+constexpr auto attach_reply_size = offsetof(ioctl::plugin_hardware, port) + sizeof(ioctl::plugin_hardware::port);
+
+/*
+ * @return call GetLastError() if false is returned
+ */
+bool make_attach_request(_Out_ ioctl::plugin_hardware &r, _In_ const device_location &location);
+
+/*
+ * @param r reply of PLUGIN_HARDWARE
+ * @param error of PLUGIN_HARDWARE
+ * @param port hub port number, zero if error is returned
+ * @return error code, zero on success
+ */
+DWORD get_attach_result(
+        _Out_ int &port, _In_ const ioctl::plugin_hardware &r, _In_ DWORD error, _In_ DWORD BytesReturned);
+
+/*
+ * @param reply of GET_IMPORTED_DEVICES
+ * @return error code, zero on success
+ */
+DWORD parse_imported_devices(_Out_ std::vector<usbip::imported_device> &result, _In_ const void *reply, _In_ DWORD length);
+
+} // namespace usbip::vhci
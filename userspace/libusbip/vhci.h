@@ -37,12 +37,54 @@ struct imported_device
         UINT16 product;
 };
 
+/*
+ * Result of attaching of a device in a batch.
+ */
+struct attach_result
+{
+        int port; // hub port number, >= 1 or zero if error is not zero
+        DWORD error; // see GetLastError
+};
+
+/*
+ * Teardown time of a detached device.
+ */
+struct detach_time
+{
+        int port; // hub port number, >= 1
+        unsigned int ms; // from the initiation of the detach till its completion or till the end of the wait
+        bool completed; // false if the device is still detaching after the timeout of the call
+};
+
 enum class state { unplugged, connecting, connected, plugged, disconnected, unplugging };
 
 struct device_state
 {
         imported_device device;
         state state;
+
+        UINT32 seqnum; // of the event for the device handle, the first one is 1
+        UINT32 lost; // the number of events dropped before this one, get_imported_devices() must be used to resync
+};
+
+/*
+ * Position in the history of changes of hub ports, see get_changed_devices.
+ * Zero-initialized object means the beginning of the history.
+ */
+struct changes_cursor
+{
+        UINT64 epoch; // unique for each load of the driver
+        UINT64 generation;
+};
+
+/*
+ * Empty member matches any value.
+ */
+struct event_filter
+{
+        std::vector<int> ports; // hub port numbers
+        std::vector<state> states;
+        std::string hostname; // case-insensitive
 };
 
 } // namespace usbip
@@ -65,6 +107,20 @@ USBIP_API Handle open(_In_ bool overlapped = false);
  */
 USBIP_API std::vector<imported_device> get_imported_devices(_In_ HANDLE dev, _Out_ bool &success);
 
+/**
+ * Incremental variant of get_imported_devices().
+ * @param dev handle of the driver device
+ * @param cursor IN: returned by the previous call, zero-initialized to get all devices; OUT: current one
+ * @param changed devices that were attached since the given cursor
+ * @param removed hub port numbers that became free since the given cursor
+ * @param all true if changed are all imported devices and the devices that were got before must be discarded,
+ *        f.e. the driver was reloaded since the previous call
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool get_changed_devices(
+        _In_ HANDLE dev, _Inout_ changes_cursor &cursor, 
+        _Out_ std::vector<imported_device> &changed, _Out_ std::vector<int> &removed, _Out_ bool &all);
+
 /**
  * @param dev handle of the driver device
  * @param location remote device to attach to
@@ -72,6 +128,19 @@ USBIP_API std::vector<imported_device> get_imported_devices(_In_ HANDLE dev, _Ou
  */
 USBIP_API int attach(_In_ HANDLE dev, _In_ const device_location &location);
 
+/**
+ * Attach the devices simultaneously, the call returns when all of them are done.
+ * Devices of the same hostname and service share the result of name resolution.
+ * @param dev handle of the driver device
+ * @param locations remote devices to attach to
+ * @param result of each location in the same order
+ * @param max_inflight the number of simultaneous attaches, zero selects the default
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool attach(
+        _In_ HANDLE dev, _In_ const std::vector<device_location> &locations,
+        _Out_ std::vector<attach_result> &result, _In_ unsigned int max_inflight = 0);
+
 /**
  * @param dev handle of the driver device
  * @param port hub port number, <= 0 means detach all ports
@@ -79,6 +148,14 @@ USBIP_API int attach(_In_ HANDLE dev, _In_ const device_location &location);
  */
 USBIP_API bool detach(_In_ HANDLE dev, _In_ int port);
 
+/**
+ * @param dev handle of the driver device
+ * @param port hub port number, <= 0 means detach all ports
+ * @param times teardown time of each device that was detached by the call
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool detach(_In_ HANDLE dev, _In_ int port, _Out_ std::vector<detach_time> &times);
+
 /**
  * @return textual representation of the given constant
  */
@@ -105,4 +182,31 @@ USBIP_API bool get_device_state(_Out_ device_state &result, _In_ const void *dat
  */
 USBIP_API bool read_device_state(_In_ HANDLE dev, _Out_ device_state &result);
 
+/**
+ * Read the events that are available at once, blocks if there are no events.
+ * @param dev handle of the driver device that must be opened for serialized I/O
+ * @param result events that were read, device_state::lost must be checked
+ * @param max_cnt the maximum number of events to read
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool read_device_states(_In_ HANDLE dev, _Out_ std::vector<device_state> &result, _In_ unsigned int max_cnt = 64);
+
+/**
+ * Events that do not match the filter will not be read from the given handle.
+ * @param dev handle of the driver device
+ * @param filter default constructed object matches any event
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool set_event_filter(_In_ HANDLE dev, _In_ const event_filter &filter);
+
+/**
+ * Limit the rate of sending to a server, bulk transfers yield the bandwidth to transfers of other types.
+ * @param dev handle of the driver device
+ * @param port hub port number, <= 0 means all ports
+ * @param rate bytes per second, zero removes the limit
+ * @param burst bytes, zero selects the default
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool set_device_rate(_In_ HANDLE dev, _In_ int port, _In_ UINT32 rate, _In_ UINT32 burst = 0);
+
 } // namespace usbip::vhci
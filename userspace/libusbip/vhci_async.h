@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "vhci.h"
+
+#include <functional>
+
+namespace usbip::vhci
+{
+
+/**
+ * @param error zero on success, otherwise error code, see GetLastError
+ * @param port hub port number, zero if error is not zero
+ */
+using attach_f = std::function<void(_In_ DWORD error, _In_ int port)>;
+
+/**
+ * @param idx zero-based index of the location in the list
+ * @param error zero on success, otherwise error code, see GetLastError
+ * @param port hub port number, zero if error is not zero
+ */
+using batch_attach_f = std::function<void(_In_ int idx, _In_ DWORD error, _In_ int port)>;
+
+/**
+ * @param error zero on success, otherwise error code, see GetLastError
+ */
+using detach_f = std::function<void(_In_ DWORD error)>;
+
+/**
+ * @param error zero on success, otherwise error code, see GetLastError
+ * @param devices empty if error is not zero
+ */
+using imported_devices_f = std::function<void(_In_ DWORD error, _In_ const std::vector<imported_device> &devices)>;
+
+/**
+ * @param error zero on success, otherwise error code, see GetLastError
+ * @param state is not valid if error is not zero
+ */
+using device_state_f = std::function<void(_In_ DWORD error, _In_ const device_state &state)>;
+
+/**
+ * Asynchronous API of the driver, the calls do not wait for the driver.
+ * The device is opened for overlapped I/O, completions are dequeued from I/O completion port
+ * by the internal thread that calls the callbacks. The callbacks are called one at a time,
+ * they can start new operations but must not block.
+ *
+ * If a method returns false, the operation was not started and the callback will not be called.
+ */
+class USBIP_API AsyncDevice
+{
+public:
+        /**
+         * Call GetLastError() if the object is not valid.
+         */
+        AsyncDevice();
+
+        /**
+         * Cancels the operations in flight and waits for their callbacks.
+         * It must not be called from a callback.
+         */
+        ~AsyncDevice();
+
+        AsyncDevice(const AsyncDevice&) = delete;
+        AsyncDevice& operator =(const AsyncDevice&) = delete;
+
+        explicit operator bool() const noexcept;
+        auto operator !() const noexcept { return !static_cast<bool>(*this); }
+
+        /**
+         * @see vhci::attach
+         * @return call GetLastError() if false is returned
+         */
+        bool attach(_In_ const device_location &location, _In_ const attach_f &on_attach);
+
+        /**
+         * Attach the list of devices, at most max_inflight of them are attached simultaneously.
+         * The next device is attached as soon as any of the previous ones is done,
+         * so no thread waits for the batch.
+         *
+         * @param on_attach will be called once for every location, possibly from this call
+         *        if the operation cannot be started; the order is the order of completion
+         * @param max_inflight zero is treated as one
+         */
+        void attach(
+                _In_ const std::vector<device_location> &locations,
+                _In_ const batch_attach_f &on_attach,
+                _In_ unsigned int max_inflight);
+
+        /**
+         * @see vhci::detach
+         * @return call GetLastError() if false is returned
+         */
+        bool detach(_In_ int port, _In_ const detach_f &on_detach);
+
+        /**
+         * @see vhci::get_imported_devices
+         * @return call GetLastError() if false is returned
+         */
+        bool get_imported_devices(_In_ const imported_devices_f &on_devices);
+
+        /**
+         * Completes when the next event is available, the callback can start the next read.
+         * @see vhci::read_device_state
+         * @return call GetLastError() if false is returned
+         */
+        bool read_device_state(_In_ const device_state_f &on_state);
+
+        /**
+         * The operations in flight complete with ERROR_OPERATION_ABORTED.
+         */
+        void cancel();
+
+        /**
+         * Returns when there are no operations in flight.
+         * It must not be called from a callback.
+         */
+        void wait();
+
+private:
+        class Impl;
+        Impl *m_impl{}; // std::unique_ptr is not compatible with __declspec(dllexport) for the class
+};
+
+} // namespace usbip::vhci
@@ -17,16 +17,28 @@ auto attach_stashed_devices(HANDLE dev)
 {
         bool success;
         
-        if (auto v = vhci::get_persistent(dev, success); !success) {
+        auto v = vhci::get_persistent(dev, success);
+        if (!success) {
                 spdlog::error(GetLastErrorMsg());
-        } else for (auto &i: v) {
-                printf("%s:%s/%s\n", i.hostname.c_str(), i.service.c_str(), i.busid.c_str());
-                if (!vhci::attach(dev, i)) {
-                        spdlog::error(GetLastErrorMsg());
+                return false;
+        }
+
+        std::vector<vhci::attach_result> result;
+        if (!vhci::attach(dev, v, result)) {
+                spdlog::error(GetLastErrorMsg());
+                return false;
+        }
+
+        for (size_t i = 0; i < v.size(); ++i) {
+                auto &loc = v[i];
+                printf("%s:%s/%s\n", loc.hostname.c_str(), loc.service.c_str(), loc.busid.c_str());
+
+                if (auto err = result[i].error) {
+                        spdlog::error(GetLastErrorMsg(err));
                 }
         }
 
-        return success;
+        return true;
 }
 
 } // namespace
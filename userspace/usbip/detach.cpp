@@ -17,7 +17,8 @@ bool usbip::cmd_detach(void *p)
 		return false;
 	}
 
-	auto ok = vhci::detach(dev.get(), args.port);
+	std::vector<vhci::detach_time> times;
+	auto ok = vhci::detach(dev.get(), args.port, times);
 
 	if (!ok) {
 		spdlog::error(GetLastErrorMsg());		
@@ -27,5 +28,13 @@ bool usbip::cmd_detach(void *p)
 		printf("port %d is succesfully detached\n", args.port);
 	}
 
+	for (auto &t: times) {
+		if (t.completed) {
+			spdlog::debug("port {}, detached in {} ms", t.port, t.ms);
+		} else {
+			spdlog::warn("port {}, still detaching after {} ms", t.port, t.ms);
+		}
+	}
+
 	return ok;
 }
@@ -7,6 +7,8 @@
 
 #include <libusbip\vhci.h>
 #include <libusbip\persistent.h>
+#include <libusbip\remote_cache.h>
+#include <libusbip\src\strconv.h>
 
 #include <spdlog\spdlog.h>
 
@@ -57,6 +59,77 @@ void on_interface(int, const usb_device &d, int idx, const usb_interface &r)
 	printf(s.c_str());
 }
 
+void print_devices(const std::string &remote, const std::vector<exportable_device> &devices)
+{
+	printf("%s: %zu exportable USB device(s)\n", remote.c_str(), devices.size());
+
+	for (int i = 0; auto &d: devices) {
+		on_device(i, d.dev);
+		for (int j = 0; auto &intf: d.interfaces) {
+			on_interface(i, d.dev, j++, intf);
+		}
+		++i;
+	}
+}
+
+auto get_cache_path()
+{
+	std::wstring path(MAX_PATH + 1, L'\0');
+	path.resize(GetTempPath(static_cast<DWORD>(path.size()), path.data()));
+
+	return wchar_to_utf8(path + L"usbip-devices.cache");
+}
+
+/*
+ * Several remotes are queried concurrently, the output of each one is printed as soon as it answers.
+ * @param cache_ttl seconds, the devices of the remotes are saved to the file and reused if it is not zero
+ */
+auto list_remotes(const std::vector<std::string> &remotes, unsigned int cache_ttl)
+{
+	using namespace std::chrono_literals;
+	enum { max_workers = 16 };
+	constexpr auto deadline = 15s;
+
+	std::vector<host_address> hosts;
+	hosts.reserve(remotes.size());
+
+	for (auto &i: remotes) {
+		hosts.push_back({ .hostname = i, .service = global_args.tcp_port });
+	}
+
+	bool success = true;
+
+	auto on_host = [&remotes, &success] (auto idx, auto err, auto &devices)
+	{
+		auto &remote = remotes[idx];
+
+		if (err) {
+			spdlog::error("{}: {}", remote, GetLastErrorMsg(err));
+			success = false;
+			return;
+		}
+
+		print_devices(remote, devices);
+	};
+
+	if (!cache_ttl) {
+		enum_exportable_devices(hosts, on_host, max_workers, deadline);
+		return success;
+	}
+
+	std::chrono::seconds ttl(cache_ttl);
+
+	ExportableDevicesCache cache({ // the process exits soon, background refresh is useless
+		.ttl = ttl,
+		.refresh = ttl,
+		.max_workers = max_workers,
+		.deadline = deadline,
+		.path = get_cache_path() });
+
+	cache.enum_exportable_devices(hosts, on_host);
+	return success;
+}
+
 auto list_stashed_devices()
 {
 	bool success{};
@@ -82,13 +155,19 @@ bool usbip::cmd_list(void *p)
 		return list_stashed_devices();
 	}
 
-	auto sock = connect(args.remote.c_str(), global_args.tcp_port.c_str());
+	if (args.remote.size() > 1 || args.cache) {
+		return list_remotes(args.remote, args.cache);
+	}
+
+	auto &remote = args.remote.front();
+
+	auto sock = connect(remote.c_str(), global_args.tcp_port.c_str());
 	if (!sock) {
 		spdlog::error(GetLastErrorMsg());
 		return false;
 	}
 
-	spdlog::debug("connected to {}:{}", args.remote, global_args.tcp_port);
+	spdlog::debug("connected to {}:{}", remote, global_args.tcp_port);
 
 	if (!enum_exportable_devices(sock.get(), on_device, on_interface, on_device_count)) {
 		spdlog::error(GetLastErrorMsg());
@@ -97,3 +176,30 @@ bool usbip::cmd_list(void *p)
 
 	return true;
 }
+
+/*
+ * Hosts that do not accept the connection are not reported, the errors of the others are.
+ */
+bool usbip::cmd_discover(void *p)
+{
+	auto &args = *reinterpret_cast<discover_args*>(p);
+	int found = 0;
+
+	auto on_host = [&found] (auto &hostname, auto err, auto &devices)
+	{
+		if (err) {
+			spdlog::error("{}: {}", hostname, GetLastErrorMsg(err));
+		} else {
+			print_devices(hostname, devices);
+			++found;
+		}
+	};
+
+	if (!discover(args.cidr.c_str(), global_args.tcp_port.c_str(), on_host)) {
+		spdlog::error(GetLastErrorMsg());
+		return false;
+	}
+
+	spdlog::info("{} USB/IP server(s) found in {}", found, args.cidr);
+	return true;
+}
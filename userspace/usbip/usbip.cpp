@@ -22,6 +22,8 @@
 
 #include <CLI11\CLI11.hpp>
 
+#include <filesystem>
+
 namespace
 {
 
@@ -36,6 +38,23 @@ auto get_ids_data()
 	return r.str();
 }
 
+/*
+ * usb.ids in the directory of the program has precedence over the embedded copy,
+ * so the database can be updated without rebuilding. The text is parsed lazily.
+ */
+auto load_ids()
+{
+	auto path = std::filesystem::path(win::get_module_filename()).replace_filename(L"usb.ids");
+
+	if (static win::MappedFile file(path.c_str()); file) {
+		if (UsbIds ids(file.str(), true); ids) {
+			return ids;
+		}
+	}
+
+	return UsbIds(get_ids_data());
+}
+
 auto get_version()
 {
 	win::FileVersion fv;
@@ -88,6 +107,17 @@ void add_cmd_detach(CLI::App &app)
 	cmd->add_flag("-a,--all", [&port = r.port] (auto) { port = -1; }, "Detach all devices");
 }
 
+void add_cmd_discover(CLI::App &app)
+{
+	static discover_args r;
+
+	auto cmd = app.add_subcommand("discover", "Find USB/IP servers in IPv4 network and list their exportable USB devices")
+		->callback(pack(cmd_discover, &r));
+
+	cmd->add_option("cidr", r.cidr, "Network to scan, f.e. 192.168.1.0/24, the prefix must be at least 16")
+		->required();
+}
+
 void add_cmd_list(CLI::App &app)
 {
 	static list_args r;
@@ -96,10 +126,14 @@ void add_cmd_list(CLI::App &app)
 		->callback(pack(cmd_list, &r))
 		->require_option(1);
 
-	cmd->add_option_group("remote", "List exportable USB devices")
-		->add_option("-r,--remote", r.remote, "List exportable devices on a remote")
+	auto rem = cmd->add_option_group("remote", "List exportable USB devices");
+
+	rem->add_option("-r,--remote", r.remote, "List exportable devices on remote(s), several remotes are queried concurrently")
 		->required();
 
+	rem->add_option("-c,--cache", r.cache, "Reuse the devices listed in the last given seconds instead of querying the remote(s) again")
+		->check(CLI::Range(1U, 24*60*60U));
+
 	cmd->add_option_group("stashed", "List stashed USB devices")
 		->add_flag("-s,--stashed", r.stashed, "List devices stashed by 'port --stash'");
 }
@@ -127,6 +161,26 @@ auto& get_resource_module() noexcept
 	return mod;
 }
 
+/*
+ * The library can produce messages until the process exits, so its output is reset before the sink is destroyed.
+ */
+class LibraryOutput
+{
+public:
+	LibraryOutput(const libusbip::output_func_type &f) : m_out(f)
+	{
+		libusbip::set_debug_output([this] (auto s) { m_out(std::move(s)); });
+	}
+
+	~LibraryOutput() { libusbip::set_debug_output({}); }
+
+	LibraryOutput(const LibraryOutput&) = delete;
+	LibraryOutput& operator =(const LibraryOutput&) = delete;
+
+private:
+	libusbip::BufferedOutput m_out;
+};
+
 void init_spdlog()
 {
 	set_default_logger(spdlog::stderr_color_st("stderr"));
@@ -134,7 +188,10 @@ void init_spdlog()
 
 	using fn = void(const std::string&);
 	fn &f = spdlog::debug; // pick this overload
-	libusbip::set_debug_output(f);
+
+	static LibraryOutput out(f); // the logger is single-threaded, the library is not
+
+	libusbip::set_output_level(libusbip::level::off); // see --debug
 }
 
 void init(CLI::App &app)
@@ -143,13 +200,18 @@ void init(CLI::App &app)
 	app.set_version_flag("-V,--version", get_version());
 
 	app.add_flag("-d,--debug", 
-		[] (auto) { spdlog::set_level(spdlog::level::debug); }, "Debug output");
+		[] (auto)
+		{
+			spdlog::set_level(spdlog::level::debug);
+			libusbip::set_output_level(libusbip::level::debug);
+		}, "Debug output");
 
 	app.add_option("-t,--tcp-port", global_args.tcp_port, "TCP/IP port number of USB/IP server")
 		->check(CLI::Range(1024, USHRT_MAX));
 
 	add_cmd_attach(app);
 	add_cmd_detach(app);
+	add_cmd_discover(app);
 	add_cmd_list(app);
 	add_cmd_port(app);
 
@@ -202,7 +264,7 @@ std::string usbip::GetLastErrorMsg(unsigned long msg_id)
 
 const UsbIds& usbip::get_ids()
 {
-	static UsbIds ids(get_ids_data());
+	static auto ids(load_ids());
 	assert(ids);
 	return ids;
 }
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <set>
 
 #include <libusbip\remote.h>
@@ -43,10 +44,17 @@ struct detach_args
 };
 command_t cmd_detach;
 
+struct discover_args
+{
+        std::string cidr;
+};
+command_t cmd_discover;
+
 struct list_args
 {
         // --remote
-        std::string remote;
+        std::vector<std::string> remote;
+        unsigned int cache; // --cache, seconds
 
         // --stashed
         bool stashed;
@@ -14,6 +14,8 @@
 #include <wx/log.h>
 #include <wx/translation.h>
 
+#include <filesystem>
+
 namespace
 {
 
@@ -39,6 +41,23 @@ auto get_ids_data()
         return r.str();
 }
 
+/*
+ * usb.ids in the directory of the program has precedence over the embedded copy,
+ * so the database can be updated without rebuilding.
+ */
+auto load_ids()
+{
+        auto path = std::filesystem::path(win::get_module_filename()).replace_filename(L"usb.ids");
+
+        if (static win::MappedFile file(path.c_str()); file) {
+                if (usbip::UsbIds ids(file.str()); ids) {
+                        return ids;
+                }
+        }
+
+        return usbip::UsbIds(get_ids_data());
+}
+
 } // namespace
 
 
@@ -67,7 +86,7 @@ auto usbip::get_vhci() -> Handle&
 
 auto usbip::get_ids() -> const UsbIds&
 {
-        static UsbIds ids(get_ids_data());
+        static auto ids(load_ids());
         wxASSERT(ids);
         return ids;
 }
@@ -25,9 +25,11 @@
 #include <wx/headerctrl.h>
 #include <wx/clipbrd.h>
 #include <wx/persist/dataview.h>
+#include <wx/tokenzr.h>
 
 #include <format>
 #include <set>
+#include <algorithm>
 
 namespace
 {
@@ -486,13 +488,18 @@ void MainFrame::read_loop()
 
         std::unique_ptr<MainFrame, decltype(on_exit)> ptr(this, on_exit);
 
-        for (device_state st; vhci::read_device_state(m_read.get(), st); ) {
-                auto evt = new DeviceStateEvent(std::move(st));
-                QueueEvent(evt); // see on_device_state()
+        for (std::vector<device_state> v; vhci::read_device_states(m_read.get(), v); ) {
+                for (auto &st: v) {
+                        if (st.lost) {
+                                post_refresh(); // the driver dropped events, resync
+                        }
+                        auto evt = new DeviceStateEvent(std::move(st));
+                        QueueEvent(evt); // see on_device_state()
+                }
         }
 
         if (auto err = GetLastError(); err != ERROR_OPERATION_ABORTED) { // see CancelSynchronousIo
-                wxLogError(_("vhci::read_device_state error %lu\n%s"), err, GetLastErrorMsg(err));
+                wxLogError(_("vhci::read_device_states error %lu\n%s"), err, GetLastErrorMsg(err));
         }
 }
 
@@ -949,84 +956,103 @@ void MainFrame::on_help_about(wxCommandEvent&)
         wxAboutBox(d, this);
 }
 
-auto MainFrame::connect(
-        _In_ const wxString &hostname, _In_ const wxString &service, 
-        _In_ const std::string &hostname_u8, _In_ const std::string &service_u8)
+/*
+ * The hosts are queried concurrently through the cache, the devices are added when all of them have answered.
+ * The hosts that were queried recently are answered from the cache at once, see ExportableDevicesCache.
+ * @return true if at least one host has answered
+ */
+bool MainFrame::add_exported_devices(_In_ const std::vector<host_address> &hosts, _In_ const wxString &msg)
 {
-        Socket sock;
-        DWORD err{};
+        struct host_devices
+        {
+                DWORD error = ERROR_CANCELLED;
+                std::vector<exportable_device> devices;
+        };
 
-        auto f = [&sock, &err, host = hostname_u8.c_str(), svc = service_u8.c_str()]
+        std::vector<host_devices> result(hosts.size());
+
+        auto f = [this, &hosts, &result]
         {
-                sock = usbip::connect(host, svc, CANCEL_BY_APC);
-                err = sock ? ERROR_SUCCESS : GetLastError();
+                auto on_host = [&result] (auto idx, auto err, auto &devices) { result[idx] = { err, devices }; };
+                m_exported_cache.enum_exportable_devices(hosts, on_host);
         };
 
-        auto msg = wxString::Format(L"%s:%s", hostname, service);
-        run_cancellable(this, msg, _("Connecting"), std::move(f), cancel_connect);
+        auto cancel = [] (auto) { SetLastError(ERROR_NOT_SUPPORTED); return FALSE; }; // the deadline limits the wait
+        run_cancellable(this, msg, _("Connecting"), std::move(f), cancel);
 
-        switch (err) {
-        case ERROR_SUCCESS:
-        case WSA_E_CANCELLED:
-        case ERROR_CANCELLED:
-                break;
-        default:
-                wxLogError(_("Could not connect to %s:%s\nError %lu\n%s"), hostname, service, err, GetLastErrorMsg(err));
+        auto persistent = get_persistent();
+        auto saved = as_set(get_saved());
+
+        bool success{};
+
+        for (size_t i = 0; i < hosts.size(); ++i) {
+                auto &[hostname, service] = hosts[i];
+
+                if (auto err = result[i].error) {
+                        wxLogError(_("Could not get devices of %s:%s\nError %lu\n%s"), 
+                                   wxString::FromUTF8(hostname), wxString::FromUTF8(service), err, GetLastErrorMsg(err));
+                        continue;
+                }
+
+                success = true;
+
+                for (auto &[device, interfaces]: result[i].devices) {
+
+                        device_state st {
+                                .device = make_imported_device(hostname, service, device),
+                                .state = state::unplugged
+                        };
+
+                        auto [dc, flags] = make_device_columns(st);
+                        flags = update_from_saved(dc, flags, persistent, &saved);
+
+                        auto [item, added] = find_or_add_device(dc);
+                        if (!added) {
+                                flags &= ~mkflag(COL_STATE); // clear
+                        }
+
+                        update_device(item, dc, flags);
+                }
         }
 
-        return sock;
+        return success;
 }
 
+/*
+ * @see add_exported_devices(hosts, msg)
+ * Value of the combobox can have several hosts separated by spaces or commas,
+ * they are queried again by on_reload.
+ */
 void MainFrame::add_exported_devices(wxCommandEvent&)
 {
         auto &cb = *m_comboBoxServer;
-
-        auto host = cb.GetValue();
-        if (host.empty()) {
-                cb.SetFocus();
-                return;
-        }
+        auto value = cb.GetValue();
 
         auto port = wxString::Format(L"%d", m_spinCtrlPort->GetValue());
-        wxLogVerbose(L"%s, host='%s', port='%s'", wxString::FromAscii(__func__), host, port);
+        wxLogVerbose(L"%s, hosts='%s', port='%s'", wxString::FromAscii(__func__), value, port);
 
-        auto u8_host = host.ToStdString(wxConvUTF8);
         auto u8_port = port.ToStdString(wxConvUTF8);
+        std::vector<host_address> hosts;
 
-        auto sock = connect(host, port, u8_host, u8_port);
-        if (!sock) {
-                return;
+        for (wxStringTokenizer tkz(value, L" ,"); tkz.HasMoreTokens(); ) {
+                hosts.push_back({ .hostname = tkz.GetNextToken().ToStdString(wxConvUTF8), .service = u8_port });
         }
 
-        auto persistent = get_persistent();
-        auto saved = as_set(get_saved());
-
-        auto dev = [this, host = std::move(u8_host), port = std::move(u8_port), &persistent, &saved] (auto, auto &device)
-        {
-                device_state st {
-                        .device = make_imported_device(std::move(host), std::move(port), device),
-                        .state = state::unplugged
-                };
-
-                auto [dc, flags] = make_device_columns(st);
-                flags = update_from_saved(dc, flags, persistent, &saved);
+        if (hosts.empty()) {
+                cb.SetFocus();
+                return;
+        }
 
-                auto [item, added] = find_or_add_device(dc);
-                if (!added) {
-                        flags &= ~mkflag(COL_STATE); // clear
+        for (auto &h: hosts) {
+                if (auto same = [&h] (auto &i) { return i.hostname == h.hostname && i.service == h.service; };
+                    std::ranges::none_of(m_exported_hosts, same)) {
+                        m_exported_hosts.push_back(h);
                 }
+        }
 
-                update_device(item, dc, flags);
-        };
-
-        auto intf = [this] (auto /*dev_idx*/, auto& /*dev*/, auto /*idx*/, auto& /*intf*/) {};
-
-        if (!enum_exportable_devices(sock.get(), dev, intf)) {
-                auto err = GetLastError();
-                wxLogError(_("enum_exportable_devices error %lu\n%s"), err, GetLastErrorMsg(err));
-        } else if (cb.FindString(host) != wxNOT_FOUND) {
+        if (!add_exported_devices(hosts, value) || cb.FindString(value) != wxNOT_FOUND) {
                 // already exists
-        } else if (auto pos = cb.Append(host); cb.GetCount() > 32) {
+        } else if (auto pos = cb.Append(value); cb.GetCount() > 32) {
                 cb.Delete(pos > 0 ? --pos : ++pos);
         }
 }
@@ -1264,6 +1290,10 @@ void MainFrame::on_reload(wxCommandEvent &event)
                 update_device(item, dc, flags);
         }
 
+        if (!m_exported_hosts.empty()) { // their devices were removed by DeleteAllItems
+                add_exported_devices(m_exported_hosts, _("Reload"));
+        }
+
         if (static bool once; !once) {
                 once = true;
                 on_load(event);
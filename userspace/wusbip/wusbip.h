@@ -9,6 +9,7 @@
 #include "tree_comparator.h"
 
 #include <libusbip/win_handle.h>
+#include <libusbip/remote_cache.h>
 
 #include <thread>
 #include <mutex>
@@ -48,6 +49,9 @@ private:
 	std::unique_ptr<TaskBarIcon> m_taskbar_icon;
 	std::unique_ptr<wxMenu> m_tree_popup_menu;
 
+	usbip::ExportableDevicesCache m_exported_cache; // in-process, see cache_params
+	std::vector<usbip::host_address> m_exported_hosts; // of add_exported_devices, are queried again by on_reload
+
 	usbip::Handle m_read;
 	std::mutex m_read_close_mtx;
 
@@ -124,6 +128,7 @@ private:
 	std::pair<wxTreeListItem, bool> find_or_add_device(_In_ const usbip::device_columns &dc);
 
 	void remove_device(_In_ wxTreeListItem dev);
+	bool add_exported_devices(_In_ const std::vector<usbip::host_address> &hosts, _In_ const wxString &msg);
 	DWORD attach(_In_ const wxString &url, _In_ const wxString &busid);
 	
 	void post_refresh();
@@ -133,9 +138,6 @@ private:
 	void set_persistent(_In_ wxTreeListItem device, _In_ bool persistent);
 
 	void update_device(_In_ wxTreeListItem device, _In_ const usbip::device_columns &dc, _In_ unsigned int flags);
-	
-	auto connect(_In_ const wxString &hostname, _In_ const wxString &service, 
-		              _In_ const std::string &hostname_u8, _In_ const std::string &service_u8);
 
 	wxDataViewColumn* find_column(_In_ const wxString &title) const noexcept;
 	wxDataViewColumn* find_column(_In_ int item_id) const noexcept;
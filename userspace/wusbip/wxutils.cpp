@@ -68,11 +68,6 @@ wxMenuItem* clone_menu_item(_In_ wxMenu &dest, _In_ int item_id, _In_ const wxMe
         return clone;
 }
 
-BOOL usbip::cancel_connect(_In_ HANDLE thread)
-{
-        return QueueUserAPC( [] (auto) { wxLogVerbose(L"APC"); }, thread, 0);
-}
-
 /*
  * Native Windows implementation uses MessageBox to show dialog. Because of this, 
  * idle events will not be handled and wxLogXXX output will be flushed 
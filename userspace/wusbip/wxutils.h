@@ -26,7 +26,6 @@ inline auto what(_In_ const std::exception &e)
 }
 
 using cancel_function = decltype(CancelSynchronousIo);
-cancel_function cancel_connect;
 
 void run_cancellable(
         _In_ wxWindow *parent,